@@ -0,0 +1,336 @@
+/* Benchmark of the incremental MPR selection on random topologies of 32 to 64 drones, from the view of drone 0.
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu11 -O2 -Ihost/shim -I. host/mpr_bench.c host/shim/host_rtos.c swarm_ranging.c swarm_localization.c \
+ *       -lm -o mpr_bench && ./mpr_bench --topologies 200 --moves 1000
+ *
+ * Drones are placed uniformly in a square sized for --degree neighbors on average within --range. Each move shifts
+ * one drone by up to --step, the resulting changes of the one-hop, two-hop and relation sets of drone 0 are fed
+ * through the neighbor set operations. Moves that change any of them are events, after which neighborSetUpdateMpr()
+ * runs and the MPR set must cover every reachable two-hop neighbor. Its time and size are compared with a greedy selection from scratch over the same
+ * sets (sole reachers first, then the one-hop neighbor covering most uncovered two-hop neighbors).
+ *
+ * Prints one JSON object per topology ("type":"topology") and a summary ("type":"summary"), per-event figures are 0
+ * without events. Exits 1 if any MPR set left a two-hop neighbor uncovered.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+#include "swarm_ranging.h"
+
+#define BENCH_NODE_MAX (NEIGHBOR_ADDRESS_MAX + 1)
+#define BENCH_SELF 0
+
+typedef struct
+{
+  double x[BENCH_NODE_MAX], y[BENCH_NODE_MAX];
+  uint64_t adjacency[BENCH_NODE_MAX];
+  int count;
+  double side;
+} Bench_Topology_t;
+
+typedef struct
+{
+  uint64_t moves;
+  uint64_t events;
+  uint64_t changes; // one-hop, two-hop and relation changes fed to the neighbor set
+  double incrementalNs;
+  double incrementalNsMax;
+  double scratchNs;
+  uint64_t incrementalSize;
+  uint64_t scratchSize;
+  uint64_t uncovered;
+} Bench_Stats_t;
+
+static double range = 4.0; // m
+static double degree = 8;  // mean neighbors
+static double step = 0.5;  // m per event
+static uint64_t benchRandom;
+
+static double perEvent(double value, uint64_t events)
+{
+  return events ? value / events : 0;
+}
+
+static double nowNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void topologyLink(Bench_Topology_t *topology, int node)
+{
+  topology->adjacency[node] = 0;
+  for (int other = 0; other < topology->count; other++)
+  {
+    bool linked = other != node &&
+                  hypot(topology->x[node] - topology->x[other], topology->y[node] - topology->y[other]) <= range;
+    if (linked)
+    {
+      topology->adjacency[node] |= 1ULL << other;
+      topology->adjacency[other] |= 1ULL << node;
+    }
+    else
+    {
+      topology->adjacency[other] &= ~(1ULL << node);
+    }
+  }
+}
+
+static void topologyInit(Bench_Topology_t *topology, int count)
+{
+  topology->count = count;
+  topology->side = sqrt(count * M_PI * range * range / degree);
+  for (int node = 0; node < count; node++)
+  {
+    topology->x[node] = hostRandomUniform(&benchRandom) * topology->side;
+    topology->y[node] = hostRandomUniform(&benchRandom) * topology->side;
+  }
+  memset(topology->adjacency, 0, sizeof(topology->adjacency));
+  for (int node = 0; node < count; node++)
+  {
+    topologyLink(topology, node);
+  }
+}
+
+static void topologyMove(Bench_Topology_t *topology, int node)
+{
+  topology->x[node] = fmin(fmax(topology->x[node] + (hostRandomUniform(&benchRandom) * 2 - 1) * step, 0), topology->side);
+  topology->y[node] = fmin(fmax(topology->y[node] + (hostRandomUniform(&benchRandom) * 2 - 1) * step, 0), topology->side);
+  topologyLink(topology, node);
+}
+
+/* Bring the neighbor set of BENCH_SELF in line with the topology through the neighbor set operations. */
+static uint64_t neighborSetSync(Ranging_Context_t *ctx, Neighbor_Set_t *set, Bench_Topology_t *topology)
+{
+  uint64_t changes = 0;
+  uint64_t oneHop = topology->adjacency[BENCH_SELF];
+  uint64_t twoHop = 0;
+  for (uint64_t bits = oneHop; bits; bits &= bits - 1)
+  {
+    twoHop |= topology->adjacency[__builtin_ctzll(bits)];
+  }
+  twoHop &= ~oneHop & ~(1ULL << BENCH_SELF);
+
+  for (uint64_t bits = (set->oneHop.bits | set->twoHop.bits) & ~(oneHop | twoHop); bits; bits &= bits - 1, changes++)
+  {
+    neighborSetRemoveNeighbor(ctx, set, __builtin_ctzll(bits));
+  }
+  for (uint64_t bits = oneHop & ~set->oneHop.bits; bits; bits &= bits - 1, changes++)
+  {
+    neighborSetAddOneHopNeighbor(ctx, set, __builtin_ctzll(bits));
+  }
+  for (uint64_t bits = twoHop & ~set->twoHop.bits; bits; bits &= bits - 1, changes++)
+  {
+    neighborSetAddTwoHopNeighbor(ctx, set, __builtin_ctzll(bits));
+  }
+  for (uint64_t bits = twoHop; bits; bits &= bits - 1)
+  {
+    UWB_Address_t to = __builtin_ctzll(bits);
+    uint64_t reach = topology->adjacency[to] & oneHop;
+    uint64_t current = set->twoHopReachSets[to].bits;
+    for (uint64_t added = reach & ~current; added; added &= added - 1, changes++)
+    {
+      neighborSetAddRelation(ctx, set, __builtin_ctzll(added), to);
+    }
+    for (uint64_t removed = current & ~reach; removed; removed &= removed - 1, changes++)
+    {
+      neighborSetRemoveRelation(ctx, set, __builtin_ctzll(removed), to);
+    }
+  }
+  return changes;
+}
+
+/* Two-hop neighbors reachable through a one-hop neighbor but through none of mpr. */
+static uint64_t mprUncovered(Neighbor_Set_t *set, uint64_t mpr)
+{
+  uint64_t uncovered = 0;
+  for (uint64_t bits = set->twoHop.bits; bits; bits &= bits - 1)
+  {
+    UWB_Address_t twoHopNeighbor = __builtin_ctzll(bits);
+    uint64_t reach = set->twoHopReachSets[twoHopNeighbor].bits & set->oneHop.bits;
+    if (reach && !(reach & mpr))
+    {
+      uncovered |= 1ULL << twoHopNeighbor;
+    }
+  }
+  return uncovered;
+}
+
+static uint64_t mprFromScratch(Neighbor_Set_t *set)
+{
+  uint64_t mpr = 0;
+  for (uint64_t bits = set->twoHop.bits; bits; bits &= bits - 1)
+  {
+    uint64_t reach = set->twoHopReachSets[__builtin_ctzll(bits)].bits & set->oneHop.bits;
+    if (__builtin_popcountll(reach) == 1)
+    {
+      mpr |= reach;
+    }
+  }
+  uint64_t uncovered = mprUncovered(set, mpr);
+  while (uncovered)
+  {
+    UWB_Address_t best = 0;
+    int bestCoverage = 0;
+    for (uint64_t bits = set->oneHop.bits & ~mpr; bits; bits &= bits - 1)
+    {
+      UWB_Address_t oneHopNeighbor = __builtin_ctzll(bits);
+      int coverage = __builtin_popcountll(set->twoHopCoverSets[oneHopNeighbor].bits & uncovered);
+      if (coverage > bestCoverage)
+      {
+        best = oneHopNeighbor;
+        bestCoverage = coverage;
+      }
+    }
+    mpr |= 1ULL << best;
+    uncovered &= ~set->twoHopCoverSets[best].bits;
+  }
+  return mpr;
+}
+
+static void benchTopology(Ranging_Context_t *ctx, int count, int moves, Bench_Stats_t *total)
+{
+  static Bench_Topology_t topology;
+  static Neighbor_Set_t set;
+  Bench_Stats_t stats = {0};
+  topologyInit(&topology, count);
+  neighborSetInit(&set);
+  neighborSetSync(ctx, &set, &topology);
+  neighborSetUpdateMpr(&set);
+
+  for (int move = 0; move < moves; move++)
+  {
+    topologyMove(&topology, 1 + hostRandomNext(&benchRandom) % (count - 1));
+    stats.moves++;
+    uint64_t changes = neighborSetSync(ctx, &set, &topology);
+    if (!changes)
+    {
+      continue;
+    }
+    stats.changes += changes;
+
+    double start = nowNs();
+    neighborSetUpdateMpr(&set);
+    double incremental = nowNs() - start;
+    start = nowNs();
+    uint64_t scratch = mprFromScratch(&set);
+    stats.scratchNs += nowNs() - start;
+
+    stats.incrementalNs += incremental;
+    stats.incrementalNsMax = fmax(stats.incrementalNsMax, incremental);
+    stats.incrementalSize += set.mprSet.size;
+    stats.scratchSize += __builtin_popcountll(scratch);
+    stats.uncovered += __builtin_popcountll(mprUncovered(&set, set.mprSet.bits));
+    stats.events++;
+  }
+
+  printf("{\"type\":\"topology\",\"nodes\":%d,\"oneHop\":%d,\"twoHop\":%d,\"moves\":%llu,\"events\":%llu,"
+         "\"changesPerEvent\":%.2f,\"incrementalNs\":%.0f,\"incrementalNsMax\":%.0f,\"scratchNs\":%.0f,\"mpr\":%.2f,"
+         "\"mprScratch\":%.2f,\"uncovered\":%llu}\n",
+         count, set.oneHop.size, set.twoHop.size, (unsigned long long)stats.moves, (unsigned long long)stats.events,
+         perEvent(stats.changes, stats.events), perEvent(stats.incrementalNs, stats.events),
+         stats.incrementalNsMax, perEvent(stats.scratchNs, stats.events), perEvent(stats.incrementalSize, stats.events),
+         perEvent(stats.scratchSize, stats.events), (unsigned long long)stats.uncovered);
+  total->moves += stats.moves;
+  total->events += stats.events;
+  total->changes += stats.changes;
+  total->incrementalNs += stats.incrementalNs;
+  total->incrementalNsMax = fmax(total->incrementalNsMax, stats.incrementalNsMax);
+  total->scratchNs += stats.scratchNs;
+  total->incrementalSize += stats.incrementalSize;
+  total->scratchSize += stats.scratchSize;
+  total->uncovered += stats.uncovered;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [--topologies N] [--moves N] [--min-nodes N] [--max-nodes N] [--range M] "
+                  "[--degree D] [--step M] [--seed X]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  int topologies = 200;
+  int moves = 1000;
+  int minNodes = 32;
+  int maxNodes = 64;
+  uint64_t seed = 1;
+  static struct option options[] = {
+      {"topologies", required_argument, NULL, 't'},
+      {"moves", required_argument, NULL, 'e'},
+      {"min-nodes", required_argument, NULL, 'n'},
+      {"max-nodes", required_argument, NULL, 'm'},
+      {"range", required_argument, NULL, 'r'},
+      {"degree", required_argument, NULL, 'd'},
+      {"step", required_argument, NULL, 's'},
+      {"seed", required_argument, NULL, 'x'},
+      {NULL, 0, NULL, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 't':
+      topologies = atoi(optarg);
+      break;
+    case 'e':
+      moves = atoi(optarg);
+      break;
+    case 'n':
+      minNodes = atoi(optarg);
+      break;
+    case 'm':
+      maxNodes = atoi(optarg);
+      break;
+    case 'r':
+      range = atof(optarg);
+      break;
+    case 'd':
+      degree = atof(optarg);
+      break;
+    case 's':
+      step = atof(optarg);
+      break;
+    case 'x':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (minNodes < 2 || maxNodes > BENCH_NODE_MAX || minNodes > maxNodes)
+  {
+    fprintf(stderr, "nodes must be within 2..%d\n", BENCH_NODE_MAX);
+    return 2;
+  }
+  benchRandom = seed;
+  Host_Node_t node;
+  hostNodeInit(&node, 0);
+  hostNodeEnter(&node);
+  Ranging_Context_t *ctx = malloc(rangingContextSize());
+  rangingContextSetup(ctx, BENCH_SELF);
+
+  Bench_Stats_t total = {0};
+  for (int i = 0; i < topologies; i++)
+  {
+    benchTopology(ctx, minNodes + hostRandomNext(&benchRandom) % (maxNodes - minNodes + 1), moves, &total);
+  }
+  printf("{\"type\":\"summary\",\"seed\":%llu,\"topologies\":%d,\"moves\":%llu,\"events\":%llu,"
+         "\"changesPerEvent\":%.2f,\"incrementalNs\":%.0f,\"incrementalNsMax\":%.0f,\"scratchNs\":%.0f,\"mpr\":%.2f,"
+         "\"mprScratch\":%.2f,\"uncovered\":%llu}\n",
+         (unsigned long long)seed, topologies, (unsigned long long)total.moves, (unsigned long long)total.events,
+         perEvent(total.changes, total.events), perEvent(total.incrementalNs, total.events),
+         total.incrementalNsMax, perEvent(total.scratchNs, total.events), perEvent(total.incrementalSize, total.events),
+         perEvent(total.scratchSize, total.events), (unsigned long long)total.uncovered);
+  return total.uncovered ? 1 : 0;
+}
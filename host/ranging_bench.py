@@ -0,0 +1,87 @@
+import argparse
+import json
+import math
+import subprocess
+import sys
+
+'''
+Benchmark suite on the simulated medium of ranging_sim.c: runs every preset swarm size in every scenario and prints
+one JSON document with the summary, the per-link results and, for leader loss, the per-second progress of each run.
+
+Build the simulator first, from the repository root:
+  gcc -std=gnu11 -O2 -pthread -Ihost/shim -I. host/ranging_sim.c host/shim/host_rtos.c swarm_ranging.c \
+      swarm_localization.c -lm -o ranging_sim
+  python3 host/ranging_bench.py --sim ./ranging_sim > bench.json
+
+With a second build that has -DENABLE_CHANNEL_HOPPING, --sim-hopping runs every preset on it as well, so that the
+channel groups can be compared with the single channel on the same medium ("hopping" in each run).
+
+Scenarios:
+  static       drones hover 3 m apart, everyone hears everyone
+  moving       drones fly at --speed and bounce off the sides of the area
+  leader-loss  the leader goes silent half way through, progress shows how the followers cope
+  hidden       range cut to half the side of the area, so drones transmit over each other unheard
+'''
+
+PRESETS = [5, 10, 20, 32]
+SCENARIOS = ['static', 'moving', 'leader-loss', 'hidden']
+
+
+def scenario_arguments(scenario, nodes, args):
+    area = 3 * math.sqrt(nodes)  # m, same default as the simulator
+    if scenario == 'moving':
+        return ['--speed', str(args.speed)]
+    if scenario == 'leader-loss':
+        return ['--leader-loss', str(args.seconds / 2), '--report', '1']
+    if scenario == 'hidden':
+        return ['--area', str(area), '--range', str(area / 2)]
+    return []
+
+
+def run(args, sim, nodes, scenario):
+    command = [sim, '--nodes', str(nodes), '--seconds', str(args.seconds), '--seed', str(args.seed),
+               '--loss', str(args.loss), '--threads', str(args.threads), '--links']
+    command += scenario_arguments(scenario, nodes, args)
+    output = subprocess.run(command, check=True, capture_output=True, text=True).stdout
+    result = {'nodes': nodes, 'scenario': scenario, 'hopping': sim == args.sim_hopping, 'command': ' '.join(command),
+              'progress': [], 'links': []}
+    for line in output.splitlines():
+        record = json.loads(line)
+        kind = record.pop('type')
+        if kind == 'summary':
+            result['summary'] = record
+        elif kind == 'progress':
+            result['progress'].append(record)
+        elif kind == 'link':
+            result['links'].append(record)
+        elif kind == 'channels':
+            result['channels'] = record
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the ranging benchmark presets on the simulated medium')
+    parser.add_argument('--sim', default='./ranging_sim', help='path of the built ranging_sim')
+    parser.add_argument('--sim-hopping', help='path of ranging_sim built with -DENABLE_CHANNEL_HOPPING')
+    parser.add_argument('--nodes', type=int, nargs='+', default=PRESETS)
+    parser.add_argument('--scenarios', nargs='+', choices=SCENARIOS, default=SCENARIOS)
+    parser.add_argument('--seconds', type=float, default=20)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--loss', type=float, default=0, help='injected loss in percent on top of collisions')
+    parser.add_argument('--speed', type=float, default=1.0, help='m/s of the moving scenario')
+    parser.add_argument('--threads', type=int, default=1)
+    args = parser.parse_args()
+
+    sims = [args.sim] + ([args.sim_hopping] if args.sim_hopping else [])
+    runs = []
+    for sim in sims:
+        for nodes in args.nodes:
+            for scenario in args.scenarios:
+                print('%s %s nodes %d' % (sim, scenario, nodes), file=sys.stderr)
+                runs.append(run(args, sim, nodes, scenario))
+    json.dump({'seconds': args.seconds, 'seed': args.seed, 'loss': args.loss, 'runs': runs}, sys.stdout, indent=1)
+    print()
+
+
+if __name__ == '__main__':
+    main()
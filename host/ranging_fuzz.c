@@ -0,0 +1,416 @@
+/* Randomized interleavings of tx, rx, loss, reordering and duplication driven through the radio paths of a few
+ * ranging instances, checking the invariants of the ranging state machine on every step.
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu11 -O2 -DRANGING_INVARIANT_CHECK_ENABLE -Ihost/shim -I. host/ranging_fuzz.c host/shim/host_rtos.c \
+ *       swarm_ranging.c swarm_localization.c -lm -o ranging_fuzz && ./ranging_fuzz --steps 2000000 --seed 1
+ *
+ * The leader and two followers stand still, so every distance the core publishes must match the truth. A run
+ * alternates adversarial rounds (frames lost, held back and handed over after later ones, handed over twice, tx
+ * timestamps lost, rx queues left to fill, silences long enough to expire neighbors) with clean rounds of regular
+ * in-order ranging. It fails on:
+ *   - a published distance more than FUZZ_TOLERANCE off the truth, which is what reusing a stale Tf or mixing up
+ *     sequence numbers looks like from outside;
+ *   - a pair with no fresh distance at the end of a clean round (no recovery);
+ *   - any RANGING_INVARIANT of the state machine, which aborts.
+ * Ticks start just below their 32 bit wrap, the DW1000 clocks wrap every 17.2 s and msgSequence wraps every 65536
+ * frames of a node, a default run crosses all three many times.
+ *
+ * Prints one JSON object per failure ("type":"failure") and a summary ("type":"summary"), exits 1 on any failure.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+#include "swarm_ranging.h"
+
+#define FUZZ_NODE_COUNT 3
+#define FUZZ_HELD_MAX 16         // frames held back per receiver
+#define FUZZ_TOLERANCE 30        // cm
+#define FUZZ_ROUND_STEPS 2000    // steps of an adversarial round
+#define FUZZ_CLEAN_PERIODS 40    // leader periods of a clean round
+#define FUZZ_FAILURE_PRINT_MAX 20
+#define FUZZ_CM_PER_NS 29.9792458 // speed of light
+#define FUZZ_SKEW_PPM 20
+
+typedef struct
+{
+  UWB_Packet_t packet;
+  uint16_t sender;
+  uint64_t time; // ns, on air
+} Fuzz_Frame_t;
+
+typedef struct
+{
+  Host_Node_t host;
+  Ranging_Context_t *ctx;
+  double x; // cm, all nodes on a line
+  TickType_t tickOffset;
+  uint64_t dwOffset;
+  double dwSkew;
+  uint32_t snapshotVersion;
+  Fuzz_Frame_t held[FUZZ_HELD_MAX];
+  int heldCount;
+} Fuzz_Node_t;
+
+typedef struct
+{
+  uint64_t steps;
+  uint64_t tx;
+  uint64_t rx;
+  uint64_t lost;
+  uint64_t reordered;
+  uint64_t duplicated;
+  uint64_t txTimeLost;
+  uint64_t silences;
+  uint64_t distances;
+  uint64_t rounds;
+  uint64_t failures;
+} Fuzz_Stats_t;
+
+/* Probabilities of the adversarial rounds */
+typedef struct
+{
+  double loss;       // per receiver and frame
+  double reorder;    // per receiver and frame, held back and handed over later
+  double duplicate;  // per receiver and frame
+  double txTimeLoss; // per frame, the tx timestamp never reaches the core
+  double silence;    // per step
+} Fuzz_Config_t;
+
+static Fuzz_Config_t config = {.loss = 0.25, .reorder = 0.1, .duplicate = 0.05, .txTimeLoss = 0.05, .silence = 0.0005};
+static Fuzz_Node_t nodes[FUZZ_NODE_COUNT];
+static Fuzz_Stats_t stats;
+static uint64_t now; // ns
+static uint64_t fuzzRandom;
+static uint64_t seed = 1;
+
+static bool randomChance(double probability)
+{
+  return hostRandomUniform(&fuzzRandom) < probability;
+}
+
+static void failure(const char *what, int node, int neighbor, int value, double truth)
+{
+  stats.failures++;
+  if (stats.failures <= FUZZ_FAILURE_PRINT_MAX)
+  {
+    printf("{\"type\":\"failure\",\"seed\":%llu,\"step\":%llu,\"what\":\"%s\",\"node\":%d,\"neighbor\":%d,"
+           "\"value\":%d,\"truth\":%.0f}\n",
+           (unsigned long long)seed, (unsigned long long)stats.steps, what, node, neighbor, value, truth);
+  }
+}
+
+static dwTime_t fuzzDwTime(Fuzz_Node_t *node, uint64_t time, double offset)
+{
+  dwTime_t dwTime = {.full = 0};
+  double units = (time + offset) * (UWB_TIME_UNITS_PER_MS / 1e6) * (1 + node->dwSkew);
+  dwTime.full = (node->dwOffset + (uint64_t)llround(fmod(units, (double)UWB_MAX_TIMESTAMP))) % UWB_MAX_TIMESTAMP;
+  return dwTime;
+}
+
+static TickType_t fuzzTick(Fuzz_Node_t *node, uint64_t time)
+{
+  return node->tickOffset + (TickType_t)(time / 1000000);
+}
+
+static void fuzzEnter(Fuzz_Node_t *node)
+{
+  node->host.tick = fuzzTick(node, now);
+  hostNodeEnter(&node->host);
+}
+
+/* Advance the simulated time and fire the timers that became due. */
+static void fuzzAdvance(uint64_t ns)
+{
+  now += ns;
+  for (int i = 0; i < FUZZ_NODE_COUNT; i++)
+  {
+    fuzzEnter(&nodes[i]);
+    hostTimersRun(&nodes[i].host);
+  }
+}
+
+static void fuzzDeliver(int receiver, Fuzz_Frame_t *frame)
+{
+  Fuzz_Node_t *node = &nodes[receiver];
+  double tof = fabs(node->x - nodes[frame->sender].x) / FUZZ_CM_PER_NS;
+  fuzzEnter(node);
+  rangingRadioRx(node->ctx, &frame->packet, fuzzDwTime(node, frame->time, tof), fuzzTick(node, frame->time));
+  stats.rx++;
+}
+
+/* Every distance published since the last check must be the truth, the positions never change. */
+static void fuzzCheckSnapshot(int index)
+{
+  Fuzz_Node_t *node = &nodes[index];
+  Neighbor_State_Snapshot_t snapshot;
+  fuzzEnter(node);
+  if (!neighborStateSnapshotGet(node->ctx, &snapshot, node->snapshotVersion))
+  {
+    return;
+  }
+  for (int i = 0; i < snapshot.size; i++)
+  {
+    Neighbor_State_t *neighbor = &snapshot.neighbors[i];
+    if (!neighbor->refresh || neighbor->address >= FUZZ_NODE_COUNT)
+    {
+      continue;
+    }
+    stats.distances++;
+    double truth = fabs(node->x - nodes[neighbor->address].x);
+    if (fabs(neighbor->distance - truth) > FUZZ_TOLERANCE)
+    {
+      failure("wrong distance", index, neighbor->address, neighbor->distance, truth);
+    }
+  }
+  node->snapshotVersion = snapshot.version;
+}
+
+static void fuzzRxTask(int index)
+{
+  fuzzEnter(&nodes[index]);
+  while (rangingRxTaskStep(nodes[index].ctx, 0))
+  {
+  }
+  fuzzCheckSnapshot(index);
+}
+
+/* One frame of a node, each receiver independently gets it, loses it, gets it later or gets it twice. */
+static void fuzzTransmit(int sender, bool adversarial)
+{
+  static Fuzz_Frame_t frame;
+  Fuzz_Node_t *node = &nodes[sender];
+  fuzzEnter(node);
+  rangingRadioTxBuild(node->ctx, &frame.packet);
+  frame.sender = sender;
+  frame.time = now;
+  stats.tx++;
+  if (adversarial && randomChance(config.txTimeLoss))
+  {
+    stats.txTimeLost++;
+  }
+  else
+  {
+    rangingRadioTxDone(node->ctx, &frame.packet, fuzzDwTime(node, now, 0));
+  }
+  for (int i = 0; i < FUZZ_NODE_COUNT; i++)
+  {
+    if (i == sender)
+    {
+      continue;
+    }
+    Fuzz_Node_t *receiver = &nodes[i];
+    double draw = adversarial ? hostRandomUniform(&fuzzRandom) : 1;
+    if (draw < config.loss)
+    {
+      stats.lost++;
+    }
+    else if (draw < config.loss + config.reorder && receiver->heldCount < FUZZ_HELD_MAX)
+    {
+      receiver->held[receiver->heldCount++] = frame;
+    }
+    else
+    {
+      fuzzDeliver(i, &frame);
+      if (draw < config.loss + config.reorder + config.duplicate)
+      {
+        fuzzDeliver(i, &frame);
+        stats.duplicated++;
+      }
+    }
+  }
+}
+
+/* Hand a held back frame over after the frames that followed it. */
+static void fuzzReleaseHeld(int receiver)
+{
+  Fuzz_Node_t *node = &nodes[receiver];
+  if (node->heldCount == 0)
+  {
+    return;
+  }
+  int pick = hostRandomNext(&fuzzRandom) % node->heldCount;
+  Fuzz_Frame_t frame = node->held[pick];
+  node->held[pick] = node->held[--node->heldCount];
+  fuzzDeliver(receiver, &frame);
+  stats.reordered++;
+}
+
+static void fuzzAdversarialStep()
+{
+  stats.steps++;
+  double draw = hostRandomUniform(&fuzzRandom);
+  if (draw < 0.45)
+  {
+    fuzzTransmit(hostRandomNext(&fuzzRandom) % FUZZ_NODE_COUNT, true);
+  }
+  else if (draw < 0.55)
+  {
+    fuzzReleaseHeld(hostRandomNext(&fuzzRandom) % FUZZ_NODE_COUNT);
+  }
+  else if (draw < 0.9)
+  {
+    fuzzRxTask(hostRandomNext(&fuzzRandom) % FUZZ_NODE_COUNT);
+  }
+  else if (draw < 0.9 + config.silence)
+  {
+    /* Long enough for the neighbor set and the ranging tables to expire their entries. */
+    fuzzAdvance((uint64_t)(2 + hostRandomUniform(&fuzzRandom) * 10) * 1000000000ULL);
+    stats.silences++;
+    return;
+  }
+  fuzzAdvance((uint64_t)(hostRandomUniform(&fuzzRandom) * 20e6));
+}
+
+static bool fuzzMeasuredWithin(Fuzz_Node_t *node, UWB_Address_t neighborAddress, TickType_t age)
+{
+  static Neighbor_State_Snapshot_t snapshot;
+  neighborStateSnapshotGet(node->ctx, &snapshot, 0);
+  for (int i = 0; i < snapshot.size; i++)
+  {
+    if (snapshot.neighbors[i].address == neighborAddress)
+    {
+      return node->host.tick - snapshot.neighbors[i].measurementTime <= age;
+    }
+  }
+  return false;
+}
+
+/* Regular in-order ranging: the leader every RANGING_PERIOD, followers in their slots, no loss. Every pair must
+ * end with a fresh distance. Frames still held from the adversarial round are dropped.
+ */
+static void fuzzCleanRound()
+{
+  for (int i = 0; i < FUZZ_NODE_COUNT; i++)
+  {
+    nodes[i].heldCount = 0;
+    fuzzRxTask(i);
+  }
+  for (int period = 0; period < FUZZ_CLEAN_PERIODS; period++)
+  {
+    for (int i = 0; i < FUZZ_NODE_COUNT; i++)
+    {
+      fuzzTransmit(i, false);
+      for (int j = 0; j < FUZZ_NODE_COUNT; j++)
+      {
+        fuzzRxTask(j);
+      }
+      fuzzAdvance(4 * 1000000ULL);
+      stats.steps++;
+    }
+    fuzzAdvance((RANGING_PERIOD - 4 * FUZZ_NODE_COUNT) * 1000000ULL);
+  }
+  for (int i = 1; i < FUZZ_NODE_COUNT; i++)
+  {
+    int pairs[2][2] = {{0, i}, {i, 0}};
+    for (int p = 0; p < 2; p++)
+    {
+      Fuzz_Node_t *node = &nodes[pairs[p][0]];
+      fuzzEnter(node);
+      int16_t distance = distanceGet(node->ctx, pairs[p][1]);
+      bool fresh = fuzzMeasuredWithin(node, pairs[p][1], M2T(2 * RANGING_PERIOD));
+      double truth = fabs(node->x - nodes[pairs[p][1]].x);
+      if (!fresh || fabs(distance - truth) > FUZZ_TOLERANCE)
+      {
+        failure("no recovery", pairs[p][0], pairs[p][1], distance, truth);
+      }
+    }
+  }
+  stats.rounds++;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [--steps N] [--seed X] [--loss P] [--reorder P] [--duplicate P] [--tx-time-loss P] "
+                  "[--silence P]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t steps = 2000000;
+  static struct option options[] = {
+      {"steps", required_argument, NULL, 'n'},
+      {"seed", required_argument, NULL, 'x'},
+      {"loss", required_argument, NULL, 'l'},
+      {"reorder", required_argument, NULL, 'r'},
+      {"duplicate", required_argument, NULL, 'd'},
+      {"tx-time-loss", required_argument, NULL, 't'},
+      {"silence", required_argument, NULL, 's'},
+      {NULL, 0, NULL, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      steps = strtoull(optarg, NULL, 0);
+      break;
+    case 'x':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'l':
+      config.loss = atof(optarg);
+      break;
+    case 'r':
+      config.reorder = atof(optarg);
+      break;
+    case 'd':
+      config.duplicate = atof(optarg);
+      break;
+    case 't':
+      config.txTimeLoss = atof(optarg);
+      break;
+    case 's':
+      config.silence = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  fuzzRandom = seed;
+  for (int i = 0; i < FUZZ_NODE_COUNT; i++)
+  {
+    Fuzz_Node_t *node = &nodes[i];
+    node->x = i == 0 ? 0 : 250.0 * i + hostRandomUniform(&fuzzRandom) * 100;
+    /* Within a minute of the tick wrap, so that it happens early in every run. */
+    node->tickOffset = (TickType_t)(0xFFFFFFFFu - 60000 + hostRandomNext(&fuzzRandom) % 30000);
+    node->dwOffset = hostRandomNext(&fuzzRandom) % UWB_MAX_TIMESTAMP;
+    node->dwSkew = (hostRandomUniform(&fuzzRandom) * 2 - 1) * FUZZ_SKEW_PPM * 1e-6;
+    hostNodeInit(&node->host, fuzzTick(node, 0));
+    hostNodeEnter(&node->host);
+    node->ctx = malloc(rangingContextSize());
+    rangingContextSetup(node->ctx, i);
+    rangingContextSeed(node->ctx, (uint32_t)hostRandomNext(&fuzzRandom));
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (stats.steps < steps)
+  {
+    for (int i = 0; i < FUZZ_ROUND_STEPS; i++)
+    {
+      fuzzAdversarialStep();
+    }
+    fuzzCleanRound();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  printf("{\"type\":\"summary\",\"seed\":%llu,\"steps\":%llu,\"stepsPerS\":%.0f,\"simulatedS\":%.0f,\"tx\":%llu,"
+         "\"rx\":%llu,\"lost\":%llu,\"reordered\":%llu,\"duplicated\":%llu,\"txTimeLost\":%llu,\"silences\":%llu,"
+         "\"distances\":%llu,\"rounds\":%llu,\"failures\":%llu}\n",
+         (unsigned long long)seed, (unsigned long long)stats.steps, stats.steps / wall, now / 1e9,
+         (unsigned long long)stats.tx, (unsigned long long)stats.rx, (unsigned long long)stats.lost,
+         (unsigned long long)stats.reordered, (unsigned long long)stats.duplicated,
+         (unsigned long long)stats.txTimeLost, (unsigned long long)stats.silences,
+         (unsigned long long)stats.distances, (unsigned long long)stats.rounds, (unsigned long long)stats.failures);
+  return stats.failures ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+/* Runs several ranging instances in one process on an ideal shared medium, through the same radio paths and task
+ * steps the deck uses, and checks that every measured distance converges to the true one. Exits non-zero if not.
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu11 -O2 -Ihost/shim -I. host/ranging_host_test.c host/shim/host_rtos.c swarm_ranging.c -lm \
+ *       -o ranging_host_test && ./ranging_host_test [nodes] [seconds]
+ *
+ * Node 0 is the leader. Each node has its own tick offset and its own DW1000 clock with an offset and a skew, frames
+ * reach every other node after the time of flight, there is no loss and no collision (see ranging_sim.c for those).
+ *
+ * Then a chain of three nodes, where the last follower only hears the first one, takes off, the leader reboots with
+ * its command epoch back at 0 and takes off again: its new stages must reach the follower two hops away although the
+ * swarm still floods the higher epoch from before the reboot.
+ *
+ * Built with -DRANGING_EVENT_RECORD_ENABLE, the records node 1 drains during the first run are replayed into a fresh
+ * instance afterwards, which must end up with the same ranging tables and distances byte for byte.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+#include "swarm_ranging.h"
+
+#define HOST_TEST_NODE_MAX 14 // followers transmit addr * 4 ms after the leader, all must fit in RANGING_PERIOD
+#define HOST_TEST_SPACING 150.0 // cm between neighbors on a circle of followers around the leader
+#define HOST_TEST_TOLERANCE 30 // cm
+#define HOST_TEST_CM_PER_NS 29.9792458 // speed of light
+#define HOST_TEST_CHAIN_SPACING 300.0 // cm between the nodes of the leader restart chain
+#define HOST_TEST_CHAIN_RANGE 400.0   // cm, so that only neighbors on the chain hear each other
+#define HOST_TEST_CONVERGE_TIME 2000  // ms of FIRST_STAGE, convergeTime of the default mission timeline
+
+typedef enum
+{
+  HOST_TX_WAIT,  // follower waits for a leader frame, transmits on its own at the deadline
+  HOST_TX_DELAY, // follower got a leader frame and waits for its slot
+} Host_Tx_State_t;
+
+typedef struct
+{
+  Host_Node_t host;
+  Ranging_Context_t *ctx;
+  double x, y; // cm
+  TickType_t tickOffset;
+  uint64_t dwOffset;
+  double dwSkew;
+  Host_Tx_State_t txState;
+  uint32_t txAt; // ms of the simulation
+} Host_Test_Node_t;
+
+static Host_Test_Node_t nodes[HOST_TEST_NODE_MAX];
+static int nodeCount;
+static double range; // cm, frames only reach receivers within it, 0 for all of them
+static uint32_t now; // ms of the simulation
+#ifdef RANGING_EVENT_RECORD_ENABLE
+#define HOST_TEST_RECORD_NODE 1
+static bool recording; // drain the records of HOST_TEST_RECORD_NODE into recorded
+static uint8_t *recorded;
+static size_t recordedSize;
+#endif
+
+static uint64_t dwTimeAt(Host_Test_Node_t *node, double ns)
+{
+  return (node->dwOffset + (uint64_t)llround(ns * (UWB_TIME_UNITS_PER_MS / 1e6) * (1 + node->dwSkew))) %
+         UWB_MAX_TIMESTAMP;
+}
+
+static double trueDistance(Host_Test_Node_t *a, Host_Test_Node_t *b)
+{
+  return hypot(a->x - b->x, a->y - b->y);
+}
+
+static void transmit(int sender)
+{
+  static UWB_Packet_t packet;
+  Host_Test_Node_t *node = &nodes[sender];
+  hostNodeEnter(&node->host);
+  rangingRadioTxBuild(node->ctx, &packet);
+  double txNs = now * 1e6;
+  dwTime_t txTime = {.full = dwTimeAt(node, txNs)};
+  rangingRadioTxDone(node->ctx, &packet, txTime);
+  for (int i = 0; i < nodeCount; i++)
+  {
+    if (i == sender)
+    {
+      continue;
+    }
+    Host_Test_Node_t *receiver = &nodes[i];
+    if (range > 0 && trueDistance(node, receiver) > range)
+    {
+      continue;
+    }
+    double tofNs = trueDistance(node, receiver) / HOST_TEST_CM_PER_NS;
+    dwTime_t rxTime = {.full = dwTimeAt(receiver, txNs + tofNs)};
+    hostNodeEnter(&receiver->host);
+    rangingRadioRx(receiver->ctx, &packet, rxTime, receiver->host.tick);
+  }
+}
+
+/* What uwbRangingTxTask does in one millisecond. */
+static void txTaskStep(int index)
+{
+  Host_Test_Node_t *node = &nodes[index];
+  hostNodeEnter(&node->host);
+  if (index == 0)
+  {
+    if (now >= node->txAt)
+    {
+      transmit(index);
+      node->txAt = now + RANGING_PERIOD;
+    }
+    return;
+  }
+  if (node->txState == HOST_TX_WAIT)
+  {
+    if (rangingTxSlotWait(node->ctx, 0))
+    {
+      node->txState = HOST_TX_DELAY;
+      node->txAt = now + rangingTxSlotDelay(node->ctx);
+    }
+    else if (now >= node->txAt)
+    {
+      node->txAt = now; // leader silent for TX_PERIOD_IN_MS
+      node->txState = HOST_TX_DELAY;
+    }
+  }
+  if (node->txState == HOST_TX_DELAY && now >= node->txAt)
+  {
+    transmit(index);
+    hostNodeEnter(&node->host);
+    node->txState = HOST_TX_WAIT;
+    node->txAt = now + rangingTxSlotTimeout(node->ctx);
+  }
+}
+
+static bool checkDistance(int from, int to)
+{
+  hostNodeEnter(&nodes[from].host);
+  int16_t measured = distanceGet(nodes[from].ctx, to);
+  double truth = trueDistance(&nodes[from], &nodes[to]);
+  bool ok = measured >= 0 && fabs(measured - truth) <= HOST_TEST_TOLERANCE;
+  printf("{\"node\":%d,\"neighbor\":%d,\"distance\":%d,\"truth\":%.0f,\"ok\":%s}\n", from, to, measured, truth,
+         ok ? "true" : "false");
+  return ok;
+}
+
+#ifdef RANGING_EVENT_RECORD_ENABLE
+static void recordDrain()
+{
+  static uint8_t buffer[RANGING_RECORD_BUFFER_SIZE];
+  Host_Test_Node_t *node = &nodes[HOST_TEST_RECORD_NODE];
+  hostNodeEnter(&node->host);
+  int32_t count;
+  while ((count = rangingRecordDrain(node->ctx, buffer, sizeof(buffer))) > 0)
+  {
+    recorded = realloc(recorded, recordedSize + count);
+    memcpy(recorded + recordedSize, buffer, count);
+    recordedSize += count;
+  }
+}
+
+/* Replay what HOST_TEST_RECORD_NODE recorded into a fresh instance started at the same tick as the live one. */
+static int checkReplay()
+{
+  Host_Test_Node_t *live = &nodes[HOST_TEST_RECORD_NODE];
+  Host_Node_t host;
+  hostNodeInit(&host, live->tickOffset);
+  hostNodeEnter(&host);
+  Ranging_Context_t *ctx = malloc(rangingContextSize());
+  rangingContextSetup(ctx, HOST_TEST_RECORD_NODE);
+  int rejected = 0;
+  for (size_t offset = 0; offset < recordedSize;)
+  {
+    Ranging_Record_Header_t header;
+    memcpy(&header, recorded + offset, sizeof(header));
+    host.tick = header.tick;
+    rejected += !rangingReplayRecord(ctx, &header, recorded + offset + sizeof(header));
+    offset += sizeof(header) + header.length;
+  }
+
+  Ranging_Table_Set_t *liveSet = rangingTableSetGet(live->ctx);
+  Ranging_Table_Set_t *replaySet = rangingTableSetGet(ctx);
+  bool ok = !rejected && replaySet->size == liveSet->size &&
+            memcmp(replaySet->tables, liveSet->tables, sizeof(Ranging_Table_t) * liveSet->size) == 0;
+  int16_t liveDistances[NEIGHBOR_ADDRESS_MAX + 1], replayDistances[NEIGHBOR_ADDRESS_MAX + 1];
+  int16_t liveRaw[NEIGHBOR_ADDRESS_MAX + 1], replayRaw[NEIGHBOR_ADDRESS_MAX + 1];
+  for (int neighbor = 0; neighbor <= NEIGHBOR_ADDRESS_MAX; neighbor++)
+  {
+    liveDistances[neighbor] = distanceGet(live->ctx, neighbor);
+    replayDistances[neighbor] = distanceGet(ctx, neighbor);
+    liveRaw[neighbor] = rawDistanceGet(live->ctx, neighbor);
+    replayRaw[neighbor] = rawDistanceGet(ctx, neighbor);
+  }
+  ok = ok && memcmp(liveDistances, replayDistances, sizeof(liveDistances)) == 0 &&
+       memcmp(liveRaw, replayRaw, sizeof(liveRaw)) == 0;
+  printf("{\"replay\":%d,\"bytes\":%zu,\"rejected\":%d,\"tables\":%d,\"ok\":%s}\n", HOST_TEST_RECORD_NODE,
+         recordedSize, rejected, replaySet->size, ok ? "true" : "false");
+  free(ctx);
+  return !ok;
+}
+#endif
+
+/* Power up node index at the current time, as a fresh instance. The memory of an instance it replaces is leaked. */
+static void nodeStart(int index, double x, double y)
+{
+  Host_Test_Node_t *node = &nodes[index];
+  node->x = x;
+  node->y = y;
+  node->tickOffset = rand() % 100000;
+  node->dwOffset = ((uint64_t)rand() << 20) % UWB_MAX_TIMESTAMP;
+  node->dwSkew = (rand() % 41 - 20) * 1e-6; // within the 20 ppm of the crystal
+  node->txState = HOST_TX_WAIT;
+  node->txAt = now + TX_PERIOD_IN_MS;
+  hostNodeInit(&node->host, node->tickOffset + now);
+  hostNodeEnter(&node->host);
+  node->ctx = malloc(rangingContextSize());
+  rangingContextSetup(node->ctx, index);
+}
+
+static void run(uint32_t duration)
+{
+  for (uint32_t end = now + duration; now < end; now++)
+  {
+    for (int i = 0; i < nodeCount; i++)
+    {
+      nodes[i].host.tick = nodes[i].tickOffset + now;
+      hostNodeEnter(&nodes[i].host);
+      hostTimersRun(&nodes[i].host);
+    }
+    for (int i = 0; i < nodeCount; i++)
+    {
+      txTaskStep(i);
+    }
+    for (int i = 0; i < nodeCount; i++)
+    {
+      hostNodeEnter(&nodes[i].host);
+      while (rangingRxTaskStep(nodes[i].ctx, 0))
+      {
+      }
+    }
+#ifdef RANGING_EVENT_RECORD_ENABLE
+    if (recording)
+    {
+      recordDrain();
+    }
+#endif
+  }
+}
+
+static void takeoff()
+{
+  hostNodeEnter(&nodes[0].host);
+  keepFlyingGetOrSet(nodes[0].ctx, 0, true);
+}
+
+/* The follower must hold the command the leader publishes now, and the stage the leader is expected to be at. */
+static bool checkCommand(int follower, int8_t stage)
+{
+  Leader_Command_t leader, command;
+  hostNodeEnter(&nodes[0].host);
+  leaderCommandGet(nodes[0].ctx, &leader);
+  hostNodeEnter(&nodes[follower].host);
+  leaderCommandGet(nodes[follower].ctx, &command);
+  bool ok = leader.stage == stage && command.epoch == leader.epoch && command.keepFlying == leader.keepFlying &&
+            command.stage == leader.stage;
+  printf("{\"node\":%d,\"epoch\":%u,\"stage\":%d,\"leaderEpoch\":%u,\"leaderStage\":%d,\"expectedStage\":%d,"
+         "\"ok\":%s}\n",
+         follower, command.epoch, command.stage, leader.epoch, leader.stage, stage, ok ? "true" : "false");
+  return ok;
+}
+
+static int checkLeaderRestart()
+{
+  nodeCount = 3;
+  range = HOST_TEST_CHAIN_RANGE;
+  for (int i = 0; i < nodeCount; i++)
+  {
+    nodeStart(i, i * HOST_TEST_CHAIN_SPACING, 0);
+  }
+  run(TX_PERIOD_IN_MS);
+  takeoff();
+  run(HOST_TEST_CONVERGE_TIME + 1000);
+  int failed = !checkCommand(2, SECOND_STAGE);
+
+  nodeStart(0, 0, 0);
+  run(TX_PERIOD_IN_MS);
+  takeoff();
+  run(HOST_TEST_CONVERGE_TIME / 2);
+  failed += !checkCommand(2, FIRST_STAGE);
+  run(HOST_TEST_CONVERGE_TIME);
+  failed += !checkCommand(2, SECOND_STAGE);
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  nodeCount = argc > 1 ? atoi(argv[1]) : 5;
+  uint32_t duration = (argc > 2 ? atoi(argv[2]) : 20) * 1000;
+  if (nodeCount < 2 || nodeCount > HOST_TEST_NODE_MAX)
+  {
+    fprintf(stderr, "nodes must be within 2..%d\n", HOST_TEST_NODE_MAX);
+    return 2;
+  }
+  srand(1);
+  double radius = HOST_TEST_SPACING * (nodeCount - 1) / (2 * M_PI);
+  for (int i = 0; i < nodeCount; i++)
+  {
+    double angle = 2 * M_PI * i / (nodeCount - 1);
+    nodeStart(i, i == 0 ? 0 : radius * cos(angle) + HOST_TEST_SPACING, i == 0 ? 0 : radius * sin(angle));
+  }
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  recording = true;
+#endif
+  run(duration);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  recording = false;
+#endif
+
+  /* The leader ranges with every follower, followers only with the leader. */
+  int failed = 0;
+  for (int i = 1; i < nodeCount; i++)
+  {
+    failed += !checkDistance(0, i);
+    failed += !checkDistance(i, 0);
+  }
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  failed += checkReplay();
+#endif
+  int nodesRanged = nodeCount;
+  failed += checkLeaderRestart();
+  printf("{\"nodes\":%d,\"seconds\":%u,\"failed\":%d}\n", nodesRanged, duration / 1000, failed);
+  return failed ? 1 : 0;
+}
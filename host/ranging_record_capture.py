@@ -0,0 +1,76 @@
+import argparse
+import sys
+import threading
+import time
+
+import cflib.crtp
+from cflib.crazyflie import Crazyflie
+from cflib.crazyflie.syncCrazyflie import SyncCrazyflie
+
+'''
+Capture the ranging records a drone streams over the app channel (firmware built with RANGING_EVENT_RECORD_ENABLE)
+into a file that host/ranging_replay.c replays:
+  python3 host/ranging_record_capture.py --uri radio://0/80/2M/E7E7E7E703 --seconds 60 flight.rec
+  ./ranging_replay --address 3 flight.rec
+
+Every packet is a sequence number followed by the next bytes of the record stream. A missing sequence number means
+records were lost on the link and the replay is only valid up to there, the capture reports the byte offset of the
+first gap. Ranging.recordLost in the log reports records the drone itself could not keep.
+
+The drone must not run another app channel client at the same time.
+'''
+
+
+class RecordCapture:
+    def __init__(self, output):
+        self.output = output
+        self.lock = threading.Lock()
+        self.expected = None
+        self.packets = 0
+        self.bytes = 0
+        self.gaps = 0
+        self.first_gap = None
+
+    def packet_received(self, data):
+        if not data:
+            return
+        with self.lock:
+            seq_num = data[0]
+            if self.expected is not None and seq_num != self.expected:
+                self.gaps += 1
+                if self.first_gap is None:
+                    self.first_gap = self.bytes
+            self.expected = (seq_num + 1) % 256
+            self.output.write(data[1:])
+            self.packets += 1
+            self.bytes += len(data) - 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Capture the ranging records streamed over the app channel')
+    parser.add_argument('--uri', default='radio://0/80/2M/E7E7E7E7E7')
+    parser.add_argument('--seconds', type=float, default=0, help='stop after this long, 0 to run until Ctrl-C')
+    parser.add_argument('output', help='file the record stream is written to')
+    args = parser.parse_args()
+
+    cflib.crtp.init_drivers()
+    with open(args.output, 'wb') as output:
+        capture = RecordCapture(output)
+        with SyncCrazyflie(args.uri, cf=Crazyflie(rw_cache='./cache')) as scf:
+            scf.cf.appchannel.packet_received.add_callback(capture.packet_received)
+            start = time.time()
+            try:
+                while not args.seconds or time.time() - start < args.seconds:
+                    time.sleep(1)
+                    print('%d packets, %d bytes, %d gaps' % (capture.packets, capture.bytes, capture.gaps),
+                          file=sys.stderr)
+            except KeyboardInterrupt:
+                pass
+            scf.cf.appchannel.packet_received.remove_callback(capture.packet_received)
+    if capture.gaps:
+        print('stream has %d gaps, replay is valid up to byte %d' % (capture.gaps, capture.first_gap), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
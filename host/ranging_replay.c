@@ -0,0 +1,166 @@
+/* Replays the records of one drone, as captured by host/ranging_record_capture.py, through a fresh ranging instance
+ * and prints the distances it ends up with, so that a flight can be stepped through and debugged on the host.
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu11 -O2 -DRANGING_EVENT_RECORD_ENABLE -Ihost/shim -I. host/ranging_replay.c host/shim/host_rtos.c \
+ *       swarm_ranging.c swarm_localization.c -lm -o ranging_replay && ./ranging_replay --address 3 flight.rec
+ *
+ * The build must have the same Function Switch flags as the firmware that recorded, --address is the UWB address of
+ * the drone. The instance sees every record at its recorded tick, timers only fire where a TIMER record says so.
+ * With --trace every change of a published distance is printed as it happens.
+ *
+ * Prints one JSON object per neighbor ("type":"neighbor") and a summary ("type":"summary"). Exits 1 if the stream
+ * ends inside a record, the records up to there are still replayed, or if a record had a length that does not fit
+ * its type ("rejected"), such a record is skipped.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+#include "swarm_ranging.h"
+
+#define REPLAY_RECORD_TYPE_COUNT (RANGING_RECORD_COMMAND + 1)
+
+static const char *RECORD_TYPE_NAMES[REPLAY_RECORD_TYPE_COUNT] = {
+    [RANGING_RECORD_CONFIG] = "config",
+    [RANGING_RECORD_RX] = "rx",
+    [RANGING_RECORD_TX] = "tx",
+    [RANGING_RECORD_TX_TIMESTAMP] = "txTimestamp",
+    [RANGING_RECORD_TIMER] = "timer",
+    [RANGING_RECORD_KEEP_FLYING] = "keepFlying",
+    [RANGING_RECORD_RX_QUEUE_DROP] = "rxQueueDrop",
+    [RANGING_RECORD_COMMAND] = "command",
+};
+
+static uint8_t *readFile(const char *path, long *size)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = malloc(*size ? *size : 1);
+  if (fread(data, 1, *size, file) != (size_t)*size)
+  {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s --address N [--trace] FILE\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  int address = -1;
+  bool trace = false;
+  static struct option options[] = {
+      {"address", required_argument, NULL, 'a'},
+      {"trace", no_argument, NULL, 't'},
+      {NULL, 0, NULL, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'a':
+      address = atoi(optarg);
+      break;
+    case 't':
+      trace = true;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (address < 0 || address > NEIGHBOR_ADDRESS_MAX || optind != argc - 1)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  long size;
+  uint8_t *stream = readFile(argv[optind], &size);
+  if (!stream)
+  {
+    fprintf(stderr, "cannot read %s\n", argv[optind]);
+    return 2;
+  }
+
+  Ranging_Record_Header_t header;
+  Host_Node_t node;
+  hostNodeInit(&node, size >= (long)sizeof(header) ? ((Ranging_Record_Header_t *)stream)->tick : 0);
+  hostNodeEnter(&node);
+  Ranging_Context_t *ctx = malloc(rangingContextSize());
+  rangingContextSetup(ctx, address);
+
+  int16_t distances[NEIGHBOR_ADDRESS_MAX + 1];
+  for (int neighbor = 0; neighbor <= NEIGHBOR_ADDRESS_MAX; neighbor++)
+  {
+    distances[neighbor] = distanceGet(ctx, neighbor);
+  }
+  uint32_t counts[REPLAY_RECORD_TYPE_COUNT] = {0};
+  uint32_t records = 0;
+  uint32_t rejected = 0;
+  Time_t firstTick = node.tick;
+  long offset = 0;
+  while (offset + (long)sizeof(header) <= size)
+  {
+    memcpy(&header, stream + offset, sizeof(header));
+    if (offset + (long)sizeof(header) + header.length > size)
+    {
+      break;
+    }
+    node.tick = header.tick;
+    if (!rangingReplayRecord(ctx, &header, stream + offset + sizeof(header)))
+    {
+      rejected++;
+    }
+    offset += sizeof(header) + header.length;
+    records++;
+    if (header.type < REPLAY_RECORD_TYPE_COUNT)
+    {
+      counts[header.type]++;
+    }
+    for (int neighbor = 0; neighbor <= NEIGHBOR_ADDRESS_MAX; neighbor++)
+    {
+      int16_t distance = distanceGet(ctx, neighbor);
+      if (distance != distances[neighbor] && trace)
+      {
+        printf("{\"type\":\"distance\",\"tick\":%u,\"neighbor\":%d,\"distance\":%d}\n", header.tick, neighbor,
+               distance);
+      }
+      distances[neighbor] = distance;
+    }
+  }
+
+  for (int neighbor = 0; neighbor <= NEIGHBOR_ADDRESS_MAX; neighbor++)
+  {
+    if (distances[neighbor] >= 0)
+    {
+      printf("{\"type\":\"neighbor\",\"neighbor\":%d,\"distance\":%d,\"raw\":%d}\n", neighbor, distances[neighbor],
+             rawDistanceGet(ctx, neighbor));
+    }
+  }
+  printf("{\"type\":\"summary\",\"address\":%d,\"records\":%u,\"rejected\":%u,\"bytes\":%ld,\"trailingBytes\":%ld,"
+         "\"seconds\":%.3f",
+         address, records, rejected, offset, size - offset, T2M(node.tick - firstTick) / 1000.0);
+  for (int type = 0; type < REPLAY_RECORD_TYPE_COUNT; type++)
+  {
+    printf(",\"%s\":%u", RECORD_TYPE_NAMES[type], counts[type]);
+  }
+  printf("}\n");
+  free(stream);
+  return offset == size && !rejected ? 0 : 1;
+}
@@ -0,0 +1,994 @@
+/* Parallel discrete event simulation of a swarm running the ranging core, for swarms larger than the flight hall.
+ *
+ * Build and run from the repository root:
+ *   gcc -std=gnu11 -O2 -pthread -Ihost/shim -I. host/ranging_sim.c host/shim/host_rtos.c swarm_ranging.c \
+ *       swarm_localization.c -lm -o ranging_sim && ./ranging_sim --nodes 200 --threads 16 --seconds 10
+ *
+ * Every drone is one instance of the core (rangingContextSetup) driven through the same radio paths and task steps
+ * as on the deck: the tx task is the state machine of uwbRangingTxTask (leader every RANGING_PERIOD, followers in
+ * their slot after a leader frame or on their own after TX_PERIOD_IN_MS), timers fire at their local ticks, frames
+ * are handed over with rangingRadioRx and processed with rangingRxTaskStep, and an estimator reads the neighbor
+ * snapshot every SIM_SAMPLE_PERIOD ms. Each drone has its own tick offset and phase and its own DW1000 clock with
+ * an offset and a skew.
+ *
+ * Medium: a frame is on air for the DW1000 airtime of its length (6.8 Mbps, 128 symbol preamble), reaches the drones
+ * within --range, and is received if the receiver was not transmitting meanwhile (half duplex), its power (1 / d^2)
+ * is SIM_CAPTURE_RATIO above the sum of all overlapping frames (capture effect, so hidden terminals only hurt where
+ * they overlap), and it survives the injected --loss. Channels: a frame goes out on the channel group the sender is
+ * tuned to, only frames of that group interfere with it, and it only reaches drones tuned to that group for all of
+ * its airtime. Without ENABLE_CHANNEL_HOPPING everyone stays on group 0; build with -DENABLE_CHANNEL_HOPPING to get
+ * the clustering of the core switching the simulated radio through its switch hook, and a "channels" line at the end.
+ *
+ * Scenarios: drones hover where they were placed, or with --speed fly straight at that speed in a random direction
+ * and bounce off the sides of the area (positions are a function of time only, so every thread sees the same), and
+ * with --leader-loss the leader goes silent and deaf at that time. Distances are checked against the truth at the
+ * time they were measured.
+ *
+ * Synchronization is conservative with windows of one lookahead L = the airtime of the shortest frame the core
+ * sends. Drones are split over the threads, each thread runs the events of its drones within the window, then the
+ * frames started in the window are published at a barrier. A reception is resolved L after the end of the frame
+ * (one rx latency), when every frame that could overlap it has been published, so results do not depend on the
+ * number of threads. Empty stretches are skipped by starting the next window at the earliest pending event.
+ *
+ * Prints one JSON object per --report interval ("type":"progress") and one summary ("type":"summary"), then with
+ * --links one object per directed link that received anything ("type":"link"). ranging_bench.py runs the presets.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+#include "usec_time.h"
+#include "swarm_ranging.h"
+
+#define SIM_NS_PER_MS 1000000ULL
+#define SIM_NS_PER_S 1000000000ULL
+#define SIM_NODE_MAX 1024
+#define SIM_THREAD_MAX 64
+#define SIM_CM_PER_NS 29.9792458     // speed of light
+#define SIM_PREAMBLE_NS 138397       // 128 + 8 SFD symbols of 1017.63 ns, ends at the RMARKER
+#define SIM_PHR_NS 21538             // 21 bits at 850 kbps
+#define SIM_BIT_NS 128.21            // 6.8 Mbps
+#define SIM_CRC_BYTES 2
+#define SIM_TX_SETUP_NS 50000        // from the tx task to the first symbol on air
+#define SIM_CAPTURE_RATIO 4.0        // 6 dB
+#define SIM_DISTANCE_MIN 50.0        // cm, below this the power no longer grows
+#define SIM_SAMPLE_PERIOD 10         // ms, estimator reading the neighbor snapshot
+#define SIM_LATENCY_BIN_COUNT 1024   // 1 ms bins, the last one holds everything older
+#define SIM_SKEW_PPM 20
+#define SIM_LINK_LATENCY_BIN_COUNT 256 // 1 ms bins of the per-link histogram
+#define SIM_CHANNEL_HISTORY 4 // switches kept per drone, more than can happen within one reception delay
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef enum
+{
+  SIM_EVENT_TIMER,
+  SIM_EVENT_TX_START,
+  SIM_EVENT_TX_END,
+  SIM_EVENT_TX_TIMEOUT,
+  SIM_EVENT_RX,
+  SIM_EVENT_SAMPLE,
+} SIM_EVENT_TYPE;
+
+typedef enum
+{
+  SIM_TX_WAIT,    // follower waits for a leader frame
+  SIM_TX_DELAY,   // waits for its slot or the next period
+  SIM_TX_SENDING, // frame on air
+} SIM_TX_STATE;
+
+typedef struct
+{
+  uint64_t time; // ns
+  uint16_t node;
+  uint8_t type;  // SIM_EVENT_TYPE
+  uint32_t seq;  // per node, orders events of a node at the same time
+  uint32_t arg;  // frame id of SIM_EVENT_RX, generation of SIM_EVENT_TX_TIMEOUT
+} Sim_Event_t;
+
+typedef struct
+{
+  Sim_Event_t *events;
+  uint32_t size;
+  uint32_t capacity;
+} Sim_Event_Heap_t;
+
+typedef struct
+{
+  uint32_t id;
+  uint16_t sender;
+  uint64_t start; // ns, first symbol on air
+  uint64_t end;   // ns
+  double x, y;    // cm, sender at start
+  uint8_t channel;
+  UWB_Packet_t packet;
+} Sim_Frame_t;
+
+typedef struct
+{
+  uint32_t tx;
+  uint32_t rx;
+  uint32_t collisions;
+  uint32_t halfDuplex;
+  uint32_t injectedLoss;
+  uint32_t offChannel; // frames in range sent on a group the receiver was not tuned to
+  uint32_t updates;
+  double errorSquareSum; // cm^2, of consumed distances against the truth at measurement time
+  uint32_t latency[SIM_LATENCY_BIN_COUNT]; // age of consumed distances
+  uint64_t txUs; // wall time in rangingRadioTxBuild
+  uint64_t rxUs; // wall time in rangingRadioRx and rangingRxTaskStep
+} Sim_Stats_t;
+
+/* What a node got from one neighbor, indexed by the neighbor address. */
+typedef struct
+{
+  uint32_t rx;
+  uint32_t updates;
+  double errorSquareSum; // cm^2
+  uint32_t latency[SIM_LINK_LATENCY_BIN_COUNT];
+} Sim_Link_t;
+
+typedef struct
+{
+  Host_Node_t host;
+  Ranging_Context_t *ctx;
+  uint16_t address;
+  double x0, y0, z; // cm, position at time 0
+  double vx, vy;    // cm/s
+  TickType_t tickOffset;
+  uint64_t tickPhase; // ns, ticks change at tickPhase + k ms
+  uint64_t dwOffset;
+  double dwSkew;
+  uint64_t random;
+  SIM_TX_STATE txState;
+  uint32_t txGeneration;
+  UWB_Packet_t txPacket;
+  uint32_t eventSeq;
+  uint32_t snapshotVersion;
+  uint64_t now; // ns, time of the event being handled
+  uint8_t channel[SIM_CHANNEL_HISTORY]; // ring of the last switches, channelSince[i] is when channel[i] began
+  uint64_t channelSince[SIM_CHANNEL_HISTORY];
+  uint8_t channelIndex; // newest entry
+  Sim_Stats_t stats;
+  Sim_Link_t *links; // sim.nodeCount entries with --links, NULL otherwise
+} Sim_Node_t;
+
+typedef struct
+{
+  int index;
+  pthread_t handle;
+  Sim_Event_Heap_t heap;
+  Sim_Frame_t *outbox;
+  uint32_t outboxSize;
+  uint32_t outboxCapacity;
+  uint64_t nextEventTime;
+} Sim_Thread_t;
+
+typedef struct
+{
+  /* Configuration */
+  int nodeCount;
+  int threadCount;
+  uint64_t seed;
+  uint64_t endTime;      // ns
+  uint64_t reportPeriod; // ns, 0 for the summary only
+  double area;           // cm, side of the square the drones are placed in
+  double range;          // cm
+  double lossPercent;
+  double speed;            // cm/s
+  uint64_t leaderLossTime; // ns, UINT64_MAX for never
+  bool links;
+  /* Derived */
+  uint64_t lookahead; // ns, airtime of the shortest frame
+  uint64_t airtimeMax;
+  /* State */
+  Sim_Node_t *nodes;
+  Sim_Thread_t threads[SIM_THREAD_MAX];
+  pthread_barrier_t barrier;
+  uint64_t windowStart;
+  bool done;
+  Sim_Frame_t *frames; // published frames sorted by start, frames[i].id == frameBase + i
+  uint32_t frameBase;
+  uint32_t frameCount;
+  uint32_t frameCapacity;
+  uint32_t frameFirstNew; // index of the first frame published at the last barrier
+  uint32_t windows;
+  uint64_t nextReport;
+  Sim_Stats_t lastReport;
+  struct timespec wallStart;
+} Sim_t;
+
+static Sim_t sim;
+
+static double wallSeconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - sim.wallStart.tv_sec) + (now.tv_nsec - sim.wallStart.tv_nsec) * 1e-9;
+}
+
+/* DW1000 airtime of a frame of length bytes, Reed-Solomon adds 48 bits to every 330. */
+static uint64_t simAirtime(uint32_t length)
+{
+  uint32_t bits = (length + SIM_CRC_BYTES) * 8;
+  return SIM_PREAMBLE_NS + SIM_PHR_NS + (uint64_t)((bits + (bits + 329) / 330 * 48) * SIM_BIT_NS);
+}
+
+static void heapPush(Sim_Event_Heap_t *heap, Sim_Event_t event)
+{
+  if (heap->size == heap->capacity)
+  {
+    heap->capacity = heap->capacity ? heap->capacity * 2 : 1024;
+    heap->events = realloc(heap->events, heap->capacity * sizeof(Sim_Event_t));
+  }
+  uint32_t i = heap->size++;
+  while (i > 0)
+  {
+    uint32_t parent = (i - 1) / 2;
+    Sim_Event_t *p = &heap->events[parent];
+    if (p->time < event.time || (p->time == event.time && (p->node < event.node ||
+                                                           (p->node == event.node && p->seq < event.seq))))
+    {
+      break;
+    }
+    heap->events[i] = *p;
+    i = parent;
+  }
+  heap->events[i] = event;
+}
+
+static bool eventBefore(Sim_Event_t *a, Sim_Event_t *b)
+{
+  return a->time < b->time || (a->time == b->time && (a->node < b->node || (a->node == b->node && a->seq < b->seq)));
+}
+
+static Sim_Event_t heapPop(Sim_Event_Heap_t *heap)
+{
+  Sim_Event_t top = heap->events[0];
+  Sim_Event_t last = heap->events[--heap->size];
+  uint32_t i = 0;
+  while (true)
+  {
+    uint32_t child = 2 * i + 1;
+    if (child >= heap->size)
+    {
+      break;
+    }
+    if (child + 1 < heap->size && eventBefore(&heap->events[child + 1], &heap->events[child]))
+    {
+      child++;
+    }
+    if (!eventBefore(&heap->events[child], &last))
+    {
+      break;
+    }
+    heap->events[i] = heap->events[child];
+    i = child;
+  }
+  if (heap->size > 0)
+  {
+    heap->events[i] = last;
+  }
+  return top;
+}
+
+static Sim_Thread_t *simThreadOf(uint16_t node)
+{
+  return &sim.threads[node % sim.threadCount];
+}
+
+static void simSchedule(Sim_Node_t *node, uint64_t time, SIM_EVENT_TYPE type, uint32_t arg)
+{
+  Sim_Event_t event = {.time = time, .node = node->address, .type = type, .seq = node->eventSeq++, .arg = arg};
+  heapPush(&simThreadOf(node->address)->heap, event);
+}
+
+/* Local tick of the node at a simulation time, and the time its tick becomes tick. */
+static TickType_t simTickAt(Sim_Node_t *node, uint64_t time)
+{
+  return node->tickOffset + (TickType_t)((time + SIM_NS_PER_MS - node->tickPhase) / SIM_NS_PER_MS);
+}
+
+static uint64_t simTickStart(Sim_Node_t *node, TickType_t tick)
+{
+  return node->tickPhase + (uint64_t)(tick - node->tickOffset - 1) * SIM_NS_PER_MS;
+}
+
+/* Time a task of the node wakes up after vTaskDelay(ticks) at time. */
+static uint64_t simDelay(Sim_Node_t *node, uint64_t time, TickType_t ticks)
+{
+  return simTickStart(node, simTickAt(node, time) + MAX(ticks, 1));
+}
+
+/* DW1000 clock of the node at time + offset ns, the offset keeps the time of flight below one ns. */
+static dwTime_t simDwTime(Sim_Node_t *node, uint64_t time, double offset)
+{
+  dwTime_t dwTime = {.full = 0};
+  double units = (time + offset) * (UWB_TIME_UNITS_PER_MS / 1e6) * (1 + node->dwSkew);
+  dwTime.full = (node->dwOffset + (uint64_t)llround(units)) % UWB_MAX_TIMESTAMP;
+  return dwTime;
+}
+
+/* Fold a coordinate moving on a line back into [0, area], as a bounce off the sides. */
+static double simBounce(double position)
+{
+  double folded = fmod(position, 2 * sim.area);
+  folded = folded < 0 ? folded + 2 * sim.area : folded;
+  return folded > sim.area ? 2 * sim.area - folded : folded;
+}
+
+static void simPosition(Sim_Node_t *node, uint64_t time, double *x, double *y)
+{
+  double seconds = time / 1e9;
+  *x = simBounce(node->x0 + node->vx * seconds);
+  *y = simBounce(node->y0 + node->vy * seconds);
+}
+
+static double simDistance(Sim_Node_t *node, uint64_t time, double x, double y)
+{
+  double nodeX, nodeY;
+  simPosition(node, time, &nodeX, &nodeY);
+  return hypot(nodeX - x, nodeY - y);
+}
+
+static bool simNodeOff(Sim_Node_t *node, uint64_t time)
+{
+  return node->address == 0 && time >= sim.leaderLossTime;
+}
+
+static uint8_t simChannelAt(Sim_Node_t *node, uint64_t time)
+{
+  for (int i = 0; i < SIM_CHANNEL_HISTORY; i++)
+  {
+    int index = (node->channelIndex + SIM_CHANNEL_HISTORY - i) % SIM_CHANNEL_HISTORY;
+    if (node->channelSince[index] <= time)
+    {
+      return node->channel[index];
+    }
+  }
+  return node->channel[(node->channelIndex + 1) % SIM_CHANNEL_HISTORY];
+}
+
+#ifdef ENABLE_CHANNEL_HOPPING
+/* Switch hook of the core, the node is the current one and tunes at the time of its event. */
+static void simChannelSwitch(uint8_t channelGroup)
+{
+  Sim_Node_t *node = (Sim_Node_t *)hostNodeCurrent();
+  node->channelIndex = (node->channelIndex + 1) % SIM_CHANNEL_HISTORY;
+  node->channel[node->channelIndex] = channelGroup;
+  node->channelSince[node->channelIndex] = node->now;
+}
+#endif
+
+static void simEnter(Sim_Node_t *node, uint64_t time)
+{
+  double x, y;
+  simPosition(node, time, &x, &y);
+  node->now = time;
+  node->host.tick = simTickAt(node, time);
+  node->host.x = x / 100;
+  node->host.y = y / 100;
+  node->host.z = node->z / 100;
+  /* The sign flips at a bounce are not worth modelling for the estimator. */
+  node->host.vx = node->vx / 100;
+  node->host.vy = node->vy / 100;
+  hostNodeEnter(&node->host);
+}
+
+static void simScheduleTimer(Sim_Node_t *node)
+{
+  TickType_t next = hostTimersNext(&node->host);
+  if (next != portMAX_DELAY)
+  {
+    simSchedule(node, simTickStart(node, next), SIM_EVENT_TIMER, 0);
+  }
+}
+
+/* Follower back in xSemaphoreTake of the tx task: take a pending leader frame or wait for one up to the timeout. */
+static void simTxWait(Sim_Node_t *node, uint64_t time)
+{
+  node->txGeneration++;
+  if (rangingTxSlotWait(node->ctx, 0))
+  {
+    node->txState = SIM_TX_DELAY;
+    simSchedule(node, simDelay(node, time, rangingTxSlotDelay(node->ctx)), SIM_EVENT_TX_START, 0);
+  }
+  else
+  {
+    node->txState = SIM_TX_WAIT;
+    simSchedule(node, simDelay(node, time, rangingTxSlotTimeout(node->ctx)), SIM_EVENT_TX_TIMEOUT, node->txGeneration);
+  }
+}
+
+static void simTxStart(Sim_Thread_t *thread, Sim_Node_t *node, uint64_t time)
+{
+  if (simNodeOff(node, time))
+  {
+    node->txState = SIM_TX_DELAY;
+    return;
+  }
+  uint64_t start = usecTimestamp();
+  rangingRadioTxBuild(node->ctx, &node->txPacket);
+  node->stats.txUs += usecTimestamp() - start;
+  node->stats.tx++;
+  node->txState = SIM_TX_SENDING;
+
+  if (thread->outboxSize == thread->outboxCapacity)
+  {
+    thread->outboxCapacity = thread->outboxCapacity ? thread->outboxCapacity * 2 : 64;
+    thread->outbox = realloc(thread->outbox, thread->outboxCapacity * sizeof(Sim_Frame_t));
+  }
+  Sim_Frame_t *frame = &thread->outbox[thread->outboxSize++];
+  frame->sender = node->address;
+  frame->start = time + SIM_TX_SETUP_NS;
+  frame->end = frame->start + simAirtime(node->txPacket.header.length);
+  simPosition(node, frame->start, &frame->x, &frame->y);
+  frame->channel = simChannelAt(node, time);
+  memcpy(&frame->packet, &node->txPacket, node->txPacket.header.length);
+  simSchedule(node, frame->end, SIM_EVENT_TX_END, 0);
+}
+
+static void simTxEnd(Sim_Node_t *node, uint64_t time)
+{
+  uint64_t rmarker = time - simAirtime(node->txPacket.header.length) + SIM_PREAMBLE_NS;
+  rangingRadioTxDone(node->ctx, &node->txPacket, simDwTime(node, rmarker, 0));
+  if (node->address == 0)
+  {
+    node->txState = SIM_TX_DELAY;
+    simSchedule(node, simDelay(node, time, M2T(RANGING_PERIOD)), SIM_EVENT_TX_START, 0);
+  }
+  else
+  {
+    simTxWait(node, time);
+  }
+}
+
+static Sim_Frame_t *simFrame(uint32_t id)
+{
+  return &sim.frames[id - sim.frameBase];
+}
+
+/* Resolve the reception of a frame at a node, every frame overlapping it has been published. */
+static void simRx(Sim_Node_t *node, uint32_t frameId, uint64_t time)
+{
+  if (simNodeOff(node, time))
+  {
+    return;
+  }
+  Sim_Frame_t *frame = simFrame(frameId);
+  if (simChannelAt(node, frame->start) != frame->channel || simChannelAt(node, frame->end) != frame->channel)
+  {
+    node->stats.offChannel++;
+    return;
+  }
+  double distance = simDistance(node, frame->start, frame->x, frame->y);
+  double signal = 1 / pow(MAX(distance, SIM_DISTANCE_MIN), 2);
+  double interference = 0;
+  /* Frames are sorted by start, walk back from the last one starting before the end of this frame. */
+  uint32_t low = 0, high = sim.frameCount;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (sim.frames[mid].start < frame->end)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  for (int i = (int)low - 1; i >= 0 && sim.frames[i].start + sim.airtimeMax > frame->start; i--)
+  {
+    Sim_Frame_t *other = &sim.frames[i];
+    if (other == frame || other->end <= frame->start)
+    {
+      continue;
+    }
+    if (other->sender == node->address)
+    {
+      node->stats.halfDuplex++;
+      return;
+    }
+    if (other->channel != frame->channel)
+    {
+      continue;
+    }
+    interference += 1 / pow(MAX(simDistance(node, other->start, other->x, other->y), SIM_DISTANCE_MIN), 2);
+  }
+  if (signal < SIM_CAPTURE_RATIO * interference)
+  {
+    node->stats.collisions++;
+    return;
+  }
+  if (hostRandomUniform(&node->random) * 100 < sim.lossPercent)
+  {
+    node->stats.injectedLoss++;
+    return;
+  }
+  node->stats.rx++;
+  if (node->links)
+  {
+    node->links[frame->sender].rx++;
+  }
+
+  dwTime_t rxTime = simDwTime(node, frame->start + SIM_PREAMBLE_NS, distance / SIM_CM_PER_NS);
+  uint64_t start = usecTimestamp();
+  rangingRadioRx(node->ctx, &frame->packet, rxTime, simTickAt(node, frame->end));
+  while (rangingRxTaskStep(node->ctx, 0))
+  {
+  }
+  node->stats.rxUs += usecTimestamp() - start;
+  if (node->address != 0 && node->txState == SIM_TX_WAIT)
+  {
+    simTxWait(node, time);
+  }
+}
+
+/* Estimator reading the snapshot, accounts each distance the first time it is consumed. */
+static void simSample(Sim_Node_t *node, uint64_t time)
+{
+  if (simNodeOff(node, time))
+  {
+    return;
+  }
+  Neighbor_State_Snapshot_t snapshot;
+  if (neighborStateSnapshotGet(node->ctx, &snapshot, node->snapshotVersion))
+  {
+    for (int i = 0; i < snapshot.size; i++)
+    {
+      Neighbor_State_t *neighbor = &snapshot.neighbors[i];
+      if (!neighbor->refresh || neighbor->address >= sim.nodeCount)
+      {
+        continue;
+      }
+      uint32_t age = T2M(node->host.tick - neighbor->measurementTime);
+      node->stats.updates++;
+      node->stats.latency[MIN(age, SIM_LATENCY_BIN_COUNT - 1)]++;
+      uint64_t measured = time > age * SIM_NS_PER_MS ? time - age * SIM_NS_PER_MS : 0;
+      double otherX, otherY;
+      simPosition(&sim.nodes[neighbor->address], measured, &otherX, &otherY);
+      double error = neighbor->distance - simDistance(node, measured, otherX, otherY);
+      node->stats.errorSquareSum += error * error;
+      if (node->links)
+      {
+        Sim_Link_t *link = &node->links[neighbor->address];
+        link->updates++;
+        link->errorSquareSum += error * error;
+        link->latency[MIN(age, SIM_LINK_LATENCY_BIN_COUNT - 1)]++;
+      }
+    }
+    node->snapshotVersion = snapshot.version;
+  }
+  simSchedule(node, simDelay(node, time, M2T(SIM_SAMPLE_PERIOD)), SIM_EVENT_SAMPLE, 0);
+}
+
+static void simHandle(Sim_Thread_t *thread, Sim_Event_t *event)
+{
+  Sim_Node_t *node = &sim.nodes[event->node];
+  simEnter(node, event->time);
+  switch (event->type)
+  {
+  case SIM_EVENT_TIMER:
+    hostTimersRun(&node->host);
+    simScheduleTimer(node);
+    break;
+  case SIM_EVENT_TX_START:
+    simTxStart(thread, node, event->time);
+    break;
+  case SIM_EVENT_TX_END:
+    simTxEnd(node, event->time);
+    break;
+  case SIM_EVENT_TX_TIMEOUT:
+    if (node->txState == SIM_TX_WAIT && event->arg == node->txGeneration)
+    {
+      simTxStart(thread, node, event->time);
+    }
+    break;
+  case SIM_EVENT_RX:
+    simRx(node, event->arg, event->time);
+    break;
+  case SIM_EVENT_SAMPLE:
+    simSample(node, event->time);
+    break;
+  }
+}
+
+static int compareFrame(const void *a, const void *b)
+{
+  const Sim_Frame_t *x = a, *y = b;
+  if (x->start != y->start)
+  {
+    return x->start < y->start ? -1 : 1;
+  }
+  return (int)x->sender - (int)y->sender;
+}
+
+static void simStatsAdd(Sim_Stats_t *total, Sim_Stats_t *stats)
+{
+  total->tx += stats->tx;
+  total->rx += stats->rx;
+  total->collisions += stats->collisions;
+  total->halfDuplex += stats->halfDuplex;
+  total->injectedLoss += stats->injectedLoss;
+  total->offChannel += stats->offChannel;
+  total->updates += stats->updates;
+  total->errorSquareSum += stats->errorSquareSum;
+  for (int i = 0; i < SIM_LATENCY_BIN_COUNT; i++)
+  {
+    total->latency[i] += stats->latency[i];
+  }
+  total->txUs += stats->txUs;
+  total->rxUs += stats->rxUs;
+}
+
+static uint32_t latencyPercentile(const uint32_t *latency, uint32_t binCount, uint32_t count, double percent)
+{
+  uint64_t accumulated = 0;
+  for (uint32_t i = 0; i < binCount; i++)
+  {
+    accumulated += latency[i];
+    if (accumulated * 100 >= count * percent && accumulated > 0)
+    {
+      return i;
+    }
+  }
+  return 0;
+}
+
+/* Rates are per second of simulated time over the interval, latency in ms, error in cm. */
+static void simReport(const char *type, Sim_Stats_t *stats, uint64_t time, double seconds)
+{
+  uint32_t attempts = stats->rx + stats->collisions + stats->halfDuplex + stats->injectedLoss;
+  double wall = wallSeconds();
+  printf("{\"type\":\"%s\",\"t\":%.3f,\"nodes\":%d,\"threads\":%d,\"seed\":%llu,\"txPerS\":%.1f,\"rxPerS\":%.1f,"
+         "\"collisionRate\":%.4f,\"halfDuplexRate\":%.4f,\"offChannelPerS\":%.1f,\"updatesPerS\":%.1f,\"latencyP50\":%u,\"latencyP90\":%u,"
+         "\"latencyP99\":%u,\"errorRms\":%.1f,\"txUsPerFrame\":%.2f,\"rxUsPerFrame\":%.2f,\"wallS\":%.3f,"
+         "\"realtime\":%.2f,\"windows\":%u}\n",
+         type, time / 1e9, sim.nodeCount, sim.threadCount, (unsigned long long)sim.seed,
+         stats->tx / seconds, stats->rx / seconds, attempts ? (double)stats->collisions / attempts : 0,
+         attempts ? (double)stats->halfDuplex / attempts : 0, stats->offChannel / seconds, stats->updates / seconds,
+         latencyPercentile(stats->latency, SIM_LATENCY_BIN_COUNT, stats->updates, 50),
+         latencyPercentile(stats->latency, SIM_LATENCY_BIN_COUNT, stats->updates, 90),
+         latencyPercentile(stats->latency, SIM_LATENCY_BIN_COUNT, stats->updates, 99), stats->updates ? sqrt(stats->errorSquareSum / stats->updates) : 0,
+         stats->tx ? (double)stats->txUs / stats->tx : 0, stats->rx ? (double)stats->rxUs / stats->rx : 0, wall,
+         wall > 0 ? time / 1e9 / wall : 0, sim.windows);
+  fflush(stdout);
+}
+
+static void simReportLinks(double seconds)
+{
+  for (int n = 0; n < sim.nodeCount; n++)
+  {
+    for (int m = 0; m < sim.nodeCount; m++)
+    {
+      Sim_Link_t *link = &sim.nodes[n].links[m];
+      if (link->rx == 0 && link->updates == 0)
+      {
+        continue;
+      }
+      printf("{\"type\":\"link\",\"node\":%d,\"neighbor\":%d,\"rxPerS\":%.2f,\"updatesPerS\":%.2f,\"latencyP50\":%u,"
+             "\"latencyP90\":%u,\"latencyP99\":%u,\"errorRms\":%.1f}\n",
+             n, m, link->rx / seconds, link->updates / seconds,
+             latencyPercentile(link->latency, SIM_LINK_LATENCY_BIN_COUNT, link->updates, 50),
+             latencyPercentile(link->latency, SIM_LINK_LATENCY_BIN_COUNT, link->updates, 90),
+             latencyPercentile(link->latency, SIM_LINK_LATENCY_BIN_COUNT, link->updates, 99),
+             link->updates ? sqrt(link->errorSquareSum / link->updates) : 0);
+    }
+  }
+}
+
+#ifdef ENABLE_CHANNEL_HOPPING
+/* Home group of every follower at the end, and how many drones each group has. */
+static void simReportChannels()
+{
+  int count[CHANNEL_GROUP_COUNT] = {0};
+  printf("{\"type\":\"channels\",\"group\":[");
+  for (int n = 0; n < sim.nodeCount; n++)
+  {
+    uint8_t group = channelHoppingGroupGet(sim.nodes[n].ctx);
+    count[group]++;
+    printf(n ? ",%u" : "%u", group);
+  }
+  printf("],\"count\":[");
+  for (int g = 0; g < CHANNEL_GROUP_COUNT; g++)
+  {
+    printf(g ? ",%d" : "%d", count[g]);
+  }
+  printf("]}\n");
+}
+#endif
+
+static void simProgress(uint64_t time)
+{
+  static Sim_Stats_t total;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < sim.nodeCount; i++)
+  {
+    simStatsAdd(&total, &sim.nodes[i].stats);
+  }
+  Sim_Stats_t delta = total;
+  delta.tx -= sim.lastReport.tx;
+  delta.rx -= sim.lastReport.rx;
+  delta.collisions -= sim.lastReport.collisions;
+  delta.halfDuplex -= sim.lastReport.halfDuplex;
+  delta.injectedLoss -= sim.lastReport.injectedLoss;
+  delta.offChannel -= sim.lastReport.offChannel;
+  delta.updates -= sim.lastReport.updates;
+  delta.errorSquareSum -= sim.lastReport.errorSquareSum;
+  for (int i = 0; i < SIM_LATENCY_BIN_COUNT; i++)
+  {
+    delta.latency[i] -= sim.lastReport.latency[i];
+  }
+  delta.txUs -= sim.lastReport.txUs;
+  delta.rxUs -= sim.lastReport.rxUs;
+  simReport("progress", &delta, time, sim.reportPeriod / 1e9);
+  sim.lastReport = total;
+}
+
+/* Run by the first thread between the two barriers of a window: publish the frames of all threads and pick the
+ * next window.
+ */
+static void simPublish(uint64_t windowEnd)
+{
+  /* Drop frames that can no longer overlap a frame whose reception is pending. */
+  uint64_t horizon = sim.windowStart > sim.lookahead + 2 * sim.airtimeMax ?
+                     sim.windowStart - sim.lookahead - 2 * sim.airtimeMax : 0;
+  uint32_t drop = 0;
+  while (drop < sim.frameCount && sim.frames[drop].end < horizon)
+  {
+    drop++;
+  }
+  if (drop > 0)
+  {
+    memmove(sim.frames, sim.frames + drop, (sim.frameCount - drop) * sizeof(Sim_Frame_t));
+    sim.frameCount -= drop;
+    sim.frameBase += drop;
+  }
+
+  sim.frameFirstNew = sim.frameCount;
+  uint64_t next = UINT64_MAX;
+  for (int t = 0; t < sim.threadCount; t++)
+  {
+    Sim_Thread_t *thread = &sim.threads[t];
+    if (sim.frameCount + thread->outboxSize > sim.frameCapacity)
+    {
+      sim.frameCapacity = MAX(sim.frameCapacity * 2, sim.frameCount + thread->outboxSize);
+      sim.frames = realloc(sim.frames, sim.frameCapacity * sizeof(Sim_Frame_t));
+    }
+    memcpy(sim.frames + sim.frameCount, thread->outbox, thread->outboxSize * sizeof(Sim_Frame_t));
+    sim.frameCount += thread->outboxSize;
+    thread->outboxSize = 0;
+    next = MIN(next, thread->nextEventTime);
+  }
+  /* Frames started in one window all start after those of earlier windows, sorting the new ones is enough. */
+  qsort(sim.frames + sim.frameFirstNew, sim.frameCount - sim.frameFirstNew, sizeof(Sim_Frame_t), compareFrame);
+  for (uint32_t i = sim.frameFirstNew; i < sim.frameCount; i++)
+  {
+    sim.frames[i].id = sim.frameBase + i;
+    next = MIN(next, sim.frames[i].end + sim.lookahead);
+  }
+
+  sim.windows++;
+  sim.windowStart = MAX(windowEnd, next);
+  /* Everything before windowStart has run, progress overshoots the interval by less than one lookahead. */
+  while (sim.reportPeriod && sim.nextReport <= MIN(sim.windowStart, sim.endTime))
+  {
+    simProgress(sim.nextReport);
+    sim.nextReport += sim.reportPeriod;
+  }
+  sim.done = sim.windowStart >= sim.endTime;
+}
+
+/* Every node of the thread in range of a new frame resolves its reception one lookahead after the frame ends. */
+static void simScheduleReceptions(Sim_Thread_t *thread)
+{
+  for (uint32_t i = sim.frameFirstNew; i < sim.frameCount; i++)
+  {
+    Sim_Frame_t *frame = &sim.frames[i];
+    for (int n = thread->index; n < sim.nodeCount; n += sim.threadCount)
+    {
+      Sim_Node_t *node = &sim.nodes[n];
+      if (n != frame->sender && simDistance(node, frame->start, frame->x, frame->y) <= sim.range)
+      {
+        simSchedule(node, frame->end + sim.lookahead, SIM_EVENT_RX, frame->id);
+      }
+    }
+  }
+}
+
+static void *simThreadRun(void *parameter)
+{
+  Sim_Thread_t *thread = parameter;
+  while (true)
+  {
+    uint64_t windowEnd = MIN(sim.windowStart + sim.lookahead, sim.endTime);
+    while (thread->heap.size > 0 && thread->heap.events[0].time < windowEnd)
+    {
+      Sim_Event_t event = heapPop(&thread->heap);
+      simHandle(thread, &event);
+    }
+    thread->nextEventTime = thread->heap.size > 0 ? thread->heap.events[0].time : UINT64_MAX;
+    pthread_barrier_wait(&sim.barrier);
+    if (thread->index == 0)
+    {
+      simPublish(windowEnd);
+    }
+    pthread_barrier_wait(&sim.barrier);
+    if (sim.done)
+    {
+      return NULL;
+    }
+    simScheduleReceptions(thread);
+  }
+}
+
+static void simNodeInit(Sim_Node_t *node, uint16_t address, uint64_t *random)
+{
+  node->address = address;
+  node->random = sim.seed ^ (0xD1B54A32D192ED03ULL * (address + 1));
+  node->x0 = hostRandomUniform(random) * sim.area;
+  node->y0 = hostRandomUniform(random) * sim.area;
+  node->z = 100;
+  double heading = hostRandomUniform(random) * 2 * M_PI;
+  node->vx = sim.speed * cos(heading);
+  node->vy = sim.speed * sin(heading);
+  node->tickOffset = hostRandomNext(random) % 100000;
+  node->tickPhase = hostRandomNext(random) % SIM_NS_PER_MS;
+  node->dwOffset = hostRandomNext(random) % UWB_MAX_TIMESTAMP;
+  node->dwSkew = (hostRandomUniform(random) * 2 - 1) * SIM_SKEW_PPM * 1e-6;
+  node->links = sim.links ? calloc(sim.nodeCount, sizeof(Sim_Link_t)) : NULL;
+
+  hostNodeInit(&node->host, simTickAt(node, 0));
+  simEnter(node, 0);
+  node->ctx = malloc(rangingContextSize());
+  rangingContextSetup(node->ctx, address);
+  rangingContextSeed(node->ctx, (uint32_t)hostRandomNext(&node->random));
+#ifdef ENABLE_CHANNEL_HOPPING
+  channelHoppingSetSwitchHook(node->ctx, simChannelSwitch);
+#endif
+
+  /* Drones power up at random within one period. */
+  uint64_t powerUp = (uint64_t)(hostRandomUniform(random) * RANGING_PERIOD * SIM_NS_PER_MS);
+  simScheduleTimer(node);
+  simSchedule(node, powerUp + hostRandomNext(random) % (SIM_SAMPLE_PERIOD * SIM_NS_PER_MS), SIM_EVENT_SAMPLE, 0);
+  node->txState = address == 0 ? SIM_TX_DELAY : SIM_TX_WAIT;
+  if (address == 0)
+  {
+    simSchedule(node, powerUp, SIM_EVENT_TX_START, 0);
+  }
+  else
+  {
+    simSchedule(node, powerUp + M2T(TX_PERIOD_IN_MS) * SIM_NS_PER_MS, SIM_EVENT_TX_TIMEOUT, node->txGeneration);
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [--nodes N] [--threads T] [--seconds S] [--seed X] [--area M] [--range M] "
+                  "[--loss PERCENT] [--speed M/S] [--leader-loss S] [--report S] [--links]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  sim.nodeCount = 200;
+  sim.threadCount = 1;
+  sim.seed = 1;
+  sim.leaderLossTime = UINT64_MAX;
+  double seconds = 10, areaM = 0, rangeM = 30, reportS = 0, speedM = 0, leaderLossS = -1;
+  static struct option options[] = {
+      {"nodes", required_argument, NULL, 'n'},  {"threads", required_argument, NULL, 't'},
+      {"seconds", required_argument, NULL, 's'}, {"seed", required_argument, NULL, 'x'},
+      {"area", required_argument, NULL, 'a'},   {"range", required_argument, NULL, 'r'},
+      {"loss", required_argument, NULL, 'l'},   {"report", required_argument, NULL, 'p'},
+      {"speed", required_argument, NULL, 'v'},  {"leader-loss", required_argument, NULL, 'o'},
+      {"links", no_argument, NULL, 'k'},        {NULL, 0, NULL, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      sim.nodeCount = atoi(optarg);
+      break;
+    case 't':
+      sim.threadCount = atoi(optarg);
+      break;
+    case 's':
+      seconds = atof(optarg);
+      break;
+    case 'x':
+      sim.seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'a':
+      areaM = atof(optarg);
+      break;
+    case 'r':
+      rangeM = atof(optarg);
+      break;
+    case 'l':
+      sim.lossPercent = atof(optarg);
+      break;
+    case 'p':
+      reportS = atof(optarg);
+      break;
+    case 'v':
+      speedM = atof(optarg);
+      break;
+    case 'o':
+      leaderLossS = atof(optarg);
+      break;
+    case 'k':
+      sim.links = true;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (sim.nodeCount < 1 || sim.nodeCount > SIM_NODE_MAX || sim.threadCount < 1 || sim.threadCount > SIM_THREAD_MAX)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  sim.threadCount = MIN(sim.threadCount, sim.nodeCount);
+  sim.endTime = (uint64_t)(seconds * SIM_NS_PER_S);
+  sim.reportPeriod = (uint64_t)(reportS * SIM_NS_PER_S);
+  sim.nextReport = sim.reportPeriod;
+  /* 3 m between drones by default. */
+  sim.area = (areaM > 0 ? areaM : 3 * sqrt(sim.nodeCount)) * 100;
+  sim.range = rangeM * 100;
+  sim.speed = speedM * 100;
+  if (leaderLossS >= 0)
+  {
+    sim.leaderLossTime = (uint64_t)(leaderLossS * SIM_NS_PER_S);
+  }
+  sim.lookahead = simAirtime(sizeof(UWB_Packet_Header_t) + sizeof(Ranging_Message_Header_t));
+  sim.airtimeMax = simAirtime(sizeof(UWB_Packet_t));
+
+  sim.nodes = calloc(sim.nodeCount, sizeof(Sim_Node_t));
+  uint64_t random = sim.seed;
+  for (int i = 0; i < sim.nodeCount; i++)
+  {
+    simNodeInit(&sim.nodes[i], i, &random);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &sim.wallStart);
+  pthread_barrier_init(&sim.barrier, NULL, sim.threadCount);
+  for (int t = 0; t < sim.threadCount; t++)
+  {
+    sim.threads[t].index = t;
+    if (t > 0)
+    {
+      pthread_create(&sim.threads[t].handle, NULL, simThreadRun, &sim.threads[t]);
+    }
+  }
+  simThreadRun(&sim.threads[0]);
+  for (int t = 1; t < sim.threadCount; t++)
+  {
+    pthread_join(sim.threads[t].handle, NULL);
+  }
+
+  static Sim_Stats_t total;
+  for (int i = 0; i < sim.nodeCount; i++)
+  {
+    simStatsAdd(&total, &sim.nodes[i].stats);
+  }
+  simReport("summary", &total, sim.endTime, sim.endTime / 1e9);
+  if (sim.links)
+  {
+    simReportLinks(sim.endTime / 1e9);
+  }
+#ifdef ENABLE_CHANNEL_HOPPING
+  simReportChannels();
+#endif
+  return 0;
+}
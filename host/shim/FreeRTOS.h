@@ -0,0 +1,38 @@
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+/* Host shim of the parts of FreeRTOS the ranging core uses, see host_rtos.h. One tick is one millisecond. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define configTICK_RATE_HZ 1000
+#define M2T(x) ((TickType_t)(x))
+#define T2M(x) ((uint32_t)(x))
+#define NO_DMA_CCM_SAFE_ZERO_INIT
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+#define ASSERT(e)                                                                 \
+  do                                                                              \
+  {                                                                               \
+    if (!(e))                                                                     \
+    {                                                                             \
+      fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #e);   \
+      abort();                                                                    \
+    }                                                                             \
+  } while (0)
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef _HOST_ADHOCDECK_H_
+#define _HOST_ADHOCDECK_H_
+
+/* Host shim of the adhoc deck driver, the packet layout follows the driver so that frame sizes and airtime match
+ * the deck. The radio itself is the driver on the host (ranging_host_test.c, ranging_sim.c).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "dwTypes.h"
+
+typedef uint16_t UWB_Address_t;
+typedef uint16_t address_t;
+typedef uint32_t Time_t;
+
+#define UWB_DEST_EMPTY 65534
+#define UWB_DEST_ANY 65535
+#define UWB_FRAME_LEN_STD 127
+#define UWB_FRAME_LEN_EXT 1023
+#define UWB_FRAME_LEN_MAX UWB_FRAME_LEN_EXT
+#define UWB_MAX_TIMESTAMP 1099511627776 // 2^40
+#define UWB_TASK_STACK_SIZE (2 * configMINIMAL_STACK_SIZE)
+#define configMINIMAL_STACK_SIZE 150
+#define ADHOC_DECK_TASK_PRI 4
+#define ADHOC_DECK_RANGING_TX_TASK_NAME "uwbRangingTxTask"
+#define ADHOC_DECK_RANGING_RX_TASK_NAME "uwbRangingRxTask"
+
+typedef enum
+{
+  UWB_REVERSED_MESSAGE = 0,
+  UWB_RANGING_MESSAGE = 1,
+  UWB_FLOODING_MESSAGE = 2,
+  UWB_DATA_MESSAGE = 3,
+  UWB_MESSAGE_TYPE_COUNT,
+} UWB_MESSAGE_TYPE;
+
+typedef struct
+{
+  UWB_Address_t srcAddress;
+  UWB_Address_t destAddress;
+  uint16_t seqNumber;
+  UWB_MESSAGE_TYPE type : 6;
+  uint16_t length : 10;
+} __attribute__((packed)) UWB_Packet_Header_t;
+
+#define UWB_PAYLOAD_SIZE_MAX (UWB_FRAME_LEN_MAX - sizeof(UWB_Packet_Header_t))
+
+typedef struct
+{
+  UWB_Packet_Header_t header;
+  uint8_t payload[UWB_PAYLOAD_SIZE_MAX];
+} __attribute__((packed)) UWB_Packet_t;
+
+typedef void (*UWBCallback)(void *);
+
+typedef struct
+{
+  UWB_MESSAGE_TYPE type;
+  QueueHandle_t rxQueue;
+  UWBCallback rxCb;
+  UWBCallback txCb;
+} UWB_Message_Listener_t;
+
+/* Deck entry points, not reachable on the host (rangingInit is not called there), these abort. */
+uint16_t uwbGetAddress(void);
+int uwbSendPacketBlock(UWB_Packet_t *packet);
+void uwbRegisterListener(UWB_Message_Listener_t *listener);
+void dwt_readrxtimestamp(uint8_t *timestamp);
+void dwt_readtxtimestamp(uint8_t *timestamp);
+
+/* DW3000 configuration, only what the channel hopping switch hook of the deck uses. */
+#define DWT_SUCCESS 0
+#define DWT_PLEN_128 0x05
+#define DWT_PAC8 0
+#define DWT_SFD_DW_8 2
+#define DWT_BR_6M8 1
+#define DWT_PHRMODE_EXT 3
+#define DWT_PHRRATE_STD 0
+#define DWT_STS_MODE_OFF 0
+#define DWT_STS_LEN_64 1
+#define DWT_PDOA_M0 0
+#define DWT_START_RX_IMMEDIATE 0
+
+typedef struct
+{
+  uint8_t chan;
+  uint16_t txPreambLength;
+  uint8_t rxPAC;
+  uint8_t txCode;
+  uint8_t rxCode;
+  uint8_t sfdType;
+  uint8_t dataRate;
+  uint8_t phrMode;
+  uint8_t phrRate;
+  uint16_t sfdTO;
+  uint8_t stsMode;
+  uint8_t stsLength;
+  uint8_t pdoaMode;
+} dwt_config_t;
+
+int dwt_configure(dwt_config_t *config);
+void dwt_forcetrxoff(void);
+int dwt_rxenable(int mode);
+
+/* Reads the state of the current node. */
+void estimatorKalmanGetSwarmInfo(short *velocityXInWorld, short *velocityYInWorld, float *gyroZ, uint16_t *positionZ);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _HOST_APP_CHANNEL_H_
+#define _HOST_APP_CHANNEL_H_
+
+#include <stddef.h>
+
+#define APPCHANNEL_MTU 31
+
+/* Only the deck streams over the app channel, host programs drain the records themselves. */
+void appchannelSendDataPacketBlock(void *data, size_t length);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _HOST_AUTOCONF_H_
+#define _HOST_AUTOCONF_H_
+
+/* Feature flags are passed with -D on the host. */
+
+#endif
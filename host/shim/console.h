@@ -0,0 +1,7 @@
+#ifndef _HOST_CONSOLE_H_
+#define _HOST_CONSOLE_H_
+
+/* Goes to stdout, whole lines of different threads are not interleaved. */
+int consolePrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
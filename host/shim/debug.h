@@ -0,0 +1,8 @@
+#ifndef _HOST_DEBUG_H_
+#define _HOST_DEBUG_H_
+
+#include "console.h"
+
+#define DEBUG_PRINT(fmt, ...) consolePrintf(fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _HOST_DW_TYPES_H_
+#define _HOST_DW_TYPES_H_
+
+#include <stdint.h>
+
+typedef union dwTime_u
+{
+  uint8_t raw[5];
+  uint64_t full;
+  struct
+  {
+    uint32_t low32;
+    uint8_t high8;
+  } __attribute__((packed));
+  struct
+  {
+    uint8_t low8;
+    uint32_t high32;
+  } __attribute__((packed));
+} dwTime_t;
+
+#endif
@@ -0,0 +1,372 @@
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+#include "timers.h"
+#include "system.h"
+#include "console.h"
+#include "log.h"
+#include "usec_time.h"
+#include "app_channel.h"
+#include "adhocdeck.h"
+#include "host_rtos.h"
+
+struct Host_Queue
+{
+  uint8_t *items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+struct Host_Semaphore
+{
+  bool isMutex;
+  UBaseType_t count;
+};
+
+static __thread Host_Node_t *hostCurrent;
+
+static void hostUnavailable(const char *name)
+{
+  fprintf(stderr, "%s is not available on the host\n", name);
+  abort();
+}
+
+static Host_Node_t *hostNodeRequire(void)
+{
+  if (!hostCurrent)
+  {
+    fprintf(stderr, "no current node, call hostNodeEnter() first\n");
+    abort();
+  }
+  return hostCurrent;
+}
+
+void hostNodeInit(Host_Node_t *node, TickType_t tick)
+{
+  memset(node, 0, sizeof(Host_Node_t));
+  node->tick = tick;
+}
+
+void hostNodeEnter(Host_Node_t *node)
+{
+  hostCurrent = node;
+}
+
+Host_Node_t *hostNodeCurrent(void)
+{
+  return hostCurrent;
+}
+
+TickType_t hostTimersNext(Host_Node_t *node)
+{
+  TickType_t next = portMAX_DELAY;
+  for (Host_Timer_t *timer = node->timers; timer; timer = timer->next)
+  {
+    if (timer->active && (next == portMAX_DELAY || (int32_t)(timer->expiry - next) < 0))
+    {
+      next = timer->expiry;
+    }
+  }
+  return next;
+}
+
+void hostTimersRun(Host_Node_t *node)
+{
+  while (true)
+  {
+    Host_Timer_t *due = NULL;
+    for (Host_Timer_t *timer = node->timers; timer; timer = timer->next)
+    {
+      if (timer->active && (int32_t)(node->tick - timer->expiry) >= 0 &&
+          (!due || (int32_t)(timer->expiry - due->expiry) < 0))
+      {
+        due = timer;
+      }
+    }
+    if (!due)
+    {
+      return;
+    }
+    if (due->autoReload)
+    {
+      due->expiry += due->period;
+    }
+    else
+    {
+      due->active = false;
+    }
+    due->callback(due);
+  }
+}
+
+uint64_t hostRandomNext(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+double hostRandomUniform(uint64_t *state)
+{
+  return (hostRandomNext(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  return hostNodeRequire()->tick;
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+  return hostNodeRequire()->tick;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint16_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+  hostUnavailable("xTaskCreate");
+  return pdFAIL;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  hostUnavailable("vTaskDelay");
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout)
+{
+  hostUnavailable("ulTaskNotifyTake");
+  return 0;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+  hostUnavailable("xTaskNotifyGive");
+}
+
+void systemWaitStart(void)
+{
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  QueueHandle_t queue = calloc(1, sizeof(struct Host_Queue));
+  queue->items = malloc(length * itemSize);
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+  if (queue->count == 0)
+  {
+    return pdFALSE;
+  }
+  memcpy(item, queue->items + queue->head * queue->itemSize, queue->itemSize);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+  if (queue->count == queue->length)
+  {
+    return pdFALSE;
+  }
+  UBaseType_t tail = (queue->head + queue->count) % queue->length;
+  memcpy(queue->items + tail * queue->itemSize, item, queue->itemSize);
+  queue->count++;
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken)
+{
+  return xQueueSend(queue, item, 0);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  return queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  SemaphoreHandle_t semaphore = calloc(1, sizeof(struct Host_Semaphore));
+  semaphore->isMutex = true;
+  semaphore->count = 1;
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+  return calloc(1, sizeof(struct Host_Semaphore));
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout)
+{
+  if (semaphore->count == 0)
+  {
+    if (semaphore->isMutex && timeout == portMAX_DELAY)
+    {
+      fprintf(stderr, "deadlock: mutex taken twice on the same instance\n");
+      abort();
+    }
+    return pdFALSE;
+  }
+  semaphore->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  if (semaphore->count > 0)
+  {
+    return pdFALSE;
+  }
+  semaphore->count = 1;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken)
+{
+  return xSemaphoreGive(semaphore);
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                           TimerCallbackFunction_t callback)
+{
+  Host_Node_t *node = hostNodeRequire();
+  TimerHandle_t timer = calloc(1, sizeof(Host_Timer_t));
+  timer->name = name;
+  timer->period = period;
+  timer->autoReload = autoReload;
+  timer->id = id;
+  timer->callback = callback;
+  timer->next = node->timers;
+  node->timers = timer;
+  return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t timeout)
+{
+  timer->active = true;
+  timer->expiry = hostNodeRequire()->tick + timer->period;
+  return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t timeout)
+{
+  timer->active = false;
+  return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+  return timer->id;
+}
+
+int consolePrintf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  flockfile(stdout);
+  int length = vprintf(format, args);
+  funlockfile(stdout);
+  va_end(args);
+  return length;
+}
+
+uint64_t usecTimestamp(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Variable ids of the state estimate, in the order of Host_Node_t. */
+logVarId_t logGetVarId(const char *group, const char *name)
+{
+  static const char *names[] = {"x", "y", "z", "vx", "vy", "vz"};
+  for (logVarId_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    if (strcmp(group, "stateEstimate") == 0 && strcmp(name, names[i]) == 0)
+    {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+float logGetFloat(logVarId_t varId)
+{
+  Host_Node_t *node = hostNodeRequire();
+  float values[] = {0, node->x, node->y, node->z, node->vx, node->vy, node->vz};
+  return varId < sizeof(values) / sizeof(values[0]) ? values[varId] : 0;
+}
+
+void estimatorKalmanGetSwarmInfo(short *velocityXInWorld, short *velocityYInWorld, float *gyroZ, uint16_t *positionZ)
+{
+  Host_Node_t *node = hostNodeRequire();
+  *velocityXInWorld = (short)(node->vx * 100);
+  *velocityYInWorld = (short)(node->vy * 100);
+  *gyroZ = node->gyroZ;
+  *positionZ = (uint16_t)(node->z * 100);
+}
+
+uint16_t uwbGetAddress(void)
+{
+  hostUnavailable("uwbGetAddress");
+  return 0;
+}
+
+int uwbSendPacketBlock(UWB_Packet_t *packet)
+{
+  hostUnavailable("uwbSendPacketBlock");
+  return 0;
+}
+
+void uwbRegisterListener(UWB_Message_Listener_t *listener)
+{
+  hostUnavailable("uwbRegisterListener");
+}
+
+void dwt_readrxtimestamp(uint8_t *timestamp)
+{
+  hostUnavailable("dwt_readrxtimestamp");
+}
+
+void dwt_readtxtimestamp(uint8_t *timestamp)
+{
+  hostUnavailable("dwt_readtxtimestamp");
+}
+
+int dwt_configure(dwt_config_t *config)
+{
+  hostUnavailable("dwt_configure");
+  return 0;
+}
+
+void dwt_forcetrxoff(void)
+{
+  hostUnavailable("dwt_forcetrxoff");
+}
+
+int dwt_rxenable(int mode)
+{
+  hostUnavailable("dwt_rxenable");
+  return 0;
+}
+
+void appchannelSendDataPacketBlock(void *data, size_t length)
+{
+  hostUnavailable("appchannelSendDataPacketBlock");
+}
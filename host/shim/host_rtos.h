@@ -0,0 +1,45 @@
+#ifndef _HOST_RTOS_H_
+#define _HOST_RTOS_H_
+
+/* Host side of the shims: a driver keeps one Host_Node_t per ranging instance and makes it current with
+ * hostNodeEnter() before calling into the instance, so that ticks, timers and the state estimate read by the core
+ * are those of that node. The current node is per thread, an instance must only be entered by one thread at a time.
+ */
+
+#include "FreeRTOS.h"
+#include "timers.h"
+
+typedef struct Host_Timer
+{
+  struct Host_Timer *next;
+  const char *name;
+  TickType_t period;
+  bool autoReload;
+  bool active;
+  TickType_t expiry;
+  void *id;
+  TimerCallbackFunction_t callback;
+} Host_Timer_t;
+
+typedef struct
+{
+  TickType_t tick;     // local tick of the node, the driver advances it
+  float x, y, z;       // m, stateEstimate of the node
+  float vx, vy, vz;    // m/s
+  float gyroZ;         // rad/s
+  Host_Timer_t *timers;
+} Host_Node_t;
+
+void hostNodeInit(Host_Node_t *node, TickType_t tick);
+void hostNodeEnter(Host_Node_t *node);
+Host_Node_t *hostNodeCurrent(void);
+/* Fire every active timer of the node due at node->tick, in expiry order. The node must be current. */
+void hostTimersRun(Host_Node_t *node);
+/* Earliest expiry of an active timer of the node, portMAX_DELAY if none. */
+TickType_t hostTimersNext(Host_Node_t *node);
+/* splitmix64, a driver keeps one state per random stream so that its runs are reproducible from a seed. */
+uint64_t hostRandomNext(uint64_t *state);
+/* Uniform in [0, 1) from the 53 high bits of the next value of state. */
+double hostRandomUniform(uint64_t *state);
+
+#endif
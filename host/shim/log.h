@@ -0,0 +1,24 @@
+#ifndef _HOST_LOG_H_
+#define _HOST_LOG_H_
+
+#include <stdint.h>
+
+/* The log table is not built on the host, logGetFloat reads the state of the current node (see Host_Node_t). */
+typedef uint16_t logVarId_t;
+
+logVarId_t logGetVarId(const char *group, const char *name);
+float logGetFloat(logVarId_t varId);
+
+#define LOG_UINT8 1
+#define LOG_UINT16 2
+#define LOG_UINT32 3
+#define LOG_INT8 4
+#define LOG_INT16 5
+#define LOG_INT32 6
+#define LOG_FLOAT 7
+#define LOG_GROUP_START(NAME) __attribute__((unused)) static const void *const hostLogGroup_##NAME[] = {
+#define LOG_ADD(TYPE, NAME, ADDRESS) (const void *)(ADDRESS),
+#define LOG_ADD_CORE(FLAGS, TYPE, NAME, ADDRESS) (const void *)(ADDRESS),
+#define LOG_GROUP_STOP(NAME) NULL};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _HOST_OLSR_H_
+#define _HOST_OLSR_H_
+
+/* Included by the ranging core, nothing of it is used. */
+
+#endif
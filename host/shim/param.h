@@ -0,0 +1,20 @@
+#ifndef _HOST_PARAM_H_
+#define _HOST_PARAM_H_
+
+#include <stdint.h>
+
+/* The parameter table is not built on the host, parameters live in Ranging_Params_t of each instance. */
+#define PARAM_UINT8 1
+#define PARAM_UINT16 2
+#define PARAM_UINT32 3
+#define PARAM_INT8 4
+#define PARAM_INT16 5
+#define PARAM_INT32 6
+#define PARAM_FLOAT 7
+#define PARAM_GROUP_START(NAME) __attribute__((unused)) static const void *const hostParamGroup_##NAME[] = {
+#define PARAM_ADD(TYPE, NAME, ADDRESS) (const void *)(ADDRESS),
+#define PARAM_ADD_CORE(FLAGS, TYPE, NAME, ADDRESS) (const void *)(ADDRESS),
+#define PARAM_ADD_WITH_CALLBACK(TYPE, NAME, ADDRESS, CALLBACK) (const void *)(ADDRESS), (const void *)(CALLBACK),
+#define PARAM_GROUP_STOP(NAME) NULL};
+
+#endif
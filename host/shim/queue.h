@@ -0,0 +1,15 @@
+#ifndef _HOST_QUEUE_H_
+#define _HOST_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+typedef struct Host_Queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+/* Never blocks on the host, a driver runs the consumer after the producer instead. */
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif
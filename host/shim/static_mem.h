@@ -0,0 +1,6 @@
+#ifndef _HOST_STATIC_MEM_H_
+#define _HOST_STATIC_MEM_H_
+
+/* Included by the ranging core, nothing of it is used. */
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _HOST_SYSTEM_H_
+#define _HOST_SYSTEM_H_
+
+void systemWaitStart(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _HOST_TASK_H_
+#define _HOST_TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/* The tick of the current node, see hostNodeEnter(). */
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+/* There are no tasks on the host, a driver calls the task steps itself, these abort if reached. */
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint16_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout);
+void xTaskNotifyGive(TaskHandle_t task);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _HOST_TIMERS_H_
+#define _HOST_TIMERS_H_
+
+#include "FreeRTOS.h"
+
+typedef struct Host_Timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+/* Timers belong to the node current at creation and fire from hostTimersRun(). */
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                           TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t timeout);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t timeout);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif
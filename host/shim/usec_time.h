@@ -0,0 +1,9 @@
+#ifndef _HOST_USEC_TIME_H_
+#define _HOST_USEC_TIME_H_
+
+#include <stdint.h>
+
+/* Wall clock of the host, not simulated time. */
+uint64_t usecTimestamp(void);
+
+#endif
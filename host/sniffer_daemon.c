@@ -0,0 +1,1206 @@
+/* Reads the frames the sniffer drone forwards over USB, decodes their ranging headers as they arrive and publishes
+ * per-drone statistics as JSON over local UDP for live plotting, while saving the capture as newdata/<time>.pkl in
+ * the format of sniffer.py, so that the draw scripts read it as before.
+ *
+ * Build and run from the repository root, with the Function Switch flags of the firmware that is sniffed:
+ *   gcc -std=gnu11 -O2 -pthread -Ihost/shim -I. host/sniffer_daemon.c -lusb-1.0 -o sniffer_daemon && ./sniffer_daemon
+ *   ./sniffer_daemon --replay data/2024-07-17-21-42-01-v3.pkl --layout v2024 --echo
+ *
+ * USB: --transfers bulk transfers of --transfer-size bytes stay queued on the IN endpoint of interface 0 (libusb
+ * async), a transfer is resubmitted from its completion, so reading never waits for the decoder. Completed transfers
+ * are concatenated into a byte stream in submission order and cut into frames, SNIFFER_META_SIZE bytes of meta then
+ * msg_len bytes of message, a frame may span transfers. On a meta without SNIFFER_MAGIC the stream is searched for
+ * the next magic, the bytes skipped are counted ("usb_resync_bytes"). Not yet run against the sniffer device.
+ *
+ * --replay reads a .pkl capture from data/ instead of the device and hands its frames over at the intervals of their
+ * sniffer_rx_time divided by --speed (0 for as fast as possible). Only the subset of pickle that sniffer.py and this
+ * daemon write is read: a list of dicts of ints and array('B') (protocol 3 to 5, no shared objects).
+ *
+ * The reader thread only reads and saves, the decoder thread decodes and publishes, the queue between them holds
+ * --queue frames: when the decoder falls behind, frames are skipped for decoding ("decode_skipped"), never on USB,
+ * and the saved capture is always complete. Every --period seconds one JSON object is sent to 127.0.0.1:--port:
+ *   {"time":..,"latency_ms":..,"decode_skipped":..,"usb_errors":..,"usb_resync_bytes":..,
+ *    "drones":{"<addr>":{"rate":..,"loss":..,"seq":..,"bodyUnits":..,"position":[x,y,z] or null}}}
+ * latency_ms is the largest delay from reading a frame to having decoded it within the period, loss comes from the
+ * gaps in seq_num. The last, shorter period is published on exit. Exits 1 on a USB failure or a malformed capture.
+ */
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <libusb-1.0/libusb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "FreeRTOS.h"
+#include "swarm_ranging.h"
+
+#define SNIFFER_MAGIC 0xBB88
+#define SNIFFER_USB_VENDOR_ID 0x0483
+#define SNIFFER_USB_PRODUCT_ID 0x5740
+#define SNIFFER_TRANSFER_MAX 64
+#define SNIFFER_FRAME_SIZE_MAX RANGING_MESSAGE_SIZE_MAX
+#define SNIFFER_NS_PER_S 1000000000ULL
+#define SNIFFER_UWB_TIME_UNITS_PER_S (UWB_TIME_UNITS_PER_MS * 1000)
+#define SNIFFER_REPLAY_GAP_MAX 1.0 // s, a longer gap between two frames means sniffer_rx_time wrapped several times
+
+/* What the sniffer sends ahead of each frame, META_FORMAT '<IHHHQ' of sniffer.py */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t senderAddress;
+  uint16_t seqNumber;
+  uint16_t msgLength;
+  uint64_t rxTime; // DW1000 time of the sniffer, 40 bit
+} __attribute__((packed)) Sniffer_Meta_t;
+
+#define SNIFFER_META_SIZE sizeof(Sniffer_Meta_t)
+
+/* Ranging_Message_Header_t of the firmware the captures of 2024-07 in data/ were taken with, '<HHQQQhhhffffH?BHH' */
+typedef struct
+{
+  uint16_t srcAddress;
+  uint16_t msgSequence;
+  uint64_t lastTxTimestamps[3];
+  short velocity;
+  short velocityXInWorld;
+  short velocityYInWorld;
+  float gyroZ;
+  float posiX;
+  float posiY;
+  float posiZ;
+  uint16_t positionZ;
+  bool keep_flying;
+  uint8_t stage;
+  uint16_t msgLength;
+  uint16_t filter;
+} __attribute__((packed)) Sniffer_Header_V2024_t;
+
+typedef enum
+{
+  SNIFFER_LAYOUT_CURRENT, // Ranging_Message_Header_t and Body_Unit_t of this build
+  SNIFFER_LAYOUT_V2024,   // Sniffer_Header_V2024_t, the header only
+} Sniffer_Layout_t;
+
+typedef struct
+{
+  Sniffer_Meta_t meta;
+  uint16_t length; // bytes in data, msg_len unless replayed from a capture that says otherwise
+  uint8_t data[SNIFFER_FRAME_SIZE_MAX];
+  struct timespec readTime; // CLOCK_MONOTONIC
+} Sniffer_Frame_t;
+
+/* Bounded queue from the reader thread to the decoder thread, it also holds the counters of the reader. */
+typedef struct
+{
+  pthread_mutex_t mu;
+  pthread_cond_t ready;
+  Sniffer_Frame_t *frames;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t count;
+  bool closed; // the reader is done, the decoder drains what is left
+  uint32_t decodeSkipped;
+  uint32_t usbErrors;
+  uint32_t usbResyncBytes;
+} Sniffer_Queue_t;
+
+/* What one drone did within the current period */
+typedef struct
+{
+  bool seen;
+  bool seqValid;
+  bool positionValid;
+  uint16_t lastSeq;
+  uint32_t received;
+  uint32_t lost;
+  uint16_t bodyUnits;
+  float position[3];
+} Sniffer_Drone_t;
+
+/* Streaming writer of the capture as a pickled list of dicts, STOP goes out on close. */
+typedef struct
+{
+  FILE *file;
+  const char *path;
+  uint32_t frames;
+} Sniffer_Capture_t;
+
+typedef struct
+{
+  libusb_context *context;
+  libusb_device_handle *handle;
+  struct libusb_transfer *transfers[SNIFFER_TRANSFER_MAX];
+  int inFlight;
+  uint8_t *stream; // bytes read and not yet cut into frames
+  size_t streamUsed;
+  size_t streamSize;
+} Sniffer_Usb_t;
+
+static volatile sig_atomic_t stopRequested;
+static Sniffer_Queue_t queue;
+static Sniffer_Capture_t capture;
+static Sniffer_Layout_t layout = SNIFFER_LAYOUT_CURRENT;
+static double period = 1.0; // s
+static int port = 9870;
+static bool echo;
+
+static void onSignal(int signal)
+{
+  (void)signal;
+  stopRequested = 1;
+}
+
+static double secondsBetween(const struct timespec *from, const struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / (double)SNIFFER_NS_PER_S;
+}
+
+static void timespecAdd(struct timespec *time, double seconds)
+{
+  uint64_t ns = time->tv_nsec + (uint64_t)(seconds * SNIFFER_NS_PER_S);
+  time->tv_sec += ns / SNIFFER_NS_PER_S;
+  time->tv_nsec = ns % SNIFFER_NS_PER_S;
+}
+
+static void queueInit(Sniffer_Queue_t *queue, uint32_t capacity)
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&queue->ready, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&queue->mu, NULL);
+  queue->frames = malloc(sizeof(Sniffer_Frame_t) * capacity);
+  queue->capacity = capacity;
+}
+
+static void queuePush(Sniffer_Queue_t *queue, const Sniffer_Frame_t *frame)
+{
+  pthread_mutex_lock(&queue->mu);
+  if (queue->count == queue->capacity)
+  {
+    queue->decodeSkipped++;
+  }
+  else
+  {
+    queue->frames[(queue->head + queue->count) % queue->capacity] = *frame;
+    queue->count++;
+    pthread_cond_signal(&queue->ready);
+  }
+  pthread_mutex_unlock(&queue->mu);
+}
+
+/* Wait for a frame until deadline, returns false if there is none by then or if the queue is closed and empty. */
+static bool queuePop(Sniffer_Queue_t *queue, Sniffer_Frame_t *frame, const struct timespec *deadline, bool *drained)
+{
+  pthread_mutex_lock(&queue->mu);
+  while (queue->count == 0 && !queue->closed &&
+         pthread_cond_timedwait(&queue->ready, &queue->mu, deadline) == 0)
+  {
+  }
+  bool popped = queue->count > 0;
+  if (popped)
+  {
+    *frame = queue->frames[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+  }
+  *drained = !popped && queue->closed;
+  pthread_mutex_unlock(&queue->mu);
+  return popped;
+}
+
+static void queueClose(Sniffer_Queue_t *queue)
+{
+  pthread_mutex_lock(&queue->mu);
+  queue->closed = true;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&queue->mu);
+}
+
+static void queueCount(Sniffer_Queue_t *queue, uint32_t *counter, uint32_t value)
+{
+  pthread_mutex_lock(&queue->mu);
+  *counter += value;
+  pthread_mutex_unlock(&queue->mu);
+}
+
+static void captureOpcode(uint8_t opcode)
+{
+  fputc(opcode, capture.file);
+}
+
+static void captureString(const char *string)
+{
+  captureOpcode(0x8C); // SHORT_BINUNICODE
+  fputc(strlen(string), capture.file);
+  fputs(string, capture.file);
+}
+
+static void captureInt(uint64_t value)
+{
+  if (value < 0x100)
+  {
+    captureOpcode('K'); // BININT1
+    fputc(value, capture.file);
+  }
+  else if (value < 0x10000)
+  {
+    captureOpcode('M'); // BININT2
+    fputc(value & 0xFF, capture.file);
+    fputc(value >> 8, capture.file);
+  }
+  else
+  {
+    /* LONG1 is two's complement, keep a clear top bit so that the value stays positive. */
+    uint8_t bytes[9];
+    uint8_t length = 0;
+    do
+    {
+      bytes[length++] = value & 0xFF;
+      value >>= 8;
+    } while (value || bytes[length - 1] & 0x80);
+    captureOpcode(0x8A); // LONG1
+    fputc(length, capture.file);
+    fwrite(bytes, 1, length, capture.file);
+  }
+}
+
+static bool captureOpen(const char *path)
+{
+  capture.file = fopen(path, "wb");
+  capture.path = path;
+  if (!capture.file)
+  {
+    return false;
+  }
+  captureOpcode(0x80); // PROTO
+  fputc(4, capture.file);
+  captureOpcode(']'); // EMPTY_LIST
+  return true;
+}
+
+/* One dict of sniffer.py, bin_data as array('B') through array._array_reconstructor. */
+static void captureFrame(const Sniffer_Frame_t *frame)
+{
+  if (!capture.file)
+  {
+    return;
+  }
+  captureOpcode('}'); // EMPTY_DICT
+  captureOpcode('('); // MARK
+  captureString("magic");
+  captureInt(frame->meta.magic);
+  captureString("sender_addr");
+  captureInt(frame->meta.senderAddress);
+  captureString("seq_num");
+  captureInt(frame->meta.seqNumber);
+  captureString("msg_len");
+  captureInt(frame->meta.msgLength);
+  captureString("sniffer_rx_time");
+  captureInt(frame->meta.rxTime);
+  captureString("bin_data");
+  fputs("carray\n_array_reconstructor\n(carray\narray\n", capture.file); // GLOBAL, MARK, GLOBAL
+  captureString("B");
+  captureInt(0); // mformat code of unsigned 8 bit
+  if (frame->length < 0x100)
+  {
+    captureOpcode('C'); // SHORT_BINBYTES
+    fputc(frame->length, capture.file);
+  }
+  else
+  {
+    uint32_t length = frame->length;
+    captureOpcode('B'); // BINBYTES
+    fwrite(&length, sizeof(length), 1, capture.file);
+  }
+  fwrite(frame->data, 1, frame->length, capture.file);
+  captureOpcode('t'); // TUPLE
+  captureOpcode('R'); // REDUCE
+  captureOpcode('u'); // SETITEMS
+  captureOpcode('a'); // APPEND
+  capture.frames++;
+}
+
+static void captureClose()
+{
+  if (!capture.file)
+  {
+    return;
+  }
+  captureOpcode('.'); // STOP
+  fclose(capture.file);
+  capture.file = NULL;
+  if (capture.frames == 0)
+  {
+    remove(capture.path); // nothing sniffed, sniffer.py did not save either
+  }
+}
+
+/* Everything the reader does with a frame. */
+static void frameRead(Sniffer_Frame_t *frame)
+{
+  clock_gettime(CLOCK_MONOTONIC, &frame->readTime);
+  captureFrame(frame);
+  queuePush(&queue, frame);
+}
+
+static void droneUpdate(Sniffer_Drone_t *drone, const Sniffer_Frame_t *frame)
+{
+  uint16_t seq = frame->meta.seqNumber;
+  if (drone->seqValid && (int16_t)(seq - drone->lastSeq) > 0)
+  {
+    drone->lost += (uint16_t)(seq - drone->lastSeq) - 1;
+  }
+  drone->seen = true;
+  drone->seqValid = true;
+  drone->lastSeq = seq;
+  drone->received++;
+  drone->bodyUnits = 0;
+  if (layout == SNIFFER_LAYOUT_CURRENT && frame->length >= sizeof(Ranging_Message_Header_t))
+  {
+    Ranging_Message_Header_t header;
+    memcpy(&header, frame->data, sizeof(header));
+    uint16_t end = frame->length < header.msgLength ? frame->length : header.msgLength;
+    if (end > sizeof(header))
+    {
+      drone->bodyUnits = (end - sizeof(header)) / sizeof(Body_Unit_t);
+    }
+    drone->position[0] = header.posiX;
+    drone->position[1] = header.posiY;
+    drone->position[2] = header.posiZ;
+    drone->positionValid = true;
+  }
+  else if (layout == SNIFFER_LAYOUT_V2024 && frame->length >= sizeof(Sniffer_Header_V2024_t))
+  {
+    Sniffer_Header_V2024_t header;
+    memcpy(&header, frame->data, sizeof(header));
+    drone->position[0] = header.posiX;
+    drone->position[1] = header.posiY;
+    drone->position[2] = header.posiZ;
+    drone->positionValid = true;
+  }
+}
+
+static void publish(int socketFd, Sniffer_Drone_t *drones, double elapsed, double latency)
+{
+  char *message;
+  size_t length;
+  FILE *out = open_memstream(&message, &length);
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  pthread_mutex_lock(&queue.mu);
+  fprintf(out, "{\"time\":%.3f,\"latency_ms\":%.3f,\"decode_skipped\":%u,\"usb_errors\":%u,\"usb_resync_bytes\":%u,"
+          "\"drones\":{",
+          wall.tv_sec + wall.tv_nsec / (double)SNIFFER_NS_PER_S, latency * 1000, queue.decodeSkipped,
+          queue.usbErrors, queue.usbResyncBytes);
+  pthread_mutex_unlock(&queue.mu);
+  bool first = true;
+  for (uint32_t address = 0; address <= UINT16_MAX; address++)
+  {
+    Sniffer_Drone_t *drone = &drones[address];
+    if (!drone->seen)
+    {
+      continue;
+    }
+    uint32_t expected = drone->received + drone->lost;
+    fprintf(out, "%s\"%u\":{\"rate\":%.2f,\"loss\":%.4f,\"seq\":%u,\"bodyUnits\":%u,\"position\":", first ? "" : ",",
+            address, elapsed > 0 ? drone->received / elapsed : 0, expected ? (double)drone->lost / expected : 0,
+            drone->lastSeq, drone->bodyUnits);
+    if (drone->positionValid)
+    {
+      fprintf(out, "[%.3f,%.3f,%.3f]}", drone->position[0], drone->position[1], drone->position[2]);
+    }
+    else
+    {
+      fprintf(out, "null}");
+    }
+    drone->received = 0;
+    drone->lost = 0;
+    first = false;
+  }
+  fprintf(out, "}}");
+  fclose(out);
+
+  struct sockaddr_in destination = {.sin_family = AF_INET, .sin_port = htons(port)};
+  destination.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sendto(socketFd, message, length, 0, (struct sockaddr *)&destination, sizeof(destination));
+  if (echo)
+  {
+    printf("%s\n", message);
+    fflush(stdout);
+  }
+  free(message);
+}
+
+static void *decodeRun(void *parameters)
+{
+  (void)parameters;
+  int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+  Sniffer_Drone_t *drones = calloc(UINT16_MAX + 1, sizeof(Sniffer_Drone_t));
+  static Sniffer_Frame_t frame;
+  struct timespec periodStart, nextReport, now;
+  clock_gettime(CLOCK_MONOTONIC, &periodStart);
+  nextReport = periodStart;
+  timespecAdd(&nextReport, period);
+  double latency = 0;
+  bool drained = false;
+  while (!drained)
+  {
+    if (queuePop(&queue, &frame, &nextReport, &drained))
+    {
+      droneUpdate(&drones[frame.meta.senderAddress], &frame);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      double delay = secondsBetween(&frame.readTime, &now);
+      latency = delay > latency ? delay : latency;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (secondsBetween(&nextReport, &now) >= 0 || drained)
+    {
+      publish(socketFd, drones, secondsBetween(&periodStart, &now), latency);
+      latency = 0;
+      periodStart = now;
+      nextReport = now;
+      timespecAdd(&nextReport, period);
+    }
+  }
+  free(drones);
+  close(socketFd);
+  return NULL;
+}
+
+/* Cut the complete frames off the front of the stream, the rest stays for the next transfer. */
+static void usbStreamSplit(Sniffer_Usb_t *usb)
+{
+  static Sniffer_Frame_t frame;
+  size_t offset = 0;
+  while (usb->streamUsed - offset >= SNIFFER_META_SIZE)
+  {
+    memcpy(&frame.meta, usb->stream + offset, SNIFFER_META_SIZE);
+    if (frame.meta.magic != SNIFFER_MAGIC || frame.meta.msgLength > SNIFFER_FRAME_SIZE_MAX)
+    {
+      /* Lost sync, move on to the next magic, or keep the last bytes that may start one. */
+      const uint32_t magic = SNIFFER_MAGIC;
+      size_t skipped = 1;
+      while (offset + skipped + sizeof(magic) <= usb->streamUsed &&
+             memcmp(usb->stream + offset + skipped, &magic, sizeof(magic)) != 0)
+      {
+        skipped++;
+      }
+      queueCount(&queue, &queue.usbResyncBytes, skipped);
+      offset += skipped;
+      continue;
+    }
+    if (usb->streamUsed - offset < SNIFFER_META_SIZE + frame.meta.msgLength)
+    {
+      break;
+    }
+    frame.length = frame.meta.msgLength;
+    memcpy(frame.data, usb->stream + offset + SNIFFER_META_SIZE, frame.length);
+    frameRead(&frame);
+    offset += SNIFFER_META_SIZE + frame.length;
+  }
+  memmove(usb->stream, usb->stream + offset, usb->streamUsed - offset);
+  usb->streamUsed -= offset;
+}
+
+static void LIBUSB_CALL usbTransferDone(struct libusb_transfer *transfer)
+{
+  Sniffer_Usb_t *usb = transfer->user_data;
+  /* A cancelled transfer may still have brought data. */
+  memcpy(usb->stream + usb->streamUsed, transfer->buffer, transfer->actual_length);
+  usb->streamUsed += transfer->actual_length;
+  usbStreamSplit(usb);
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED && transfer->status != LIBUSB_TRANSFER_CANCELLED)
+  {
+    queueCount(&queue, &queue.usbErrors, 1);
+  }
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED || stopRequested || libusb_submit_transfer(transfer) != 0)
+  {
+    usb->inFlight--;
+  }
+}
+
+/* Interface 0 of the sniffer and its first IN endpoint, as sniffer.py found them. */
+static int usbOpen(Sniffer_Usb_t *usb, uint8_t *endpoint)
+{
+  int error = libusb_init(&usb->context);
+  if (error)
+  {
+    return error;
+  }
+  usb->handle = libusb_open_device_with_vid_pid(usb->context, SNIFFER_USB_VENDOR_ID, SNIFFER_USB_PRODUCT_ID);
+  if (!usb->handle)
+  {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  libusb_set_auto_detach_kernel_driver(usb->handle, 1);
+  error = libusb_claim_interface(usb->handle, 0);
+  if (error)
+  {
+    return error;
+  }
+  struct libusb_config_descriptor *config;
+  error = libusb_get_active_config_descriptor(libusb_get_device(usb->handle), &config);
+  if (error)
+  {
+    return error;
+  }
+  const struct libusb_interface_descriptor *interface = &config->interface[0].altsetting[0];
+  error = LIBUSB_ERROR_NOT_FOUND;
+  for (int i = 0; i < interface->bNumEndpoints; i++)
+  {
+    if (interface->endpoint[i].bEndpointAddress & LIBUSB_ENDPOINT_IN)
+    {
+      *endpoint = interface->endpoint[i].bEndpointAddress;
+      error = 0;
+      break;
+    }
+  }
+  libusb_free_config_descriptor(config);
+  return error;
+}
+
+static int usbSource(int transferCount, int transferSize)
+{
+  static Sniffer_Usb_t usb;
+  uint8_t endpoint = 0;
+  int error = usbOpen(&usb, &endpoint);
+  if (!error)
+  {
+    fprintf(stderr, "endpoint 0x%02x, %d transfers of %d bytes\n", endpoint, transferCount, transferSize);
+    usb.streamSize = SNIFFER_META_SIZE + SNIFFER_FRAME_SIZE_MAX + transferSize;
+    usb.stream = malloc(usb.streamSize);
+  }
+  for (int i = 0; !error && i < transferCount; i++)
+  {
+    struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(transfer, usb.handle, endpoint, malloc(transferSize), transferSize, usbTransferDone,
+                              &usb, 0);
+    transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    usb.transfers[i] = transfer;
+    error = libusb_submit_transfer(transfer);
+    usb.inFlight += !error;
+  }
+
+  struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+  bool cancelled = false;
+  while (usb.inFlight > 0)
+  {
+    if ((stopRequested || error) && !cancelled)
+    {
+      for (int i = 0; i < transferCount; i++)
+      {
+        if (usb.transfers[i])
+        {
+          libusb_cancel_transfer(usb.transfers[i]);
+        }
+      }
+      cancelled = true;
+    }
+    libusb_handle_events_timeout_completed(usb.context, &timeout, NULL);
+  }
+  if (!error && !stopRequested)
+  {
+    error = LIBUSB_ERROR_IO; // every transfer failed
+  }
+
+  for (int i = 0; i < transferCount; i++)
+  {
+    libusb_free_transfer(usb.transfers[i]);
+  }
+  free(usb.stream);
+  if (usb.handle)
+  {
+    libusb_release_interface(usb.handle, 0);
+    libusb_close(usb.handle);
+  }
+  if (usb.context)
+  {
+    libusb_exit(usb.context);
+  }
+  if (error)
+  {
+    fprintf(stderr, "usb: %s\n", libusb_error_name(error));
+  }
+  return error;
+}
+
+/* Restricted unpickler, values live on the stack and in the memo by value, dicts are the frames being filled. */
+typedef enum
+{
+  PICKLE_MARK,
+  PICKLE_NONE,
+  PICKLE_INT,
+  PICKLE_STRING,
+  PICKLE_BYTES,
+  PICKLE_GLOBAL, // integer is 1 for array._array_reconstructor
+  PICKLE_TUPLE,  // data and length are those of the last bytes in it
+  PICKLE_DICT,
+  PICKLE_LIST,
+} Pickle_Type_t;
+
+#define PICKLE_FIELD_MAGIC (1 << 0)
+#define PICKLE_FIELD_SENDER (1 << 1)
+#define PICKLE_FIELD_SEQ (1 << 2)
+#define PICKLE_FIELD_LENGTH (1 << 3)
+#define PICKLE_FIELD_RX_TIME (1 << 4)
+#define PICKLE_FIELD_DATA (1 << 5)
+#define PICKLE_FIELD_ALL ((1 << 6) - 1)
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t fields; // PICKLE_FIELD_* set in a dict
+  int64_t integer;
+  const uint8_t *data;
+  uint32_t length;
+  Sniffer_Meta_t meta; // dict
+} Pickle_Value_t;
+
+typedef struct
+{
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  Pickle_Value_t *stack;
+  size_t stackUsed, stackSize;
+  Pickle_Value_t *memo;
+  size_t memoSize;
+  bool (*onFrame)(const Pickle_Value_t *dict); // false to stop
+} Pickle_Reader_t;
+
+static const uint8_t *pickleTake(Pickle_Reader_t *reader, size_t length)
+{
+  if (reader->size - reader->offset < length)
+  {
+    return NULL;
+  }
+  reader->offset += length;
+  return reader->data + reader->offset - length;
+}
+
+static bool pickleTakeUint(Pickle_Reader_t *reader, uint8_t length, uint32_t *value)
+{
+  const uint8_t *bytes = pickleTake(reader, length);
+  *value = 0;
+  for (int i = 0; bytes && i < length; i++)
+  {
+    *value |= (uint32_t)bytes[i] << (8 * i);
+  }
+  return bytes != NULL;
+}
+
+static void picklePush(Pickle_Reader_t *reader, Pickle_Value_t value)
+{
+  if (reader->stackUsed == reader->stackSize)
+  {
+    reader->stackSize = reader->stackSize ? reader->stackSize * 2 : 256;
+    reader->stack = realloc(reader->stack, sizeof(Pickle_Value_t) * reader->stackSize);
+  }
+  reader->stack[reader->stackUsed++] = value;
+}
+
+static Pickle_Value_t *pickleTop(Pickle_Reader_t *reader, size_t depth)
+{
+  return reader->stackUsed > depth ? &reader->stack[reader->stackUsed - 1 - depth] : NULL;
+}
+
+/* Index of the topmost MARK, the stack size if there is none. */
+static size_t pickleMark(Pickle_Reader_t *reader)
+{
+  for (size_t i = reader->stackUsed; i > 0; i--)
+  {
+    if (reader->stack[i - 1].type == PICKLE_MARK)
+    {
+      return i - 1;
+    }
+  }
+  return reader->stackUsed;
+}
+
+/* Index of the object SETITEM(S) or APPEND(S) add to: below the topmost MARK if marked, else below count items. */
+static bool pickleItems(Pickle_Reader_t *reader, bool marked, size_t count, size_t *target)
+{
+  if (!marked && reader->stackUsed < count)
+  {
+    return false;
+  }
+  size_t below = marked ? pickleMark(reader) : reader->stackUsed - count;
+  if (below == 0 || (marked && below == reader->stackUsed))
+  {
+    return false;
+  }
+  *target = below - 1;
+  return true;
+}
+
+static bool pickleSetItem(Pickle_Value_t *dict, const Pickle_Value_t *key, const Pickle_Value_t *value)
+{
+  if (dict->type != PICKLE_DICT || key->type != PICKLE_STRING)
+  {
+    return false;
+  }
+  static const char *NAMES[] = {"magic", "sender_addr", "seq_num", "msg_len", "sniffer_rx_time", "bin_data"};
+  for (int field = 0; field < 6; field++)
+  {
+    if (key->length != strlen(NAMES[field]) || memcmp(key->data, NAMES[field], key->length) != 0)
+    {
+      continue;
+    }
+    if ((field == 5) != (value->type == PICKLE_BYTES) || (field != 5 && value->type != PICKLE_INT))
+    {
+      return false;
+    }
+    switch (field)
+    {
+    case 0:
+      dict->meta.magic = value->integer;
+      break;
+    case 1:
+      dict->meta.senderAddress = value->integer;
+      break;
+    case 2:
+      dict->meta.seqNumber = value->integer;
+      break;
+    case 3:
+      dict->meta.msgLength = value->integer;
+      break;
+    case 4:
+      dict->meta.rxTime = value->integer;
+      break;
+    default:
+      dict->data = value->data;
+      dict->length = value->length;
+      break;
+    }
+    dict->fields |= 1 << field;
+  }
+  return true;
+}
+
+static bool pickleAppend(Pickle_Reader_t *reader, const Pickle_Value_t *list, const Pickle_Value_t *item)
+{
+  if (list->type != PICKLE_LIST || item->type != PICKLE_DICT || item->fields != PICKLE_FIELD_ALL ||
+      item->length > SNIFFER_FRAME_SIZE_MAX)
+  {
+    return false;
+  }
+  return reader->onFrame(item);
+}
+
+/* Run the pickle up to STOP, returns false on an opcode or value outside the subset or when onFrame stopped it. */
+static bool pickleRun(Pickle_Reader_t *reader)
+{
+  while (true)
+  {
+    const uint8_t *opcode = pickleTake(reader, 1);
+    if (!opcode)
+    {
+      return false;
+    }
+    Pickle_Value_t value = {.type = PICKLE_NONE};
+    Pickle_Value_t *top;
+    uint32_t length;
+    size_t target;
+    switch (*opcode)
+    {
+    case 0x80: // PROTO
+      if (!pickleTake(reader, 1))
+      {
+        return false;
+      }
+      break;
+    case 0x95: // FRAME
+      if (!pickleTake(reader, 8))
+      {
+        return false;
+      }
+      break;
+    case '.': // STOP
+      return true;
+    case '(': // MARK
+      value.type = PICKLE_MARK;
+      picklePush(reader, value);
+      break;
+    case 'N': // NONE
+    case 0x88: // NEWTRUE
+    case 0x89: // NEWFALSE
+      picklePush(reader, value);
+      break;
+    case ']': // EMPTY_LIST
+      value.type = PICKLE_LIST;
+      picklePush(reader, value);
+      break;
+    case '}': // EMPTY_DICT
+      value.type = PICKLE_DICT;
+      picklePush(reader, value);
+      break;
+    case 'K': // BININT1
+    case 'M': // BININT2
+    case 'J': // BININT
+      if (!pickleTakeUint(reader, *opcode == 'K' ? 1 : *opcode == 'M' ? 2 : 4, &length))
+      {
+        return false;
+      }
+      value.type = PICKLE_INT;
+      value.integer = *opcode == 'J' ? (int32_t)length : (int64_t)length;
+      picklePush(reader, value);
+      break;
+    case 0x8A: // LONG1
+    {
+      if (!pickleTakeUint(reader, 1, &length) || length > 8)
+      {
+        return false;
+      }
+      const uint8_t *bytes = pickleTake(reader, length);
+      if (!bytes)
+      {
+        return false;
+      }
+      uint64_t integer = 0;
+      for (uint32_t i = 0; i < length; i++)
+      {
+        integer |= (uint64_t)bytes[i] << (8 * i);
+      }
+      if (length > 0 && length < 8 && bytes[length - 1] & 0x80)
+      {
+        integer |= ~0ULL << (8 * length); // negative
+      }
+      value.type = PICKLE_INT;
+      value.integer = (int64_t)integer;
+      picklePush(reader, value);
+      break;
+    }
+    case 0x8C: // SHORT_BINUNICODE
+    case 'X':  // BINUNICODE
+    case 'C':  // SHORT_BINBYTES
+    case 'B':  // BINBYTES
+      if (!pickleTakeUint(reader, *opcode == 0x8C || *opcode == 'C' ? 1 : 4, &length))
+      {
+        return false;
+      }
+      value.type = *opcode == 0x8C || *opcode == 'X' ? PICKLE_STRING : PICKLE_BYTES;
+      value.length = length;
+      value.data = pickleTake(reader, length);
+      if (!value.data)
+      {
+        return false;
+      }
+      picklePush(reader, value);
+      break;
+    case 'c': // GLOBAL, "module\nname\n"
+    {
+      const uint8_t *start = reader->data + reader->offset;
+      const uint8_t *end = memchr(start, '\n', reader->size - reader->offset);
+      end = end ? memchr(end + 1, '\n', reader->data + reader->size - end - 1) : NULL;
+      if (!end)
+      {
+        return false;
+      }
+      reader->offset = end + 1 - reader->data;
+      value.type = PICKLE_GLOBAL;
+      value.integer = end - start == strlen("array\n_array_reconstructor") &&
+                      memcmp(start, "array\n_array_reconstructor", end - start) == 0;
+      picklePush(reader, value);
+      break;
+    }
+    case 0x93: // STACK_GLOBAL
+    {
+      Pickle_Value_t *module = pickleTop(reader, 1), *name = pickleTop(reader, 0);
+      if (!module || module->type != PICKLE_STRING || name->type != PICKLE_STRING)
+      {
+        return false;
+      }
+      value.type = PICKLE_GLOBAL;
+      value.integer = module->length == strlen("array") && memcmp(module->data, "array", module->length) == 0 &&
+                      name->length == strlen("_array_reconstructor") &&
+                      memcmp(name->data, "_array_reconstructor", name->length) == 0;
+      reader->stackUsed -= 2;
+      picklePush(reader, value);
+      break;
+    }
+    case 't':  // TUPLE
+    case ')':  // EMPTY_TUPLE
+    case 0x85: // TUPLE1
+    case 0x86: // TUPLE2
+    case 0x87: // TUPLE3
+    {
+      size_t count = *opcode == ')' ? 0 : *opcode - 0x85 + 1;
+      size_t start = *opcode == 't' ? pickleMark(reader) + 1 : reader->stackUsed - count;
+      if (start > reader->stackUsed || (*opcode != 't' && reader->stackUsed < count))
+      {
+        return false;
+      }
+      value.type = PICKLE_TUPLE;
+      for (size_t i = start; i < reader->stackUsed; i++)
+      {
+        if (reader->stack[i].type == PICKLE_BYTES)
+        {
+          value.data = reader->stack[i].data;
+          value.length = reader->stack[i].length;
+        }
+      }
+      reader->stackUsed = *opcode == 't' ? start - 1 : start;
+      picklePush(reader, value);
+      break;
+    }
+    case 'R': // REDUCE, only array._array_reconstructor(array, 'B', 0, bytes) gives a value that is used
+    {
+      Pickle_Value_t *callable = pickleTop(reader, 1), *arguments = pickleTop(reader, 0);
+      if (!callable || arguments->type != PICKLE_TUPLE)
+      {
+        return false;
+      }
+      if (callable->type == PICKLE_GLOBAL && callable->integer && arguments->data)
+      {
+        value.type = PICKLE_BYTES;
+        value.data = arguments->data;
+        value.length = arguments->length;
+      }
+      reader->stackUsed -= 2;
+      picklePush(reader, value);
+      break;
+    }
+    case 0x94: // MEMOIZE
+    case 'q':  // BINPUT
+    case 'r':  // LONG_BINPUT
+    {
+      top = pickleTop(reader, 0);
+      length = reader->memoSize;
+      if (!top || (*opcode != 0x94 && !pickleTakeUint(reader, *opcode == 'q' ? 1 : 4, &length)))
+      {
+        return false;
+      }
+      if (length >= reader->memoSize)
+      {
+        reader->memo = realloc(reader->memo, sizeof(Pickle_Value_t) * (length + 1));
+        memset(reader->memo + reader->memoSize, 0, sizeof(Pickle_Value_t) * (length + 1 - reader->memoSize));
+        reader->memoSize = length + 1;
+      }
+      reader->memo[length] = *top;
+      break;
+    }
+    case 'h': // BINGET
+    case 'j': // LONG_BINGET
+      if (!pickleTakeUint(reader, *opcode == 'h' ? 1 : 4, &length) || length >= reader->memoSize)
+      {
+        return false;
+      }
+      picklePush(reader, reader->memo[length]);
+      break;
+    case 's': // SETITEM
+    case 'u': // SETITEMS
+      if (!pickleItems(reader, *opcode == 'u', 2, &target) || (reader->stackUsed - target - 1 - (*opcode == 'u')) % 2)
+      {
+        return false;
+      }
+      for (size_t i = target + 1 + (*opcode == 'u'); i + 1 < reader->stackUsed; i += 2)
+      {
+        if (!pickleSetItem(&reader->stack[target], &reader->stack[i], &reader->stack[i + 1]))
+        {
+          return false;
+        }
+      }
+      reader->stackUsed = target + 1;
+      break;
+    case 'a': // APPEND
+    case 'e': // APPENDS
+      if (!pickleItems(reader, *opcode == 'e', 1, &target))
+      {
+        return false;
+      }
+      for (size_t i = target + 1 + (*opcode == 'e'); i < reader->stackUsed; i++)
+      {
+        if (!pickleAppend(reader, &reader->stack[target], &reader->stack[i]))
+        {
+          return false;
+        }
+      }
+      reader->stackUsed = target + 1;
+      break;
+    default:
+      return false;
+    }
+  }
+}
+
+static double replaySpeed = 1.0;
+
+/* Hand the frames of a capture over at their recorded intervals. */
+static bool replayFrame(const Pickle_Value_t *dict)
+{
+  static Sniffer_Frame_t frame;
+  static bool started;
+  static uint64_t lastRxTime;
+  if (stopRequested)
+  {
+    return false;
+  }
+  if (replaySpeed > 0 && started)
+  {
+    double gap = ((dict->meta.rxTime - lastRxTime) % UWB_MAX_TIMESTAMP) / (double)SNIFFER_UWB_TIME_UNITS_PER_S;
+    if (gap < SNIFFER_REPLAY_GAP_MAX)
+    {
+      struct timespec delay = {0};
+      timespecAdd(&delay, gap / replaySpeed);
+      nanosleep(&delay, NULL);
+    }
+  }
+  started = true;
+  lastRxTime = dict->meta.rxTime;
+  frame.meta = dict->meta;
+  frame.length = dict->length;
+  memcpy(frame.data, dict->data, dict->length);
+  frameRead(&frame);
+  return true;
+}
+
+static int replaySource(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    fprintf(stderr, "cannot read %s\n", path);
+    return 2;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = malloc(size ? size : 1);
+  bool read = fread(data, 1, size, file) == (size_t)size;
+  fclose(file);
+  Pickle_Reader_t reader = {.data = data, .size = size, .onFrame = replayFrame};
+  bool ok = read && pickleRun(&reader);
+  if (!ok && !stopRequested)
+  {
+    fprintf(stderr, "%s: not a sniffer capture at byte %zu\n", path, reader.offset);
+  }
+  free(reader.stack);
+  free(reader.memo);
+  free(data);
+  return ok || stopRequested ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [--replay FILE [--speed X]] [--save FILE] [--layout current|v2024] [--port N] [--period S]\n"
+          "          [--queue N] [--echo] [--transfers N] [--transfer-size N]\n",
+          name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *replay = NULL;
+  const char *save = NULL;
+  int queueSize = 1024;
+  int transferCount = 8;
+  int transferSize = 4096;
+  static struct option options[] = {
+      {"replay", required_argument, NULL, 'r'},
+      {"speed", required_argument, NULL, 's'},
+      {"save", required_argument, NULL, 'w'},
+      {"layout", required_argument, NULL, 'l'},
+      {"port", required_argument, NULL, 'p'},
+      {"period", required_argument, NULL, 'P'},
+      {"queue", required_argument, NULL, 'q'},
+      {"echo", no_argument, NULL, 'e'},
+      {"transfers", required_argument, NULL, 't'},
+      {"transfer-size", required_argument, NULL, 'T'},
+      {NULL, 0, NULL, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'r':
+      replay = optarg;
+      break;
+    case 's':
+      replaySpeed = atof(optarg);
+      break;
+    case 'w':
+      save = optarg;
+      break;
+    case 'l':
+      if (strcmp(optarg, "current") != 0 && strcmp(optarg, "v2024") != 0)
+      {
+        usage(argv[0]);
+        return 2;
+      }
+      layout = strcmp(optarg, "v2024") == 0 ? SNIFFER_LAYOUT_V2024 : SNIFFER_LAYOUT_CURRENT;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'P':
+      period = atof(optarg);
+      break;
+    case 'q':
+      queueSize = atoi(optarg);
+      break;
+    case 'e':
+      echo = true;
+      break;
+    case 't':
+      transferCount = atoi(optarg);
+      break;
+    case 'T':
+      transferSize = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (optind != argc || period <= 0 || queueSize < 1 || transferCount < 1 || transferCount > SNIFFER_TRANSFER_MAX ||
+      transferSize < 1)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  /* Live captures are kept in newdata/ like sniffer.py did, replays only with --save. */
+  char path[64];
+  if (!save && !replay)
+  {
+    time_t now = time(NULL);
+    strftime(path, sizeof(path), "./newdata/%Y-%m-%d-%H-%M-%S.pkl", localtime(&now));
+    save = path;
+  }
+  if (save && !captureOpen(save))
+  {
+    fprintf(stderr, "cannot write %s\n", save);
+    return 2;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  queueInit(&queue, queueSize);
+  pthread_t decoder;
+  pthread_create(&decoder, NULL, decodeRun, NULL);
+  int result = 0;
+  if (replay)
+  {
+    result = replaySource(replay);
+  }
+  else if (usbSource(transferCount, transferSize) != 0)
+  {
+    result = 1;
+  }
+  queueClose(&queue);
+  pthread_join(decoder, NULL);
+  captureClose();
+  if (save)
+  {
+    fprintf(stderr, "%u frames saved to %s\n", capture.frames, save);
+  }
+  return result;
+}
@@ -0,0 +1,315 @@
+#include <math.h>
+#include <string.h>
+#include "swarm_localization.h"
+
+#define SWARM_LOCALIZATION_GOLDEN_ANGLE 2.39996323f // rad, spreads the initial bearings of new nodes
+
+void swarmLocalizationInit(Swarm_Localization_t *localization, uint16_t selfAddress)
+{
+  memset(localization, 0, sizeof(Swarm_Localization_t));
+  localization->address[0] = selfAddress;
+  localization->placed[0] = true;
+  localization->seen[0] = true;
+  localization->nodeCount = 1;
+}
+
+void swarmLocalizationBeginRound(Swarm_Localization_t *localization)
+{
+  for (int i = 1; i < localization->nodeCount; i++)
+  {
+    localization->seen[i] = false;
+  }
+  localization->linkCount = 0;
+  localization->round++;
+}
+
+uint8_t swarmLocalizationNode(Swarm_Localization_t *localization, uint16_t address, float z)
+{
+  uint8_t index = SWARM_LOCALIZATION_NODE_NONE;
+  for (int i = 0; i < localization->nodeCount; i++)
+  {
+    if (localization->address[i] == address)
+    {
+      index = i;
+      break;
+    }
+  }
+  if (index == SWARM_LOCALIZATION_NODE_NONE)
+  {
+    if (localization->nodeCount >= SWARM_LOCALIZATION_NODE_MAX)
+    {
+      return SWARM_LOCALIZATION_NODE_NONE;
+    }
+    index = localization->nodeCount++;
+    localization->address[index] = address;
+    localization->x[index] = 0;
+    localization->y[index] = 0;
+    localization->placed[index] = false;
+  }
+  localization->z[index] = z;
+  localization->seen[index] = true;
+  return index;
+}
+
+bool swarmLocalizationAddLink(Swarm_Localization_t *localization, uint8_t from, uint8_t to, float distance, float weight)
+{
+  if (from >= localization->nodeCount || to >= localization->nodeCount || from == to ||
+      localization->linkCount >= SWARM_LOCALIZATION_LINK_MAX || distance <= 0 || weight <= 0)
+  {
+    return false;
+  }
+  Swarm_Localization_Link_t *link = &localization->link[localization->linkCount++];
+  link->from = from;
+  link->to = to;
+  link->distance = distance;
+  link->weight = weight;
+  return true;
+}
+
+/* Compact away the nodes not seen in this round, rewriting the node indexes of the links accordingly. */
+static void swarmLocalizationDropUnseen(Swarm_Localization_t *localization)
+{
+  uint8_t newIndex[SWARM_LOCALIZATION_NODE_MAX];
+  uint8_t count = 0;
+  for (int i = 0; i < localization->nodeCount; i++)
+  {
+    if (!localization->seen[i])
+    {
+      newIndex[i] = SWARM_LOCALIZATION_NODE_NONE;
+      continue;
+    }
+    newIndex[i] = count;
+    localization->address[count] = localization->address[i];
+    localization->x[count] = localization->x[i];
+    localization->y[count] = localization->y[i];
+    localization->z[count] = localization->z[i];
+    localization->placed[count] = localization->placed[i];
+    localization->seen[count] = true;
+    count++;
+  }
+  if (count == localization->nodeCount)
+  {
+    return;
+  }
+  localization->nodeCount = count;
+  uint16_t linkCount = 0;
+  for (int l = 0; l < localization->linkCount; l++)
+  {
+    Swarm_Localization_Link_t link = localization->link[l];
+    if (newIndex[link.from] == SWARM_LOCALIZATION_NODE_NONE || newIndex[link.to] == SWARM_LOCALIZATION_NODE_NONE)
+    {
+      continue;
+    }
+    link.from = newIndex[link.from];
+    link.to = newIndex[link.to];
+    localization->link[linkCount++] = link;
+  }
+  localization->linkCount = linkCount;
+}
+
+/* Place each new node at its measured horizontal range from an already placed node, repeated so that nodes only
+ * linked through other new nodes are placed as well.
+ */
+static void swarmLocalizationPlaceNewNodes(Swarm_Localization_t *localization)
+{
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int l = 0; l < localization->linkCount; l++)
+    {
+      Swarm_Localization_Link_t *link = &localization->link[l];
+      if (localization->placed[link->from] == localization->placed[link->to])
+      {
+        continue;
+      }
+      uint8_t anchor = localization->placed[link->from] ? link->from : link->to;
+      uint8_t node = anchor == link->from ? link->to : link->from;
+      float dz = localization->z[node] - localization->z[anchor];
+      float horizontal = sqrtf(fmaxf(0, link->distance * link->distance - dz * dz));
+      float bearing = SWARM_LOCALIZATION_GOLDEN_ANGLE * localization->address[node];
+      localization->x[node] = localization->x[anchor] + horizontal * cosf(bearing);
+      localization->y[node] = localization->y[anchor] + horizontal * sinf(bearing);
+      localization->placed[node] = true;
+      changed = true;
+    }
+  }
+}
+
+/* Bucket the links by node with a counting sort, so that a sweep touches each link twice instead of scanning all
+ * links for every node.
+ */
+static void swarmLocalizationBuildAdjacency(Swarm_Localization_t *localization)
+{
+  uint16_t *start = localization->adjacencyStart;
+  memset(start, 0, sizeof(localization->adjacencyStart));
+  for (int l = 0; l < localization->linkCount; l++)
+  {
+    start[localization->link[l].from + 1]++;
+    start[localization->link[l].to + 1]++;
+  }
+  for (int i = 0; i < localization->nodeCount; i++)
+  {
+    start[i + 1] += start[i];
+  }
+  uint16_t fill[SWARM_LOCALIZATION_NODE_MAX];
+  memcpy(fill, start, sizeof(fill));
+  for (int l = 0; l < localization->linkCount; l++)
+  {
+    localization->adjacency[fill[localization->link[l].from]++] = l;
+    localization->adjacency[fill[localization->link[l].to]++] = l;
+  }
+}
+
+/* One damped Gauss-Newton step on the horizontal position of a node, holding all other nodes fixed. */
+static void swarmLocalizationUpdateNode(Swarm_Localization_t *localization, uint8_t node)
+{
+  float h11 = 0, h12 = 0, h22 = 0, g1 = 0, g2 = 0, weightSum = 0;
+  for (int a = localization->adjacencyStart[node]; a < localization->adjacencyStart[node + 1]; a++)
+  {
+    Swarm_Localization_Link_t *link = &localization->link[localization->adjacency[a]];
+    uint8_t other = link->from == node ? link->to : link->from;
+    if (!localization->placed[other])
+    {
+      continue;
+    }
+    float dx = localization->x[node] - localization->x[other];
+    float dy = localization->y[node] - localization->y[other];
+    float dz = localization->z[node] - localization->z[other];
+    float range = sqrtf(dx * dx + dy * dy + dz * dz);
+    if (range < SWARM_LOCALIZATION_MIN_RANGE)
+    {
+      continue;
+    }
+    float ux = dx / range;
+    float uy = dy / range;
+    float residual = range - link->distance;
+    h11 += link->weight * ux * ux;
+    h12 += link->weight * ux * uy;
+    h22 += link->weight * uy * uy;
+    g1 += link->weight * ux * residual;
+    g2 += link->weight * uy * residual;
+    weightSum += link->weight;
+  }
+  if (weightSum == 0)
+  {
+    return;
+  }
+  float lambda = SWARM_LOCALIZATION_DAMPING * weightSum;
+  h11 += lambda;
+  h22 += lambda;
+  float det = h11 * h22 - h12 * h12;
+  if (det <= 0)
+  {
+    return;
+  }
+  localization->x[node] -= (h22 * g1 - h12 * g2) / det;
+  localization->y[node] -= (h11 * g2 - h12 * g1) / det;
+}
+
+static float swarmLocalizationResidual(Swarm_Localization_t *localization)
+{
+  float squareSum = 0, weightSum = 0;
+  for (int l = 0; l < localization->linkCount; l++)
+  {
+    Swarm_Localization_Link_t *link = &localization->link[l];
+    float dx = localization->x[link->from] - localization->x[link->to];
+    float dy = localization->y[link->from] - localization->y[link->to];
+    float dz = localization->z[link->from] - localization->z[link->to];
+    float residual = sqrtf(dx * dx + dy * dy + dz * dz) - link->distance;
+    squareSum += link->weight * residual * residual;
+    weightSum += link->weight;
+  }
+  return weightSum > 0 ? sqrtf(squareSum / weightSum) : 0;
+}
+
+float swarmLocalizationSolve(Swarm_Localization_t *localization, uint8_t sweeps)
+{
+  swarmLocalizationDropUnseen(localization);
+  swarmLocalizationPlaceNewNodes(localization);
+  swarmLocalizationBuildAdjacency(localization);
+  for (int sweep = 0; sweep < sweeps; sweep++)
+  {
+    /* Node 0 fixes the translation of the solution. */
+    for (int i = 1; i < localization->nodeCount; i++)
+    {
+      if (localization->placed[i])
+      {
+        swarmLocalizationUpdateNode(localization, i);
+      }
+    }
+  }
+  localization->residual = swarmLocalizationResidual(localization);
+  return localization->residual;
+}
+
+bool swarmLocalizationGetPosition(Swarm_Localization_t *localization, uint16_t address, float *x, float *y)
+{
+  for (int i = 0; i < localization->nodeCount; i++)
+  {
+    if (localization->address[i] == address && localization->placed[i])
+    {
+      *x = localization->x[i];
+      *y = localization->y[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef SWARM_LOCALIZATION_HOST_BENCHMARK
+#include <stdio.h>
+#include <time.h>
+
+/* Reads "round from to distance" lines (addresses, distance in cm, heights taken as 0) from stdin, as exported
+ * from the captured data, node from of the first line is taken as this drone. Solves once per round and prints
+ * the residual and solve time of each round.
+ */
+static Swarm_Localization_t benchmarkLocalization;
+
+static void benchmarkSolve(uint32_t round, double *totalUs)
+{
+  clock_t start = clock();
+  float residual = swarmLocalizationSolve(&benchmarkLocalization, SWARM_LOCALIZATION_SWEEPS);
+  double us = (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC;
+  *totalUs += us;
+  printf("{\"round\":%u,\"nodes\":%u,\"links\":%u,\"residual\":%.2f,\"us\":%.1f}\n", round,
+         benchmarkLocalization.nodeCount, benchmarkLocalization.linkCount, residual, us);
+}
+
+int main()
+{
+  unsigned round, from, to, lastRound = 0;
+  float distance;
+  uint32_t rounds = 0;
+  double totalUs = 0;
+  bool started = false;
+  while (scanf("%u %u %u %f", &round, &from, &to, &distance) == 4)
+  {
+    if (!started)
+    {
+      swarmLocalizationInit(&benchmarkLocalization, from);
+      swarmLocalizationBeginRound(&benchmarkLocalization);
+      started = true;
+      lastRound = round;
+    }
+    if (round != lastRound)
+    {
+      benchmarkSolve(lastRound, &totalUs);
+      rounds++;
+      swarmLocalizationBeginRound(&benchmarkLocalization);
+      lastRound = round;
+    }
+    uint8_t a = swarmLocalizationNode(&benchmarkLocalization, from, 0);
+    uint8_t b = swarmLocalizationNode(&benchmarkLocalization, to, 0);
+    swarmLocalizationAddLink(&benchmarkLocalization, a, b, distance, 1);
+  }
+  if (started)
+  {
+    benchmarkSolve(lastRound, &totalUs);
+    rounds++;
+    printf("{\"rounds\":%u,\"meanUs\":%.1f}\n", rounds, totalUs / rounds);
+  }
+  return 0;
+}
+#endif
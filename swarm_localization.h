@@ -0,0 +1,63 @@
+#ifndef _SWARM_LOCALIZATION_H_
+#define _SWARM_LOCALIZATION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Relative localization of the swarm from pairwise distances, free of any firmware dependency so that it also
+ * builds on the host (define SWARM_LOCALIZATION_HOST_BENCHMARK to get a benchmark main reading captured links).
+ *
+ * Node 0 is this drone and stays at the origin. Each round the caller registers the nodes it knows and the links
+ * between them, then runs a bounded number of block Gauss-Newton sweeps that refine every other node's horizontal
+ * position while holding the rest fixed. Positions are kept between rounds as warm starts, and each step is
+ * damped towards the previous position.
+ *
+ * Distances only fix the solution up to a rotation and a mirror about node 0. The warm start and the damping make
+ * the frame change slowly from round to round but do not hold it, so consumers must use the positions relative to
+ * each other (or align them to known bearings) rather than as fixed directions.
+ */
+
+#define SWARM_LOCALIZATION_NODE_MAX 21 // this drone plus up to 20 one-hop neighbors
+#define SWARM_LOCALIZATION_LINK_MAX (SWARM_LOCALIZATION_NODE_MAX * (SWARM_LOCALIZATION_NODE_MAX - 1) / 2)
+#define SWARM_LOCALIZATION_NODE_NONE 0xFF
+#define SWARM_LOCALIZATION_SWEEPS 4     // sweeps per round, each visits every link twice through the adjacency
+#define SWARM_LOCALIZATION_DAMPING 0.1f // Levenberg damping relative to the summed link weight of a node
+#define SWARM_LOCALIZATION_MIN_RANGE 1.0f // cm, below this the direction of a link is undefined
+
+typedef struct
+{
+  uint8_t from;
+  uint8_t to;
+  float distance; // cm
+  float weight;
+} Swarm_Localization_Link_t;
+
+typedef struct
+{
+  uint16_t address[SWARM_LOCALIZATION_NODE_MAX];
+  float x[SWARM_LOCALIZATION_NODE_MAX]; // cm, relative to node 0
+  float y[SWARM_LOCALIZATION_NODE_MAX]; // cm, relative to node 0
+  float z[SWARM_LOCALIZATION_NODE_MAX]; // cm, height given by the caller, not estimated
+  bool placed[SWARM_LOCALIZATION_NODE_MAX]; // has a position, either solved or initialized from a link
+  bool seen[SWARM_LOCALIZATION_NODE_MAX];   // registered in the current round
+  uint8_t nodeCount;
+  Swarm_Localization_Link_t link[SWARM_LOCALIZATION_LINK_MAX];
+  uint16_t linkCount;
+  /* Links of node i are adjacency[adjacencyStart[i]] up to adjacencyStart[i + 1], rebuilt once per solve. */
+  uint16_t adjacencyStart[SWARM_LOCALIZATION_NODE_MAX + 1];
+  uint16_t adjacency[2 * SWARM_LOCALIZATION_LINK_MAX];
+  float residual; // cm, weighted RMS of link residuals after the last solve
+  uint32_t round;
+} Swarm_Localization_t;
+
+void swarmLocalizationInit(Swarm_Localization_t *localization, uint16_t selfAddress);
+/* Start a new round, clears the links and marks every node except this drone as not seen. */
+void swarmLocalizationBeginRound(Swarm_Localization_t *localization);
+/* Find or add a node and set its height, returns SWARM_LOCALIZATION_NODE_NONE when full. */
+uint8_t swarmLocalizationNode(Swarm_Localization_t *localization, uint16_t address, float z);
+bool swarmLocalizationAddLink(Swarm_Localization_t *localization, uint8_t from, uint8_t to, float distance, float weight);
+/* Drop the nodes not seen in this round and run the sweeps, returns the residual. */
+float swarmLocalizationSolve(Swarm_Localization_t *localization, uint8_t sweeps);
+bool swarmLocalizationGetPosition(Swarm_Localization_t *localization, uint16_t address, float *x, float *y);
+
+#endif
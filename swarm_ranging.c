@@ -14,6 +14,17 @@
 #include "olsr.h"
 #include "timers.h"
 #include "static_mem.h"
+#include "param.h"
+#include "console.h"
+#ifdef RANGING_BENCHMARK_ENABLE
+#include "usec_time.h"
+#endif
+#ifdef RANGING_EVENT_RECORD_ENABLE
+#include "app_channel.h"
+#endif
+#ifdef ENABLE_SWARM_LOCALIZATION
+#include "swarm_localization.h"
+#endif
 
 #ifndef RANGING_DEBUG_ENABLE
 #undef DEBUG_PRINT
@@ -23,23 +34,6 @@
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define ABS(a) ((a) > 0 ? (a) : -(a))
-static uint16_t MY_UWB_ADDRESS;
-
-static QueueHandle_t rxQueue;
-static Neighbor_Set_t neighborSet;
-static TimerHandle_t neighborSetEvictionTimer;
-NO_DMA_CCM_SAFE_ZERO_INIT Ranging_Table_Set_t rangingTableSet;
-static TimerHandle_t rangingTableSetEvictionTimer;
-static UWB_Message_Listener_t listener;
-static TaskHandle_t uwbRangingTxTaskHandle = 0;
-static TaskHandle_t uwbRangingRxTaskHandle = 0;
-static int TfBufferIndex = 0;
-static Timestamp_Tuple_t TfBuffer[Tf_BUFFER_POOL_SIZE] = {0};
-static SemaphoreHandle_t TfBufferMutex;
-static int rangingSeqNumber = 1;
-static logVarId_t idVelocityX, idVelocityY, idVelocityZ;
-static logVarId_t idX, idY, idZ;
-static float velocity;
 static Ranging_Table_t EMPTY_RANGING_TABLE = {
     .neighborAddress = UWB_DEST_EMPTY,
     .Rp.timestamp.full = 0,
@@ -63,1536 +57,3765 @@ static Ranging_Table_t EMPTY_RANGING_TABLE = {
     .lastSendTime = 0,
     .distance = -1};
 
-int16_t distanceTowards[NEIGHBOR_ADDRESS_MAX + 1] = {[0 ... NEIGHBOR_ADDRESS_MAX] = -1};
-uint8_t distanceSource[NEIGHBOR_ADDRESS_MAX + 1] = {[0 ... NEIGHBOR_ADDRESS_MAX] = -1};
-float distanceReal[NEIGHBOR_ADDRESS_MAX + 1] = {[0 ... NEIGHBOR_ADDRESS_MAX] = -1};
-// Add by lcy
-static uint16_t txPeriodDelay = 0;            // the tx send period delay
-static SemaphoreHandle_t rangingTxTaskBinary; // if it is open, then tx, Semaphore for synchronization
-
 typedef struct Stastistic
 {
   uint16_t recvSeq;
   uint16_t recvnum;
   uint16_t compute1num;
   uint16_t compute2num;
+  uint16_t compute3num; // drift-compensated single-sided
+  uint16_t passivenum;  // passive distances between this neighbor and others
+  uint16_t stallnum;    // times the neighbor stalled, see RANGING_STALL_THRESHOLD
+  uint16_t lostnum;     // frames missed according to sequence number gaps
 } Stastistic;
-static Stastistic statistic[NEIGHBOR_ADDRESS_MAX + 1];
-static TimerHandle_t statisticTimer;
-
-static uint16_t MY_UWB_ADDRESS;
-int16_t TX_jitter = 0;
-uint16_t TX_PERIOD_IN_MS = 60;
-/*--5添加--*/
-static SemaphoreHandle_t rangingTableSetMutex;                 // 用于互斥访问rangingTableSet
-static median_data_t median_data[RANGING_TABLE_SIZE + 1];      // 存储测距的历史值
-static uint16_t rv_data_interval[RANGING_TABLE_SIZE + 1];      // 两次接收到数据包的时间间隔
-static uint8_t rv_data_interval_index[RANGING_TABLE_SIZE + 1]; // 两次接收到数据包的时间间隔下标
-static uint8_t rv_any_index = 0;
-static currentNeighborAddressInfo_t currentNeighborAddressInfo;
-static uint32_t latest_txTime;                                                  // 最新的发送数据包时间，用于日志
-static uint32_t neighbor_latest_rvTime[RANGING_TABLE_SIZE + 1];                 // 最新的接收数据包时间，用于日志
-static uint32_t last_swapPeriod_Time;                                           // 上一次变化周期的时间，如果距离上一次变换周期的时间>固定的传输周期，则恢复至固定传输周期
-static uint32_t last_swapPeriod_period;                                         // 上一次变化的周期值
-static tx_rv_interval_history_t tx_rv_interval_history[RANGING_TABLE_SIZE + 1]; //  两次的漂移差
-static uint8_t tx_rv_interval[RANGING_TABLE_SIZE + 1] = {0};                    // 两次漂移时间差
-// static uint8_t nextTransportPeriod = TX_PERIOD_IN_MS;                           // 发送数据包周期
-
-static SemaphoreHandle_t rangingTableSetMutex;            // 用于互斥访问rangingTableSet
-static median_data_t median_data[RANGING_TABLE_SIZE + 1]; // 存储测距的历史值
-/*--5添加--*/
-
-static logVarId_t idVelocityX, idVelocityY, idVelocityZ; // 从日志获取速度
-static float velocity;
-static bool MYisAlreadyTakeoff = false;
-static bool allIsTakeoff = false; // 判断是否所有的邻居无人机都起飞了
-static uint32_t tickInterval = 0; // 记录控制飞行的时间
-static int8_t stage = ZERO_STAGE; // 编队控制阶段
-// static bool allIsTakeoff = true; // 测试时，设置为true
-static leaderStateInfo_t leaderStateInfo;
-static neighborStateInfo_t neighborStateInfo; // 邻居的状态信息
 
-// Add by lcy
-inline static void txPeriodDelayset()
+#ifdef RANGING_BENCHMARK_ENABLE
+/* Counters behind the periodic benchmark report, per link values are kept to report deltas between reports. */
+typedef struct
 {
-  txPeriodDelay = MY_UWB_ADDRESS * 4;
-}
-int16_t getDistance(UWB_Address_t neighborAddress)
+  uint32_t txFrames;
+  uint32_t rxFrames;
+  uint32_t rxDropped; // dropped by rxLossPercent
+  uint64_t txGenerateUs;
+  uint64_t rxProcessUs;
+  uint16_t lastRecvnum[RANGING_TABLE_SIZE_MAX];
+  uint16_t lastLostnum[RANGING_TABLE_SIZE_MAX];
+  uint16_t lastUpdatenum[RANGING_TABLE_SIZE_MAX];
+  Time_t lastReportTime;
+} Ranging_Benchmark_t;
+#endif
+
+#ifdef RANGING_EVENT_RECORD_ENABLE
+/* Byte ring of records, see RANGING_RECORD_TYPE. A record that does not fit is dropped rather than overwriting
+ * older ones, since a replay needs every record from boot.
+ */
+typedef struct
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  return distanceTowards[neighborAddress];
-}
+  uint8_t buffer[RANGING_RECORD_BUFFER_SIZE];
+  uint16_t head; // next byte to write
+  uint16_t tail; // first byte of the oldest record
+  uint16_t used;
+  uint32_t lost; // records dropped for lack of room, a replay is only valid while this stays 0
+  Ranging_Record_Config_t config; // params as of the last CONFIG record
+  bool configRecorded;
+  volatile uint16_t rxQueueDropped; // counted by rangingRxCallback, reported with the next record
+  uint16_t rxQueueDroppedRecorded;
+  SemaphoreHandle_t mu;
+} Ranging_Record_t;
+#endif
 
-void setDistance(UWB_Address_t neighborAddress, int16_t distance, uint8_t source)
+/* All state of one ranging instance, every function of the core takes it explicitly. The default instance run by
+ * rangingInit() is one statically sized object, so that its footprint is known at compile time (see
+ * printRangingMemoryBudget) and so that it can be placed in CCM: nothing in it is touched by DMA, frames are copied
+ * in and out through the rx queue and the TX task stack. Timer and task shims find it through their timer ID and
+ * task parameter, the radio callbacks and the getters for other modules use the default instance.
+ */
+struct Ranging_Context
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  // DEBUG_PRINT("setBeforeDistance: neighborAddress = %d\n", neighborAddress);
-  distanceTowards[neighborAddress] = distance;
+  /* Identity and tasks */
+  uint16_t myAddress;
+  QueueHandle_t rxQueue;
+  QueueHandle_t commandQueue; // Leader_Command_Update_t, filled by rangingRxCallback, drained by the rx task
+  UWB_Message_Listener_t listener;
+  TaskHandle_t uwbRangingTxTaskHandle;
+  TaskHandle_t uwbRangingRxTaskHandle;
+  TaskHandle_t neighborSetEventTaskHandle;
+  uint16_t txPeriodDelay;                // the tx send period delay
+  SemaphoreHandle_t rangingTxTaskBinary; // if it is open, then tx, Semaphore for synchronization
+  logVarId_t idVelocityX, idVelocityY, idVelocityZ; // 从日志获取速度
+  logVarId_t idX, idY, idZ;                         // 从日志获取位置
+  float velocity;                                   // m/s
+  Ranging_Own_State_t ownState;                     // sampled by rangingHandleRx/Tx under the table locks
+
+  /* Ranging */
+  Ranging_Table_Set_t rangingTableSet;
+  TimerHandle_t rangingTableSetEvictionTimer;
+  Neighbor_Set_t neighborSet;
+  TimerHandle_t neighborSetEvictionTimer;
+  Neighbor_Slot_Map_t neighborSlotMap; // 邻居地址到slot的映射
+  Timestamp_Tuple_t TfBuffer[Tf_BUFFER_POOL_SIZE];
+  int TfBufferIndex;
+  int TfBufferSize; // number of valid entries in TfBuffer
+  SemaphoreHandle_t TfBufferMutex;
+  uint16_t rangingSeqNumber; // wraps, compare with seqNumberLessThan()
+
+  /* Distances, by address */
+  int16_t distanceTowards[NEIGHBOR_ADDRESS_MAX + 1];
+  uint8_t distanceSource[NEIGHBOR_ADDRESS_MAX + 1];
+  float distanceReal[NEIGHBOR_ADDRESS_MAX + 1];
+  int16_t distanceRaw[NEIGHBOR_ADDRESS_MAX + 1];
+
+  /* Per neighbor, by slot */
+  Distance_Filter_t distanceFilter[RANGING_TABLE_SIZE_MAX];     // 测距滤波器状态
+  Stastistic statistic[RANGING_TABLE_SIZE_MAX];
+  Distance_Latency_t distanceLatency[RANGING_TABLE_SIZE_MAX];   // 距离被使用时的时延分布
+  Link_Quality_t linkQuality[RANGING_TABLE_SIZE_MAX];           // 链路质量
+  Neighbor_Motion_t neighborMotion[RANGING_TABLE_SIZE_MAX];     // 邻居距离及其变化率的跟踪
+  neighborStateInfo_t neighborStateInfo;                        // 邻居的状态信息
+  Neighbor_State_Snapshot_t neighborStateSnapshots[2];          // 邻居状态快照双缓冲
+  volatile uint8_t neighborStateSnapshotFront;                  // 当前可读的快照下标
+  uint32_t neighborStateVersion;                                // 最新发布的快照版本
+  Passive_Distance_Matrix_t passiveDistanceMatrix;              // 被动测得的邻居之间的距离，按slot对索引
+#ifdef ENABLE_DISTANCE_SHARING
+  Shared_Distance_Row_t sharedDistance[RANGING_TABLE_SIZE_MAX]; // 邻居上报的距离，按上报者的slot索引
+#endif
+#ifdef ENABLE_SWARM_LOCALIZATION
+  Swarm_Localization_t swarmLocalization; // 相对定位，本机为0号节点
+  uint8_t swarmLocalizationNodes;         // 上一轮参与解算的节点数，用于log
+  float swarmLocalizationResidual;        // 上一轮解算的残差(cm)，用于log
+#endif
+#ifdef ENABLE_CHANNEL_HOPPING
+  Channel_Hopping_t channelHopping; // 信道分组与跳频状态
+#endif
 
-  distanceSource[neighborAddress] = source;
-}
+  /* Mission */
+  bool myTakeoff;
+  leaderStateInfo_t leaderStateInfo;
+  int8_t missionStage;                 // 任务时间线最近一次计算的阶段，经leaderCommand发布
+  TimerHandle_t missionTimelineTimer;
+  Leader_Command_t leaderCommand;      // 随每帧报文头洪泛的leader命令，由leaderCommandMu保护
+  SemaphoreHandle_t leaderCommandMu;   // leaderCommand is written by the rx task, the mission timer and the commander
+  uint16_t commandRepublished;         // leader only, epochs moved past a newer one still flooding after a reboot
+
+  /* Statistics and params */
+  TimerHandle_t statisticTimer;
+  uint16_t getStatisticIndex;
+#ifdef RANGING_BENCHMARK_ENABLE
+  Ranging_Benchmark_t benchmark;
+#endif
+  Ranging_Params_t *params;     // &ownParams, or the params outside the context for the default instance
+  Ranging_Params_t ownParams;
+  uint32_t rxLossRandom;        // xorshift state of the injected loss, per instance so that runs are reproducible
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  Ranging_Record_t record;
+  bool replaying; // inputs come from rangingReplayRecord, nothing is sampled or recorded
+#endif
+};
 
-static int16_t median_filter_3(int16_t *data)
-{
-  int16_t middle;
-  if ((data[0] <= data[1]) && (data[0] <= data[2]))
-  {
-    middle = (data[1] <= data[2]) ? data[1] : data[2];
-  }
-  else if ((data[1] <= data[0]) && (data[1] <= data[2]))
-  {
-    middle = (data[0] <= data[2]) ? data[0] : data[2];
+_Static_assert(sizeof(Ranging_Context_t) <= RANGING_CONTEXT_SIZE_MAX, "ranging state no longer fits its arena");
+NO_DMA_CCM_SAFE_ZERO_INIT static Ranging_Context_t rangingContext;
+
+#ifdef RANGING_EVENT_RECORD_ENABLE
+#define RANGING_PARAMS_RECORD_DEFAULT .recordEnable = 1,
+#else
+#define RANGING_PARAMS_RECORD_DEFAULT
+#endif
+#define RANGING_PARAMS_DEFAULT                                                                               \
+  {                                                                                                          \
+    .distanceFilterType = DISTANCE_FILTER_NONE, .passiveRangingEnable = 1, .rxLossPercent = 0,               \
+    RANGING_PARAMS_RECORD_DEFAULT                                                                            \
+    .missionTimeline = {.convergeTime = 2000, .followTime = 10000, .maintainTime = 5000, .rotationCount = 8} \
   }
-  else
+
+/* Params of the default instance, initialized data outside the zeroed context so that values the client sets before
+ * rangingInit() are not reset by it.
+ */
+static Ranging_Params_t rangingParams = RANGING_PARAMS_DEFAULT;
+
+static const uint16_t DISTANCE_LATENCY_BIN_EDGES[DISTANCE_LATENCY_BIN_COUNT] = {10, 20, 40, 60, 100, 150, 200, UINT16_MAX};
+
+/* Everything with a default other than zero is set here before any task starts. */
+static void rangingContextInit(Ranging_Context_t *ctx)
+{
+  memset(ctx, 0, sizeof(Ranging_Context_t));
+  for (int i = 0; i <= NEIGHBOR_ADDRESS_MAX; i++)
   {
-    middle = (data[0] <= data[1]) ? data[0] : data[1];
+    ctx->distanceTowards[i] = -1;
+    ctx->distanceSource[i] = -1;
+    ctx->distanceReal[i] = -1;
+    ctx->distanceRaw[i] = -1;
   }
-  return middle;
+  ctx->ownParams = (Ranging_Params_t)RANGING_PARAMS_DEFAULT;
+  ctx->params = &ctx->ownParams;
+  ctx->getStatisticIndex = 3;
+  ctx->missionStage = ZERO_STAGE;
 }
 
-void rangingTableBufferInit(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer)
+// Add by lcy
+inline static void txPeriodDelayset(Ranging_Context_t *ctx)
 {
-  rangingTableBuffer->cur = 0;
-  rangingTableBuffer->latest = 0;
-  Timestamp_Tuple_t empty = {.seqNumber = 0, .timestamp.full = 0};
-  for (set_index_t i = 0; i < Tr_Rr_BUFFER_POOL_SIZE; i++)
-  {
-    rangingTableBuffer->candidates[i].Tr = empty;
-    rangingTableBuffer->candidates[i].Rr = empty;
-  }
+  ctx->txPeriodDelay = ctx->myAddress * 4;
 }
 
-void rangingTableTxRxHistoryInit(Ranging_Table_Tx_Rx_History_t *history)
+#ifdef RANGING_EVENT_RECORD_ENABLE
+static void rangingRecordCopyIn(Ranging_Record_t *record, const void *data, uint16_t length)
 {
-  Timestamp_Tuple_t empty = {.seqNumber = 0, .timestamp.full = 0};
-  history->Tx = empty;
-  history->Rx = empty;
+  uint16_t first = MIN(length, RANGING_RECORD_BUFFER_SIZE - record->head);
+  memcpy(&record->buffer[record->head], data, first);
+  memcpy(record->buffer, (const uint8_t *)data + first, length - first);
+  record->head = (record->head + length) % RANGING_RECORD_BUFFER_SIZE;
+  record->used += length;
 }
 
-void printStasticCallback(TimerHandle_t timer)
+static void rangingRecordCopyOut(Ranging_Record_t *record, void *data, uint16_t length)
 {
-  DEBUG_PRINT("recvnum:%d,compute1num:%d,compute2num:%d\n",
-              statistic[1].recvnum,
-              statistic[1].compute1num,
-              statistic[1].compute2num);
+  uint16_t first = MIN(length, RANGING_RECORD_BUFFER_SIZE - record->tail);
+  memcpy(data, &record->buffer[record->tail], first);
+  memcpy((uint8_t *)data + first, record->buffer, length - first);
+  record->tail = (record->tail + length) % RANGING_RECORD_BUFFER_SIZE;
+  record->used -= length;
 }
 
-void statisticInit()
+static bool rangingRecordPut(Ranging_Record_t *record, uint8_t type, const void *part1, uint16_t length1,
+                             const void *part2, uint16_t length2)
 {
-  for (int i = 0; i <= NEIGHBOR_ADDRESS_MAX; i++)
+  Ranging_Record_Header_t header = {.type = type, .length = length1 + length2, .tick = xTaskGetTickCount()};
+  if (RANGING_RECORD_BUFFER_SIZE - record->used < sizeof(header) + header.length)
   {
-    statistic[i].recvSeq = 0;
-    statistic[i].recvnum = 0;
-    statistic[i].compute1num = 0;
-    statistic[i].compute2num = 0;
+    record->lost++;
+    return false;
   }
-  statisticTimer = xTimerCreate("statisticTimer",
-                                M2T(NEIGHBOR_SET_HOLD_TIME / 2),
-                                pdTRUE,
-                                (void *)0,
-                                printStasticCallback);
-  xTimerStart(statisticTimer, M2T(0));
+  rangingRecordCopyIn(record, &header, sizeof(header));
+  rangingRecordCopyIn(record, part1, length1);
+  rangingRecordCopyIn(record, part2, length2);
+  return true;
 }
 
-void rangingTableBufferUpdate(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer,
-                              Timestamp_Tuple_t Tr,
-                              Timestamp_Tuple_t Rr)
+/* Append one record of up to two payload parts. A CONFIG record goes first whenever the params changed, and the rx
+ * queue drops counted since the previous record go right before it.
+ */
+static void rangingRecord(Ranging_Context_t *ctx, uint8_t type, const void *part1, uint16_t length1,
+                          const void *part2, uint16_t length2)
 {
-  rangingTableBuffer->candidates[rangingTableBuffer->cur].Tr = Tr;
-  rangingTableBuffer->candidates[rangingTableBuffer->cur].Rr = Rr;
-  // shift
-  rangingTableBuffer->latest = rangingTableBuffer->cur;
-  rangingTableBuffer->cur = (rangingTableBuffer->cur + 1) % Tr_Rr_BUFFER_POOL_SIZE;
+  Ranging_Record_t *record = &ctx->record;
+  if (!ctx->params->recordEnable || ctx->replaying)
+  {
+    return;
+  }
+  xSemaphoreTake(record->mu, portMAX_DELAY);
+  Ranging_Record_Config_t config = {.distanceFilterType = ctx->params->distanceFilterType,
+                                    .passiveRangingEnable = ctx->params->passiveRangingEnable,
+                                    .rxLossPercent = ctx->params->rxLossPercent,
+                                    .missionTimeline = ctx->params->missionTimeline};
+  if (!record->configRecorded || memcmp(&config, &record->config, sizeof(config)) != 0)
+  {
+    record->configRecorded = rangingRecordPut(record, RANGING_RECORD_CONFIG, &config, sizeof(config), NULL, 0);
+    record->config = config;
+  }
+  uint16_t dropped = record->rxQueueDropped - record->rxQueueDroppedRecorded;
+  if (dropped && rangingRecordPut(record, RANGING_RECORD_RX_QUEUE_DROP, &dropped, sizeof(dropped), NULL, 0))
+  {
+    record->rxQueueDroppedRecorded += dropped;
+  }
+  rangingRecordPut(record, type, part1, length1, part2, length2);
+  xSemaphoreGive(record->mu);
 }
 
-Ranging_Table_Tr_Rr_Candidate_t rangingTableBufferGetCandidate(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer,
-                                                               Timestamp_Tuple_t Tf, Timestamp_Tuple_t Tp)
+static void rangingRecordTimer(Ranging_Context_t *ctx, RANGING_RECORD_TIMER_ID timer)
 {
-  set_index_t index = rangingTableBuffer->latest;
-  uint64_t rightBound = Tf.timestamp.full % UWB_MAX_TIMESTAMP;
-  uint64_t leftBound = Tp.timestamp.full % UWB_MAX_TIMESTAMP;
-  Ranging_Table_Tr_Rr_Candidate_t candidate = {.Rr.timestamp.full = 0, .Tr.timestamp.full = 0};
+  uint8_t id = timer;
+  rangingRecord(ctx, RANGING_RECORD_TIMER, &id, sizeof(id), NULL, 0);
+}
 
-  for (int count = 0; count < Tr_Rr_BUFFER_POOL_SIZE; count++)
+int32_t rangingRecordDrain(Ranging_Context_t *ctx, uint8_t *buffer, uint16_t size)
+{
+  Ranging_Record_t *record = &ctx->record;
+  int32_t count = 0;
+  xSemaphoreTake(record->mu, portMAX_DELAY);
+  while (record->used)
   {
-    if (rangingTableBuffer->candidates[index].Rr.timestamp.full &&
-        rangingTableBuffer->candidates[index].Rr.timestamp.full % UWB_MAX_TIMESTAMP < rightBound &&
-        rangingTableBuffer->candidates[index].Rr.timestamp.full % UWB_MAX_TIMESTAMP > leftBound &&
-        rangingTableBuffer->candidates[index].Rr.seqNumber == rangingTableBuffer->candidates[index].Tr.seqNumber)
+    Ranging_Record_Header_t header;
+    uint16_t tail = record->tail;
+    rangingRecordCopyOut(record, &header, sizeof(header));
+    if (count + sizeof(header) + header.length > size)
     {
-      candidate.Tr = rangingTableBuffer->candidates[index].Tr;
-      candidate.Rr = rangingTableBuffer->candidates[index].Rr;
+      /* Leave the record in place for the next read, a record that can never fit is reported instead. */
+      record->tail = tail;
+      record->used += sizeof(header);
+      if (count == 0)
+      {
+        count = -(int32_t)(sizeof(header) + header.length);
+      }
       break;
     }
-    index = (index - 1 + Tr_Rr_BUFFER_POOL_SIZE) % Tr_Rr_BUFFER_POOL_SIZE;
+    memcpy(buffer + count, &header, sizeof(header));
+    rangingRecordCopyOut(record, buffer + count + sizeof(header), header.length);
+    count += sizeof(header) + header.length;
   }
-
-  return candidate;
+  xSemaphoreGive(record->mu);
+  return count;
 }
 
-Ranging_Table_Tr_Rr_Candidate_t rangingTableBufferGetLatest(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer)
+int32_t rangingRecordRead(uint8_t *buffer, uint16_t size)
 {
-
-  Ranging_Table_Tr_Rr_Candidate_t candidate = {.Rr.timestamp.full = 0, .Tr.timestamp.full = 0};
-  int index = rangingTableBuffer->latest;
-  candidate.Tr = rangingTableBuffer->candidates[index].Tr;
-  candidate.Rr = rangingTableBuffer->candidates[index].Rr;
-
-  return candidate;
+  return rangingRecordDrain(&rangingContext, buffer, size);
 }
 
-void updateTfBuffer(Timestamp_Tuple_t timestamp)
+/* Stream the records to the client over the app channel as a plain byte stream, see host/ranging_record_capture.py.
+ * Each packet starts with a sequence number so that the client can tell where packets went missing.
+ */
+typedef struct
 {
-  xSemaphoreTake(TfBufferMutex, portMAX_DELAY);
-  TfBufferIndex++;
-  TfBufferIndex %= Tf_BUFFER_POOL_SIZE;
-  TfBuffer[TfBufferIndex] = timestamp;
-  //  DEBUG_PRINT("updateTfBuffer: time = %llu, seq = %d\n", TfBuffer[TfBufferIndex].timestamp.full, TfBuffer[TfBufferIndex].seqNumber);
-  xSemaphoreGive(TfBufferMutex);
-}
+  uint8_t seqNumber;
+  uint8_t data[APPCHANNEL_MTU - 1];
+} __attribute__((packed)) Ranging_Record_Packet_t;
 
-Timestamp_Tuple_t findTfBySeqNumber(uint16_t seqNumber)
+static void rangingRecordDrainTask(void *parameters)
 {
-  xSemaphoreTake(TfBufferMutex, portMAX_DELAY);
-  Timestamp_Tuple_t Tf = {.timestamp.full = 0, .seqNumber = 0};
-  int startIndex = TfBufferIndex;
-  /* Backward search */
-  for (int i = startIndex; i >= 0; i--)
+  Ranging_Context_t *ctx = (Ranging_Context_t *)parameters;
+  static uint8_t records[RANGING_RECORD_SIZE_MAX];
+  static Ranging_Record_Packet_t packet;
+  systemWaitStart();
+
+  while (true)
   {
-    if (TfBuffer[i].seqNumber == seqNumber)
+    int32_t count = rangingRecordDrain(ctx, records, sizeof(records));
+    ASSERT(count >= 0);
+    if (count == 0)
     {
-      Tf = TfBuffer[i];
-      break;
+      vTaskDelay(M2T(RANGING_RECORD_DRAIN_PERIOD));
+      continue;
     }
-  }
-  if (!Tf.timestamp.full)
-  {
-    /* Forward search */
-    for (int i = startIndex + 1; i < Tf_BUFFER_POOL_SIZE; i++)
+    for (int32_t offset = 0; offset < count; offset += sizeof(packet.data))
     {
-      if (TfBuffer[i].seqNumber == seqNumber)
-      {
-        Tf = TfBuffer[i];
-        break;
-      }
+      uint16_t length = MIN(count - offset, sizeof(packet.data));
+      memcpy(packet.data, records + offset, length);
+      appchannelSendDataPacketBlock(&packet, sizeof(packet.seqNumber) + length);
+      packet.seqNumber++;
     }
   }
-  xSemaphoreGive(TfBufferMutex);
-  return Tf;
-}
-
-Timestamp_Tuple_t getLatestTxTimestamp()
-{
-  return TfBuffer[TfBufferIndex];
 }
+#endif
 
-void getLatestNTxTimestamps(Timestamp_Tuple_t *timestamps, int n)
+/* Sample what the core reads from the estimator, a replay provides the recorded sample instead. */
+static void rangingOwnStateSample(Ranging_Context_t *ctx)
 {
-  ASSERT(n <= Tf_BUFFER_POOL_SIZE);
-  xSemaphoreTake(TfBufferMutex, portMAX_DELAY);
-  int startIndex = (TfBufferIndex + 1 - n + Tf_BUFFER_POOL_SIZE) % Tf_BUFFER_POOL_SIZE;
-  for (int i = n - 1; i >= 0; i--)
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  if (ctx->replaying)
   {
-    timestamps[i] = TfBuffer[startIndex];
-    startIndex = (startIndex + 1) % Tf_BUFFER_POOL_SIZE;
+    return;
   }
-  xSemaphoreGive(TfBufferMutex);
+#endif
+  Ranging_Own_State_t *state = &ctx->ownState;
+  state->x = logGetFloat(ctx->idX);
+  state->y = logGetFloat(ctx->idY);
+  state->z = logGetFloat(ctx->idZ);
+  state->vx = logGetFloat(ctx->idVelocityX);
+  state->vy = logGetFloat(ctx->idVelocityY);
+  state->vz = logGetFloat(ctx->idVelocityZ);
+  /* The state is packed for the records, read through aligned locals. */
+  short velocityXInWorld, velocityYInWorld;
+  float gyroZ;
+  uint16_t positionZ;
+  estimatorKalmanGetSwarmInfo(&velocityXInWorld, &velocityYInWorld, &gyroZ, &positionZ);
+  state->velocityXInWorld = velocityXInWorld;
+  state->velocityYInWorld = velocityYInWorld;
+  state->gyroZ = gyroZ;
+  state->positionZ = positionZ;
 }
-
-Ranging_Table_Set_t *getGlobalRangingTableSet()
+int16_t distanceGet(Ranging_Context_t *ctx, UWB_Address_t neighborAddress)
 {
-  return &rangingTableSet;
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return ctx->distanceTowards[neighborAddress];
 }
 
-void rangingTableInit(Ranging_Table_t *table, UWB_Address_t neighborAddress)
+int16_t getDistance(UWB_Address_t neighborAddress)
 {
-  memset(table, 0, sizeof(Ranging_Table_t));
-  table->state = RANGING_STATE_S1;
-  table->neighborAddress = neighborAddress;
-  table->period = RANGING_PERIOD;
-  table->nextExpectedDeliveryTime = 0;
-  table->expirationTime = 0;
-  table->lastSendTime = 0;
-  rangingTableBufferInit(&table->TrRrBuffer); // Can be safely removed this line since memset() is called
-  rangingTableTxRxHistoryInit(&table->TxRxHistory);
+  return distanceGet(&rangingContext, neighborAddress);
 }
 
-/* Ranging Table Set Operations */
-void rangingTableSetInit(Ranging_Table_Set_t *set)
+void setDistance(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, int16_t distance, uint8_t source)
 {
-  set->mu = xSemaphoreCreateMutex();
-  set->size = 0;
-  for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  // DEBUG_PRINT("setBeforeDistance: neighborAddress = %d\n", neighborAddress);
+  ctx->distanceTowards[neighborAddress] = distance;
+
+  ctx->distanceSource[neighborAddress] = source;
+  if (distance < 0)
   {
-    set->tables[i] = EMPTY_RANGING_TABLE;
+    ctx->distanceRaw[neighborAddress] = distance;
   }
 }
 
-static void rangingTableSetSwapTable(Ranging_Table_Set_t *set, int first, int second)
+int16_t rawDistanceGet(Ranging_Context_t *ctx, UWB_Address_t neighborAddress)
 {
-  Ranging_Table_t temp = set->tables[first];
-  set->tables[first] = set->tables[second];
-  set->tables[second] = temp;
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return ctx->distanceRaw[neighborAddress];
 }
 
-static int rangingTableSetSearchTable(Ranging_Table_Set_t *set, UWB_Address_t targetAddress)
+int16_t getRawDistance(UWB_Address_t neighborAddress)
 {
-  /* Binary Search */
-  int left = -1, right = set->size, res = -1;
-  while (left + 1 != right)
-  {
-    int mid = left + (right - left) / 2;
-    if (set->tables[mid].neighborAddress == targetAddress)
-    {
-      res = mid;
-      break;
-    }
-    else if (set->tables[mid].neighborAddress > targetAddress)
-    {
-      right = mid;
-    }
-    else
-    {
-      left = mid;
-    }
-  }
-  return res;
+  return rawDistanceGet(&rangingContext, neighborAddress);
 }
 
-typedef int (*rangingTableCompareFunc)(Ranging_Table_t *, Ranging_Table_t *);
-
-static int COMPARE_BY_ADDRESS(Ranging_Table_t *first, Ranging_Table_t *second)
+static int16_t median_filter_3(int16_t *data)
 {
-  if (first->neighborAddress == second->neighborAddress)
+  int16_t middle;
+  if ((data[0] <= data[1]) && (data[0] <= data[2]))
   {
-    return 0;
+    middle = (data[1] <= data[2]) ? data[1] : data[2];
   }
-  if (first->neighborAddress > second->neighborAddress)
+  else if ((data[1] <= data[0]) && (data[1] <= data[2]))
   {
-    return 1;
+    middle = (data[0] <= data[2]) ? data[0] : data[2];
   }
-  return -1;
+  else
+  {
+    middle = (data[0] <= data[1]) ? data[0] : data[1];
+  }
+  return middle;
 }
 
-static int COMPARE_BY_EXPIRATION_TIME(Ranging_Table_t *first, Ranging_Table_t *second)
+/* Median of a small window by insertion sort on a copy, n <= DISTANCE_FILTER_WINDOW_SIZE. */
+static int16_t median_filter_n(int16_t *data, uint8_t n)
 {
-  if (first->expirationTime == second->expirationTime)
-  {
-    return 0;
-  }
-  if (first->expirationTime > second->expirationTime)
+  int16_t sorted[DISTANCE_FILTER_WINDOW_SIZE];
+  for (uint8_t i = 0; i < n; i++)
   {
-    return -1;
+    int16_t value = data[i];
+    int8_t j = i - 1;
+    while (j >= 0 && sorted[j] > value)
+    {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = value;
   }
-  return 1;
+  return sorted[n / 2];
 }
 
-static int COMPARE_BY_NEXT_EXPECTED_DELIVERY_TIME(Ranging_Table_t *first, Ranging_Table_t *second)
+void distanceFilterInit(Distance_Filter_t *filter)
 {
-  if (first->nextExpectedDeliveryTime == second->nextExpectedDeliveryTime)
+  for (int i = 0; i < DISTANCE_FILTER_WINDOW_SIZE; i++)
   {
-    return 0;
+    filter->history[i] = 0;
   }
-  if (first->nextExpectedDeliveryTime > second->nextExpectedDeliveryTime)
+  filter->type = DISTANCE_FILTER_NONE;
+  filter->index_inserting = 0;
+  filter->count = 0;
+  filter->rejectionCount = 0;
+  filter->estimate = 0;
+  filter->variance = 0;
+  filter->lastUpdateTime = 0;
+}
+
+static void distanceFilterPush(Distance_Filter_t *filter, int16_t distance)
+{
+  filter->history[filter->index_inserting] = distance;
+  filter->index_inserting = (filter->index_inserting + 1) % DISTANCE_FILTER_WINDOW_SIZE;
+  if (filter->count < DISTANCE_FILTER_WINDOW_SIZE)
   {
-    return 1;
+    filter->count++;
   }
-  return -1;
 }
 
-static int COMPARE_BY_LAST_SEND_TIME(Ranging_Table_t *first, Ranging_Table_t *second)
+/* Sliding median over the samples in the window, the window is not full during the first ones. */
+static int16_t distanceFilterMedian(Distance_Filter_t *filter, int16_t distance)
 {
-  if (first->lastSendTime == second->lastSendTime)
+  distanceFilterPush(filter, distance);
+  return median_filter_n(filter->history, filter->count);
+}
+
+/* Hampel identifier, an outlier is replaced by the window median. */
+static int16_t distanceFilterHampel(Distance_Filter_t *filter, int16_t distance)
+{
+  distanceFilterPush(filter, distance);
+  if (filter->count < DISTANCE_FILTER_WINDOW_SIZE)
   {
-    return 0;
+    return distance;
   }
-  if (first->lastSendTime > second->lastSendTime)
+  int16_t median = median_filter_n(filter->history, DISTANCE_FILTER_WINDOW_SIZE);
+  int16_t deviation[DISTANCE_FILTER_WINDOW_SIZE];
+  for (int i = 0; i < DISTANCE_FILTER_WINDOW_SIZE; i++)
   {
-    return 1;
+    deviation[i] = ABS(filter->history[i] - median);
   }
-  return -1;
+  /* Integer cm often give a MAD of 0, which would replace every sample that differs from the median. */
+  int16_t medianDeviation = median_filter_n(deviation, DISTANCE_FILTER_WINDOW_SIZE);
+  float mad = 1.4826f * MAX(medianDeviation, DISTANCE_FILTER_HAMPEL_MAD_MIN);
+  if (ABS(distance - median) > DISTANCE_FILTER_HAMPEL_THRESHOLD * mad)
+  {
+    return median;
+  }
+  return distance;
 }
 
-/* Build the heap */
-static void rangingTableSetArrange(Ranging_Table_Set_t *set, int index, int len, rangingTableCompareFunc compare)
+/* 1-D Kalman filter on distance, the process noise grows with the bound of relative speed (cm/s) since the
+ * direction towards the neighbor is unknown. Samples outside the innovation gate are rejected.
+ */
+static int16_t distanceFilterKalman(Distance_Filter_t *filter, int16_t distance, float relativeSpeed, Time_t curTime)
 {
-  int leftChild = 2 * index + 1;
-  int rightChild = 2 * index + 2;
-  int maxIndex = index;
-  if (leftChild < len && compare(&set->tables[maxIndex], &set->tables[leftChild]) < 0)
-  {
-    maxIndex = leftChild;
-  }
-  if (rightChild < len && compare(&set->tables[maxIndex], &set->tables[rightChild]) < 0)
+  if (filter->count == 0 || filter->rejectionCount >= DISTANCE_FILTER_MAX_REJECTION)
   {
-    maxIndex = rightChild;
+    filter->estimate = distance;
+    filter->variance = DISTANCE_FILTER_KALMAN_MEASURE_NOISE;
+    filter->rejectionCount = 0;
+    filter->count = 1;
+    filter->lastUpdateTime = curTime;
+    return distance;
   }
-  if (maxIndex != index)
+  float dt = T2M(curTime - filter->lastUpdateTime) / 1000.0f;
+  float motion = relativeSpeed * dt;
+  float predictedVariance = filter->variance + motion * motion + DISTANCE_FILTER_KALMAN_PROCESS_NOISE;
+  float innovation = distance - filter->estimate;
+  float innovationVariance = predictedVariance + DISTANCE_FILTER_KALMAN_MEASURE_NOISE;
+  if (innovation * innovation > DISTANCE_FILTER_KALMAN_GATE * innovationVariance)
   {
-    rangingTableSetSwapTable(set, index, maxIndex);
-    rangingTableSetArrange(set, maxIndex, len, compare);
+    filter->rejectionCount++;
+    return -1;
   }
+  float gain = predictedVariance / innovationVariance;
+  filter->estimate += gain * innovation;
+  filter->variance = (1 - gain) * predictedVariance;
+  filter->rejectionCount = 0;
+  filter->lastUpdateTime = curTime;
+  return (int16_t)(filter->estimate + 0.5f);
 }
 
-/* Sort the ranging table */
-static void rangingTableSetRearrange(Ranging_Table_Set_t *set, rangingTableCompareFunc compare)
+int16_t distanceFilterUpdate(Distance_Filter_t *filter, DISTANCE_FILTER_TYPE type, int16_t distance,
+                             float relativeSpeed, Time_t curTime)
 {
-  /* Build max heap */
-  for (int i = set->size / 2 - 1; i >= 0; i--)
+  /* Filter type is switched at runtime, restart from an empty state. */
+  if (filter->type != type)
   {
-    rangingTableSetArrange(set, i, set->size, compare);
+    distanceFilterInit(filter);
+    filter->type = type;
   }
-  for (int i = set->size - 1; i >= 0; i--)
+  switch (type)
   {
-    rangingTableSetSwapTable(set, 0, i);
-    rangingTableSetArrange(set, 0, i, compare);
+  case DISTANCE_FILTER_MEDIAN:
+    return distanceFilterMedian(filter, distance);
+  case DISTANCE_FILTER_HAMPEL:
+    return distanceFilterHampel(filter, distance);
+  case DISTANCE_FILTER_KALMAN:
+    return distanceFilterKalman(filter, distance, relativeSpeed, curTime);
+  default:
+    return distance;
   }
 }
 
-static int rangingTableSetClearExpire(Ranging_Table_Set_t *set)
+/* Sequence numbers are 16-bit and wrap after about an hour, order them with serial number arithmetic (RFC 1982). */
+static inline bool seqNumberLessThan(uint16_t a, uint16_t b)
 {
-  Time_t curTime = xTaskGetTickCount();
-  int evictionCount = 0;
+  return (int16_t)(a - b) < 0;
+}
 
-  for (int i = 0; i < rangingTableSet.size; i++)
+void rangingTableBufferInit(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer)
+{
+  rangingTableBuffer->cur = 0;
+  rangingTableBuffer->latest = 0;
+  Timestamp_Tuple_t empty = {.seqNumber = 0, .timestamp.full = 0};
+  for (set_index_t i = 0; i < Tr_Rr_BUFFER_POOL_SIZE; i++)
   {
-    if (rangingTableSet.tables[i].expirationTime <= curTime)
-    {
-      DEBUG_PRINT("rangingTableSetClearExpire: Clean ranging table for neighbor %u that expire at %lu.\n",
-                  rangingTableSet.tables[i].neighborAddress,
-                  rangingTableSet.tables[i].expirationTime);
-      setDistance(rangingTableSet.tables[i].neighborAddress, -1, -1);
-      rangingTableSet.tables[i] = EMPTY_RANGING_TABLE;
-      evictionCount++;
-    }
+    rangingTableBuffer->candidates[i].Tr = empty;
+    rangingTableBuffer->candidates[i].Rr = empty;
+    rangingTableBuffer->candidates[i].valid = 0;
   }
-  /* Keeps ranging table set in order. */
-  rangingTableSetRearrange(&rangingTableSet, COMPARE_BY_ADDRESS);
-  rangingTableSet.size -= evictionCount;
-
-  return evictionCount;
 }
 
-static void rangingTableSetClearExpireTimerCallback(TimerHandle_t timer)
+static inline bool rangingCandidateIsValid(const Ranging_Table_Tr_Rr_Candidate_t *candidate)
 {
-  xSemaphoreTake(rangingTableSet.mu, portMAX_DELAY);
+  return (candidate->valid & RANGING_CANDIDATE_VALID) == RANGING_CANDIDATE_VALID;
+}
 
-  Time_t curTime = xTaskGetTickCount();
-  DEBUG_PRINT("rangingTableSetClearExpireTimerCallback: Trigger expiration timer at %lu.\n", curTime);
+void rangingTableTxRxHistoryInit(Ranging_Table_Tx_Rx_History_t *history)
+{
+  Timestamp_Tuple_t empty = {.seqNumber = 0, .timestamp.full = 0};
+  history->Tx = empty;
+  history->Rx = empty;
+}
 
-  int evictionCount = rangingTableSetClearExpire(&rangingTableSet);
-  if (evictionCount > 0)
+#ifdef RANGING_BENCHMARK_ENABLE
+/* One JSON object per line, a "node" record followed by one "link" record per neighbor, rates are per second
+ * since the previous report (rxRateMilli and updateRateMilli in thousandths per second).
+ */
+static void printRangingBenchmark(Ranging_Context_t *ctx)
+{
+  Time_t curTime = xTaskGetTickCount();
+  uint32_t elapsedMs = T2M(curTime - ctx->benchmark.lastReportTime);
+  if (elapsedMs == 0)
   {
-    DEBUG_PRINT("rangingTableSetClearExpireTimerCallback: Evict total %d ranging tables.\n", evictionCount);
+    return;
   }
-  else
+  ctx->benchmark.lastReportTime = curTime;
+  consolePrintf("{\"type\":\"node\",\"node\":%u,\"t\":%lu,\"tx\":%lu,\"rx\":%lu,\"rxDropped\":%lu,"
+                "\"txUsPerFrame\":%lu,\"rxUsPerFrame\":%lu}\n",
+                ctx->myAddress,
+                T2M(curTime),
+                ctx->benchmark.txFrames,
+                ctx->benchmark.rxFrames,
+                ctx->benchmark.rxDropped,
+                ctx->benchmark.txFrames ? (uint32_t)(ctx->benchmark.txGenerateUs / ctx->benchmark.txFrames) : 0,
+                ctx->benchmark.rxFrames ? (uint32_t)(ctx->benchmark.rxProcessUs / ctx->benchmark.rxFrames) : 0);
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
   {
-    DEBUG_PRINT("rangingTableSetClearExpireTimerCallback: Evict none.\n");
+    if (ctx->neighborSlotMap.addressOf[slot] == UWB_DEST_EMPTY)
+    {
+      continue;
+    }
+    Stastistic *stat = &ctx->statistic[slot];
+    uint16_t updatenum = stat->compute1num + stat->compute2num + stat->compute3num;
+    uint16_t recv = stat->recvnum - ctx->benchmark.lastRecvnum[slot];
+    uint16_t lost = stat->lostnum - ctx->benchmark.lastLostnum[slot];
+    uint16_t updates = updatenum - ctx->benchmark.lastUpdatenum[slot];
+    ctx->benchmark.lastRecvnum[slot] = stat->recvnum;
+    ctx->benchmark.lastLostnum[slot] = stat->lostnum;
+    ctx->benchmark.lastUpdatenum[slot] = updatenum;
+    /* Rates in thousandths of a frame or an update per second to stay in integer printf, hence the Milli suffix. */
+    consolePrintf("{\"type\":\"link\",\"node\":%u,\"nbr\":%u,\"t\":%lu,\"rxRateMilli\":%lu,\"updateRateMilli\":%lu,"
+                  "\"lossPermille\":%lu,\"ageP50\":%u,\"ageP90\":%u,\"ageMax\":%u}\n",
+                  ctx->myAddress,
+                  ctx->neighborSlotMap.addressOf[slot],
+                  T2M(curTime),
+                  (uint32_t)recv * 1000000 / elapsedMs,
+                  (uint32_t)updates * 1000000 / elapsedMs,
+                  recv + lost ? (uint32_t)lost * 1000 / (recv + lost) : 0,
+                  ctx->distanceLatency[slot].p50,
+                  ctx->distanceLatency[slot].p90,
+                  ctx->distanceLatency[slot].maxAge);
   }
-
-  xSemaphoreGive(rangingTableSet.mu);
 }
+#endif
 
-bool rangingTableSetAddTable(Ranging_Table_Set_t *set, Ranging_Table_t table)
+static void distanceLatencyAdd(Distance_Latency_t *latency, uint32_t age)
 {
-  int index = rangingTableSetSearchTable(set, table.neighborAddress);
-  if (index != -1)
+  int bin = 0;
+  while (bin < DISTANCE_LATENCY_BIN_COUNT - 1 && age > DISTANCE_LATENCY_BIN_EDGES[bin])
   {
-    DEBUG_PRINT(
-        "rangingTableSetAddTable: Try to add an already added ranging table for neighbor %u, update it instead.\n",
-        table.neighborAddress);
-    set->tables[index] = table;
-    return true;
+    bin++;
   }
-  /* If ranging table is full now and there is no expired ranging table, then ignore. */
-  if (set->size == RANGING_TABLE_SIZE_MAX && rangingTableSetClearExpire(&rangingTableSet) == 0)
+  if (latency->histogram[bin] < UINT16_MAX)
   {
-    DEBUG_PRINT("rangingTableSetAddTable: Ranging table if full, ignore new neighbor %u.\n",
-                table.neighborAddress);
-    return false;
+    latency->histogram[bin]++;
   }
-  /* Add the new entry to the last */
-  uint8_t curIndex = set->size;
-  set->tables[curIndex] = table;
-  set->size++;
-  /* Sort the ranging table, keep it in order. */
-  rangingTableSetRearrange(set, COMPARE_BY_ADDRESS);
-  DEBUG_PRINT("rangingTableSetAddTable: Add new neighbor %u to ranging table.\n", table.neighborAddress);
-  return true;
+  latency->maxAge = MAX(latency->maxAge, MIN(age, UINT16_MAX));
 }
 
-void rangingTableSetUpdateTable(Ranging_Table_Set_t *set, Ranging_Table_t table)
+/* Record the age of a distance when getNeighborStateInfo() hands it to the estimator. */
+static void distanceLatencyRecord(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, Time_t measurementTick)
 {
-  int index = rangingTableSetSearchTable(set, table.neighborAddress);
-  if (index == -1)
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    DEBUG_PRINT("rangingTableSetUpdateTable: Cannot find correspond table for neighbor %u, add it instead.\n",
-                table.neighborAddress);
-    rangingTableSetAddTable(set, table);
+    return;
   }
-  else
+  distanceLatencyAdd(&ctx->distanceLatency[slot], T2M(xTaskGetTickCount() - measurementTick));
+}
+
+static uint16_t distanceLatencyPercentile(Distance_Latency_t *latency, uint8_t percent)
+{
+  uint32_t total = 0;
+  for (int bin = 0; bin < DISTANCE_LATENCY_BIN_COUNT; bin++)
   {
-    set->tables[index] = table;
-    DEBUG_PRINT("rangingTableSetUpdateTable: Update table for neighbor %u.\n", table.neighborAddress);
+    total += latency->histogram[bin];
+  }
+  if (total == 0)
+  {
+    return 0;
   }
+  uint32_t accumulated = 0;
+  for (int bin = 0; bin < DISTANCE_LATENCY_BIN_COUNT; bin++)
+  {
+    accumulated += latency->histogram[bin];
+    if (accumulated * 100 >= total * percent)
+    {
+      return bin == DISTANCE_LATENCY_BIN_COUNT - 1 ? latency->maxAge : DISTANCE_LATENCY_BIN_EDGES[bin];
+    }
+  }
+  return latency->maxAge;
 }
 
-void rangingTableSetRemoveTable(Ranging_Table_Set_t *set, UWB_Address_t neighborAddress)
+bool distanceLatencyGet(Ranging_Context_t *ctx, uint16_t neighborAddress, Distance_Latency_t *latency)
 {
-  if (set->size == 0)
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    DEBUG_PRINT("rangingTableSetRemoveTable: Ranging table is empty, ignore.\n");
-    return;
+    return false;
   }
-  int index = rangingTableSetSearchTable(set, neighborAddress);
-  if (index == -1)
+  *latency = ctx->distanceLatency[slot];
+  latency->p50 = distanceLatencyPercentile(latency, 50);
+  latency->p90 = distanceLatencyPercentile(latency, 90);
+  return true;
+}
+
+bool getDistanceLatency(uint16_t neighborAddress, Distance_Latency_t *latency)
+{
+  return distanceLatencyGet(&rangingContext, neighborAddress, latency);
+}
+
+void distanceLatencySetInit(Distance_Latency_Set_t *set)
+{
+  memset(set, 0, sizeof(Distance_Latency_Set_t));
+  for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
   {
-    DEBUG_PRINT("rangingTableSetRemoveTable: Cannot find correspond table for neighbor %u, ignore.\n", neighborAddress);
-    return;
+    set->address[i] = UWB_DEST_EMPTY;
   }
-  rangingTableSetSwapTable(set, index, set->size - 1);
-  set->tables[set->size - 1] = EMPTY_RANGING_TABLE;
-  set->size--;
-  rangingTableSetRearrange(set, COMPARE_BY_ADDRESS);
 }
 
-Ranging_Table_t rangingTableSetFindTable(Ranging_Table_Set_t *set, UWB_Address_t neighborAddress)
+/* Owned by the consumer, so reading a snapshot stays free of side effects on the ranging state. Neighbors that left
+ * the snapshot are forgotten, as their slot is in the ranging state.
+ */
+void distanceLatencyAccount(Distance_Latency_Set_t *set, const Neighbor_State_Snapshot_t *snapshot, Time_t curTime)
 {
-  int index = rangingTableSetSearchTable(set, neighborAddress);
-  Ranging_Table_t table = EMPTY_RANGING_TABLE;
-  if (index == -1)
+  for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
   {
-    DEBUG_PRINT("rangingTableSetFindTable: Cannot find correspond table for neighbor %u.\n", neighborAddress);
+    if (set->address[i] == UWB_DEST_EMPTY)
+    {
+      continue;
+    }
+    bool present = false;
+    for (int j = 0; j < snapshot->size && !present; j++)
+    {
+      present = snapshot->neighbors[j].address == set->address[i];
+    }
+    if (!present)
+    {
+      set->address[i] = UWB_DEST_EMPTY;
+      memset(&set->latency[i], 0, sizeof(Distance_Latency_t));
+    }
   }
-  else
+  for (int j = 0; j < snapshot->size; j++)
   {
-    table = set->tables[index];
+    const Neighbor_State_t *state = &snapshot->neighbors[j];
+    if (!state->refresh)
+    {
+      continue;
+    }
+    int index = -1;
+    for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
+    {
+      if (set->address[i] == state->address)
+      {
+        index = i;
+        break;
+      }
+      if (index == -1 && set->address[i] == UWB_DEST_EMPTY)
+      {
+        index = i;
+      }
+    }
+    if (index == -1)
+    {
+      continue;
+    }
+    set->address[index] = state->address;
+    distanceLatencyAdd(&set->latency[index], T2M(curTime - state->measurementTime));
   }
-  return table;
 }
 
-void neighborBitSetInit(Neighbor_Bit_Set_t *bitSet)
+bool distanceLatencySetGet(Distance_Latency_Set_t *set, UWB_Address_t neighborAddress, Distance_Latency_t *latency)
 {
-  bitSet->bits = 0;
-  bitSet->size = 0;
+  for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
+  {
+    if (set->address[i] == neighborAddress)
+    {
+      *latency = set->latency[i];
+      latency->p50 = distanceLatencyPercentile(latency, 50);
+      latency->p90 = distanceLatencyPercentile(latency, 90);
+      return true;
+    }
+  }
+  return false;
 }
 
-void neighborBitSetAdd(Neighbor_Bit_Set_t *bitSet, UWB_Address_t neighborAddress)
+void printStasticCallback(TimerHandle_t timer)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  uint64_t prevBits = bitSet->bits;
-  bitSet->bits |= (1ULL << neighborAddress);
-  if (prevBits != bitSet->bits)
+  Ranging_Context_t *ctx = (Ranging_Context_t *)pvTimerGetTimerID(timer);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecordTimer(ctx, RANGING_RECORD_TIMER_STATISTIC);
+#endif
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
   {
-    bitSet->size++;
+    if (ctx->neighborSlotMap.addressOf[slot] == UWB_DEST_EMPTY)
+    {
+      continue;
+    }
+    Distance_Latency_t latency = {0};
+    distanceLatencyGet(ctx, ctx->neighborSlotMap.addressOf[slot], &latency);
+    ctx->distanceLatency[slot].p50 = latency.p50;
+    ctx->distanceLatency[slot].p90 = latency.p90;
+    DEBUG_PRINT("neighbor:%u,recvnum:%d,compute1num:%d,compute2num:%d,age p50:%u,p90:%u,max:%u\n",
+                ctx->neighborSlotMap.addressOf[slot],
+                ctx->statistic[slot].recvnum,
+                ctx->statistic[slot].compute1num,
+                ctx->statistic[slot].compute2num,
+                ctx->distanceLatency[slot].p50,
+                ctx->distanceLatency[slot].p90,
+                ctx->distanceLatency[slot].maxAge);
   }
+#ifdef RANGING_BENCHMARK_ENABLE
+  printRangingBenchmark(ctx);
+#endif
 }
 
-void neighborBitSetRemove(Neighbor_Bit_Set_t *bitSet, UWB_Address_t neighborAddress)
+void statisticInit(Ranging_Context_t *ctx)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  uint64_t prevBits = bitSet->bits;
-  bitSet->bits &= ~(1ULL << neighborAddress);
-  if (prevBits != bitSet->bits)
+  for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
   {
-    bitSet->size--;
+    ctx->statistic[i].recvSeq = 0;
+    ctx->statistic[i].recvnum = 0;
+    ctx->statistic[i].compute1num = 0;
+    ctx->statistic[i].compute2num = 0;
+    ctx->statistic[i].compute3num = 0;
+    ctx->statistic[i].passivenum = 0;
+    ctx->statistic[i].stallnum = 0;
+    ctx->statistic[i].lostnum = 0;
   }
+  ctx->statisticTimer = xTimerCreate("statisticTimer",
+                                     M2T(NEIGHBOR_SET_HOLD_TIME / 2),
+                                     pdTRUE,
+                                     (void *)ctx,
+                                     printStasticCallback);
+  xTimerStart(ctx->statisticTimer, M2T(0));
 }
 
-void neighborBitSetClear(Neighbor_Bit_Set_t *bitSet)
+void rangingTableBufferUpdate(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer,
+                              Timestamp_Tuple_t Tr,
+                              Timestamp_Tuple_t Rr)
 {
-  bitSet->bits = 0;
-  bitSet->size = 0;
+  rangingTableBuffer->candidates[rangingTableBuffer->cur].Tr = Tr;
+  rangingTableBuffer->candidates[rangingTableBuffer->cur].Rr = Rr;
+  rangingTableBuffer->candidates[rangingTableBuffer->cur].valid = RANGING_CANDIDATE_VALID;
+  // shift
+  rangingTableBuffer->latest = rangingTableBuffer->cur;
+  rangingTableBuffer->cur = (rangingTableBuffer->cur + 1) % Tr_Rr_BUFFER_POOL_SIZE;
 }
 
-bool neighborBitSetHas(Neighbor_Bit_Set_t *bitSet, UWB_Address_t neighborAddress)
+Ranging_Table_Tr_Rr_Candidate_t rangingTableBufferGetCandidate(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer,
+                                                               Timestamp_Tuple_t Tf, Timestamp_Tuple_t Tp)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  return (bitSet->bits & (1ULL << neighborAddress)) != 0;
+  set_index_t index = rangingTableBuffer->latest;
+  /* Rr must lie in (Tp, Tf), measured from Tp so that it still holds when the UWB clock wraps in between. */
+  uint64_t rightBound = (Tf.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  Ranging_Table_Tr_Rr_Candidate_t candidate = {.Rr.timestamp.full = 0, .Tr.timestamp.full = 0, .valid = 0};
+
+  for (int count = 0; count < Tr_Rr_BUFFER_POOL_SIZE; count++)
+  {
+    uint64_t offset = (rangingTableBuffer->candidates[index].Rr.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+    if (rangingCandidateIsValid(&rangingTableBuffer->candidates[index]) &&
+        offset > 0 && offset < rightBound &&
+        rangingTableBuffer->candidates[index].Rr.seqNumber == rangingTableBuffer->candidates[index].Tr.seqNumber)
+    {
+      candidate = rangingTableBuffer->candidates[index];
+      break;
+    }
+    index = (index - 1 + Tr_Rr_BUFFER_POOL_SIZE) % Tr_Rr_BUFFER_POOL_SIZE;
+  }
+
+  return candidate;
 }
 
-Neighbor_Set_t *getGlobalNeighborSet()
+Ranging_Table_Tr_Rr_Candidate_t rangingTableBufferGetLatest(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer)
+{
+
+  Ranging_Table_Tr_Rr_Candidate_t candidate = {.Rr.timestamp.full = 0, .Tr.timestamp.full = 0, .valid = 0};
+  int index = rangingTableBuffer->latest;
+  if (rangingCandidateIsValid(&rangingTableBuffer->candidates[index]))
+  {
+    candidate = rangingTableBuffer->candidates[index];
+  }
+
+  return candidate;
+}
+
+void updateTfBuffer(Ranging_Context_t *ctx, Timestamp_Tuple_t timestamp)
 {
-  return &neighborSet;
+  xSemaphoreTake(ctx->TfBufferMutex, portMAX_DELAY);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecord(ctx, RANGING_RECORD_TX_TIMESTAMP, &timestamp, sizeof(timestamp), NULL, 0);
+#endif
+  ctx->TfBufferIndex++;
+  ctx->TfBufferIndex %= Tf_BUFFER_POOL_SIZE;
+  ctx->TfBuffer[ctx->TfBufferIndex] = timestamp;
+  ctx->TfBufferSize = MIN(ctx->TfBufferSize + 1, Tf_BUFFER_POOL_SIZE);
+  //  DEBUG_PRINT("updateTfBuffer: time = %llu, seq = %d\n", TfBuffer[TfBufferIndex].timestamp.full, TfBuffer[TfBufferIndex].seqNumber);
+  xSemaphoreGive(ctx->TfBufferMutex);
 }
 
-void neighborSetInit(Neighbor_Set_t *set)
+/* Search TfBuffer from the latest entry backwards, returns false if no valid Tf has this sequence number. */
+bool findTfBySeqNumber(Ranging_Context_t *ctx, uint16_t seqNumber, Timestamp_Tuple_t *Tf)
 {
-  set->size = 0;
-  set->mu = xSemaphoreCreateMutex();
-  neighborBitSetInit(&set->oneHop);
-  neighborBitSetInit(&set->twoHop);
-  set->neighborNewHooks.hook = NULL;
-  set->neighborNewHooks.next = NULL;
-  set->neighborExpirationHooks.hook = NULL;
-  set->neighborExpirationHooks.next = NULL;
-  set->neighborTopologyChangeHooks.hook = NULL;
-  set->neighborTopologyChangeHooks.next = NULL;
-  for (UWB_Address_t neighborAddress = 0; neighborAddress <= NEIGHBOR_ADDRESS_MAX; neighborAddress++)
+  xSemaphoreTake(ctx->TfBufferMutex, portMAX_DELAY);
+  bool found = false;
+  for (int i = 0; i < ctx->TfBufferSize; i++)
   {
-    set->expirationTime[neighborAddress] = 0;
-    neighborBitSetInit(&set->twoHopReachSets[neighborAddress]);
+    int index = (ctx->TfBufferIndex - i + Tf_BUFFER_POOL_SIZE) % Tf_BUFFER_POOL_SIZE;
+    if (ctx->TfBuffer[index].seqNumber == seqNumber)
+    {
+      *Tf = ctx->TfBuffer[index];
+      found = true;
+      break;
+    }
   }
+  xSemaphoreGive(ctx->TfBufferMutex);
+  return found;
 }
 
-bool neighborSetHas(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+Timestamp_Tuple_t getLatestTxTimestamp(Ranging_Context_t *ctx)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  return neighborBitSetHas(&set->oneHop, neighborAddress) || neighborBitSetHas(&set->twoHop, neighborAddress);
+  return ctx->TfBuffer[ctx->TfBufferIndex];
 }
 
-bool neighborSetHasOneHop(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+int getLatestNTxTimestamps(Ranging_Context_t *ctx, Timestamp_Tuple_t *timestamps, int n)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  return neighborBitSetHas(&set->oneHop, neighborAddress);
+  ASSERT(n <= Tf_BUFFER_POOL_SIZE);
+  xSemaphoreTake(ctx->TfBufferMutex, portMAX_DELAY);
+  int count = MIN(n, ctx->TfBufferSize);
+  for (int i = 0; i < count; i++)
+  {
+    timestamps[i] = ctx->TfBuffer[(ctx->TfBufferIndex - i + Tf_BUFFER_POOL_SIZE) % Tf_BUFFER_POOL_SIZE];
+  }
+  xSemaphoreGive(ctx->TfBufferMutex);
+  return count;
 }
 
-bool neighborSetHasTwoHop(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+_Static_assert(EXPIRATION_WHEEL_BUCKET_COUNT * EXPIRATION_WHEEL_RESOLUTION > RANGING_TABLE_HOLD_TIME &&
+                   EXPIRATION_WHEEL_BUCKET_COUNT * EXPIRATION_WHEEL_RESOLUTION > NEIGHBOR_SET_HOLD_TIME,
+               "Expiration wheel must span more than the hold time");
+_Static_assert((EXPIRATION_WHEEL_BUCKET_COUNT & (EXPIRATION_WHEEL_BUCKET_COUNT - 1)) == 0,
+               "EXPIRATION_WHEEL_BUCKET_COUNT must be a power of 2");
+
+static inline Time_t expirationWheelTickOf(Expiration_Wheel_t *wheel, Time_t time)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  return neighborBitSetHas(&set->twoHop, neighborAddress);
+  return (Time_t)(time - wheel->origin) / M2T(EXPIRATION_WHEEL_RESOLUTION);
 }
 
-void neighborSetAddOneHopNeighbor(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+void expirationWheelInit(Expiration_Wheel_t *wheel, Time_t curTime)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  bool isNewNeighbor = false;
-  if (!neighborSetHas(set, neighborAddress))
+  for (UWB_Address_t address = 0; address <= NEIGHBOR_ADDRESS_MAX; address++)
   {
-    isNewNeighbor = true;
+    wheel->deadline[address] = 0;
+    wheel->next[address] = EXPIRATION_WHEEL_NIL;
+    wheel->prev[address] = EXPIRATION_WHEEL_NIL;
+    wheel->bucketOf[address] = EXPIRATION_WHEEL_NIL;
   }
-  /* If neighbor is previous two-hop neighbor, remove it from two-hop neighbor set. */
-  if (neighborSetHasTwoHop(set, neighborAddress))
+  for (int bucket = 0; bucket < EXPIRATION_WHEEL_BUCKET_COUNT; bucket++)
   {
-    neighborSetRemoveNeighbor(set, neighborAddress);
+    wheel->heads[bucket] = EXPIRATION_WHEEL_NIL;
   }
-  /* Add one-hop neighbor. */
-  if (!neighborSetHasOneHop(set, neighborAddress))
+  wheel->origin = curTime;
+  wheel->lastTick = expirationWheelTickOf(wheel, curTime);
+}
+
+void expirationWheelCancel(Expiration_Wheel_t *wheel, UWB_Address_t address)
+{
+  ASSERT(address <= NEIGHBOR_ADDRESS_MAX);
+  uint8_t bucket = wheel->bucketOf[address];
+  if (bucket == EXPIRATION_WHEEL_NIL)
   {
-    neighborBitSetAdd(&set->oneHop, neighborAddress);
-    neighborSetUpdateExpirationTime(set, neighborAddress);
-    neighborSetHooksInvoke(&set->neighborTopologyChangeHooks, neighborAddress);
+    return;
   }
-  set->size = set->oneHop.size + set->twoHop.size;
-  if (isNewNeighbor)
+  if (wheel->prev[address] == EXPIRATION_WHEEL_NIL)
   {
-    neighborSetHooksInvoke(&set->neighborNewHooks, neighborAddress);
+    wheel->heads[bucket] = wheel->next[address];
   }
-}
-
-void neighborSetAddTwoHopNeighbor(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
-{
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  bool isNewNeighbor = false;
-  if (!neighborSetHas(set, neighborAddress))
+  else
   {
-    isNewNeighbor = true;
+    wheel->next[wheel->prev[address]] = wheel->next[address];
   }
-  /* If neighbor is previous one-hop neighbor, remove it from one-hop neighbor set. */
-  if (neighborSetHasOneHop(set, neighborAddress))
+  if (wheel->next[address] != EXPIRATION_WHEEL_NIL)
   {
-    neighborSetRemoveNeighbor(set, neighborAddress);
+    wheel->prev[wheel->next[address]] = wheel->prev[address];
   }
-  if (!neighborSetHasTwoHop(set, neighborAddress))
+  wheel->next[address] = EXPIRATION_WHEEL_NIL;
+  wheel->prev[address] = EXPIRATION_WHEEL_NIL;
+  wheel->bucketOf[address] = EXPIRATION_WHEEL_NIL;
+}
+
+void expirationWheelSchedule(Expiration_Wheel_t *wheel, UWB_Address_t address, Time_t deadline)
+{
+  ASSERT(address <= NEIGHBOR_ADDRESS_MAX);
+  expirationWheelCancel(wheel, address);
+  Time_t tick = expirationWheelTickOf(wheel, deadline);
+  /* Buckets up to lastTick are already processed, an overdue deadline goes to the next bucket to be visited. */
+  if ((int32_t)(tick - wheel->lastTick) <= 0)
   {
-    /* Add two-hop neighbor. */
-    neighborBitSetAdd(&set->twoHop, neighborAddress);
-    neighborSetUpdateExpirationTime(set, neighborAddress);
-    neighborSetHooksInvoke(&set->neighborTopologyChangeHooks, neighborAddress);
+    tick = wheel->lastTick + 1;
   }
-  set->size = set->oneHop.size + set->twoHop.size;
-  if (isNewNeighbor)
+  uint8_t bucket = tick & (EXPIRATION_WHEEL_BUCKET_COUNT - 1);
+  wheel->deadline[address] = deadline;
+  wheel->bucketOf[address] = bucket;
+  wheel->prev[address] = EXPIRATION_WHEEL_NIL;
+  wheel->next[address] = wheel->heads[bucket];
+  if (wheel->heads[bucket] != EXPIRATION_WHEEL_NIL)
   {
-    neighborSetHooksInvoke(&set->neighborNewHooks, neighborAddress);
+    wheel->prev[wheel->heads[bucket]] = address;
   }
+  wheel->heads[bucket] = address;
 }
 
-void neighborSetRemoveNeighbor(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+int expirationWheelAdvance(Expiration_Wheel_t *wheel, Time_t curTime, UWB_Address_t *expired)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  if (neighborSetHas(set, neighborAddress))
+  int expiredCount = 0;
+  Time_t curTick = expirationWheelTickOf(wheel, curTime);
+  Time_t tick = wheel->lastTick + 1;
+  /* Visiting more than one full round is pointless. */
+  if (curTick - wheel->lastTick > EXPIRATION_WHEEL_BUCKET_COUNT)
   {
-    if (neighborSetHasOneHop(set, neighborAddress) && neighborSetHasTwoHop(set, neighborAddress))
-    {
-      ASSERT(0); // impossible
-    }
-    set->expirationTime[neighborAddress] = 0;
-    if (neighborSetHasOneHop(set, neighborAddress))
+    tick = curTick - EXPIRATION_WHEEL_BUCKET_COUNT + 1;
+  }
+  for (; (int32_t)(tick - curTick) <= 0; tick++)
+  {
+    uint8_t address = wheel->heads[tick & (EXPIRATION_WHEEL_BUCKET_COUNT - 1)];
+    while (address != EXPIRATION_WHEEL_NIL)
     {
-      neighborBitSetRemove(&set->oneHop, neighborAddress);
-      /* Remove related path to two-hop neighbor */
-      for (UWB_Address_t twoHopNeighbor = 0; twoHopNeighbor <= NEIGHBOR_ADDRESS_MAX; twoHopNeighbor++)
+      uint8_t next = wheel->next[address];
+      if ((int32_t)(curTime - wheel->deadline[address]) >= 0)
       {
-        if (neighborSetHasRelation(set, neighborAddress, twoHopNeighbor))
-        {
-          neighborSetRemoveRelation(set, neighborAddress, twoHopNeighbor);
-        }
+        expirationWheelCancel(wheel, address);
+        expired[expiredCount++] = address;
       }
+      address = next;
     }
-    else if (neighborSetHasTwoHop(set, neighborAddress))
-    {
-      neighborBitSetRemove(&set->twoHop, neighborAddress);
-      /* Clear related two-hop reach set */
-      neighborBitSetClear(&set->twoHopReachSets[neighborAddress]);
-    }
-    else
-    {
-      ASSERT(0); // impossible
-    }
-    neighborSetHooksInvoke(&set->neighborTopologyChangeHooks, neighborAddress);
   }
-  set->size = set->oneHop.size + set->twoHop.size;
+  /* The bucket of curTick may still hold entries that expire later within this tick, visit it again next time. */
+  wheel->lastTick = curTick - 1;
+  return expiredCount;
 }
 
-bool neighborSetHasRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to)
+void neighborSlotMapInit(Neighbor_Slot_Map_t *map)
 {
-  ASSERT(from <= NEIGHBOR_ADDRESS_MAX);
-  ASSERT(to <= NEIGHBOR_ADDRESS_MAX);
-  return neighborBitSetHas(&set->twoHopReachSets[to], from);
-}
-
-void neighborSetAddRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to)
-{
-  ASSERT(from <= NEIGHBOR_ADDRESS_MAX);
-  ASSERT(to <= NEIGHBOR_ADDRESS_MAX);
-  if (!neighborBitSetHas(&set->twoHopReachSets[to], from))
+  map->size = 0;
+  for (UWB_Address_t neighborAddress = 0; neighborAddress <= NEIGHBOR_ADDRESS_MAX; neighborAddress++)
   {
-    neighborBitSetAdd(&set->twoHopReachSets[to], from);
-    neighborSetHooksInvoke(&set->neighborTopologyChangeHooks, from);
+    map->slotOf[neighborAddress] = NEIGHBOR_SLOT_NONE;
   }
-}
-
-void neighborSetRemoveRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to)
-{
-  ASSERT(from <= NEIGHBOR_ADDRESS_MAX);
-  ASSERT(to <= NEIGHBOR_ADDRESS_MAX);
-  if (neighborBitSetHas(&set->twoHopReachSets[to], from))
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
   {
-    neighborBitSetRemove(&set->twoHopReachSets[to], from);
-    neighborSetHooksInvoke(&set->neighborTopologyChangeHooks, from);
+    map->addressOf[slot] = UWB_DEST_EMPTY;
   }
 }
 
-void neighborSetRegisterNewNeighborHook(Neighbor_Set_t *set, neighborSetHook hook)
-{
-  ASSERT(hook);
-  Neighbor_Set_Hooks_t cur = {
-      .hook = hook,
-      .next = (struct Neighbor_Set_Hook_Node *)set->neighborNewHooks.hook};
-  set->neighborNewHooks = cur;
-}
-
-void neighborSetRegisterExpirationHook(Neighbor_Set_t *set, neighborSetHook hook)
+set_index_t neighborSlotMapGet(Neighbor_Slot_Map_t *map, UWB_Address_t neighborAddress)
 {
-  ASSERT(hook);
-  Neighbor_Set_Hooks_t cur = {
-      .hook = hook,
-      .next = (struct Neighbor_Set_Hook_Node *)set->neighborExpirationHooks.hook};
-  set->neighborExpirationHooks = cur;
+  if (neighborAddress > NEIGHBOR_ADDRESS_MAX)
+  {
+    return NEIGHBOR_SLOT_NONE;
+  }
+  return map->slotOf[neighborAddress];
 }
 
-void neighborSetRegisterTopologyChangeHook(Neighbor_Set_t *set, neighborSetHook hook)
+set_index_t neighborSlotMapAcquire(Neighbor_Slot_Map_t *map, UWB_Address_t neighborAddress)
 {
-  ASSERT(hook);
-  Neighbor_Set_Hooks_t cur = {
-      .hook = hook,
-      .next = (struct Neighbor_Set_Hook_Node *)set->neighborTopologyChangeHooks.hook};
-  set->neighborTopologyChangeHooks = cur;
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  if (map->slotOf[neighborAddress] != NEIGHBOR_SLOT_NONE)
+  {
+    return map->slotOf[neighborAddress];
+  }
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
+  {
+    if (map->addressOf[slot] == UWB_DEST_EMPTY)
+    {
+      map->addressOf[slot] = neighborAddress;
+      map->slotOf[neighborAddress] = slot;
+      map->size++;
+      return slot;
+    }
+  }
+  DEBUG_PRINT("neighborSlotMapAcquire: No free slot for neighbor %u.\n", neighborAddress);
+  return NEIGHBOR_SLOT_NONE;
 }
 
-void neighborSetHooksInvoke(Neighbor_Set_Hooks_t *hooks, UWB_Address_t neighborAddress)
+void neighborSlotMapRelease(Neighbor_Slot_Map_t *map, UWB_Address_t neighborAddress)
 {
-  neighborSetHook cur = hooks->hook;
-  while (cur != NULL)
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  set_index_t slot = map->slotOf[neighborAddress];
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    DEBUG_PRINT("neighborSetHooksInvoke: Invoke neighbor set hook.\n");
-    cur(neighborAddress);
-    cur = (neighborSetHook)hooks->next;
+    return;
   }
+  map->addressOf[slot] = UWB_DEST_EMPTY;
+  map->slotOf[neighborAddress] = NEIGHBOR_SLOT_NONE;
+  map->size--;
 }
 
-void neighborSetUpdateExpirationTime(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+/* Index of the unordered pair of two distinct slots in the passive distance matrix. */
+static int passiveDistancePairIndex(set_index_t slot1, set_index_t slot2)
 {
-  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
-  set->expirationTime[neighborAddress] = xTaskGetTickCount() + M2T(NEIGHBOR_SET_HOLD_TIME);
+  ASSERT(slot1 != slot2);
+  set_index_t row = MIN(slot1, slot2);
+  set_index_t col = MAX(slot1, slot2);
+  /* Offset of row in the upper triangle without diagonal, then column within the row. */
+  return row * (2 * RANGING_TABLE_SIZE_MAX - row - 1) / 2 + (col - row - 1);
 }
 
-int neighborSetClearExpire(Neighbor_Set_t *set)
+static void passiveDistanceClearSlot(Ranging_Context_t *ctx, set_index_t slot)
 {
-  Time_t curTime = xTaskGetTickCount();
-  int evictionCount = 0;
-  for (UWB_Address_t neighborAddress = 0; neighborAddress <= NEIGHBOR_ADDRESS_MAX; neighborAddress++)
+  for (set_index_t other = 0; other < RANGING_TABLE_SIZE_MAX; other++)
   {
-    if (neighborSetHas(set, neighborAddress) && set->expirationTime[neighborAddress] <= curTime)
+    if (other == slot)
     {
-      evictionCount++;
-      neighborSetRemoveNeighbor(set, neighborAddress);
-      DEBUG_PRINT("neighborSetClearExpire: neighbor %u expire at %lu.\n", neighborAddress, curTime);
-      neighborSetHooksInvoke(&set->neighborExpirationHooks, neighborAddress);
+      continue;
     }
+    int index = passiveDistancePairIndex(slot, other);
+    ctx->passiveDistanceMatrix.distance[index] = -1;
+    ctx->passiveDistanceMatrix.updateTime[index] = 0;
   }
-  return evictionCount;
 }
 
-static void topologySensing(Ranging_Message_t *rangingMessage)
+static void passiveDistanceUpdate(Ranging_Context_t *ctx, set_index_t slot1, set_index_t slot2, int16_t distance, Time_t curTime)
 {
-  //  DEBUG_PRINT("topologySensing: Received ranging message from neighbor %u.\n", rangingMessage->header.srcAddress);
-  UWB_Address_t neighborAddress = rangingMessage->header.srcAddress;
-  if (!neighborSetHasOneHop(&neighborSet, neighborAddress))
+  int index = passiveDistancePairIndex(slot1, slot2);
+  int16_t *current = &ctx->passiveDistanceMatrix.distance[index];
+  if (*current < 0 || curTime - ctx->passiveDistanceMatrix.updateTime[index] > M2T(RANGING_TABLE_HOLD_TIME))
   {
-    /* Add current neighbor to one-hop neighbor set. */
-    neighborSetAddOneHopNeighbor(&neighborSet, neighborAddress);
+    *current = distance;
   }
-  neighborSetUpdateExpirationTime(&neighborSet, neighborAddress);
-
-  /* Infer one-hop and tow-hop neighbors from received ranging message. */
-  uint8_t bodyUnitCount = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
-  for (int i = 0; i < bodyUnitCount; i++)
+  else
   {
-#ifdef ROUTING_OLSR_ENABLE
-    if (rangingMessage->bodyUnits[i].address == uwbGetAddress())
-    {
-      /* If been selected as MPR, add neighbor to mpr selector set. */
-      if (rangingMessage->bodyUnits[i].flags.MPR)
-      {
-        if (!mprSelectorSetHas(getGlobalMPRSelectorSet(), neighborAddress))
-        {
-          mprSelectorSetAdd(getGlobalMPRSelectorSet(), neighborAddress);
-        }
-        mprSelectorSetUpdateExpirationTime(getGlobalMPRSelectorSet(), neighborAddress);
-      }
-      else
-      {
-        if (mprSelectorSetHas(getGlobalMPRSelectorSet(), neighborAddress))
-        {
-          mprSelectorSetRemove(getGlobalMPRSelectorSet(), neighborAddress);
-        }
-      }
-    }
-#endif
-    UWB_Address_t twoHopNeighbor = rangingMessage->bodyUnits[i].address;
-    if (twoHopNeighbor != uwbGetAddress() && !neighborSetHasOneHop(&neighborSet, twoHopNeighbor))
-    {
-      /* If it is not one-hop neighbor then it is now my two-hop neighbor, if new add it to neighbor set. */
-      if (!neighborSetHasTwoHop(&neighborSet, twoHopNeighbor))
-      {
-        neighborSetAddTwoHopNeighbor(&neighborSet, twoHopNeighbor);
-      }
-      if (!neighborSetHasRelation(&neighborSet, neighborAddress, twoHopNeighbor))
-      {
-        neighborSetAddRelation(&neighborSet, neighborAddress, twoHopNeighbor);
-      }
-      neighborSetUpdateExpirationTime(&neighborSet, twoHopNeighbor);
-    }
+    *current += (distance - *current) / PASSIVE_DISTANCE_SMOOTHING;
   }
+  ctx->passiveDistanceMatrix.updateTime[index] = curTime;
 }
 
-static void neighborSetClearExpireTimerCallback(TimerHandle_t timer)
+int16_t passiveDistanceGet(Ranging_Context_t *ctx, UWB_Address_t address1, UWB_Address_t address2, Time_t *updateTime)
 {
-  xSemaphoreTake(neighborSet.mu, portMAX_DELAY);
-
-  Time_t curTime = xTaskGetTickCount();
-  DEBUG_PRINT("neighborSetClearExpireTimerCallback: Trigger expiration timer at %lu.\n", curTime);
-
-  int evictionCount = neighborSetClearExpire(&neighborSet);
-  if (evictionCount > 0)
+  set_index_t slot1 = neighborSlotMapGet(&ctx->neighborSlotMap, address1);
+  set_index_t slot2 = neighborSlotMapGet(&ctx->neighborSlotMap, address2);
+  if (slot1 == NEIGHBOR_SLOT_NONE || slot2 == NEIGHBOR_SLOT_NONE || slot1 == slot2)
   {
-    DEBUG_PRINT("neighborSetClearExpireTimerCallback: Evict total %d neighbors.\n", evictionCount);
+    return -1;
   }
-  else
+  int index = passiveDistancePairIndex(slot1, slot2);
+  if (updateTime)
   {
-    DEBUG_PRINT("neighborSetClearExpireTimerCallback: Evict none.\n");
+    *updateTime = ctx->passiveDistanceMatrix.updateTime[index];
   }
-
-  xSemaphoreGive(neighborSet.mu);
+  return ctx->passiveDistanceMatrix.distance[index];
 }
 
-void printRangingTable(Ranging_Table_t *table)
+int16_t getPassiveDistance(UWB_Address_t address1, UWB_Address_t address2, Time_t *updateTime)
 {
-  DEBUG_PRINT("Rp = %u, Tr = %u, Rf = %u, \n",
-              table->Rp.seqNumber,
-              table->TrRrBuffer.candidates[table->TrRrBuffer.latest].Tr.seqNumber,
-              table->Rf.seqNumber);
-  DEBUG_PRINT("Tp = %u, Rr = %u, Tf = %u, Re = %u, \n",
-              table->Tp.seqNumber,
-              table->TrRrBuffer.candidates[table->TrRrBuffer.latest].Rr.seqNumber,
-              table->Tf.seqNumber,
-              table->Re.seqNumber);
-  DEBUG_PRINT("\n");
+  return passiveDistanceGet(&rangingContext, address1, address2, updateTime);
 }
 
-void printRangingTableSet(Ranging_Table_Set_t *set)
+#ifdef ENABLE_DISTANCE_SHARING
+static void sharedDistanceClearSlot(Ranging_Context_t *ctx, set_index_t slot)
 {
-  DEBUG_PRINT("neighbor\t distance\t period\t expire\t \n");
-  for (int i = 0; i < set->size; i++)
+  for (int i = 0; i < SHARED_DISTANCE_ROW_SIZE; i++)
   {
-    if (set->tables[i].neighborAddress == UWB_DEST_EMPTY)
-    {
-      continue;
-    }
-    DEBUG_PRINT("%u\t %d\t %lu\t %lu\t \n",
-                set->tables[i].neighborAddress,
-                set->tables[i].distance,
-                set->tables[i].period,
-                set->tables[i].expirationTime);
+    ctx->sharedDistance[slot].address[i] = UWB_DEST_EMPTY;
+    ctx->sharedDistance[slot].distance[i] = -1;
+    ctx->sharedDistance[slot].measurementTime[i] = 0;
   }
-  DEBUG_PRINT("---\n");
 }
 
-void printRangingMessage(Ranging_Message_t *rangingMessage)
+/* Quantize our latest filtered distance to the neighbor of a body unit, left unknown once it is too old. */
+static void sharedDistanceFill(Ranging_Context_t *ctx, Body_Unit_t *bodyUnit, Time_t curTime)
 {
-  for (int i = 0; i < RANGING_MAX_Tr_UNIT; i++)
+  bodyUnit->distance = 0;
+  bodyUnit->flags.distanceAge = 0;
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, bodyUnit->address);
+  if (slot == NEIGHBOR_SLOT_NONE || !ctx->neighborStateInfo.distanceTowards[slot])
   {
-    DEBUG_PRINT("lastTxTimestamp %d seq=%u, lastTxTimestamp=%2x%8lx\n",
-                i,
-                rangingMessage->header.lastTxTimestamps[i].seqNumber,
-                rangingMessage->header.lastTxTimestamps[i].timestamp.high8,
-                rangingMessage->header.lastTxTimestamps[i].timestamp.low32);
+    return;
   }
-  if (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t) == 0)
+  uint32_t age = T2M(curTime - ctx->neighborStateInfo.measurementTime[slot]) / SHARED_DISTANCE_AGE_UNIT;
+  if (age > SHARED_DISTANCE_AGE_MAX)
   {
     return;
   }
-  uint16_t body_unit_number = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
-  if (body_unit_number >= RANGING_MAX_BODY_UNIT)
+  uint32_t quantized = (ctx->neighborStateInfo.distanceTowards[slot] + SHARED_DISTANCE_UNIT / 2) / SHARED_DISTANCE_UNIT;
+  bodyUnit->distance = MAX(1, MIN(UINT8_MAX, quantized));
+  bodyUnit->flags.distanceAge = age;
+}
+
+/* Store the distances a neighbor reports in its body units into its row, updating the entry of the same address
+ * or else replacing the stalest one.
+ */
+static void sharedDistanceOnRx(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, Ranging_Message_t *rangingMessage, Time_t rxTime)
+{
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    DEBUG_PRINT("printRangingMessage: malformed body unit number.\n");
     return;
   }
-  for (int i = 0; i < body_unit_number; i++)
+  Shared_Distance_Row_t *row = &ctx->sharedDistance[slot];
+  uint8_t bodyUnitCount = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
+  for (int i = 0; i < bodyUnitCount; i++)
   {
-    DEBUG_PRINT("unitAddress=%u, Seq=%u\n",
-                rangingMessage->bodyUnits[i].address,
-                rangingMessage->bodyUnits[i].timestamp.seqNumber);
+    Body_Unit_t *bodyUnit = &rangingMessage->bodyUnits[i];
+    if (!bodyUnit->distance || bodyUnit->address == neighborAddress || bodyUnit->address > NEIGHBOR_ADDRESS_MAX)
+    {
+      continue;
+    }
+    int entry = 0;
+    for (int j = 0; j < SHARED_DISTANCE_ROW_SIZE; j++)
+    {
+      if (row->address[j] == bodyUnit->address)
+      {
+        entry = j;
+        break;
+      }
+      if (row->address[entry] != UWB_DEST_EMPTY &&
+          (row->address[j] == UWB_DEST_EMPTY || (int32_t)(row->measurementTime[j] - row->measurementTime[entry]) < 0))
+      {
+        entry = j;
+      }
+    }
+    row->address[entry] = bodyUnit->address;
+    row->distance[entry] = bodyUnit->distance * SHARED_DISTANCE_UNIT;
+    row->measurementTime[entry] = rxTime - M2T(bodyUnit->flags.distanceAge * SHARED_DISTANCE_AGE_UNIT);
   }
 }
 
-void printNeighborBitSet(Neighbor_Bit_Set_t *bitSet)
+static int16_t sharedDistanceFind(Ranging_Context_t *ctx, UWB_Address_t reporter, UWB_Address_t address, Time_t *measurementTime)
 {
-  DEBUG_PRINT("%u has %u neighbors = ", uwbGetAddress(), bitSet->size);
-  for (int neighborAddress = 0; neighborAddress <= NEIGHBOR_ADDRESS_MAX; neighborAddress++)
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, reporter);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    if (neighborBitSetHas(bitSet, neighborAddress))
+    return -1;
+  }
+  for (int i = 0; i < SHARED_DISTANCE_ROW_SIZE; i++)
+  {
+    if (ctx->sharedDistance[slot].address[i] == address)
     {
-      DEBUG_PRINT("%u ", neighborAddress);
+      *measurementTime = ctx->sharedDistance[slot].measurementTime[i];
+      return ctx->sharedDistance[slot].distance[i];
     }
   }
-  DEBUG_PRINT("\n");
+  return -1;
 }
 
-void printNeighborSet(Neighbor_Set_t *set)
+int16_t sharedDistanceGet(Ranging_Context_t *ctx, UWB_Address_t address1, UWB_Address_t address2, Time_t *measurementTime)
 {
-  DEBUG_PRINT("%u has %u one hop neighbors, %u two hop neighbors, %u neighbors in total.\n",
-              uwbGetAddress(),
-              set->oneHop.size,
-              set->twoHop.size,
-              set->size);
-  DEBUG_PRINT("one-hop neighbors = ");
-  for (UWB_Address_t oneHopNeighbor = 0; oneHopNeighbor <= NEIGHBOR_ADDRESS_MAX; oneHopNeighbor++)
+  Time_t time1 = 0, time2 = 0;
+  int16_t distance1 = sharedDistanceFind(ctx, address1, address2, &time1);
+  int16_t distance2 = sharedDistanceFind(ctx, address2, address1, &time2);
+  /* Both ends may report the link, take the fresher one. */
+  if (distance1 < 0 || (distance2 >= 0 && (int32_t)(time2 - time1) > 0))
   {
-    if (neighborBitSetHas(&set->oneHop, oneHopNeighbor))
-    {
-      DEBUG_PRINT("%u ", oneHopNeighbor);
-    }
+    distance1 = distance2;
+    time1 = time2;
   }
-  DEBUG_PRINT("\n");
-  DEBUG_PRINT("two-hop neighbors = ");
-  for (UWB_Address_t twoHopNeighbor = 0; twoHopNeighbor <= NEIGHBOR_ADDRESS_MAX; twoHopNeighbor++)
+  if (distance1 < 0 || xTaskGetTickCount() - time1 > M2T(RANGING_TABLE_HOLD_TIME))
   {
-    if (neighborBitSetHas(&set->twoHop, twoHopNeighbor))
-    {
-      DEBUG_PRINT("%u ", twoHopNeighbor);
-    }
+    return -1;
   }
-  DEBUG_PRINT("\n");
-  for (UWB_Address_t twoHopNeighbor = 0; twoHopNeighbor <= NEIGHBOR_ADDRESS_MAX; twoHopNeighbor++)
+  if (measurementTime)
   {
-    if (!neighborBitSetHas(&set->twoHop, twoHopNeighbor))
-    {
-      continue;
-    }
-    DEBUG_PRINT("to two-hop neighbor %u: ", twoHopNeighbor);
-    for (UWB_Address_t oneHopNeighbor = 0; oneHopNeighbor <= NEIGHBOR_ADDRESS_MAX; oneHopNeighbor++)
-    {
-      if (neighborSetHasRelation(set, oneHopNeighbor, twoHopNeighbor))
-      {
-        DEBUG_PRINT("%u ", oneHopNeighbor);
-      }
-    }
-    DEBUG_PRINT("\n");
+    *measurementTime = time1;
   }
+  return distance1;
 }
 
-static int16_t computeDistance(Timestamp_Tuple_t Tp, Timestamp_Tuple_t Rp,
-                               Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr,
-                               Timestamp_Tuple_t Tf, Timestamp_Tuple_t Rf)
+int16_t getSharedDistance(UWB_Address_t address1, UWB_Address_t address2, Time_t *measurementTime)
 {
+  return sharedDistanceGet(&rangingContext, address1, address2, measurementTime);
+}
+#endif
 
-  bool isErrorOccurred = false;
+/* Reset all per-neighbor state stored in the given slot, called whenever a slot changes owner. */
+static void neighborSlotReset(Ranging_Context_t *ctx, set_index_t slot)
+{
+  ASSERT(slot >= 0 && slot < RANGING_TABLE_SIZE_MAX);
+  ctx->statistic[slot].recvSeq = 0;
+  ctx->statistic[slot].recvnum = 0;
+  ctx->statistic[slot].compute1num = 0;
+  ctx->statistic[slot].compute2num = 0;
+  ctx->statistic[slot].compute3num = 0;
+  ctx->statistic[slot].passivenum = 0;
+  ctx->statistic[slot].stallnum = 0;
+  ctx->statistic[slot].lostnum = 0;
+#ifdef RANGING_BENCHMARK_ENABLE
+  ctx->benchmark.lastRecvnum[slot] = 0;
+  ctx->benchmark.lastLostnum[slot] = 0;
+  ctx->benchmark.lastUpdatenum[slot] = 0;
+#endif
+  distanceFilterInit(&ctx->distanceFilter[slot]);
+  passiveDistanceClearSlot(ctx, slot);
+#ifdef ENABLE_DISTANCE_SHARING
+  sharedDistanceClearSlot(ctx, slot);
+#endif
+  ctx->neighborStateInfo.distanceTowards[slot] = 0;
+  ctx->neighborStateInfo.velocityXInWorld[slot] = 0;
+  ctx->neighborStateInfo.velocityYInWorld[slot] = 0;
+  ctx->neighborStateInfo.gyroZ[slot] = 0;
+  ctx->neighborStateInfo.positionZ[slot] = 0;
+  ctx->neighborStateInfo.refresh[slot] = false;
+  ctx->neighborStateInfo.isNewAdd[slot] = false;
+  ctx->neighborStateInfo.isNewAddUsed[slot] = false;
+  ctx->neighborStateInfo.isAlreadyTakeoff[slot] = false;
+  ctx->neighborStateInfo.measurementTime[slot] = 0;
+  ctx->neighborStateInfo.measurementUwbTime[slot].full = 0;
+  memset(&ctx->distanceLatency[slot], 0, sizeof(Distance_Latency_t));
+  memset(&ctx->neighborMotion[slot], 0, sizeof(Neighbor_Motion_t));
+  /* Optimistic start so a new neighbor is admitted until its own frames say otherwise. */
+  ctx->linkQuality[slot].reception = LINK_QUALITY_ONE;
+  ctx->linkQuality[slot].success = LINK_QUALITY_ONE;
+  ctx->neighborStateInfo.addedVersion[slot] = ctx->neighborStateVersion + 1;
+  ctx->neighborStateInfo.distanceVersion[slot] = 0;
+}
 
-  DEBUG_PRINT("Tp:%d,Rp:%d,Tr:%d,Rr:%d,Tf:%d,Rf:%d\n", Tp.seqNumber, Rp.seqNumber, Tr.seqNumber, Rr.seqNumber, Tf.seqNumber, Rf.seqNumber);
-  if (Tp.seqNumber != Rp.seqNumber || Tr.seqNumber != Rr.seqNumber || Tf.seqNumber != Rf.seqNumber)
-  {
-    // DEBUG_PRINT("Tp:%d,Rp:%d,Tr:%d,Rr:%d,Tf:%d,Rf:%d\n", Tp.seqNumber, Rp.seqNumber, Tr.seqNumber, Rr.seqNumber, Tf.seqNumber, Rf.seqNumber);
-    DEBUG_PRINT("Ranging Error: sequence number mismatch\n");
-    isErrorOccurred = true;
-  }
+static Stastistic *getStatistic(Ranging_Context_t *ctx, UWB_Address_t neighborAddress)
+{
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  ASSERT(slot != NEIGHBOR_SLOT_NONE);
+  return &ctx->statistic[slot];
+}
 
-  if (Tp.seqNumber >= Tf.seqNumber || Rp.seqNumber >= Rf.seqNumber)
-  {
-    DEBUG_PRINT("Ranging Error: sequence number out of order\n");
-    isErrorOccurred = true;
-  }
+static inline uint16_t linkQualityUpdate(uint16_t ratio, bool sample)
+{
+  int32_t target = sample ? LINK_QUALITY_ONE : 0;
+  return ratio + ((target - ratio) >> LINK_QUALITY_WINDOW_SHIFT);
+}
 
-  int64_t tRound1, tReply1, tRound2, tReply2, diff1, diff2, t;
-  tRound1 = (Rr.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  tReply1 = (Tr.timestamp.full - Rp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  tRound2 = (Rf.timestamp.full - Tr.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  tReply2 = (Tf.timestamp.full - Rr.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  diff1 = tRound1 - tReply1;
-  diff2 = tRound2 - tReply2;
-  t = (diff1 * tReply2 + diff2 * tReply1 + diff2 * diff1) / (tRound1 + tRound2 + tReply1 + tReply2);
-  int16_t distance = (int16_t)t * 0.4691763978616;
-  DEBUG_PRINT("compute dist 1:%d\n", distance);
-  if (distance < 0)
+/* Account a received frame preceded by lost missed frames, O(1) since the gap is capped. */
+static void linkQualityOnRx(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, uint16_t lost)
+{
+  Link_Quality_t *quality = &ctx->linkQuality[neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress)];
+  for (uint16_t i = 0; i < MIN(lost, LINK_QUALITY_GAP_MAX); i++)
   {
-    DEBUG_PRINT("Ranging Error: distance < 0\n");
-    isErrorOccurred = true;
+    quality->reception = linkQualityUpdate(quality->reception, false);
   }
+  quality->reception = linkQualityUpdate(quality->reception, true);
+}
 
-  if (distance > 1000)
-  {
-    DEBUG_PRINT("Ranging Error: distance > 1000\n");
-    isErrorOccurred = true;
-  }
+static void linkQualityOnDistance(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, bool success)
+{
+  Link_Quality_t *quality = &ctx->linkQuality[neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress)];
+  quality->success = linkQualityUpdate(quality->success, success);
+}
 
-  if (isErrorOccurred)
+bool linkQualityGet(Ranging_Context_t *ctx, uint16_t neighborAddress, Link_Quality_t *quality)
+{
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    return -1;
+    return false;
   }
+  *quality = ctx->linkQuality[slot];
+  return true;
+}
+
+bool getLinkQuality(uint16_t neighborAddress, Link_Quality_t *quality)
+{
+  return linkQualityGet(&rangingContext, neighborAddress, quality);
+}
+
+Ranging_Table_Set_t *rangingTableSetGet(Ranging_Context_t *ctx)
+{
+  return &ctx->rangingTableSet;
+}
+
+Ranging_Table_Set_t *getGlobalRangingTableSet()
+{
+  return rangingTableSetGet(&rangingContext);
+}
+
+void rangingTableInit(Ranging_Table_t *table, UWB_Address_t neighborAddress)
+{
+  memset(table, 0, sizeof(Ranging_Table_t));
+  table->state = RANGING_STATE_S1;
+  table->neighborAddress = neighborAddress;
+  table->period = RANGING_PERIOD;
+  table->nextExpectedDeliveryTime = xTaskGetTickCount(); // due at once
+  table->expirationTime = xTaskGetTickCount() + M2T(RANGING_TABLE_HOLD_TIME);
+  table->lastSendTime = 0;
+  rangingTableBufferInit(&table->TrRrBuffer); // Can be safely removed this line since memset() is called
+  rangingTableTxRxHistoryInit(&table->TxRxHistory);
+}
+
+/* Ranging Table Set Operations */
+void rangingTableSetInit(Ranging_Table_Set_t *set)
+{
+  set->mu = xSemaphoreCreateMutex();
+  set->size = 0;
+  expirationWheelInit(&set->expirationWheel, xTaskGetTickCount());
+  for (int i = 0; i < RANGING_TABLE_SIZE_MAX; i++)
+  {
+    set->tables[i] = EMPTY_RANGING_TABLE;
+  }
+}
+
+static void rangingTableSetSwapTable(Ranging_Table_Set_t *set, int first, int second)
+{
+  Ranging_Table_t temp = set->tables[first];
+  set->tables[first] = set->tables[second];
+  set->tables[second] = temp;
+}
+
+static int rangingTableSetSearchTable(Ranging_Table_Set_t *set, UWB_Address_t targetAddress)
+{
+  /* Binary Search */
+  int left = -1, right = set->size, res = -1;
+  while (left + 1 != right)
+  {
+    int mid = left + (right - left) / 2;
+    if (set->tables[mid].neighborAddress == targetAddress)
+    {
+      res = mid;
+      break;
+    }
+    else if (set->tables[mid].neighborAddress > targetAddress)
+    {
+      right = mid;
+    }
+    else
+    {
+      left = mid;
+    }
+  }
+  return res;
+}
+
+typedef int (*rangingTableCompareFunc)(Ranging_Table_t *, Ranging_Table_t *);
+
+static int COMPARE_BY_ADDRESS(Ranging_Table_t *first, Ranging_Table_t *second)
+{
+  if (first->neighborAddress == second->neighborAddress)
+  {
+    return 0;
+  }
+  if (first->neighborAddress > second->neighborAddress)
+  {
+    return 1;
+  }
+  return -1;
+}
+
+static int COMPARE_BY_EXPIRATION_TIME(Ranging_Table_t *first, Ranging_Table_t *second)
+{
+  if (first->expirationTime == second->expirationTime)
+  {
+    return 0;
+  }
+  if (first->expirationTime > second->expirationTime)
+  {
+    return -1;
+  }
+  return 1;
+}
+
+static int COMPARE_BY_NEXT_EXPECTED_DELIVERY_TIME(Ranging_Table_t *first, Ranging_Table_t *second)
+{
+  if (first->nextExpectedDeliveryTime == second->nextExpectedDeliveryTime)
+  {
+    return 0;
+  }
+  if (first->nextExpectedDeliveryTime > second->nextExpectedDeliveryTime)
+  {
+    return 1;
+  }
+  return -1;
+}
+
+static int COMPARE_BY_LAST_SEND_TIME(Ranging_Table_t *first, Ranging_Table_t *second)
+{
+  if (first->lastSendTime == second->lastSendTime)
+  {
+    return 0;
+  }
+  if (first->lastSendTime > second->lastSendTime)
+  {
+    return 1;
+  }
+  return -1;
+}
+
+/* Build the heap */
+static void rangingTableSetArrange(Ranging_Table_Set_t *set, int index, int len, rangingTableCompareFunc compare)
+{
+  int leftChild = 2 * index + 1;
+  int rightChild = 2 * index + 2;
+  int maxIndex = index;
+  if (leftChild < len && compare(&set->tables[maxIndex], &set->tables[leftChild]) < 0)
+  {
+    maxIndex = leftChild;
+  }
+  if (rightChild < len && compare(&set->tables[maxIndex], &set->tables[rightChild]) < 0)
+  {
+    maxIndex = rightChild;
+  }
+  if (maxIndex != index)
+  {
+    rangingTableSetSwapTable(set, index, maxIndex);
+    rangingTableSetArrange(set, maxIndex, len, compare);
+  }
+}
+
+/* Sort the ranging table */
+static void rangingTableSetRearrange(Ranging_Table_Set_t *set, rangingTableCompareFunc compare)
+{
+  /* Build max heap */
+  for (int i = set->size / 2 - 1; i >= 0; i--)
+  {
+    rangingTableSetArrange(set, i, set->size, compare);
+  }
+  for (int i = set->size - 1; i >= 0; i--)
+  {
+    rangingTableSetSwapTable(set, 0, i);
+    rangingTableSetArrange(set, 0, i, compare);
+  }
+}
+
+static int rangingTableSetClearExpire(Ranging_Context_t *ctx, Ranging_Table_Set_t *set)
+{
+  UWB_Address_t expired[NEIGHBOR_ADDRESS_MAX + 1];
+  int evictionCount = expirationWheelAdvance(&set->expirationWheel, xTaskGetTickCount(), expired);
+
+  for (int i = 0; i < evictionCount; i++)
+  {
+    DEBUG_PRINT("rangingTableSetClearExpire: Clean ranging table for neighbor %u that expire at %lu.\n",
+                expired[i],
+                set->expirationWheel.deadline[expired[i]]);
+    setDistance(ctx, expired[i], -1, -1);
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+    int index = rangingTableSetSearchTable(set, expired[i]);
+    if (index != -1)
+    {
+      printRangingTransitionTrace(&set->tables[index]);
+    }
+#endif
+    rangingTableSetRemoveTable(ctx, set, expired[i]);
+  }
+
+  return evictionCount;
+}
+
+static void rangingTableSetClearExpireTimerCallback(TimerHandle_t timer)
+{
+  Ranging_Context_t *ctx = (Ranging_Context_t *)pvTimerGetTimerID(timer);
+  xSemaphoreTake(ctx->rangingTableSet.mu, portMAX_DELAY);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecordTimer(ctx, RANGING_RECORD_TIMER_RANGING_TABLE_SET);
+#endif
+
+  Time_t curTime = xTaskGetTickCount();
+  DEBUG_PRINT("rangingTableSetClearExpireTimerCallback: Trigger expiration timer at %lu.\n", curTime);
+
+  int evictionCount = rangingTableSetClearExpire(ctx, &ctx->rangingTableSet);
+  if (evictionCount > 0)
+  {
+    publishNeighborStateSnapshot(ctx);
+    DEBUG_PRINT("rangingTableSetClearExpireTimerCallback: Evict total %d ranging tables.\n", evictionCount);
+  }
+  else
+  {
+    DEBUG_PRINT("rangingTableSetClearExpireTimerCallback: Evict none.\n");
+  }
+
+  xSemaphoreGive(ctx->rangingTableSet.mu);
+}
+
+/* Find the least recently heard neighbor that has been silent for at least RANGING_TABLE_EVICTION_IDLE_TIME,
+ * the leader is never evicted. Returns -1 if there is no such neighbor.
+ */
+static int rangingTableSetFindEvictionCandidate(Ranging_Context_t *ctx, Ranging_Table_Set_t *set)
+{
+  Time_t curTime = xTaskGetTickCount();
+  int candidate = -1;
+  for (int i = 0; i < set->size; i++)
+  {
+    if (set->tables[i].neighborAddress == ctx->leaderStateInfo.address)
+    {
+      continue;
+    }
+    if (candidate == -1 || (int32_t)(set->tables[i].expirationTime - set->tables[candidate].expirationTime) < 0)
+    {
+      candidate = i;
+    }
+  }
+  /* expirationTime = last receive time + RANGING_TABLE_HOLD_TIME */
+  if (candidate != -1 &&
+      (int32_t)(set->tables[candidate].expirationTime + M2T(RANGING_TABLE_EVICTION_IDLE_TIME) -
+                curTime - M2T(RANGING_TABLE_HOLD_TIME)) > 0)
+  {
+    candidate = -1;
+  }
+  return candidate;
+}
+
+bool rangingTableSetAddTable(Ranging_Context_t *ctx, Ranging_Table_Set_t *set, Ranging_Table_t table)
+{
+  int index = rangingTableSetSearchTable(set, table.neighborAddress);
+  if (index != -1)
+  {
+    DEBUG_PRINT(
+        "rangingTableSetAddTable: Try to add an already added ranging table for neighbor %u, update it instead.\n",
+        table.neighborAddress);
+    set->tables[index] = table;
+    return true;
+  }
+  /* If ranging table is full now and there is no expired ranging table, try to replace the least recently
+   * heard neighbor, otherwise ignore.
+   */
+  if (set->size == RANGING_TABLE_SIZE_MAX && rangingTableSetClearExpire(ctx, &ctx->rangingTableSet) == 0)
+  {
+    int candidate = rangingTableSetFindEvictionCandidate(ctx, set);
+    if (candidate == -1)
+    {
+      DEBUG_PRINT("rangingTableSetAddTable: Ranging table if full, ignore new neighbor %u.\n",
+                  table.neighborAddress);
+      return false;
+    }
+    DEBUG_PRINT("rangingTableSetAddTable: Ranging table if full, evict idle neighbor %u for new neighbor %u.\n",
+                set->tables[candidate].neighborAddress,
+                table.neighborAddress);
+    setDistance(ctx, set->tables[candidate].neighborAddress, -1, -1);
+    rangingTableSetRemoveTable(ctx, set, set->tables[candidate].neighborAddress);
+  }
+  /* Insert the new entry in address order, keep the ranging table set sorted for binary search. */
+  int curIndex = set->size;
+  while (curIndex > 0 && set->tables[curIndex - 1].neighborAddress > table.neighborAddress)
+  {
+    set->tables[curIndex] = set->tables[curIndex - 1];
+    curIndex--;
+  }
+  set->tables[curIndex] = table;
+  set->size++;
+  neighborSlotReset(ctx, neighborSlotMapAcquire(&ctx->neighborSlotMap, table.neighborAddress));
+  expirationWheelSchedule(&set->expirationWheel, table.neighborAddress, table.expirationTime);
+  DEBUG_PRINT("rangingTableSetAddTable: Add new neighbor %u to ranging table.\n", table.neighborAddress);
+  return true;
+}
+
+void rangingTableSetUpdateTable(Ranging_Context_t *ctx, Ranging_Table_Set_t *set, Ranging_Table_t table)
+{
+  int index = rangingTableSetSearchTable(set, table.neighborAddress);
+  if (index == -1)
+  {
+    DEBUG_PRINT("rangingTableSetUpdateTable: Cannot find correspond table for neighbor %u, add it instead.\n",
+                table.neighborAddress);
+    rangingTableSetAddTable(ctx, set, table);
+  }
+  else
+  {
+    set->tables[index] = table;
+    DEBUG_PRINT("rangingTableSetUpdateTable: Update table for neighbor %u.\n", table.neighborAddress);
+  }
+}
+
+void rangingTableSetRemoveTable(Ranging_Context_t *ctx, Ranging_Table_Set_t *set, UWB_Address_t neighborAddress)
+{
+  if (set->size == 0)
+  {
+    DEBUG_PRINT("rangingTableSetRemoveTable: Ranging table is empty, ignore.\n");
+    return;
+  }
+  int index = rangingTableSetSearchTable(set, neighborAddress);
+  if (index == -1)
+  {
+    DEBUG_PRINT("rangingTableSetRemoveTable: Cannot find correspond table for neighbor %u, ignore.\n", neighborAddress);
+    return;
+  }
+  neighborSlotMapRelease(&ctx->neighborSlotMap, neighborAddress);
+  expirationWheelCancel(&set->expirationWheel, neighborAddress);
+  /* Shift the following entries forward, the ranging table set stays sorted by address. */
+  for (int i = index; i < set->size - 1; i++)
+  {
+    set->tables[i] = set->tables[i + 1];
+  }
+  set->tables[set->size - 1] = EMPTY_RANGING_TABLE;
+  set->size--;
+}
+
+Ranging_Table_t rangingTableSetFindTable(Ranging_Table_Set_t *set, UWB_Address_t neighborAddress)
+{
+  int index = rangingTableSetSearchTable(set, neighborAddress);
+  Ranging_Table_t table = EMPTY_RANGING_TABLE;
+  if (index == -1)
+  {
+    DEBUG_PRINT("rangingTableSetFindTable: Cannot find correspond table for neighbor %u.\n", neighborAddress);
+  }
+  else
+  {
+    table = set->tables[index];
+  }
+  return table;
+}
+
+_Static_assert(NEIGHBOR_ADDRESS_MAX < 64, "Neighbor_Bit_Set_t can hold at most 64 addresses");
+
+void neighborBitSetInit(Neighbor_Bit_Set_t *bitSet)
+{
+  bitSet->bits = 0;
+  bitSet->size = 0;
+}
+
+void neighborBitSetAdd(Neighbor_Bit_Set_t *bitSet, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  uint64_t prevBits = bitSet->bits;
+  bitSet->bits |= (1ULL << neighborAddress);
+  if (prevBits != bitSet->bits)
+  {
+    bitSet->size++;
+  }
+}
+
+void neighborBitSetRemove(Neighbor_Bit_Set_t *bitSet, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  uint64_t prevBits = bitSet->bits;
+  bitSet->bits &= ~(1ULL << neighborAddress);
+  if (prevBits != bitSet->bits)
+  {
+    bitSet->size--;
+  }
+}
+
+void neighborBitSetClear(Neighbor_Bit_Set_t *bitSet)
+{
+  bitSet->bits = 0;
+  bitSet->size = 0;
+}
+
+bool neighborBitSetHas(Neighbor_Bit_Set_t *bitSet, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return (bitSet->bits & (1ULL << neighborAddress)) != 0;
+}
+
+static void neighborSetHooksInit(Neighbor_Set_Hooks_t *hooks)
+{
+  for (int i = 0; i < NEIGHBOR_SET_HOOKS_MAX; i++)
+  {
+    hooks->hooks[i] = NULL;
+  }
+  hooks->size = 0;
+  neighborBitSetInit(&hooks->pending);
+}
+
+Neighbor_Set_t *neighborSetGet(Ranging_Context_t *ctx)
+{
+  return &ctx->neighborSet;
+}
+
+Neighbor_Set_t *getGlobalNeighborSet()
+{
+  return neighborSetGet(&rangingContext);
+}
+
+void neighborSetInit(Neighbor_Set_t *set)
+{
+  set->size = 0;
+  set->mu = xSemaphoreCreateMutex();
+  expirationWheelInit(&set->expirationWheel, xTaskGetTickCount());
+  neighborBitSetInit(&set->oneHop);
+  neighborBitSetInit(&set->twoHop);
+  neighborBitSetInit(&set->mprSet);
+  neighborBitSetInit(&set->mprDirty);
+  neighborBitSetInit(&set->mprPruneCandidates);
+  neighborSetHooksInit(&set->neighborNewHooks);
+  neighborSetHooksInit(&set->neighborExpirationHooks);
+  neighborSetHooksInit(&set->neighborTopologyChangeHooks);
+  for (UWB_Address_t neighborAddress = 0; neighborAddress <= NEIGHBOR_ADDRESS_MAX; neighborAddress++)
+  {
+    set->expirationTime[neighborAddress] = 0;
+    neighborBitSetInit(&set->twoHopReachSets[neighborAddress]);
+    neighborBitSetInit(&set->twoHopCoverSets[neighborAddress]);
+  }
+}
+
+bool neighborSetHas(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return neighborBitSetHas(&set->oneHop, neighborAddress) || neighborBitSetHas(&set->twoHop, neighborAddress);
+}
+
+bool neighborSetHasOneHop(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return neighborBitSetHas(&set->oneHop, neighborAddress);
+}
+
+bool neighborSetHasTwoHop(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return neighborBitSetHas(&set->twoHop, neighborAddress);
+}
+
+void neighborSetAddOneHopNeighbor(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  bool isNewNeighbor = false;
+  if (!neighborSetHas(set, neighborAddress))
+  {
+    isNewNeighbor = true;
+  }
+  /* If neighbor is previous two-hop neighbor, remove it from two-hop neighbor set. */
+  if (neighborSetHasTwoHop(set, neighborAddress))
+  {
+    neighborSetRemoveNeighbor(ctx, set, neighborAddress);
+  }
+  /* Add one-hop neighbor. */
+  if (!neighborSetHasOneHop(set, neighborAddress))
+  {
+    neighborBitSetAdd(&set->oneHop, neighborAddress);
+    neighborSetUpdateExpirationTime(set, neighborAddress);
+    neighborSetHooksPost(ctx, &set->neighborTopologyChangeHooks, neighborAddress);
+  }
+  set->size = set->oneHop.size + set->twoHop.size;
+  if (isNewNeighbor)
+  {
+    neighborSetHooksPost(ctx, &set->neighborNewHooks, neighborAddress);
+  }
+}
+
+void neighborSetAddTwoHopNeighbor(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  bool isNewNeighbor = false;
+  if (!neighborSetHas(set, neighborAddress))
+  {
+    isNewNeighbor = true;
+  }
+  /* If neighbor is previous one-hop neighbor, remove it from one-hop neighbor set. */
+  if (neighborSetHasOneHop(set, neighborAddress))
+  {
+    neighborSetRemoveNeighbor(ctx, set, neighborAddress);
+  }
+  if (!neighborSetHasTwoHop(set, neighborAddress))
+  {
+    /* Add two-hop neighbor. */
+    neighborBitSetAdd(&set->twoHop, neighborAddress);
+    neighborSetUpdateExpirationTime(set, neighborAddress);
+    neighborSetHooksPost(ctx, &set->neighborTopologyChangeHooks, neighborAddress);
+  }
+  set->size = set->oneHop.size + set->twoHop.size;
+  if (isNewNeighbor)
+  {
+    neighborSetHooksPost(ctx, &set->neighborNewHooks, neighborAddress);
+  }
+}
+
+void neighborSetRemoveNeighbor(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  if (neighborSetHas(set, neighborAddress))
+  {
+    if (neighborSetHasOneHop(set, neighborAddress) && neighborSetHasTwoHop(set, neighborAddress))
+    {
+      ASSERT(0); // impossible
+    }
+    set->expirationTime[neighborAddress] = 0;
+    expirationWheelCancel(&set->expirationWheel, neighborAddress);
+    if (neighborSetHasOneHop(set, neighborAddress))
+    {
+      neighborBitSetRemove(&set->oneHop, neighborAddress);
+      /* Remove related path to two-hop neighbor */
+      for (UWB_Address_t twoHopNeighbor = 0; twoHopNeighbor <= NEIGHBOR_ADDRESS_MAX; twoHopNeighbor++)
+      {
+        if (neighborSetHasRelation(set, neighborAddress, twoHopNeighbor))
+        {
+          neighborSetRemoveRelation(ctx, set, neighborAddress, twoHopNeighbor);
+        }
+      }
+    }
+    else if (neighborSetHasTwoHop(set, neighborAddress))
+    {
+      neighborBitSetRemove(&set->twoHop, neighborAddress);
+      /* Clear related two-hop reach set */
+      uint64_t reachSet = set->twoHopReachSets[neighborAddress].bits;
+      while (reachSet)
+      {
+        UWB_Address_t oneHopNeighbor = __builtin_ctzll(reachSet);
+        reachSet &= reachSet - 1;
+        neighborBitSetRemove(&set->twoHopCoverSets[oneHopNeighbor], neighborAddress);
+      }
+      set->mprPruneCandidates.bits |= set->twoHopReachSets[neighborAddress].bits;
+      neighborBitSetClear(&set->twoHopReachSets[neighborAddress]);
+    }
+    else
+    {
+      ASSERT(0); // impossible
+    }
+    neighborSetHooksPost(ctx, &set->neighborTopologyChangeHooks, neighborAddress);
+  }
+  set->size = set->oneHop.size + set->twoHop.size;
+}
+
+bool neighborSetHasRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to)
+{
+  ASSERT(from <= NEIGHBOR_ADDRESS_MAX);
+  ASSERT(to <= NEIGHBOR_ADDRESS_MAX);
+  return neighborBitSetHas(&set->twoHopReachSets[to], from);
+}
+
+void neighborSetAddRelation(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to)
+{
+  ASSERT(from <= NEIGHBOR_ADDRESS_MAX);
+  ASSERT(to <= NEIGHBOR_ADDRESS_MAX);
+  if (!neighborBitSetHas(&set->twoHopReachSets[to], from))
+  {
+    set->mprPruneCandidates.bits |= set->twoHopReachSets[to].bits;
+    neighborBitSetAdd(&set->twoHopReachSets[to], from);
+    neighborBitSetAdd(&set->twoHopCoverSets[from], to);
+    neighborBitSetAdd(&set->mprDirty, to);
+    neighborSetHooksPost(ctx, &set->neighborTopologyChangeHooks, from);
+  }
+}
+
+void neighborSetRemoveRelation(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to)
+{
+  ASSERT(from <= NEIGHBOR_ADDRESS_MAX);
+  ASSERT(to <= NEIGHBOR_ADDRESS_MAX);
+  if (neighborBitSetHas(&set->twoHopReachSets[to], from))
+  {
+    neighborBitSetRemove(&set->twoHopReachSets[to], from);
+    neighborBitSetRemove(&set->twoHopCoverSets[from], to);
+    neighborBitSetAdd(&set->mprDirty, to);
+    /* from covers less now, and whichever MPR takes over to may make the MPRs sharing from's coverage redundant. */
+    neighborBitSetAdd(&set->mprPruneCandidates, from);
+    neighborSetHooksPost(ctx, &set->neighborTopologyChangeHooks, from);
+  }
+}
+
+bool neighborSetHasMpr(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  return neighborBitSetHas(&set->mprSet, neighborAddress);
+}
+
+/* Incremental greedy MPR selection, only two-hop neighbors whose reach set changed since last update are
+ * re-examined:
+ *  1. Every dirty two-hop neighbor that is no longer covered picks the one-hop neighbor in its reach set
+ *     covering the most uncovered two-hop neighbors (a sole reacher is picked naturally).
+ *  2. MPRs that may have become redundant are dropped if all two-hop neighbors they cover have another MPR.
+ */
+void neighborSetUpdateMpr(Neighbor_Set_t *set)
+{
+  if (!set->mprDirty.bits && !set->mprPruneCandidates.bits && !(set->mprSet.bits & ~set->oneHop.bits))
+  {
+    return;
+  }
+  uint64_t mpr = set->mprSet.bits & set->oneHop.bits;
+  uint64_t pruneCandidates = set->mprPruneCandidates.bits & mpr;
+  uint64_t dirty = set->mprDirty.bits & set->twoHop.bits;
+  neighborBitSetClear(&set->mprDirty);
+  neighborBitSetClear(&set->mprPruneCandidates);
+
+  uint64_t uncovered = 0;
+  while (dirty)
+  {
+    UWB_Address_t twoHopNeighbor = __builtin_ctzll(dirty);
+    dirty &= dirty - 1;
+    if (!(set->twoHopReachSets[twoHopNeighbor].bits & mpr))
+    {
+      uncovered |= 1ULL << twoHopNeighbor;
+    }
+  }
+
+  while (uncovered)
+  {
+    UWB_Address_t twoHopNeighbor = __builtin_ctzll(uncovered);
+    uint64_t reachSet = set->twoHopReachSets[twoHopNeighbor].bits & set->oneHop.bits;
+    if (!reachSet)
+    {
+      uncovered &= ~(1ULL << twoHopNeighbor);
+      continue;
+    }
+    UWB_Address_t best = __builtin_ctzll(reachSet);
+    int bestCoverage = -1;
+    while (reachSet)
+    {
+      UWB_Address_t oneHopNeighbor = __builtin_ctzll(reachSet);
+      reachSet &= reachSet - 1;
+      int coverage = __builtin_popcountll(set->twoHopCoverSets[oneHopNeighbor].bits & uncovered);
+      if (coverage > bestCoverage)
+      {
+        best = oneHopNeighbor;
+        bestCoverage = coverage;
+      }
+    }
+    mpr |= 1ULL << best;
+    uncovered &= ~set->twoHopCoverSets[best].bits;
+    /* Existing MPRs covering what best covers may no longer be needed. */
+    uint64_t covered = set->twoHopCoverSets[best].bits & set->twoHop.bits;
+    while (covered)
+    {
+      UWB_Address_t coveredNeighbor = __builtin_ctzll(covered);
+      covered &= covered - 1;
+      pruneCandidates |= set->twoHopReachSets[coveredNeighbor].bits & mpr & ~(1ULL << best);
+    }
+  }
+
+  while (pruneCandidates)
+  {
+    UWB_Address_t candidate = __builtin_ctzll(pruneCandidates);
+    pruneCandidates &= pruneCandidates - 1;
+    uint64_t others = mpr & ~(1ULL << candidate);
+    uint64_t covered = set->twoHopCoverSets[candidate].bits & set->twoHop.bits;
+    bool redundant = true;
+    while (covered && redundant)
+    {
+      UWB_Address_t twoHopNeighbor = __builtin_ctzll(covered);
+      covered &= covered - 1;
+      redundant = (set->twoHopReachSets[twoHopNeighbor].bits & others) != 0;
+    }
+    if (redundant)
+    {
+      mpr = others;
+    }
+  }
+
+  set->mprSet.bits = mpr;
+  set->mprSet.size = __builtin_popcountll(mpr);
+}
+
+static void neighborSetHooksRegister(Neighbor_Set_Hooks_t *hooks, neighborSetHook hook)
+{
+  ASSERT(hook);
+  ASSERT(hooks->size < NEIGHBOR_SET_HOOKS_MAX);
+  hooks->hooks[hooks->size] = hook;
+  hooks->size++;
+}
+
+void neighborSetRegisterNewNeighborHook(Neighbor_Set_t *set, neighborSetHook hook)
+{
+  neighborSetHooksRegister(&set->neighborNewHooks, hook);
+}
+
+void neighborSetRegisterExpirationHook(Neighbor_Set_t *set, neighborSetHook hook)
+{
+  neighborSetHooksRegister(&set->neighborExpirationHooks, hook);
+}
+
+void neighborSetRegisterTopologyChangeHook(Neighbor_Set_t *set, neighborSetHook hook)
+{
+  neighborSetHooksRegister(&set->neighborTopologyChangeHooks, hook);
+}
+
+/* Invoke all subscribers synchronously. */
+void neighborSetHooksInvoke(Neighbor_Set_Hooks_t *hooks, UWB_Address_t neighborAddress)
+{
+  for (int i = 0; i < hooks->size; i++)
+  {
+    DEBUG_PRINT("neighborSetHooksInvoke: Invoke neighbor set hook.\n");
+    hooks->hooks[i](neighborAddress);
+  }
+}
+
+/* Queue an event in O(1), it is delivered later by neighborSetEventTask. */
+void neighborSetHooksPost(Ranging_Context_t *ctx, Neighbor_Set_Hooks_t *hooks, UWB_Address_t neighborAddress)
+{
+  if (hooks->size == 0)
+  {
+    return;
+  }
+  neighborBitSetAdd(&hooks->pending, neighborAddress);
+  if (ctx->neighborSetEventTaskHandle)
+  {
+    xTaskNotifyGive(ctx->neighborSetEventTaskHandle);
+  }
+}
+
+/* Deliver and clear all pending events, returns the number of notified neighbors. */
+int neighborSetHooksDispatch(Neighbor_Set_Hooks_t *hooks)
+{
+  uint64_t pending = hooks->pending.bits;
+  int count = hooks->pending.size;
+  neighborBitSetClear(&hooks->pending);
+  while (pending)
+  {
+    UWB_Address_t neighborAddress = __builtin_ctzll(pending);
+    pending &= pending - 1;
+    neighborSetHooksInvoke(hooks, neighborAddress);
+  }
+  return count;
+}
+
+void neighborSetUpdateExpirationTime(Neighbor_Set_t *set, UWB_Address_t neighborAddress)
+{
+  ASSERT(neighborAddress <= NEIGHBOR_ADDRESS_MAX);
+  set->expirationTime[neighborAddress] = xTaskGetTickCount() + M2T(NEIGHBOR_SET_HOLD_TIME);
+  expirationWheelSchedule(&set->expirationWheel, neighborAddress, set->expirationTime[neighborAddress]);
+}
+
+int neighborSetClearExpire(Ranging_Context_t *ctx, Neighbor_Set_t *set)
+{
+  Time_t curTime = xTaskGetTickCount();
+  UWB_Address_t expired[NEIGHBOR_ADDRESS_MAX + 1];
+  int expiredCount = expirationWheelAdvance(&set->expirationWheel, curTime, expired);
+  int evictionCount = 0;
+  for (int i = 0; i < expiredCount; i++)
+  {
+    UWB_Address_t neighborAddress = expired[i];
+    if (neighborSetHas(set, neighborAddress))
+    {
+      evictionCount++;
+      neighborSetRemoveNeighbor(ctx, set, neighborAddress);
+      DEBUG_PRINT("neighborSetClearExpire: neighbor %u expire at %lu.\n", neighborAddress, curTime);
+      neighborSetHooksPost(ctx, &set->neighborExpirationHooks, neighborAddress);
+    }
+  }
+  return evictionCount;
+}
+
+static void topologySensing(Ranging_Context_t *ctx, Ranging_Message_t *rangingMessage)
+{
+  //  DEBUG_PRINT("topologySensing: Received ranging message from neighbor %u.\n", rangingMessage->header.srcAddress);
+  UWB_Address_t neighborAddress = rangingMessage->header.srcAddress;
+  if (neighborAddress > NEIGHBOR_ADDRESS_MAX)
+  {
+    return;
+  }
+  if (!neighborSetHasOneHop(&ctx->neighborSet, neighborAddress))
+  {
+    /* Add current neighbor to one-hop neighbor set. */
+    neighborSetAddOneHopNeighbor(ctx, &ctx->neighborSet, neighborAddress);
+  }
+  neighborSetUpdateExpirationTime(&ctx->neighborSet, neighborAddress);
+
+  /* Infer one-hop and tow-hop neighbors from received ranging message. */
+  uint8_t bodyUnitCount = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
+  for (int i = 0; i < bodyUnitCount; i++)
+  {
+#ifdef ROUTING_OLSR_ENABLE
+    if (rangingMessage->bodyUnits[i].address == ctx->myAddress)
+    {
+      /* If been selected as MPR, add neighbor to mpr selector set. */
+      if (rangingMessage->bodyUnits[i].flags.MPR)
+      {
+        if (!mprSelectorSetHas(getGlobalMPRSelectorSet(), neighborAddress))
+        {
+          mprSelectorSetAdd(getGlobalMPRSelectorSet(), neighborAddress);
+        }
+        mprSelectorSetUpdateExpirationTime(getGlobalMPRSelectorSet(), neighborAddress);
+      }
+      else
+      {
+        if (mprSelectorSetHas(getGlobalMPRSelectorSet(), neighborAddress))
+        {
+          mprSelectorSetRemove(getGlobalMPRSelectorSet(), neighborAddress);
+        }
+      }
+    }
+#endif
+    UWB_Address_t twoHopNeighbor = rangingMessage->bodyUnits[i].address;
+    if (twoHopNeighbor > NEIGHBOR_ADDRESS_MAX)
+    {
+      continue;
+    }
+    if (twoHopNeighbor != ctx->myAddress && !neighborSetHasOneHop(&ctx->neighborSet, twoHopNeighbor))
+    {
+      /* If it is not one-hop neighbor then it is now my two-hop neighbor, if new add it to neighbor set. */
+      if (!neighborSetHasTwoHop(&ctx->neighborSet, twoHopNeighbor))
+      {
+        neighborSetAddTwoHopNeighbor(ctx, &ctx->neighborSet, twoHopNeighbor);
+      }
+      if (!neighborSetHasRelation(&ctx->neighborSet, neighborAddress, twoHopNeighbor))
+      {
+        neighborSetAddRelation(ctx, &ctx->neighborSet, neighborAddress, twoHopNeighbor);
+      }
+      neighborSetUpdateExpirationTime(&ctx->neighborSet, twoHopNeighbor);
+    }
+  }
+  neighborSetUpdateMpr(&ctx->neighborSet);
+}
+
+static void neighborSetClearExpireTimerCallback(TimerHandle_t timer)
+{
+  Ranging_Context_t *ctx = (Ranging_Context_t *)pvTimerGetTimerID(timer);
+  xSemaphoreTake(ctx->neighborSet.mu, portMAX_DELAY);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecordTimer(ctx, RANGING_RECORD_TIMER_NEIGHBOR_SET);
+#endif
+
+  Time_t curTime = xTaskGetTickCount();
+  DEBUG_PRINT("neighborSetClearExpireTimerCallback: Trigger expiration timer at %lu.\n", curTime);
+
+  int evictionCount = neighborSetClearExpire(ctx, &ctx->neighborSet);
+  neighborSetUpdateMpr(&ctx->neighborSet);
+  if (evictionCount > 0)
+  {
+    DEBUG_PRINT("neighborSetClearExpireTimerCallback: Evict total %d neighbors.\n", evictionCount);
+  }
+  else
+  {
+    DEBUG_PRINT("neighborSetClearExpireTimerCallback: Evict none.\n");
+  }
+
+  xSemaphoreGive(ctx->neighborSet.mu);
+}
+
+/* Delivers neighbor set events outside of the RX path. Subscribers are invoked with neighborSet.mu held, the same
+ * context they had when hooks ran synchronously, and all events posted while the RX task processes a frame are
+ * coalesced into one notification per neighbor.
+ */
+static void neighborSetEventDispatch(Ranging_Context_t *ctx)
+{
+  xSemaphoreTake(ctx->neighborSet.mu, portMAX_DELAY);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecordTimer(ctx, RANGING_RECORD_TIMER_NEIGHBOR_SET_EVENT);
+#endif
+
+  neighborSetHooksDispatch(&ctx->neighborSet.neighborNewHooks);
+  neighborSetHooksDispatch(&ctx->neighborSet.neighborTopologyChangeHooks);
+  neighborSetHooksDispatch(&ctx->neighborSet.neighborExpirationHooks);
+
+  xSemaphoreGive(ctx->neighborSet.mu);
+}
+
+static void neighborSetEventTask(void *parameters)
+{
+  Ranging_Context_t *ctx = (Ranging_Context_t *)parameters;
+  systemWaitStart();
+
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    neighborSetEventDispatch(ctx);
+  }
+}
+
+void printRangingTable(Ranging_Table_t *table)
+{
+  DEBUG_PRINT("Rp = %u, Tr = %u, Rf = %u, \n",
+              table->Rp.seqNumber,
+              table->TrRrBuffer.candidates[table->TrRrBuffer.latest].Tr.seqNumber,
+              table->Rf.seqNumber);
+  DEBUG_PRINT("Tp = %u, Rr = %u, Tf = %u, Re = %u, \n",
+              table->Tp.seqNumber,
+              table->TrRrBuffer.candidates[table->TrRrBuffer.latest].Rr.seqNumber,
+              table->Tf.seqNumber,
+              table->Re.seqNumber);
+  DEBUG_PRINT("\n");
+}
+
+void printRangingTableSet(Ranging_Table_Set_t *set)
+{
+  DEBUG_PRINT("neighbor\t distance\t period\t expire\t \n");
+  for (int i = 0; i < set->size; i++)
+  {
+    if (set->tables[i].neighborAddress == UWB_DEST_EMPTY)
+    {
+      continue;
+    }
+    DEBUG_PRINT("%u\t %d\t %lu\t %lu\t \n",
+                set->tables[i].neighborAddress,
+                set->tables[i].distance,
+                set->tables[i].period,
+                set->tables[i].expirationTime);
+  }
+  DEBUG_PRINT("---\n");
+}
+
+void printRangingMessage(Ranging_Message_t *rangingMessage)
+{
+  for (int i = 0; i < RANGING_MAX_Tr_UNIT; i++)
+  {
+    DEBUG_PRINT("lastTxTimestamp %d seq=%u, lastTxTimestamp=%2x%8lx\n",
+                i,
+                rangingMessage->header.lastTxTimestamps[i].seqNumber,
+                rangingMessage->header.lastTxTimestamps[i].timestamp.high8,
+                rangingMessage->header.lastTxTimestamps[i].timestamp.low32);
+  }
+  if (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t) == 0)
+  {
+    return;
+  }
+  uint16_t body_unit_number = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
+  if (body_unit_number >= RANGING_MAX_BODY_UNIT)
+  {
+    DEBUG_PRINT("printRangingMessage: malformed body unit number.\n");
+    return;
+  }
+  for (int i = 0; i < body_unit_number; i++)
+  {
+    DEBUG_PRINT("unitAddress=%u, Seq=%u\n",
+                rangingMessage->bodyUnits[i].address,
+                rangingMessage->bodyUnits[i].timestamp.seqNumber);
+  }
+}
+
+void printNeighborBitSet(Neighbor_Bit_Set_t *bitSet)
+{
+  DEBUG_PRINT("%u has %u neighbors = ", uwbGetAddress(), bitSet->size);
+  for (int neighborAddress = 0; neighborAddress <= NEIGHBOR_ADDRESS_MAX; neighborAddress++)
+  {
+    if (neighborBitSetHas(bitSet, neighborAddress))
+    {
+      DEBUG_PRINT("%u ", neighborAddress);
+    }
+  }
+  DEBUG_PRINT("\n");
+}
+
+void printNeighborSet(Neighbor_Set_t *set)
+{
+  DEBUG_PRINT("%u has %u one hop neighbors, %u two hop neighbors, %u neighbors in total.\n",
+              uwbGetAddress(),
+              set->oneHop.size,
+              set->twoHop.size,
+              set->size);
+  DEBUG_PRINT("one-hop neighbors = ");
+  for (UWB_Address_t oneHopNeighbor = 0; oneHopNeighbor <= NEIGHBOR_ADDRESS_MAX; oneHopNeighbor++)
+  {
+    if (neighborBitSetHas(&set->oneHop, oneHopNeighbor))
+    {
+      DEBUG_PRINT("%u ", oneHopNeighbor);
+    }
+  }
+  DEBUG_PRINT("\n");
+  DEBUG_PRINT("mpr = ");
+  for (UWB_Address_t oneHopNeighbor = 0; oneHopNeighbor <= NEIGHBOR_ADDRESS_MAX; oneHopNeighbor++)
+  {
+    if (neighborBitSetHas(&set->mprSet, oneHopNeighbor))
+    {
+      DEBUG_PRINT("%u ", oneHopNeighbor);
+    }
+  }
+  DEBUG_PRINT("\n");
+  DEBUG_PRINT("two-hop neighbors = ");
+  for (UWB_Address_t twoHopNeighbor = 0; twoHopNeighbor <= NEIGHBOR_ADDRESS_MAX; twoHopNeighbor++)
+  {
+    if (neighborBitSetHas(&set->twoHop, twoHopNeighbor))
+    {
+      DEBUG_PRINT("%u ", twoHopNeighbor);
+    }
+  }
+  DEBUG_PRINT("\n");
+  for (UWB_Address_t twoHopNeighbor = 0; twoHopNeighbor <= NEIGHBOR_ADDRESS_MAX; twoHopNeighbor++)
+  {
+    if (!neighborBitSetHas(&set->twoHop, twoHopNeighbor))
+    {
+      continue;
+    }
+    DEBUG_PRINT("to two-hop neighbor %u: ", twoHopNeighbor);
+    for (UWB_Address_t oneHopNeighbor = 0; oneHopNeighbor <= NEIGHBOR_ADDRESS_MAX; oneHopNeighbor++)
+    {
+      if (neighborSetHasRelation(set, oneHopNeighbor, twoHopNeighbor))
+      {
+        DEBUG_PRINT("%u ", oneHopNeighbor);
+      }
+    }
+    DEBUG_PRINT("\n");
+  }
+}
+
+/* Footprint of each component of the ranging context, all sizes are compile time constants. */
+typedef struct
+{
+  const char *name;
+  uint32_t size;
+} Ranging_Footprint_t;
+
+#define RANGING_FOOTPRINT(component) {#component, sizeof(((Ranging_Context_t *)0)->component)}
+static const Ranging_Footprint_t RANGING_FOOTPRINT_TABLE[] = {
+    RANGING_FOOTPRINT(rangingTableSet),
+    RANGING_FOOTPRINT(neighborSet),
+    RANGING_FOOTPRINT(neighborSlotMap),
+    RANGING_FOOTPRINT(TfBuffer),
+    RANGING_FOOTPRINT(distanceTowards),
+    RANGING_FOOTPRINT(distanceRaw),
+    RANGING_FOOTPRINT(distanceSource),
+    RANGING_FOOTPRINT(distanceReal),
+    RANGING_FOOTPRINT(distanceFilter),
+    RANGING_FOOTPRINT(statistic),
+    RANGING_FOOTPRINT(distanceLatency),
+    RANGING_FOOTPRINT(linkQuality),
+    RANGING_FOOTPRINT(neighborMotion),
+    RANGING_FOOTPRINT(neighborStateInfo),
+    RANGING_FOOTPRINT(neighborStateSnapshots),
+    RANGING_FOOTPRINT(passiveDistanceMatrix),
+#ifdef ENABLE_DISTANCE_SHARING
+    RANGING_FOOTPRINT(sharedDistance),
+#endif
+#ifdef ENABLE_SWARM_LOCALIZATION
+    RANGING_FOOTPRINT(swarmLocalization),
+#endif
+#ifdef ENABLE_CHANNEL_HOPPING
+    RANGING_FOOTPRINT(channelHopping),
+#endif
+#ifdef RANGING_BENCHMARK_ENABLE
+    RANGING_FOOTPRINT(benchmark),
+#endif
+};
+
+/* What one more slot of RANGING_TABLE_SIZE_MAX costs, the passive distance matrix grows with the square. */
+#define RANGING_FOOTPRINT_PER_NEIGHBOR                                                                   \
+  (sizeof(Ranging_Table_t) + sizeof(UWB_Address_t) + sizeof(Distance_Filter_t) + sizeof(Stastistic) +    \
+   sizeof(Distance_Latency_t) + sizeof(Link_Quality_t) + sizeof(Neighbor_Motion_t) +                     \
+   (sizeof(neighborStateInfo_t) + 2 * sizeof(Neighbor_State_Snapshot_t)) / RANGING_TABLE_SIZE_MAX)
+#define RANGING_FOOTPRINT_PER_PAIR (sizeof(int16_t) + sizeof(Time_t))
+#define RANGING_FOOTPRINT_PER_ADDRESS                                                                    \
+  (2 * sizeof(int16_t) + sizeof(uint8_t) + sizeof(float) + sizeof(set_index_t) + sizeof(Neighbor_Bit_Set_t) + \
+   sizeof(Time_t))
+
+void printRangingMemoryBudget()
+{
+  consolePrintf("Ranging memory budget: %u neighbors in table, %u addresses, arena %u of %u bytes.\n",
+                (unsigned)RANGING_TABLE_SIZE_MAX,
+                (unsigned)(NEIGHBOR_ADDRESS_MAX + 1),
+                (unsigned)sizeof(Ranging_Context_t),
+                (unsigned)RANGING_CONTEXT_SIZE_MAX);
+  for (int i = 0; i < (int)(sizeof(RANGING_FOOTPRINT_TABLE) / sizeof(Ranging_Footprint_t)); i++)
+  {
+    consolePrintf("  %s = %u\n", RANGING_FOOTPRINT_TABLE[i].name, (unsigned)RANGING_FOOTPRINT_TABLE[i].size);
+  }
+  consolePrintf("per neighbor = %u, per neighbor pair = %u, per address = %u bytes\n",
+                (unsigned)RANGING_FOOTPRINT_PER_NEIGHBOR,
+                (unsigned)RANGING_FOOTPRINT_PER_PAIR,
+                (unsigned)RANGING_FOOTPRINT_PER_ADDRESS);
+}
+
+static int16_t computeDistance(Timestamp_Tuple_t Tp, Timestamp_Tuple_t Rp,
+                               Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr,
+                               Timestamp_Tuple_t Tf, Timestamp_Tuple_t Rf)
+{
+
+  bool isErrorOccurred = false;
+
+  DEBUG_PRINT("Tp:%d,Rp:%d,Tr:%d,Rr:%d,Tf:%d,Rf:%d\n", Tp.seqNumber, Rp.seqNumber, Tr.seqNumber, Rr.seqNumber, Tf.seqNumber, Rf.seqNumber);
+  if (Tp.seqNumber != Rp.seqNumber || Tr.seqNumber != Rr.seqNumber || Tf.seqNumber != Rf.seqNumber)
+  {
+    // DEBUG_PRINT("Tp:%d,Rp:%d,Tr:%d,Rr:%d,Tf:%d,Rf:%d\n", Tp.seqNumber, Rp.seqNumber, Tr.seqNumber, Rr.seqNumber, Tf.seqNumber, Rf.seqNumber);
+    DEBUG_PRINT("Ranging Error: sequence number mismatch\n");
+    isErrorOccurred = true;
+  }
+
+  if (!seqNumberLessThan(Tp.seqNumber, Tf.seqNumber) || !seqNumberLessThan(Rp.seqNumber, Rf.seqNumber))
+  {
+    DEBUG_PRINT("Ranging Error: sequence number out of order\n");
+    isErrorOccurred = true;
+  }
+
+  int64_t tRound1, tReply1, tRound2, tReply2, diff1, diff2, t;
+  tRound1 = (Rr.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  tReply1 = (Tr.timestamp.full - Rp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  tRound2 = (Rf.timestamp.full - Tr.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  tReply2 = (Tf.timestamp.full - Rr.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  /* A reply sent before the frame it answers was received wraps to an interval of almost the whole clock. */
+  if (tRound1 > UWB_MAX_TIMESTAMP / 2 || tReply1 > UWB_MAX_TIMESTAMP / 2 ||
+      tRound2 > UWB_MAX_TIMESTAMP / 2 || tReply2 > UWB_MAX_TIMESTAMP / 2)
+  {
+    DEBUG_PRINT("Ranging Error: timestamps out of order\n");
+    isErrorOccurred = true;
+  }
+  diff1 = tRound1 - tReply1;
+  diff2 = tRound2 - tReply2;
+  t = (diff1 * tReply2 + diff2 * tReply1 + diff2 * diff1) / (tRound1 + tRound2 + tReply1 + tReply2);
+  int16_t distance = (int16_t)t * 0.4691763978616;
+  DEBUG_PRINT("compute dist 1:%d\n", distance);
+  if (distance < 0)
+  {
+    DEBUG_PRINT("Ranging Error: distance < 0\n");
+    isErrorOccurred = true;
+  }
+
+  if (distance > 1000)
+  {
+    DEBUG_PRINT("Ranging Error: distance > 1000\n");
+    isErrorOccurred = true;
+  }
+
+  if (isErrorOccurred)
+  {
+    return -1;
+  }
+
+  return distance;
+}
+
+static int16_t computeDistance2(Timestamp_Tuple_t Tx, Timestamp_Tuple_t Rx,
+                                Timestamp_Tuple_t Tp, Timestamp_Tuple_t Rp,
+                                Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr)
+{
+  bool isErrorOccurred = false;
+  DEBUG_PRINT("Tx:%d,Rx:%d,Tp:%d,Rp:%d,Tr:%d,Rr:%d\n", Tx.seqNumber, Rx.seqNumber, Tp.seqNumber, Rp.seqNumber, Tr.seqNumber, Rr.seqNumber);
+
+  if (Tp.seqNumber != Rp.seqNumber || Tr.seqNumber != Rr.seqNumber || Tx.seqNumber != Rx.seqNumber)
+  {
+    DEBUG_PRINT("Ranging Error: sequence number mismatch\n");
+    isErrorOccurred = true;
+  }
+
+  if (!seqNumberLessThan(Tx.seqNumber, Tr.seqNumber) || !seqNumberLessThan(Rx.seqNumber, Rr.seqNumber))
+  {
+    DEBUG_PRINT("Ranging Error: sequence number out of order\n");
+    isErrorOccurred = true;
+  }
+
+  int64_t tRound1, tReply1, tRound2, tReply2, diff1, diff2, t;
+  tRound1 = (Rp.timestamp.full - Tx.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  tReply1 = (Tp.timestamp.full - Rx.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  tRound2 = (Rr.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  tReply2 = (Tr.timestamp.full - Rp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  /* A reply sent before the frame it answers was received wraps to an interval of almost the whole clock. */
+  if (tRound1 > UWB_MAX_TIMESTAMP / 2 || tReply1 > UWB_MAX_TIMESTAMP / 2 ||
+      tRound2 > UWB_MAX_TIMESTAMP / 2 || tReply2 > UWB_MAX_TIMESTAMP / 2)
+  {
+    DEBUG_PRINT("Ranging Error: timestamps out of order\n");
+    isErrorOccurred = true;
+  }
+  diff1 = tRound1 - tReply1;
+  diff2 = tRound2 - tReply2;
+  t = (diff1 * tReply2 + diff2 * tReply1 + diff2 * diff1) / (tRound1 + tRound2 + tReply1 + tReply2);
+  int16_t distance = (int16_t)t * 0.4691763978616;
+
+  DEBUG_PRINT("compute dist 2:%d\n", distance);
+  if (distance < 0)
+  {
+    DEBUG_PRINT("Ranging Error: distance < 0\n");
+    isErrorOccurred = true;
+  }
+
+  if (distance > 1000)
+  {
+    DEBUG_PRINT("Ranging Error: distance > 1000\n");
+    isErrorOccurred = true;
+  }
+
+  if (isErrorOccurred)
+  {
+    return -1;
+  }
+
+  return distance;
+}
+
+/* Drift-compensated single-sided TWR from our (Tp, Rp) exchange and the following (Tr, Rr) reply:
+ * tof = ((Rr - Tp) - (Tr - Rp) / (1 + skew)) / 2
+ */
+static int16_t computeDistanceSingleSided(Timestamp_Tuple_t Tp, Timestamp_Tuple_t Rp,
+                                          Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr,
+                                          float clockSkew)
+{
+  if (Tp.seqNumber != Rp.seqNumber || Tr.seqNumber != Rr.seqNumber)
+  {
+    DEBUG_PRINT("Ranging Error: single-sided sequence number mismatch\n");
+    return -1;
+  }
+  int64_t tRound = (Rr.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  int64_t tReply = (Tr.timestamp.full - Rp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  if (tReply > SINGLE_SIDED_REPLY_MAX || tRound <= 0)
+  {
+    return -1;
+  }
+  /* Subtract the drift term separately to keep precision: tReply / (1 + skew) ~= tReply - tReply * skew */
+  double t = (tRound - tReply + (double)tReply * clockSkew / (1 + clockSkew)) / 2;
+  int16_t distance = (int16_t)(t * 0.4691763978616);
+  DEBUG_PRINT("compute dist 3:%d\n", distance);
+  if (distance < 0 || distance > 1000)
+  {
+    DEBUG_PRINT("Ranging Error: single-sided distance out of range\n");
+    return -1;
+  }
+  return distance;
+}
+
+/* Track the clock skew of a neighbor from consecutive (Tr, Rr) pairs, i.e. neighbor tx time and our rx time of
+ * the same message, over a baseline of at least CLOCK_SKEW_MIN_INTERVAL. Tr and Rr must both be valid.
+ */
+void rangingTableUpdateClockSkew(Ranging_Table_t *table, Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr)
+{
+  Ranging_Table_Tr_Rr_Candidate_t *reference = &table->clockReference;
+  if (Tr.seqNumber != Rr.seqNumber)
+  {
+    return;
+  }
+  if (rangingCandidateIsValid(reference))
+  {
+    int64_t localInterval = (Rr.timestamp.full - reference->Rr.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+    int64_t neighborInterval = (Tr.timestamp.full - reference->Tr.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+    if (localInterval < CLOCK_SKEW_MIN_INTERVAL)
+    {
+      return;
+    }
+    if (localInterval <= CLOCK_SKEW_MAX_INTERVAL)
+    {
+      float skew = (float)(neighborInterval - localInterval) / localInterval;
+      if (table->clockSkewSamples == 0)
+      {
+        table->clockSkew = skew;
+        table->clockSkewSamples = 1;
+      }
+      else if (table->clockSkewSamples < CLOCK_SKEW_MIN_SAMPLES || fabsf(skew - table->clockSkew) < CLOCK_SKEW_GATE)
+      {
+        uint8_t weight = MIN(table->clockSkewSamples + 1, CLOCK_SKEW_MIN_SAMPLES);
+        table->clockSkew += (skew - table->clockSkew) / weight;
+        table->clockSkewSamples = MIN(table->clockSkewSamples + 1, UINT8_MAX);
+      }
+    }
+  }
+  reference->Tr = Tr;
+  reference->Rr = Rr;
+  reference->valid = RANGING_CANDIDATE_VALID;
+}
+
+/* Invariants of the ranging state machine, checked on every accepted distance and after every transition when enabled. */
+#ifdef RANGING_INVARIANT_CHECK_ENABLE
+#define RANGING_INVARIANT(expr) ASSERT(expr)
+#else
+#define RANGING_INVARIANT(expr)
+#endif
+
+static void neighborMotionUpdate(Neighbor_Motion_t *motion, int16_t distance, float relativeSpeed, Time_t measurementTime)
+{
+  motion->relativeSpeed = relativeSpeed;
+  if (!motion->initialized || (int32_t)(measurementTime - motion->lastUpdateTime) <= 0)
+  {
+    if (!motion->initialized)
+    {
+      motion->distance = distance;
+      motion->rangeRate = motion->hasRangeRatePrior ? motion->rangeRatePrior : 0;
+      motion->residualVar = 0;
+      motion->lastUpdateTime = measurementTime;
+      motion->initialized = true;
+    }
+    return;
+  }
+  float dt = T2M(measurementTime - motion->lastUpdateTime) / 1000.0f;
+  float predicted = motion->distance + motion->rangeRate * dt;
+  float residual = distance - predicted;
+  motion->distance = predicted + NEIGHBOR_MOTION_ALPHA * residual;
+  motion->rangeRate += NEIGHBOR_MOTION_BETA * residual / dt;
+  if (motion->hasRangeRatePrior)
+  {
+    motion->rangeRate += NEIGHBOR_MOTION_PRIOR_WEIGHT * (motion->rangeRatePrior - motion->rangeRate);
+  }
+  /* The range rate can never exceed the relative speed reported by both nodes. */
+  motion->rangeRate = MAX(-relativeSpeed, MIN(relativeSpeed, motion->rangeRate));
+  motion->residualVar += (residual * residual - motion->residualVar) / 8;
+  motion->lastUpdateTime = measurementTime;
+}
+
+/* Range rate implied by the headers, the relative velocity projected onto the line of sight between the reported
+ * positions, in cm/s. Headers carry no vertical velocity, so only its horizontal part counts.
+ */
+static void neighborMotionSetPrior(Ranging_Context_t *ctx, set_index_t slot, Ranging_Message_Header_t *header)
+{
+  Neighbor_Motion_t *motion = &ctx->neighborMotion[slot];
+  /* Positions are in m, velocities in cm/s. */
+  float dx = (header->posiX - ctx->ownState.x) * 100;
+  float dy = (header->posiY - ctx->ownState.y) * 100;
+  float dz = (header->posiZ - ctx->ownState.z) * 100;
+  float baseline = sqrtf(dx * dx + dy * dy + dz * dz);
+  if (baseline < NEIGHBOR_MOTION_PRIOR_MIN_BASELINE)
+  {
+    motion->hasRangeRatePrior = false;
+    return;
+  }
+  float vx = (float)header->velocityXInWorld - ctx->ownState.velocityXInWorld;
+  float vy = (float)header->velocityYInWorld - ctx->ownState.velocityYInWorld;
+  motion->rangeRatePrior = (vx * dx + vy * dy) / baseline;
+  motion->hasRangeRatePrior = true;
+}
+
+/* Extrapolate along the tracked range rate, the uncertainty grows with the part of the relative speed the range
+ * rate does not explain, which is the tangential motion and the error of the rate itself.
+ */
+static int16_t neighborMotionExtrapolate(const Neighbor_Motion_t *motion, Time_t queryTime, float *uncertainty)
+{
+  if (!motion->initialized)
+  {
+    return -1;
+  }
+  float dt = (int32_t)(queryTime - motion->lastUpdateTime) > 0 ? T2M(queryTime - motion->lastUpdateTime) / 1000.0f : 0;
+  if (dt * 1000 > NEIGHBOR_MOTION_MAX_HORIZON)
+  {
+    return -1;
+  }
+  float predicted = motion->distance + motion->rangeRate * dt;
+  if (uncertainty)
+  {
+    float unexplainedSpeed = MAX(0, motion->relativeSpeed - fabsf(motion->rangeRate));
+    *uncertainty = sqrtf(motion->residualVar) + unexplainedSpeed * dt;
+  }
+  return predicted > 0 ? (int16_t)predicted : 0;
+}
+
+#ifdef ENABLE_SWARM_LOCALIZATION
+/* Core side, the caller holds the ranging table lock. */
+static int16_t neighborMotionPredict(Ranging_Context_t *ctx, uint16_t neighborAddress, Time_t queryTime, float *uncertainty)
+{
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
+  {
+    return -1;
+  }
+  return neighborMotionExtrapolate(&ctx->neighborMotion[slot], queryTime, uncertainty);
+}
+#endif
+
+/* Other modules read the tracker from the published snapshot, under the same sequence check as
+ * getNeighborStateSnapshot() but copying only the entry of this neighbor.
+ */
+int16_t predictedDistanceGet(Ranging_Context_t *ctx, uint16_t neighborAddress, Time_t queryTime, float *uncertainty)
+{
+  Neighbor_Motion_t motion;
+  bool found;
+  while (true)
+  {
+    Neighbor_State_Snapshot_t *front = &ctx->neighborStateSnapshots[ctx->neighborStateSnapshotFront];
+    uint32_t sequence = front->sequence;
+    __sync_synchronize();
+    if (sequence & 1)
+    {
+      continue;
+    }
+    found = false;
+    for (int i = 0; i < front->size && i < RANGING_TABLE_SIZE_MAX; i++)
+    {
+      if (front->neighbors[i].address == neighborAddress)
+      {
+        motion = front->neighbors[i].motion;
+        found = true;
+        break;
+      }
+    }
+    __sync_synchronize();
+    if (front->sequence == sequence)
+    {
+      break;
+    }
+  }
+  return found ? neighborMotionExtrapolate(&motion, queryTime, uncertainty) : -1;
+}
+
+int16_t getPredictedDistance(uint16_t neighborAddress, Time_t queryTime, float *uncertainty)
+{
+  return predictedDistanceGet(&rangingContext, neighborAddress, queryTime, uncertainty);
+}
+
+/* Run a successfully computed raw distance through the filter stage of this neighbor and publish the result. */
+static void rangingTableUpdateDistance(Ranging_Context_t *ctx, Ranging_Table_t *rangingTable, int16_t distance, uint8_t source,
+                                       dwTime_t measurementUwbTime)
+{
+  UWB_Address_t neighborAddress = rangingTable->neighborAddress;
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  ASSERT(slot != NEIGHBOR_SLOT_NONE);
+  RANGING_INVARIANT(distance > 0 && distance <= 1000);
+  ctx->distanceRaw[neighborAddress] = distance;
+
+  /* Bound of relative speed in cm/s, own velocity is in m/s. */
+  float neighborSpeed = sqrtf((float)ctx->neighborStateInfo.velocityXInWorld[slot] * ctx->neighborStateInfo.velocityXInWorld[slot] +
+                              (float)ctx->neighborStateInfo.velocityYInWorld[slot] * ctx->neighborStateInfo.velocityYInWorld[slot]);
+  float relativeSpeed = ctx->velocity * 100 + neighborSpeed;
+  int16_t filtered = distanceFilterUpdate(&ctx->distanceFilter[slot], ctx->params->distanceFilterType, distance, relativeSpeed,
+                                          xTaskGetTickCount());
+  if (filtered < 0)
+  {
+    DEBUG_PRINT("rangingTableUpdateDistance: reject outlier %d for neighbor %u.\n", distance, neighborAddress);
+    return;
+  }
+  rangingTable->distance = filtered;
+  setDistance(ctx, neighborAddress, filtered, source);
+  /* Re is the local UWB time of the frame being processed, received at latestReceivedTick. */
+  uint64_t sinceMeasurement = (rangingTable->Re.timestamp.full - measurementUwbTime.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  Time_t measurementTick = rangingTable->latestReceivedTick - M2T(sinceMeasurement / UWB_TIME_UNITS_PER_MS);
+  setNeighborDistanceWithEpoch(ctx, neighborAddress, filtered, measurementTick, measurementUwbTime);
+  neighborMotionUpdate(&ctx->neighborMotion[slot], filtered, relativeSpeed, measurementTick);
+}
+
+/* Fall back to single-sided ranging when the double-sided chain is not available. */
+static int16_t rangingTableTrySingleSided(Ranging_Context_t *ctx, Ranging_Table_t *rangingTable, Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate)
+{
+  if (rangingTable->clockSkewSamples < CLOCK_SKEW_MIN_SAMPLES ||
+      (rangingTable->valid & (RANGING_VALID_Tp | RANGING_VALID_Rp)) != (RANGING_VALID_Tp | RANGING_VALID_Rp) ||
+      !rangingCandidateIsValid(&Tr_Rr_Candidate))
+  {
+    return -1;
+  }
+  int16_t distance = computeDistanceSingleSided(rangingTable->Tp, rangingTable->Rp,
+                                                Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr,
+                                                rangingTable->clockSkew);
+  if (distance > 0)
+  {
+    getStatistic(ctx, rangingTable->neighborAddress)->compute3num++;
+    rangingTableUpdateDistance(ctx, rangingTable, distance, 3, Tr_Rr_Candidate.Rr.timestamp);
+  }
+  return distance;
+}
+
+/* Ranging state machine, each (state, event) pair maps to the actions to apply and the next state.
+ *   S1: initial, S2: Tf sent, S3: Rf received, S4: Tf sent after Rf received.
+ * RANGING_STATE_S5 is effectively a temporary state for distance calculation and never dispatched.
+ */
+static const Ranging_Transition_t RANGING_TRANSITION[RANGING_TABLE_STATE_COUNT][RANGING_TABLE_EVENT_COUNT] = {
+    [RANGING_STATE_S1] = {
+        [RANGING_EVENT_TX_Tf] = {RANGING_ACTION_NONE, RANGING_STATE_S2},
+        [RANGING_EVENT_RX_NO_Rf] = {RANGING_ACTION_NONE, RANGING_STATE_S1},
+        [RANGING_EVENT_RX_Rf] = {RANGING_ACTION_NONE, RANGING_STATE_S1},
+    },
+    [RANGING_STATE_S2] = {
+        [RANGING_EVENT_TX_Tf] = {RANGING_ACTION_NONE, RANGING_STATE_S2},
+        [RANGING_EVENT_RX_NO_Rf] = {RANGING_ACTION_NONE, RANGING_STATE_S2},
+        [RANGING_EVENT_RX_Rf] = {RANGING_ACTION_FIND_Tf | RANGING_ACTION_SHIFT_Rf | RANGING_ACTION_SHIFT_Re,
+                                 RANGING_STATE_S3},
+    },
+    [RANGING_STATE_S3] = {
+        [RANGING_EVENT_TX_Tf] = {RANGING_ACTION_NONE, RANGING_STATE_S4},
+        [RANGING_EVENT_RX_NO_Rf] = {RANGING_ACTION_COMPUTE_HISTORY | RANGING_ACTION_SHIFT_Re, RANGING_STATE_S3},
+        [RANGING_EVENT_RX_Rf] = {RANGING_ACTION_COMPUTE_HISTORY | RANGING_ACTION_SHIFT_Re, RANGING_STATE_S3},
+    },
+    [RANGING_STATE_S4] = {
+        [RANGING_EVENT_TX_Tf] = {RANGING_ACTION_NONE, RANGING_STATE_S4},
+        [RANGING_EVENT_RX_NO_Rf] = {RANGING_ACTION_COMPUTE_HISTORY | RANGING_ACTION_SHIFT_Re, RANGING_STATE_S4},
+        // TODO: check if valid
+        [RANGING_EVENT_RX_Rf] = {RANGING_ACTION_FIND_Tf | RANGING_ACTION_COMPUTE_DS_TWR | RANGING_ACTION_SHIFT_Rf |
+                                     RANGING_ACTION_SHIFT_Re,
+                                 RANGING_STATE_S3},
+    },
+};
+
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+static void rangingTableTrace(Ranging_Table_t *table, RANGING_TABLE_EVENT event, uint16_t seqNumber,
+                              RANGING_TABLE_STATE prevState, int16_t distance)
+{
+  Ranging_Transition_Trace_Item_t *item = &table->trace.items[table->trace.index];
+  item->tick = xTaskGetTickCount();
+  item->seqNumber = seqNumber;
+  item->prevState = prevState;
+  item->event = event;
+  item->curState = table->state;
+  item->distance = distance;
+  table->trace.index = (table->trace.index + 1) % RANGING_TRANSITION_TRACE_SIZE;
+}
+#endif
+
+void printRangingTransitionTrace(Ranging_Table_t *table)
+{
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+  DEBUG_PRINT("transition trace of neighbor %u, oldest first:\n", table->neighborAddress);
+  for (int i = 0; i < RANGING_TRANSITION_TRACE_SIZE; i++)
+  {
+    Ranging_Transition_Trace_Item_t *item = &table->trace.items[(table->trace.index + i) % RANGING_TRANSITION_TRACE_SIZE];
+    if (!item->tick)
+    {
+      continue;
+    }
+    DEBUG_PRINT("%lu\t seq = %u\t S%u -(%u)-> S%u\t distance = %d\n",
+                item->tick, item->seqNumber, item->prevState, item->event, item->curState, item->distance);
+  }
+#else
+  (void)table;
+#endif
+}
+
+void rangingTableOnEvent(Ranging_Context_t *ctx, Ranging_Table_t *table, RANGING_TABLE_EVENT event)
+{
+  ASSERT(table->state < RANGING_TABLE_STATE_COUNT);
+  ASSERT(event < RANGING_TABLE_EVENT_COUNT);
+  RANGING_TABLE_STATE prevState = table->state;
+  Ranging_Transition_t transition = RANGING_TRANSITION[prevState][event];
+  if (transition.next == RANGING_STATE_RESERVED)
+  {
+    //  DEBUG_PRINT("rangingTableOnEvent: invalid event %d in state S%d, just ignore\n", event, prevState);
+    return;
+  }
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+  uint16_t seqNumber = event == RANGING_EVENT_TX_Tf ? getLatestTxTimestamp(ctx).seqNumber : table->Re.seqNumber;
+#endif
+  int16_t distance = -1;
+
+  if (transition.actions & RANGING_ACTION_FIND_Tf)
+  {
+    /* Find corresponding Tf in TfBuffer, it is possible that can not find corresponding Tf. */
+    if ((table->valid & RANGING_VALID_Rf) && findTfBySeqNumber(ctx, table->Rf.seqNumber, &table->Tf))
+    {
+      table->valid |= RANGING_VALID_Tf;
+    }
+    else
+    {
+      table->valid &= ~RANGING_VALID_Tf;
+      DEBUG_PRINT("Cannot found corresponding Tf in Tf buffer, the ranging frequency may be too high or Tf buffer is in a small size.");
+    }
+  }
+  const uint8_t validDsTwr = RANGING_VALID_Tp | RANGING_VALID_Rp | RANGING_VALID_Tf | RANGING_VALID_Rf;
+  const uint8_t validHistory = RANGING_VALID_Tp | RANGING_VALID_Rp | RANGING_VALID_TxRx;
+  if ((transition.actions & RANGING_ACTION_COMPUTE_DS_TWR) && (table->valid & validDsTwr) != validDsTwr)
+  {
+    distance = rangingTableTrySingleSided(ctx, table, rangingTableBufferGetLatest(&table->TrRrBuffer));
+  }
+  else if (transition.actions & RANGING_ACTION_COMPUTE_DS_TWR)
+  {
+    Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate = rangingTableBufferGetCandidate(&table->TrRrBuffer,
+                                                                                     table->Tf, table->Tp);
+    if (rangingCandidateIsValid(&Tr_Rr_Candidate))
+    {
+      distance = computeDistance(table->Tp, table->Rp,
+                                 Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr,
+                                 table->Tf, table->Rf);
+    }
+    if (distance > 0)
+    {
+      getStatistic(ctx, table->neighborAddress)->compute1num++;
+      rangingTableUpdateDistance(ctx, table, distance, 1, table->Tf.timestamp);
+      /* update history tx,rx
+       * only success distance,update history
+       */
+      table->TxRxHistory.Tx = Tr_Rr_Candidate.Tr;
+      table->TxRxHistory.Rx = Tr_Rr_Candidate.Rr;
+      table->valid |= RANGING_VALID_TxRx;
+    }
+    else
+    {
+      distance = rangingTableTrySingleSided(ctx, table, rangingTableBufferGetLatest(&table->TrRrBuffer));
+    }
+  }
+  if ((transition.actions & RANGING_ACTION_COMPUTE_HISTORY) && (table->valid & validHistory) != validHistory)
+  {
+    distance = rangingTableTrySingleSided(ctx, table, rangingTableBufferGetLatest(&table->TrRrBuffer));
+  }
+  else if (transition.actions & RANGING_ACTION_COMPUTE_HISTORY)
+  {
+    /* use history tx,rx to compute distance */
+    Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate = rangingTableBufferGetLatest(&table->TrRrBuffer);
+    if (rangingCandidateIsValid(&Tr_Rr_Candidate))
+    {
+      distance = computeDistance2(table->TxRxHistory.Tx, table->TxRxHistory.Rx,
+                                  table->Tp, table->Rp,
+                                  Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr);
+    }
+    if (distance > 0)
+    {
+      getStatistic(ctx, table->neighborAddress)->compute2num++;
+      rangingTableUpdateDistance(ctx, table, distance, 2, Tr_Rr_Candidate.Rr.timestamp);
+    }
+    else
+    {
+      distance = rangingTableTrySingleSided(ctx, table, Tr_Rr_Candidate);
+    }
+  }
+
+  /* Shift ranging table
+   * Rp <- Rf
+   * Tp <- Tf  Rr <- Re
+   */
+  Timestamp_Tuple_t empty = {.timestamp.full = 0, .seqNumber = 0};
+  if (transition.actions & RANGING_ACTION_SHIFT_Rf)
+  {
+    table->Rp = table->Rf;
+    table->Tp = table->Tf;
+    table->Rf = empty;
+    table->Tf = empty;
+    table->valid &= ~(RANGING_VALID_Rp | RANGING_VALID_Tp);
+    table->valid |= (table->valid & RANGING_VALID_Rf ? RANGING_VALID_Rp : 0) |
+                    (table->valid & RANGING_VALID_Tf ? RANGING_VALID_Tp : 0);
+    table->valid &= ~(RANGING_VALID_Rf | RANGING_VALID_Tf);
+  }
+  if (transition.actions & RANGING_ACTION_SHIFT_Re)
+  {
+    table->TrRrBuffer.candidates[table->TrRrBuffer.cur].Rr = table->Re;
+    table->TrRrBuffer.candidates[table->TrRrBuffer.cur].valid = table->valid & RANGING_VALID_Re ? RANGING_CANDIDATE_VALID_Rr : 0;
+    table->Re = empty;
+    table->valid &= ~RANGING_VALID_Re;
+  }
+
+  /* Don't update Tf on TX events since sending message is an async action, we put all Tf in TfBuffer. */
+  table->state = transition.next;
+
+  RANGING_INVARIANT(table->state >= RANGING_STATE_S1 && table->state <= RANGING_STATE_S4);
+  RANGING_INVARIANT(!(transition.actions & RANGING_ACTION_SHIFT_Re) || !(table->valid & RANGING_VALID_Re));
+  RANGING_INVARIANT(!(transition.actions & RANGING_ACTION_SHIFT_Rf) ||
+                    !(table->valid & (RANGING_VALID_Rf | RANGING_VALID_Tf)));
+  /* A fresh Tp must match the Rp it was looked up for, a stale Tf from the buffer is never reused. */
+  RANGING_INVARIANT(!(transition.actions & RANGING_ACTION_SHIFT_Rf) || !(table->valid & RANGING_VALID_Tp) ||
+                    table->Tp.seqNumber == table->Rp.seqNumber);
+  RANGING_INVARIANT(distance >= -1 && distance <= 1000);
+
+  if (event != RANGING_EVENT_TX_Tf)
+  {
+    linkQualityOnDistance(ctx, table->neighborAddress, distance > 0);
+    if (distance > 0)
+    {
+      table->rxWithoutDistance = 0;
+    }
+    else if (++table->rxWithoutDistance == RANGING_STALL_THRESHOLD)
+    {
+      /* Counted once per stall, the counter keeps growing until a distance is computed again. */
+      DEBUG_PRINT("rangingTableOnEvent: neighbor %u stalled in S%d\n", table->neighborAddress, table->state);
+      getStatistic(ctx, table->neighborAddress)->stallnum++;
+      printRangingTransitionTrace(table);
+    }
+    else if (table->rxWithoutDistance == UINT8_MAX)
+    {
+      table->rxWithoutDistance = RANGING_STALL_THRESHOLD;
+    }
+  }
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+  rangingTableTrace(table, event, seqNumber, prevState, distance);
+#endif
+  //  DEBUG_PRINT("rangingTableOnEvent: S%d -> S%d\n", prevState, table->state);
+}
+
+// liujiangpeng add
+
+void initNeighborStateInfoAndMedian_data(Ranging_Context_t *ctx)
+{
+  neighborSlotMapInit(&ctx->neighborSlotMap);
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
+  {
+    neighborSlotReset(ctx, slot);
+  }
+}
+
+static void leaderCommandAck(Ranging_Context_t *ctx, uint64_t ackBits)
+{
+  ctx->leaderCommand.ackBits |= ackBits;
+  if (ctx->myAddress <= NEIGHBOR_ADDRESS_MAX)
+  {
+    ctx->leaderCommand.ackBits |= 1ULL << ctx->myAddress;
+  }
+  ctx->leaderCommand.ackCount = __builtin_popcountll(ctx->leaderCommand.ackBits);
+}
+
+/* Leader only, start a new epoch whenever keep_flying or stage changes. */
+static void leaderCommandPublish(Ranging_Context_t *ctx, bool keepFlying, int8_t stage)
+{
+  xSemaphoreTake(ctx->leaderCommandMu, portMAX_DELAY);
+  if (ctx->leaderCommand.keepFlying == keepFlying && ctx->leaderCommand.stage == stage)
+  {
+    xSemaphoreGive(ctx->leaderCommandMu);
+    return;
+  }
+  ctx->leaderCommand.epoch++;
+  ctx->leaderCommand.keepFlying = keepFlying;
+  ctx->leaderCommand.stage = stage;
+  ctx->leaderCommand.ackBits = 0;
+  leaderCommandAck(ctx, 0);
+  xSemaphoreGive(ctx->leaderCommandMu);
+  DEBUG_PRINT("leaderCommandPublish: epoch %u, keepFlying %d, stage %d\n", ctx->leaderCommand.epoch, keepFlying, stage);
+}
+
+/* Adopt a newer command from any neighbor. Every node carries its latest command in each header, so the command
+ * floods hop by hop with the regular frames, there is no separate forwarding.
+ * After a reboot the epoch of the leader starts over below the one the swarm still floods. The leader stays
+ * authoritative by moving past any newer epoch it hears (or the same epoch with another command) and republishing
+ * its own command under it, followers only ever adopt newer epochs and cannot flip back to a stale one.
+ */
+static void leaderCommandOnRx(Ranging_Context_t *ctx, const Leader_Command_Update_t *update)
+{
+  xSemaphoreTake(ctx->leaderCommandMu, portMAX_DELAY);
+  if (ctx->myAddress == ctx->leaderStateInfo.address)
+  {
+    bool isStale = seqNumberLessThan(ctx->leaderCommand.epoch, update->epoch) ||
+                   (update->epoch == ctx->leaderCommand.epoch &&
+                    (update->keepFlying != ctx->leaderCommand.keepFlying || update->stage != ctx->leaderCommand.stage));
+    if (isStale)
+    {
+      ctx->leaderCommand.epoch = update->epoch + 1;
+      ctx->leaderCommand.ackBits = 0;
+      leaderCommandAck(ctx, 0);
+      ctx->commandRepublished++;
+      DEBUG_PRINT("leaderCommandOnRx: epoch %u from %u, republish as %u\n", update->epoch, update->srcAddress,
+                  ctx->leaderCommand.epoch);
+    }
+    else if (update->epoch == ctx->leaderCommand.epoch)
+    {
+      leaderCommandAck(ctx, update->ackBits);
+    }
+    xSemaphoreGive(ctx->leaderCommandMu);
+    return;
+  }
+  if (seqNumberLessThan(ctx->leaderCommand.epoch, update->epoch))
+  {
+    ctx->leaderCommand.epoch = update->epoch;
+    ctx->leaderCommand.keepFlying = update->keepFlying;
+    ctx->leaderCommand.stage = update->stage;
+    ctx->leaderCommand.ackBits = 0;
+    leaderCommandAck(ctx, update->ackBits);
+    ctx->leaderStateInfo.keepFlying = ctx->leaderCommand.keepFlying;
+    ctx->leaderStateInfo.stage = ctx->leaderCommand.stage;
+    DEBUG_PRINT("leaderCommandOnRx: epoch %u from %u, keepFlying %d, stage %d\n",
+                ctx->leaderCommand.epoch, update->srcAddress, ctx->leaderCommand.keepFlying, ctx->leaderCommand.stage);
+  }
+  else if (update->epoch == ctx->leaderCommand.epoch)
+  {
+    /* Duplicate, only merge what the sender knows about the coverage. */
+    leaderCommandAck(ctx, update->ackBits);
+  }
+  xSemaphoreGive(ctx->leaderCommandMu);
+}
+
+static void leaderCommandUpdateFromMessage(const Ranging_Message_t *rangingMessage, Leader_Command_Update_t *update)
+{
+  update->srcAddress = rangingMessage->header.srcAddress;
+  update->epoch = rangingMessage->header.commandEpoch;
+  update->keepFlying = rangingMessage->header.keep_flying;
+  update->stage = rangingMessage->header.stage;
+  update->ackBits = rangingMessage->header.commandAck;
+#ifdef ENABLE_CHANNEL_HOPPING
+  update->channelGroup = rangingMessage->header.channelGroup;
+  update->channelHead = rangingMessage->header.channelHead;
+#endif
+}
 
-  return distance;
+void leaderCommandGet(Ranging_Context_t *ctx, Leader_Command_t *command)
+{
+  xSemaphoreTake(ctx->leaderCommandMu, portMAX_DELAY);
+  *command = ctx->leaderCommand;
+  xSemaphoreGive(ctx->leaderCommandMu);
 }
 
-static int16_t computeDistance2(Timestamp_Tuple_t Tx, Timestamp_Tuple_t Rx,
-                                Timestamp_Tuple_t Tp, Timestamp_Tuple_t Rp,
-                                Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr)
+void getLeaderCommand(Leader_Command_t *command)
 {
-  bool isErrorOccurred = false;
-  DEBUG_PRINT("Tx:%d,Rx:%d,Tp:%d,Rp:%d,Tr:%d,Rr:%d\n", Tx.seqNumber, Rx.seqNumber, Tp.seqNumber, Rp.seqNumber, Tr.seqNumber, Rr.seqNumber);
+  leaderCommandGet(&rangingContext, command);
+}
 
-  if (Tp.seqNumber != Rp.seqNumber || Tr.seqNumber != Rr.seqNumber || Tx.seqNumber != Rx.seqNumber)
+void initLeaderStateInfo(Ranging_Context_t *ctx)
+{
+  ctx->leaderStateInfo.keepFlying = false;
+  ctx->leaderStateInfo.address = 0;
+  ctx->leaderStateInfo.stage = ZERO_STAGE;
+  ctx->leaderCommand.epoch = 0;
+  ctx->leaderCommand.keepFlying = ctx->leaderStateInfo.keepFlying;
+  ctx->leaderCommand.stage = ctx->leaderStateInfo.stage;
+  ctx->leaderCommand.ackBits = 0;
+  leaderCommandAck(ctx, 0);
+  DEBUG_PRINT("--init--%d\n", ctx->leaderStateInfo.stage);
+}
+/* Stage at elapsed ms into the mission: FIRST_STAGE, SECOND_STAGE, then rotation indices -1, 0, ... and LAND_STAGE. */
+static int8_t missionTimelineStageAt(Mission_Timeline_t *timeline, uint32_t elapsed)
+{
+  if (elapsed < timeline->convergeTime)
   {
-    DEBUG_PRINT("Ranging Error: sequence number mismatch\n");
-    isErrorOccurred = true;
+    return FIRST_STAGE;
   }
-
-  if (Tx.seqNumber >= Tr.seqNumber || Rx.seqNumber >= Rr.seqNumber)
+  elapsed -= timeline->convergeTime;
+  if (elapsed < timeline->followTime)
   {
-    DEBUG_PRINT("Ranging Error: sequence number out of order\n");
-    isErrorOccurred = true;
+    return SECOND_STAGE;
   }
-
-  int64_t tRound1, tReply1, tRound2, tReply2, diff1, diff2, t;
-  tRound1 = (Rp.timestamp.full - Tx.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  tReply1 = (Tp.timestamp.full - Rx.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  tRound2 = (Rr.timestamp.full - Tp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  tReply2 = (Tr.timestamp.full - Rp.timestamp.full + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
-  diff1 = tRound1 - tReply1;
-  diff2 = tRound2 - tReply2;
-  t = (diff1 * tReply2 + diff2 * tReply1 + diff2 * diff1) / (tRound1 + tRound2 + tReply1 + tReply2);
-  int16_t distance = (int16_t)t * 0.4691763978616;
-
-  DEBUG_PRINT("compute dist 2:%d\n", distance);
-  if (distance < 0)
+  elapsed -= timeline->followTime;
+  /* The rotation index must stay clear of the stage codes from RESET_INIT_STAGE up, a replayed config may not have
+   * gone through the param callback.
+   */
+  uint8_t rotationCount = MIN(timeline->rotationCount, MISSION_TIMELINE_ROTATION_MAX);
+  if (timeline->maintainTime && elapsed < (uint64_t)timeline->maintainTime * (rotationCount + 1))
   {
-    DEBUG_PRINT("Ranging Error: distance < 0\n");
-    isErrorOccurred = true;
+    return (int8_t)(elapsed / timeline->maintainTime) - 1;
   }
+  return LAND_STAGE;
+}
 
-  if (distance > 1000)
+static void missionTimelineRotationCountChanged(void)
+{
+  if (rangingParams.missionTimeline.rotationCount > MISSION_TIMELINE_ROTATION_MAX)
   {
-    DEBUG_PRINT("Ranging Error: distance > 1000\n");
-    isErrorOccurred = true;
+    rangingParams.missionTimeline.rotationCount = MISSION_TIMELINE_ROTATION_MAX;
   }
+}
 
-  if (isErrorOccurred)
+static void missionTimelineTimerCallback(TimerHandle_t timer)
+{
+  Ranging_Context_t *ctx = (Ranging_Context_t *)pvTimerGetTimerID(timer);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecordTimer(ctx, RANGING_RECORD_TIMER_MISSION_TIMELINE);
+#endif
+  if (ctx->myAddress != ctx->leaderStateInfo.address || !ctx->leaderStateInfo.keepFlying)
   {
-    return -1;
+    ctx->missionStage = ZERO_STAGE;
+    return;
   }
-
-  return distance;
+  uint32_t elapsed = T2M(xTaskGetTickCount() - ctx->leaderStateInfo.keepFlyingTrueTick);
+  ctx->missionStage = missionTimelineStageAt(&ctx->params->missionTimeline, elapsed);
+  ctx->leaderStateInfo.stage = ctx->missionStage;
+  leaderCommandPublish(ctx, ctx->leaderStateInfo.keepFlying, ctx->leaderStateInfo.stage);
 }
 
-static void S1_Tf(Ranging_Table_t *rangingTable)
+static void missionTimelineInit(Ranging_Context_t *ctx)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Don't update Tf here since sending message is an async action, we put all Tf in TfBuffer. */
-  rangingTable->state = RANGING_STATE_S2;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S1_Tf: S%d -> S%d\n", prevState, curState);
+  ctx->missionTimelineTimer = xTimerCreate("missionTimelineTimer",
+                                           M2T(MISSION_TIMELINE_PERIOD),
+                                           pdTRUE,
+                                           (void *)ctx,
+                                           missionTimelineTimerCallback);
+  xTimerStart(ctx->missionTimelineTimer, M2T(0));
 }
 
-static void S1_RX_NO_Rf(Ranging_Table_t *rangingTable)
+int8_t leaderStageGet(Ranging_Context_t *ctx)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  rangingTable->state = RANGING_STATE_S1;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("Invalid state transition occurs, just ignore\n");
-  //  DEBUG_PRINT("S1_RX_NO_Rf: S%d -> S%d\n", prevState, curState);
+  DEBUG_PRINT("--get--%d\n", ctx->leaderStateInfo.stage);
+  return ctx->leaderStateInfo.stage;
 }
 
-static void S1_RX_Rf(Ranging_Table_t *rangingTable)
+int8_t getLeaderStage()
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  rangingTable->state = RANGING_STATE_S1;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("Invalid state transition occurs, just ignore\n");
-  //  DEBUG_PRINT("S1_RX_Rf: S%d -> S%d\n", prevState, curState);
+  return leaderStageGet(&rangingContext);
 }
 
-static void S2_Tf(Ranging_Table_t *rangingTable)
+void myTakeoffSet(Ranging_Context_t *ctx, bool isAlreadyTakeoff)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Don't update Tf here since sending message is an async action, we put all Tf in TfBuffer. */
-  rangingTable->state = RANGING_STATE_S2;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S2_Tf: S%d -> S%d\n", prevState, curState);
+  ctx->myTakeoff = isAlreadyTakeoff;
 }
 
-static void S2_RX_NO_Rf(Ranging_Table_t *rangingTable)
+void setMyTakeoff(bool isAlreadyTakeoff)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  rangingTable->state = RANGING_STATE_S2;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("Invalid state transition occurs, just ignore\n");
-  //  DEBUG_PRINT("S2_RX_NO_Rf: S%d -> S%d\n", prevState, curState);
+  myTakeoffSet(&rangingContext, isAlreadyTakeoff);
 }
 
-static void S2_RX_Rf(Ranging_Table_t *rangingTable)
+void setNeighborStateInfo(Ranging_Context_t *ctx, uint16_t neighborAddress, Ranging_Message_Header_t *rangingMessageHeader)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Find corresponding Tf in TfBuffer, it is possible that can not find corresponding Tf. */
-  rangingTable->Tf = findTfBySeqNumber(rangingTable->Rf.seqNumber);
-  if (!rangingTable->Tf.timestamp.full)
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-    DEBUG_PRINT("Cannot found corresponding Tf in Tf buffer, the ranging frequency may be too high or Tf buffer is in a small size.");
+    return;
   }
 
-  /* Shift ranging table
-   * Rp <- Rf
-   * Tp <- Tf  Rr <- Re
-   */
-  rangingTable->Rp = rangingTable->Rf;
-  rangingTable->Tp = rangingTable->Tf;
-  rangingTable->TrRrBuffer.candidates[rangingTable->TrRrBuffer.cur].Rr = rangingTable->Re;
-
-  Timestamp_Tuple_t empty = {.timestamp.full = 0, .seqNumber = 0};
-  rangingTable->Rf = empty;
-  rangingTable->Tf = empty;
-  rangingTable->Re = empty;
-
-  rangingTable->state = RANGING_STATE_S3;
+  ctx->neighborStateInfo.velocityXInWorld[slot] = rangingMessageHeader->velocityXInWorld;
+  ctx->neighborStateInfo.velocityYInWorld[slot] = rangingMessageHeader->velocityYInWorld;
+  ctx->neighborStateInfo.gyroZ[slot] = rangingMessageHeader->gyroZ;
+  ctx->neighborStateInfo.positionZ[slot] = rangingMessageHeader->positionZ;
+  neighborMotionSetPrior(ctx, slot, rangingMessageHeader);
+  /* keep_flying and stage are set by the leader command flooding, see leaderCommandOnRx() */
+}
+void setNeighborDistance(Ranging_Context_t *ctx, uint16_t neighborAddress, int16_t distance)
+{
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
+  {
+    return;
+  }
 
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S2_RX_Rf: S%d -> S%d\n", prevState, curState);
+  ctx->neighborStateInfo.distanceTowards[slot] = distance;
+  ctx->neighborStateInfo.refresh[slot] = true;
+  ctx->neighborStateInfo.measurementTime[slot] = xTaskGetTickCount();
+  ctx->neighborStateInfo.measurementUwbTime[slot].full = 0;
+  ctx->neighborStateInfo.distanceVersion[slot] = ctx->neighborStateVersion + 1;
 }
 
-static void S3_Tf(Ranging_Table_t *rangingTable)
+void setNeighborDistanceWithEpoch(Ranging_Context_t *ctx, uint16_t neighborAddress, int16_t distance, Time_t measurementTick, dwTime_t measurementUwbTime)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Don't update Tf here since sending message is an async action, we put all Tf in TfBuffer. */
-  rangingTable->state = RANGING_STATE_S4;
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
+  {
+    return;
+  }
 
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S3_Tf: S%d -> S%d\n", prevState, curState);
+  ctx->neighborStateInfo.distanceTowards[slot] = distance;
+  ctx->neighborStateInfo.refresh[slot] = true;
+  ctx->neighborStateInfo.measurementTime[slot] = measurementTick;
+  ctx->neighborStateInfo.measurementUwbTime[slot] = measurementUwbTime;
+  ctx->neighborStateInfo.distanceVersion[slot] = ctx->neighborStateVersion + 1;
 }
 
-static void S3_RX_NO_Rf(Ranging_Table_t *rangingTable)
-
+/* Writes the back buffer and then flips it to front, the sequence number of each buffer lets readers detect that
+ * the buffer they are copying is being rewritten. Called with rangingTableSet.mu held (RX task and eviction timer),
+ * so there is a single writer at a time, and the front buffer is never written while it is front.
+ */
+void publishNeighborStateSnapshot(Ranging_Context_t *ctx)
 {
-  DEBUG_PRINT("T1-");
-  Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate = rangingTableBufferGetLatest(&rangingTable->TrRrBuffer);
-  int16_t distance = computeDistance2(rangingTable->TxRxHistory.Tx, rangingTable->TxRxHistory.Rx,
-                                      rangingTable->Tp, rangingTable->Rp,
-                                      Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr);
-
-  if (distance > 0)
+  uint8_t back = ctx->neighborStateSnapshotFront ^ 1;
+  Neighbor_State_Snapshot_t *snapshot = &ctx->neighborStateSnapshots[back];
+
+  snapshot->sequence++;
+  __sync_synchronize();
+  snapshot->version = ctx->neighborStateVersion + 1;
+  snapshot->keepFlying = ctx->leaderStateInfo.keepFlying;
+  snapshot->size = 0;
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
   {
-    statistic[rangingTable->neighborAddress].compute2num++;
-    rangingTable->distance = distance;
-    setDistance(rangingTable->neighborAddress, distance, 2);
+    if (ctx->neighborSlotMap.addressOf[slot] == UWB_DEST_EMPTY)
+    {
+      continue;
+    }
+    Neighbor_State_t *state = &snapshot->neighbors[snapshot->size++];
+    state->address = ctx->neighborSlotMap.addressOf[slot];
+    state->distance = ctx->neighborStateInfo.distanceTowards[slot];
+    state->velocityXInWorld = ctx->neighborStateInfo.velocityXInWorld[slot];
+    state->velocityYInWorld = ctx->neighborStateInfo.velocityYInWorld[slot];
+    state->gyroZ = ctx->neighborStateInfo.gyroZ[slot];
+    state->positionZ = ctx->neighborStateInfo.positionZ[slot];
+    state->measurementTime = ctx->neighborStateInfo.measurementTime[slot];
+    state->measurementUwbTime = ctx->neighborStateInfo.measurementUwbTime[slot];
+    state->addedVersion = ctx->neighborStateInfo.addedVersion[slot];
+    state->distanceVersion = ctx->neighborStateInfo.distanceVersion[slot];
+    state->motion = ctx->neighborMotion[slot];
+  }
+  __sync_synchronize();
+  snapshot->sequence++;
+  ctx->neighborStateVersion++;
+  ctx->neighborStateSnapshotFront = back;
+}
 
-    setNeighborDistance(rangingTable->neighborAddress, distance);
+bool neighborStateSnapshotGet(Ranging_Context_t *ctx, Neighbor_State_Snapshot_t *snapshot, uint32_t lastVersion)
+{
+  while (true)
+  {
+    Neighbor_State_Snapshot_t *front = &ctx->neighborStateSnapshots[ctx->neighborStateSnapshotFront];
+    uint32_t sequence = front->sequence;
+    __sync_synchronize();
+    if (sequence & 1)
+    {
+      continue;
+    }
+    if (front->version <= lastVersion)
+    {
+      return false;
+    }
+    memcpy(snapshot, front, sizeof(Neighbor_State_Snapshot_t));
+    __sync_synchronize();
+    if (front->sequence == sequence)
+    {
+      break;
+    }
   }
-  else
+  for (int i = 0; i < snapshot->size; i++)
   {
-    //    DEBUG_PRINT("distance is not updated since some error occurs\n");
+    snapshot->neighbors[i].isNewAdd = snapshot->neighbors[i].addedVersion > lastVersion;
+    snapshot->neighbors[i].refresh = snapshot->neighbors[i].distanceVersion > lastVersion;
   }
+  return true;
+}
 
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Shift ranging table
-   * Rr <- Re
-   */
-  rangingTable->TrRrBuffer.candidates[rangingTable->TrRrBuffer.cur].Rr = rangingTable->Re;
-  Timestamp_Tuple_t empty = {.timestamp.full = 0, .seqNumber = 0};
-  rangingTable->Re = empty;
-
-  rangingTable->state = RANGING_STATE_S3;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S3_RX_NO_Rf: S%d -> S%d\n", prevState, curState);
+bool getNeighborStateSnapshot(Neighbor_State_Snapshot_t *snapshot, uint32_t lastVersion)
+{
+  return neighborStateSnapshotGet(&rangingContext, snapshot, lastVersion);
 }
 
-static void S3_RX_Rf(Ranging_Table_t *rangingTable)
+static void leaderKeepFlyingSet(Ranging_Context_t *ctx, bool keep_flying)
 {
-  Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate = rangingTableBufferGetLatest(&rangingTable->TrRrBuffer);
-  int16_t distance = computeDistance2(rangingTable->TxRxHistory.Tx, rangingTable->TxRxHistory.Rx,
-                                      rangingTable->Tp, rangingTable->Rp,
-                                      Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr);
-  if (distance > 0)
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  if (ctx->leaderStateInfo.keepFlying != keep_flying)
   {
+    uint8_t value = keep_flying;
+    rangingRecord(ctx, RANGING_RECORD_KEEP_FLYING, &value, sizeof(value), NULL, 0);
+  }
+#endif
+  if (ctx->leaderStateInfo.keepFlying == false && keep_flying == true)
+  {
+    ctx->leaderStateInfo.keepFlyingTrueTick = xTaskGetTickCount();
+  }
+  ctx->leaderStateInfo.keepFlying = keep_flying;
+  leaderCommandPublish(ctx, ctx->leaderStateInfo.keepFlying, ctx->leaderStateInfo.stage);
+}
 
-    statistic[rangingTable->neighborAddress].compute2num++;
-    rangingTable->distance = distance;
-    setDistance(rangingTable->neighborAddress, distance, 2);
-
-    setNeighborDistance(rangingTable->neighborAddress, distance);
+bool keepFlyingGetOrSet(Ranging_Context_t *ctx, uint16_t uwbAddress, bool keep_flying)
+{
+  if (uwbAddress == ctx->leaderStateInfo.address)
+  {
+    leaderKeepFlyingSet(ctx, keep_flying);
+    return keep_flying;
   }
   else
   {
-    //    DEBUG_PRINT("distance is not updated since some error occurs\n");
+    return ctx->leaderStateInfo.keepFlying;
   }
-
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Shift ranging table
-   * Rr <- Re
-   */
-  rangingTable->TrRrBuffer.candidates[rangingTable->TrRrBuffer.cur].Rr = rangingTable->Re;
-  Timestamp_Tuple_t empty = {.timestamp.full = 0, .seqNumber = 0};
-  rangingTable->Re = empty;
-
-  rangingTable->state = RANGING_STATE_S3;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S3_RX_Rf: S%d -> S%d\n", prevState, curState);
 }
 
-static void S4_Tf(Ranging_Table_t *rangingTable)
+bool getOrSetKeepflying(uint16_t uwbAddress, bool keep_flying)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Don't update Tf here since sending message is an async action, we put all Tf in TfBuffer. */
-  rangingTable->state = RANGING_STATE_S4;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S4_Tf: S%d -> S%d\n", prevState, curState);
+  return keepFlyingGetOrSet(&rangingContext, uwbAddress, keep_flying);
 }
 
-static void S4_RX_NO_Rf(Ranging_Table_t *rangingTable)
+void setNeighborStateInfo_isNewAdd(Ranging_Context_t *ctx, uint16_t neighborAddress, bool isNewAddNeighbor)
 {
-
-  DEBUG_PRINT("T2-");
-  /*use history tx,rx to compute distance*/
-  Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate = rangingTableBufferGetLatest(&rangingTable->TrRrBuffer);
-  int16_t distance = computeDistance2(rangingTable->TxRxHistory.Tx, rangingTable->TxRxHistory.Rx,
-                                      rangingTable->Tp, rangingTable->Rp,
-                                      Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr);
-  if (distance > 0)
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-
-    statistic[rangingTable->neighborAddress].compute2num++;
-    rangingTable->distance = distance;
-    setDistance(rangingTable->neighborAddress, distance, 2);
-    setNeighborDistance(rangingTable->neighborAddress, distance);
+    return;
+  }
+  if (isNewAddNeighbor == true)
+  {
+    ctx->neighborStateInfo.isNewAdd[slot] = true;
+    ctx->neighborStateInfo.isNewAddUsed[slot] = false;
   }
   else
   {
-    //    DEBUG_PRINT("distance is not updated since some error occurs\n");
+    if (ctx->neighborStateInfo.isNewAddUsed[slot] == true)
+    {
+      ctx->neighborStateInfo.isNewAdd[slot] = false;
+    }
   }
-
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Shift ranging table
-   * Rr <- Re
-   */
-  rangingTable->TrRrBuffer.candidates[rangingTable->TrRrBuffer.cur].Rr = rangingTable->Re;
-  Timestamp_Tuple_t empty = {.timestamp.full = 0, .seqNumber = 0};
-  rangingTable->Re = empty;
-
-  rangingTable->state = RANGING_STATE_S4;
-
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S4_RX_NO_Rf: S%d -> S%d\n", prevState, curState);
 }
 
-static void S4_RX_Rf(Ranging_Table_t *rangingTable)
+bool neighborStateInfoGet(Ranging_Context_t *ctx, uint16_t neighborAddress, uint16_t *distance, short *vx, short *vy, float *gyroZ, uint16_t *height, bool *isNewAddNeighbor)
 {
-  RANGING_TABLE_STATE prevState = rangingTable->state;
-
-  /* Find corresponding Tf in TfBuffer, it is possible that can not find corresponding Tf. */
-  rangingTable->Tf = findTfBySeqNumber(rangingTable->Rf.seqNumber);
-
-  Ranging_Table_Tr_Rr_Candidate_t Tr_Rr_Candidate = rangingTableBufferGetCandidate(&rangingTable->TrRrBuffer,
-                                                                                   rangingTable->Tf, rangingTable->Tp);
-
-  //  printRangingTable(rangingTable);
-  // DEBUG_PRINT("Tp:%d,Rf:%d\n", rangingTable->Tp.seqNumber, rangingTable->Rf.seqNumber);
-  /* try to compute distance */
-  int16_t distance = computeDistance(rangingTable->Tp, rangingTable->Rp,
-                                     Tr_Rr_Candidate.Tr, Tr_Rr_Candidate.Rr,
-                                     rangingTable->Tf, rangingTable->Rf);
-  if (distance > 0)
+  set_index_t slot = neighborSlotMapGet(&ctx->neighborSlotMap, neighborAddress);
+  if (slot == NEIGHBOR_SLOT_NONE)
   {
-
-    statistic[rangingTable->neighborAddress].compute1num++;
-    rangingTable->distance = distance;
-    setDistance(rangingTable->neighborAddress, distance, 1);
-    setNeighborDistance(rangingTable->neighborAddress, distance);
-    /* update history tx,rx
-     * only success distance,update history
-     */
-    rangingTable->TxRxHistory.Tx = Tr_Rr_Candidate.Tr;
-    rangingTable->TxRxHistory.Rx = Tr_Rr_Candidate.Rr;
+    return false;
+  }
+  if (ctx->neighborStateInfo.refresh[slot] == true && ctx->leaderStateInfo.keepFlying == true)
+  {
+    ctx->neighborStateInfo.refresh[slot] = false;
+    *distance = ctx->neighborStateInfo.distanceTowards[slot];
+    *vx = ctx->neighborStateInfo.velocityXInWorld[slot];
+    *vy = ctx->neighborStateInfo.velocityYInWorld[slot];
+    *gyroZ = ctx->neighborStateInfo.gyroZ[slot];
+    *height = ctx->neighborStateInfo.positionZ[slot];
+    *isNewAddNeighbor = ctx->neighborStateInfo.isNewAdd[slot];
+    ctx->neighborStateInfo.isNewAddUsed[slot] = true;
+    distanceLatencyRecord(ctx, neighborAddress, ctx->neighborStateInfo.measurementTime[slot]);
+    return true;
   }
   else
   {
-    //    DEBUG_PRINT("distance is not updated since some error occurs\n");
+    return false;
   }
+}
 
-  /* Shift ranging table
-   * Rp <- Rf
-   * Tp <- Tf  Rr <- Re
-   */
-  rangingTable->Rp = rangingTable->Rf;
-  rangingTable->Tp = rangingTable->Tf;
-  rangingTable->TrRrBuffer.candidates[rangingTable->TrRrBuffer.cur].Rr = rangingTable->Re;
-
-  Timestamp_Tuple_t empty = {.timestamp.full = 0, .seqNumber = 0};
-  rangingTable->Rf = empty;
-  rangingTable->Tf = empty;
-  rangingTable->Re = empty;
+bool getNeighborStateInfo(uint16_t neighborAddress,
+                          uint16_t *distance,
+                          short *vx,
+                          short *vy,
+                          float *gyroZ,
+                          uint16_t *height,
+                          bool *isNewAddNeighbor)
+{
+  return neighborStateInfoGet(&rangingContext, neighborAddress, distance, vx, vy, gyroZ, height, isNewAddNeighbor);
+}
 
-  // TODO: check if valid
-  rangingTable->state = RANGING_STATE_S3;
+void currentNeighborAddressInfoGet(Ranging_Context_t *ctx, currentNeighborAddressInfo_t *currentNeighborAddressInfo)
+{
+  /*--11添加--*/
+  currentNeighborAddressInfo->size = ctx->rangingTableSet.size;
+  for (set_index_t iter = 0; iter < ctx->rangingTableSet.size; iter++)
+  {
+    currentNeighborAddressInfo->address[iter] = ctx->rangingTableSet.tables[iter].neighborAddress;
+  }
 
-  RANGING_TABLE_STATE curState = rangingTable->state;
-  //  DEBUG_PRINT("S4_RX_Rf: S%d -> S%d\n", prevState, curState);
+  /*--11添加--*/
 }
 
-/* Don't call this handler function. */
-static void S5_Tf(Ranging_Table_t *rangingTable)
+void getCurrentNeighborAddressInfo_t(currentNeighborAddressInfo_t *currentNeighborAddressInfo)
 {
-  //  DEBUG_PRINT("S5_Tf: invalid handler invocation of temporary state RANGING_STATE_S5\n");
+  currentNeighborAddressInfoGet(&rangingContext, currentNeighborAddressInfo);
 }
 
-/* Don't call this handler function. */
-static void S5_RX_NO_Rf(Ranging_Table_t *rangingTable)
+void computeRealDistance(Ranging_Context_t *ctx, uint16_t neighborAddress, float x1, float y1, float z1, float x2, float y2, float z2)
+{
+  // 计算各坐标的差
+  float dx = x2 - x1;
+  float dy = y2 - y1;
+  float dz = z2 - z1;
+
+  // 计算距离的平方和再开方
+  float distance = sqrt(dx * dx + dy * dy + dz * dz) * 100;
+  DEBUG_PRINT("distance:%f\n", distance);
+  ctx->distanceReal[neighborAddress] = distance;
+}
+/* Swarm Ranging */
+#ifdef ENABLE_CHANNEL_HOPPING
+static void channelHoppingInit(Ranging_Context_t *ctx, Channel_Hopping_t *hopping)
 {
-  //  DEBUG_PRINT("S5_RX_NO_Rf: invalid handler invocation of temporary state RANGING_STATE_S5\n");
+  /* Every follower starts as the head of its own cluster, the lower heads then take over their neighborhoods. */
+  hopping->group = ctx->myAddress % CHANNEL_GROUP_COUNT;
+  hopping->current = CHANNEL_GROUP_NONE;
+  hopping->isBridge = false;
+  hopping->head = ctx->myAddress;
+  hopping->pendingCount = 0;
+  hopping->hopIndex = 0;
+  hopping->leaderRxTick = 0;
+  hopping->leaderSeen = false;
+  for (int i = 0; i <= NEIGHBOR_ADDRESS_MAX; i++)
+  {
+    hopping->neighbors[i].group = CHANNEL_GROUP_NONE;
+    hopping->neighbors[i].head = UWB_DEST_EMPTY;
+    hopping->neighbors[i].lastHeard = 0;
+  }
 }
 
-/* Don't call this handler function. */
-static void S5_RX_Rf(Ranging_Table_t *rangingTable)
+void channelHoppingSetSwitchHook(Ranging_Context_t *ctx, channelSwitchHook hook)
 {
-  //  DEBUG_PRINT("S5_RX_Rf: invalid handler invocation of temporary state RANGING_STATE_S5\n");
+  ctx->channelHopping.switchHook = hook;
 }
 
-/* Don't call this handler function. */
-static void RESERVED_STUB(Ranging_Table_t *rangingTable)
+void channelHoppingRegisterSwitchHook(channelSwitchHook hook)
 {
-  //  DEBUG_PRINT("RESERVED_STUB: Error, been invoked unexpectedly\n");
+  channelHoppingSetSwitchHook(&rangingContext, hook);
 }
 
-static RangingTableEventHandler EVENT_HANDLER[RANGING_TABLE_STATE_COUNT][RANGING_TABLE_EVENT_COUNT] = {
-    {RESERVED_STUB, RESERVED_STUB, RESERVED_STUB},
-    {S1_Tf, S1_RX_NO_Rf, S1_RX_Rf},
-    {S2_Tf, S2_RX_NO_Rf, S2_RX_Rf},
-    {S3_Tf, S3_RX_NO_Rf, S3_RX_Rf},
-    {S4_Tf, S4_RX_NO_Rf, S4_RX_Rf},
-    /* RANGING_STATE_S5 is effectively a temporary state for distance calculation, never been invoked */
-    {S5_Tf, S5_RX_NO_Rf, S5_RX_Rf}};
+uint8_t channelHoppingGroupGet(Ranging_Context_t *ctx)
+{
+  return ctx->channelHopping.group;
+}
 
-void rangingTableOnEvent(Ranging_Table_t *table, RANGING_TABLE_EVENT event)
+uint8_t channelHoppingGetGroup()
 {
-  ASSERT(table->state < RANGING_TABLE_STATE_COUNT);
-  ASSERT(event < RANGING_TABLE_EVENT_COUNT);
-  EVENT_HANDLER[table->state][event](table);
+  return channelHoppingGroupGet(&rangingContext);
 }
 
-// liujiangpeng add
+/* Radio settings of each channel group, the DW3000 has channels 5 and 9 and distinct preamble codes keep the
+ * groups apart where the channels leak. The rest follows the deck driver: 6.8 Mbps, 128 symbol preamble.
+ */
+static const uint8_t CHANNEL_GROUP_CHANNEL[CHANNEL_GROUP_COUNT] = {5, 9};
+static const uint8_t CHANNEL_GROUP_PREAMBLE_CODE[CHANNEL_GROUP_COUNT] = {9, 10};
 
-void initNeighborStateInfoAndMedian_data()
+/* Switch hook of the deck, called from the tx task right before the frame is handed to the driver. */
+static void channelHoppingRadioSwitch(uint8_t channelGroup)
 {
-  for (int i = 0; i < RANGING_TABLE_SIZE + 1; i++)
+  dwt_config_t config = {
+      .chan = CHANNEL_GROUP_CHANNEL[channelGroup],
+      .txPreambLength = DWT_PLEN_128,
+      .rxPAC = DWT_PAC8,
+      .txCode = CHANNEL_GROUP_PREAMBLE_CODE[channelGroup],
+      .rxCode = CHANNEL_GROUP_PREAMBLE_CODE[channelGroup],
+      .sfdType = DWT_SFD_DW_8,
+      .dataRate = DWT_BR_6M8,
+      .phrMode = DWT_PHRMODE_EXT,
+      .phrRate = DWT_PHRRATE_STD,
+      .sfdTO = 129 + 8 - 8,
+      .stsMode = DWT_STS_MODE_OFF,
+      .stsLength = DWT_STS_LEN_64,
+      .pdoaMode = DWT_PDOA_M0,
+  };
+  dwt_forcetrxoff();
+  if (dwt_configure(&config) != DWT_SUCCESS)
   {
-    tx_rv_interval_history[i].latest_data_index = 0;
-    tx_rv_interval_history[i].interval[0] = 1000;
-    median_data[i].index_inserting = 0;
-    neighborStateInfo.refresh[i] = false;
-    neighborStateInfo.isAlreadyTakeoff[i] = false;
+    DEBUG_PRINT("channelHoppingRadioSwitch: failed to tune to group %u\n", channelGroup);
   }
+  dwt_rxenable(DWT_START_RX_IMMEDIATE);
 }
 
-void initLeaderStateInfo()
-{
-  leaderStateInfo.keepFlying = false;
-  leaderStateInfo.address = 0;
-  leaderStateInfo.stage = ZERO_STAGE;
-  DEBUG_PRINT("--init--%d\n", leaderStateInfo.stage);
-}
-int8_t getLeaderStage()
+static void channelHoppingOnRx(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, uint8_t group, uint16_t head)
 {
-  DEBUG_PRINT("--get--%d\n", leaderStateInfo.stage);
-  return leaderStateInfo.stage;
+  if (neighborAddress > NEIGHBOR_ADDRESS_MAX || group >= CHANNEL_GROUP_COUNT)
+  {
+    return;
+  }
+  Channel_Hopping_Neighbor_t *neighbor = &ctx->channelHopping.neighbors[neighborAddress];
+  neighbor->group = group;
+  neighbor->head = head;
+  neighbor->lastHeard = xTaskGetTickCount();
 }
 
-void setMyTakeoff(bool isAlreadyTakeoff)
+static bool channelHoppingHeard(Channel_Hopping_t *hopping, UWB_Address_t address, Time_t now)
 {
-  MYisAlreadyTakeoff = isAlreadyTakeoff;
+  Channel_Hopping_Neighbor_t *neighbor = &hopping->neighbors[address];
+  return neighbor->group != CHANNEL_GROUP_NONE && now - neighbor->lastHeard < M2T(CHANNEL_NEIGHBOR_TIMEOUT);
 }
 
-void setNeighborStateInfo(uint16_t neighborAddress, Ranging_Message_Header_t *rangingMessageHeader)
+/* Lowest follower below limit heard heading a cluster on this node's group, UWB_DEST_EMPTY if none. Heads heard
+ * while bridging to another group are left alone, or clusters would merge across channels.
+ */
+static UWB_Address_t channelHoppingLowestHead(Channel_Hopping_t *hopping, UWB_Address_t limit, Time_t now)
 {
-  ASSERT(neighborAddress <= RANGING_TABLE_SIZE);
-
-  neighborStateInfo.velocityXInWorld[neighborAddress] = rangingMessageHeader->velocityXInWorld;
-  neighborStateInfo.velocityYInWorld[neighborAddress] = rangingMessageHeader->velocityYInWorld;
-  neighborStateInfo.gyroZ[neighborAddress] = rangingMessageHeader->gyroZ;
-  neighborStateInfo.positionZ[neighborAddress] = rangingMessageHeader->positionZ;
-  DEBUG_PRINT("set sucess%d\n", leaderStateInfo.stage);
-  if (neighborAddress == leaderStateInfo.address)
-  { /*无人机的keep_flying都是由0号无人机来设置的*/
-    leaderStateInfo.keepFlying = rangingMessageHeader->keep_flying;
-    leaderStateInfo.stage = rangingMessageHeader->stage;
-    DEBUG_PRINT("--before recv--%d\n", leaderStateInfo.stage);
+  for (UWB_Address_t address = 1; address < limit && address <= NEIGHBOR_ADDRESS_MAX; address++)
+  {
+    Channel_Hopping_Neighbor_t *neighbor = &hopping->neighbors[address];
+    if (channelHoppingHeard(hopping, address, now) && neighbor->head == address && neighbor->group == hopping->group)
+    {
+      return address;
+    }
   }
+  return UWB_DEST_EMPTY;
 }
-void setNeighborDistance(uint16_t neighborAddress, int16_t distance)
-{
-  ASSERT(neighborAddress <= RANGING_TABLE_SIZE);
 
-  neighborStateInfo.distanceTowards[neighborAddress] = distance;
-  neighborStateInfo.refresh[neighborAddress] = true;
+/* Group of a new head, the one fewest heads around use, its own address breaks ties. */
+static uint8_t channelHoppingQuietestGroup(Ranging_Context_t *ctx, Channel_Hopping_t *hopping, Time_t now)
+{
+  uint8_t heads[CHANNEL_GROUP_COUNT] = {0};
+  for (UWB_Address_t address = 1; address <= NEIGHBOR_ADDRESS_MAX; address++)
+  {
+    if (address != ctx->myAddress && channelHoppingHeard(hopping, address, now) &&
+        hopping->neighbors[address].head == address)
+    {
+      heads[hopping->neighbors[address].group]++;
+    }
+  }
+  uint8_t group = ctx->myAddress % CHANNEL_GROUP_COUNT;
+  for (uint8_t i = 0; i < CHANNEL_GROUP_COUNT; i++)
+  {
+    group = heads[i] < heads[group] ? i : group;
+  }
+  return group;
 }
 
-bool getOrSetKeepflying(uint16_t uwbAddress, bool keep_flying)
+/* Least cluster change clustering over the followers. The leader is left out, it is heard by nearly everyone and
+ * would head one cluster spanning the swarm. A follower keeps its head as long as it hears it, heads hearing a
+ * lower head on their group give way, and only a head lost or contested for CHANNEL_GROUP_HOLD_COUNT transmissions
+ * changes the cluster. Heads are sticky, so retuning, which hides the other groups, does not feed back into it.
+ */
+static void channelHoppingCluster(Ranging_Context_t *ctx, Channel_Hopping_t *hopping, Time_t now)
 {
-  if (uwbAddress == leaderStateInfo.address)
+  UWB_Address_t candidate;
+  if (hopping->head == ctx->myAddress)
   {
-    if (leaderStateInfo.keepFlying == false && keep_flying == true)
+    candidate = channelHoppingLowestHead(hopping, ctx->myAddress, now);
+    if (candidate == UWB_DEST_EMPTY)
     {
-      leaderStateInfo.keepFlyingTrueTick = xTaskGetTickCount();
+      hopping->pendingCount = 0;
+      return;
     }
-    leaderStateInfo.keepFlying = keep_flying;
-    return keep_flying;
+  }
+  else if (channelHoppingHeard(hopping, hopping->head, now) && hopping->neighbors[hopping->head].head == hopping->head)
+  {
+    hopping->pendingCount = 0;
+    return;
+  }
+  else
+  {
+    candidate = channelHoppingLowestHead(hopping, NEIGHBOR_ADDRESS_MAX + 1, now);
+  }
+  if (++hopping->pendingCount < CHANNEL_GROUP_HOLD_COUNT)
+  {
+    return;
+  }
+  hopping->pendingCount = 0;
+  if (candidate == UWB_DEST_EMPTY)
+  {
+    hopping->head = ctx->myAddress;
+    hopping->group = channelHoppingQuietestGroup(ctx, hopping, now);
   }
   else
   {
-    return leaderStateInfo.keepFlying;
+    hopping->head = candidate;
+    hopping->group = hopping->neighbors[candidate].group;
   }
+  DEBUG_PRINT("channelHoppingCluster: head %u, group %u\n", hopping->head, hopping->group);
 }
 
-void setNeighborStateInfo_isNewAdd(uint16_t neighborAddress, bool isNewAddNeighbor)
+/* Pick the group of the next transmission and tune the radio to it, the radio keeps listening there until the
+ * next one. The leader visits the groups in turn, one per transmission, followers that have not heard the leader
+ * for CHANNEL_NEIGHBOR_TIMEOUT bridge every other transmission to the next foreign group.
+ */
+static void channelHoppingUpdate(Ranging_Context_t *ctx, Channel_Hopping_t *hopping)
 {
-  if (isNewAddNeighbor == true)
+  Time_t now = xTaskGetTickCount();
+  uint8_t next;
+  if (ctx->myAddress == 0)
   {
-    neighborStateInfo.isNewAdd[neighborAddress] = true;
-    neighborStateInfo.isNewAddUsed[neighborAddress] = false;
+    /* Every group, the leader only hears a group while visiting it and could not tell an empty one. */
+    next = (hopping->group + 1) % CHANNEL_GROUP_COUNT;
+    hopping->group = next;
+    hopping->head = ctx->myAddress;
+    hopping->isBridge = true;
   }
   else
   {
-    if (neighborStateInfo.isNewAddUsed[neighborAddress] == true)
+    channelHoppingCluster(ctx, hopping, now);
+    hopping->isBridge = !hopping->leaderSeen || now - hopping->leaderRxTick >= M2T(CHANNEL_NEIGHBOR_TIMEOUT);
+    next = hopping->group;
+    if (hopping->isBridge && (hopping->hopIndex++ & 1))
     {
-      neighborStateInfo.isNewAdd[neighborAddress] = false;
+      next = (hopping->group + 1 + (hopping->hopIndex / 2) % (CHANNEL_GROUP_COUNT - 1)) % CHANNEL_GROUP_COUNT;
+    }
+  }
+  if (next != hopping->current)
+  {
+    hopping->current = next;
+    if (hopping->switchHook)
+    {
+      hopping->switchHook(next);
     }
   }
 }
+#endif
 
-bool getNeighborStateInfo(uint16_t neighborAddress,
-                          uint16_t *distance,
-                          short *vx,
-                          short *vy,
-                          float *gyroZ,
-                          uint16_t *height,
-                          bool *isNewAddNeighbor)
+_Static_assert(PASSIVE_RX_HISTORY_SIZE <= 8, "rxHistoryValid must hold a bit per rxHistory entry");
+
+static void rangingTableRecordRx(Ranging_Table_t *table, Timestamp_Tuple_t rx)
 {
-  if (neighborStateInfo.refresh[neighborAddress] == true && leaderStateInfo.keepFlying == true)
-  {
-    neighborStateInfo.refresh[neighborAddress] = false;
-    *distance = neighborStateInfo.distanceTowards[neighborAddress];
-    *vx = neighborStateInfo.velocityXInWorld[neighborAddress];
-    *vy = neighborStateInfo.velocityYInWorld[neighborAddress];
-    *gyroZ = neighborStateInfo.gyroZ[neighborAddress];
-    *height = neighborStateInfo.positionZ[neighborAddress];
-    *isNewAddNeighbor = neighborStateInfo.isNewAdd[neighborAddress];
-    neighborStateInfo.isNewAddUsed[neighborAddress] = true;
-    return true;
-  }
-  else
+  table->rxHistory[table->rxHistoryIndex] = rx;
+  table->rxHistoryValid |= 1 << table->rxHistoryIndex;
+  table->rxHistoryIndex = (table->rxHistoryIndex + 1) % PASSIVE_RX_HISTORY_SIZE;
+}
+
+static bool rangingTableFindRxBySeqNumber(Ranging_Table_t *table, uint16_t seqNumber, Timestamp_Tuple_t *rx)
+{
+  for (int i = 0; i < PASSIVE_RX_HISTORY_SIZE; i++)
   {
-    return false;
+    if ((table->rxHistoryValid & (1 << i)) && table->rxHistory[i].seqNumber == seqNumber)
+    {
+      *rx = table->rxHistory[i];
+      return true;
+    }
   }
+  return false;
+}
+
+/* Entries of lastTxTimestamps only report frames sent before the one carrying them, the sender fills the entries
+ * it has no Tf for with the sequence number of the frame itself.
+ */
+static bool lastTxTimestampIsValid(const Ranging_Message_Header_t *header, int index)
+{
+  return seqNumberLessThan(header->lastTxTimestamps[index].seqNumber, header->msgSequence);
 }
 
-void getCurrentNeighborAddressInfo_t(currentNeighborAddressInfo_t *currentNeighborAddressInfo)
+/* Signed difference to - from of two UWB timestamps, assuming they are less than half a wrap apart. */
+static int64_t uwbTimeSignedInterval(uint64_t to, uint64_t from)
 {
-  /*--11添加--*/
-  currentNeighborAddressInfo->size = rangingTableSet.size;
-  for (set_index_t iter = 0; iter < rangingTableSet.size; iter++)
+  int64_t interval = (to - from + UWB_MAX_TIMESTAMP) % UWB_MAX_TIMESTAMP;
+  if (interval > UWB_MAX_TIMESTAMP / 2)
   {
-    currentNeighborAddressInfo->address[iter] = rangingTableSet.tables[iter].neighborAddress;
+    interval -= UWB_MAX_TIMESTAMP;
   }
-
-  /*--11添加--*/
+  return interval;
 }
 
-void computeRealDistance(uint16_t neighborAddress, float x1, float y1, float z1, float x2, float y2, float z2)
+/* Passive ranging between the sender B of an overheard message and each neighbor A listed in its body units.
+ * A frame of A reaches us at pA and B at bA, B later transmits at bB which reaches us at pB, then
+ *   pB - pA = (bB - bA) / (1 + skew of B) + d(A, B) + d(B, me) - d(A, me)
+ * so d(A, B) follows from our own distances to A and B without any extra transmission.
+ */
+static void processPassiveRanging(Ranging_Context_t *ctx, Ranging_Table_t *senderTable, Ranging_Message_t *rangingMessage)
 {
-  // 计算各坐标的差
-  float dx = x2 - x1;
-  float dy = y2 - y1;
-  float dz = z2 - z1;
-
-  // 计算距离的平方和再开方
-  float distance = sqrt(dx * dx + dy * dy + dz * dz) * 100;
-  DEBUG_PRINT("distance:%f\n", distance);
-  distanceReal[neighborAddress] = distance;
+  if (!ctx->params->passiveRangingEnable || senderTable->clockSkewSamples < CLOCK_SKEW_MIN_SAMPLES || senderTable->distance <= 0)
+  {
+    return;
+  }
+  /* Latest transmission of the sender that we also received, (bB, pB). */
+  Timestamp_Tuple_t senderTx = {.timestamp.full = 0, .seqNumber = 0};
+  Timestamp_Tuple_t senderRx = {.timestamp.full = 0, .seqNumber = 0};
+  bool hasSender = false;
+  for (int i = 0; i < RANGING_MAX_Tr_UNIT; i++)
+  {
+    Timestamp_Tuple_t Tr = rangingMessage->header.lastTxTimestamps[i];
+    if (!lastTxTimestampIsValid(&rangingMessage->header, i) ||
+        (hasSender && !seqNumberLessThan(senderTx.seqNumber, Tr.seqNumber)))
+    {
+      continue;
+    }
+    Timestamp_Tuple_t Rr;
+    if (rangingTableFindRxBySeqNumber(senderTable, Tr.seqNumber, &Rr))
+    {
+      senderTx = Tr;
+      senderRx = Rr;
+      hasSender = true;
+    }
+  }
+  if (!hasSender)
+  {
+    return;
+  }
+  set_index_t senderSlot = neighborSlotMapGet(&ctx->neighborSlotMap, senderTable->neighborAddress);
+  Time_t curTime = xTaskGetTickCount();
+  uint8_t bodyUnitCount = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
+  for (int i = 0; i < bodyUnitCount; i++)
+  {
+    Body_Unit_t *bodyUnit = &rangingMessage->bodyUnits[i];
+    if (bodyUnit->address == ctx->myAddress || bodyUnit->address == senderTable->neighborAddress ||
+        bodyUnit->address > NEIGHBOR_ADDRESS_MAX)
+    {
+      continue;
+    }
+    int otherIndex = rangingTableSetSearchTable(&ctx->rangingTableSet, bodyUnit->address);
+    if (otherIndex == -1)
+    {
+      continue;
+    }
+    Ranging_Table_t *otherTable = &ctx->rangingTableSet.tables[otherIndex];
+    Timestamp_Tuple_t otherRx;
+    if (otherTable->distance <= 0 || !rangingTableFindRxBySeqNumber(otherTable, bodyUnit->timestamp.seqNumber, &otherRx))
+    {
+      continue;
+    }
+    int64_t senderInterval = uwbTimeSignedInterval(senderTx.timestamp.full, bodyUnit->timestamp.timestamp.full);
+    if (senderInterval > (int64_t)SINGLE_SIDED_REPLY_MAX || senderInterval < -(int64_t)SINGLE_SIDED_REPLY_MAX)
+    {
+      continue;
+    }
+    int64_t localInterval = uwbTimeSignedInterval(senderRx.timestamp.full, otherRx.timestamp.full);
+    double t = localInterval - senderInterval + (double)senderInterval * senderTable->clockSkew / (1 + senderTable->clockSkew);
+    int32_t distance = (int32_t)(t * 0.4691763978616) - senderTable->distance + otherTable->distance;
+    if (distance <= 0 || distance > 1000)
+    {
+      DEBUG_PRINT("processPassiveRanging: distance %ld between %u and %u out of range\n",
+                  distance, senderTable->neighborAddress, bodyUnit->address);
+      continue;
+    }
+    set_index_t otherSlot = neighborSlotMapGet(&ctx->neighborSlotMap, bodyUnit->address);
+    passiveDistanceUpdate(ctx, senderSlot, otherSlot, distance, curTime);
+    ctx->statistic[senderSlot].passivenum++;
+  }
 }
-/* Swarm Ranging */
-static void processRangingMessage(Ranging_Message_With_Timestamp_t *rangingMessageWithTimestamp)
+
+void processRangingMessage(Ranging_Context_t *ctx, Ranging_Message_With_Timestamp_t *rangingMessageWithTimestamp)
 {
   Ranging_Message_t *rangingMessage = &rangingMessageWithTimestamp->rangingMessage;
   uint16_t neighborAddress = rangingMessage->header.srcAddress;
   // DEBUG_PRINT("processRangingMessage: neighborAddress = %d\n", neighborAddress);
-  int neighborIndex = rangingTableSetSearchTable(&rangingTableSet, neighborAddress);
+  if (neighborAddress > NEIGHBOR_ADDRESS_MAX)
+  {
+    DEBUG_PRINT("processRangingMessage: neighbor address %u out of range, ignore.\n", neighborAddress);
+    return;
+  }
+  int neighborIndex = rangingTableSetSearchTable(&ctx->rangingTableSet, neighborAddress);
 
   // DEBUG_PRINT("seq:%d\n", rangingMessage->header.msgSequence);
 
-  float posiX = logGetFloat(idX);
+  float posiX = ctx->ownState.x;
   // DEBUG_PRINT("posiX:%f", posiX);
-  float posiY = logGetFloat(idY);
-  float posiZ = logGetFloat(idZ);
-  computeRealDistance(neighborAddress, posiX, posiY, posiZ, rangingMessage->header.posiX, rangingMessage->header.posiY, rangingMessage->header.posiZ);
+  float posiY = ctx->ownState.y;
+  float posiZ = ctx->ownState.z;
+  computeRealDistance(ctx, neighborAddress, posiX, posiY, posiZ, rangingMessage->header.posiX, rangingMessage->header.posiY, rangingMessage->header.posiZ);
 
-  statistic[neighborAddress].recvnum++;
-  statistic[neighborAddress].recvSeq = rangingMessage->header.msgSequence;
   bool isNewAddNeighbor = neighborIndex == -1 ? true : false; /*如果是新添加的邻居，则是true*/
-  setNeighborStateInfo_isNewAdd(neighborAddress, isNewAddNeighbor);
   DEBUG_PRINT("processRangingMessage: neighborIndex = %d, isNewAddNeighbor = %d\n", neighborIndex, isNewAddNeighbor);
   /* Handle new neighbor */
   if (neighborIndex == -1)
@@ -1600,72 +3823,110 @@ static void processRangingMessage(Ranging_Message_With_Timestamp_t *rangingMessa
     Ranging_Table_t table;
     rangingTableInit(&table, neighborAddress);
     /* Ranging table set is full, ignore this ranging message. */
-    if (!rangingTableSetAddTable(&rangingTableSet, table))
+    if (!rangingTableSetAddTable(ctx, &ctx->rangingTableSet, table))
     {
       DEBUG_PRINT("processRangingMessage: Ranging table is full = %d, cannot handle new neighbor %d.\n",
-                  rangingTableSet.size,
+                  ctx->rangingTableSet.size,
                   neighborAddress);
       return;
     }
     else
     {
-      neighborIndex = rangingTableSetSearchTable(&rangingTableSet, neighborAddress);
+      neighborIndex = rangingTableSetSearchTable(&ctx->rangingTableSet, neighborAddress);
     }
   }
 
-  Ranging_Table_t *neighborRangingTable = &rangingTableSet.tables[neighborIndex];
+  Stastistic *neighborStatistic = getStatistic(ctx, neighborAddress);
+  uint16_t lost = 0;
+  if (neighborStatistic->recvnum && seqNumberLessThan(neighborStatistic->recvSeq, rangingMessage->header.msgSequence))
+  {
+    lost = rangingMessage->header.msgSequence - neighborStatistic->recvSeq - 1;
+    neighborStatistic->lostnum += lost;
+  }
+  linkQualityOnRx(ctx, neighborAddress, lost);
+  neighborStatistic->recvnum++;
+  neighborStatistic->recvSeq = rangingMessage->header.msgSequence;
+  setNeighborStateInfo_isNewAdd(ctx, neighborAddress, isNewAddNeighbor);
+
+  Ranging_Table_t *neighborRangingTable = &ctx->rangingTableSet.tables[neighborIndex];
   /* Update Re */
   neighborRangingTable->Re.timestamp = rangingMessageWithTimestamp->rxTime;
   neighborRangingTable->Re.seqNumber = rangingMessage->header.msgSequence;
+  neighborRangingTable->valid |= RANGING_VALID_Re;
   /* Update latest received timestamp of this neighbor */
   neighborRangingTable->latestReceived = neighborRangingTable->Re;
+  neighborRangingTable->valid |= RANGING_VALID_LATEST;
+  neighborRangingTable->latestReceivedTick = rangingMessageWithTimestamp->rxTick;
+  rangingTableRecordRx(neighborRangingTable, neighborRangingTable->Re);
   /* Update expiration time of this neighbor */
   neighborRangingTable->expirationTime = xTaskGetTickCount() + M2T(RANGING_TABLE_HOLD_TIME);
+  expirationWheelSchedule(&ctx->rangingTableSet.expirationWheel, neighborAddress, neighborRangingTable->expirationTime);
 
   /* Each ranging messages contains MAX_Tr_UNIT lastTxTimestamps, find corresponding
    * Tr according to Rr to get a valid Tr-Rr pair if possible, this approach may
    * help when experiencing continuous packet loss.
    */
-  Ranging_Table_Tr_Rr_Buffer_t *neighborTrRrBuffer = &neighborRangingTable->TrRrBuffer;
+  Ranging_Table_Tr_Rr_Candidate_t *pending = &neighborRangingTable->TrRrBuffer.candidates[neighborRangingTable->TrRrBuffer.cur];
   for (int i = 0; i < RANGING_MAX_Tr_UNIT; i++)
   {
-    if (rangingMessage->header.lastTxTimestamps[i].timestamp.full && neighborTrRrBuffer->candidates[neighborTrRrBuffer->cur].Rr.timestamp.full && rangingMessage->header.lastTxTimestamps[i].seqNumber == neighborTrRrBuffer->candidates[neighborTrRrBuffer->cur].Rr.seqNumber)
+    if ((pending->valid & RANGING_CANDIDATE_VALID_Rr) && lastTxTimestampIsValid(&rangingMessage->header, i) &&
+        rangingMessage->header.lastTxTimestamps[i].seqNumber == pending->Rr.seqNumber)
     {
-      rangingTableBufferUpdate(&neighborRangingTable->TrRrBuffer,
-                               rangingMessage->header.lastTxTimestamps[i],
-                               neighborTrRrBuffer->candidates[neighborTrRrBuffer->cur].Rr);
+      rangingTableUpdateClockSkew(neighborRangingTable, rangingMessage->header.lastTxTimestamps[i], pending->Rr);
+      rangingTableBufferUpdate(&neighborRangingTable->TrRrBuffer, rangingMessage->header.lastTxTimestamps[i],
+                               pending->Rr);
       break;
     }
   }
+  processPassiveRanging(ctx, neighborRangingTable, rangingMessage);
+#ifdef ENABLE_DISTANCE_SHARING
+  sharedDistanceOnRx(ctx, neighborAddress, rangingMessage, neighborRangingTable->latestReceivedTick);
+#endif
   //  printRangingMessage(rangingMessage);
 
   /* Try to find corresponding Rf for MY_UWB_ADDRESS. */
   Timestamp_Tuple_t neighborRf = {.timestamp.full = 0, .seqNumber = 0};
-  if (rangingMessage->header.filter & (1 << (uwbGetAddress() % 16)))
+  bool hasNeighborRf = false;
+  if (rangingMessage->header.filter & (1 << (ctx->myAddress % 16)))
   {
     /* Retrieve body unit from received ranging message. */
     uint8_t bodyUnitCount = (rangingMessage->header.msgLength - sizeof(Ranging_Message_Header_t)) / sizeof(Body_Unit_t);
     for (int i = 0; i < bodyUnitCount; i++)
     {
-      if (rangingMessage->bodyUnits[i].address == uwbGetAddress())
+      if (rangingMessage->bodyUnits[i].address == ctx->myAddress)
       {
         neighborRf = rangingMessage->bodyUnits[i].timestamp;
+        hasNeighborRf = true;
         break;
       }
     }
   }
-  Timestamp_Tuple_t Tf = findTfBySeqNumber(neighborRf.seqNumber);
+  Timestamp_Tuple_t Tf;
+  bool hasTf = hasNeighborRf && findTfBySeqNumber(ctx, neighborRf.seqNumber, &Tf);
   // DEBUG_PRINT("setNeightborStateInfo: neighborAddress = %d\n", neighborAddress);
-  setNeighborStateInfo(neighborAddress, &rangingMessage->header);
+  setNeighborStateInfo(ctx, neighborAddress, &rangingMessage->header);
+  Leader_Command_Update_t commandUpdate = {.srcAddress = neighborAddress,
+                                           .epoch = rangingMessage->header.commandEpoch,
+                                           .keepFlying = rangingMessage->header.keep_flying,
+                                           .stage = rangingMessage->header.stage,
+                                           .ackBits = rangingMessage->header.commandAck};
+  leaderCommandOnRx(ctx, &commandUpdate);
+#ifdef ENABLE_CHANNEL_HOPPING
+  channelHoppingOnRx(ctx, neighborAddress, rangingMessage->header.channelGroup, rangingMessage->header.channelHead);
+#endif
   // DEBUG_PRINT("afterSetNeightborStateInfo: neighborAddress = %d\n", neighborAddress);
-  if (neighborRf.seqNumber != neighborRangingTable->Tp.seqNumber && Tf.timestamp.full)
+  /* An Rf already shifted into Rp is a repeated body unit, not a new response. */
+  bool isRepeatedRf = (neighborRangingTable->valid & RANGING_VALID_Tp) &&
+                      neighborRf.seqNumber == neighborRangingTable->Tp.seqNumber;
+  if (hasTf && !isRepeatedRf)
   {
     neighborRangingTable->Rf = neighborRf;
-    rangingTableOnEvent(neighborRangingTable, RANGING_EVENT_RX_Rf);
+    neighborRangingTable->valid |= RANGING_VALID_Rf;
+    rangingTableOnEvent(ctx, neighborRangingTable, RANGING_EVENT_RX_Rf);
   }
   else
   {
-    rangingTableOnEvent(neighborRangingTable, RANGING_EVENT_RX_NO_Rf);
+    rangingTableOnEvent(ctx, neighborRangingTable, RANGING_EVENT_RX_NO_Rf);
   }
   // /* Trigger event handler according to Rf */
   // if (neighborRf.timestamp.full)
@@ -1680,8 +3941,9 @@ static void processRangingMessage(Ranging_Message_With_Timestamp_t *rangingMessa
   // }
 
 #ifdef ENABLE_DYNAMIC_RANGING_PERIOD
-  /* update period according to distance and velocity */
-  neighborRangingTable->period = M2T(DYNAMIC_RANGING_COEFFICIENT * (neighborRangingTable->distance / rangingMessage->header.velocity));
+  /* update period according to distance and velocity, a sender at rest gives 0 as the Cortex-M4 division did */
+  neighborRangingTable->period = rangingMessage->header.velocity == 0 ? 0 :
+                                 M2T(DYNAMIC_RANGING_COEFFICIENT * (neighborRangingTable->distance / rangingMessage->header.velocity));
   /* bound ranging period between RANGING_PERIOD_MIN and RANGING_PERIOD_MAX */
   neighborRangingTable->period = MAX(neighborRangingTable->period, M2T(RANGING_PERIOD_MIN));
   neighborRangingTable->period = MIN(neighborRangingTable->period, M2T(RANGING_PERIOD_MAX));
@@ -1728,33 +3990,39 @@ static void processRangingMessage(Ranging_Message_With_Timestamp_t *rangingMessa
  * nextExpectedDeliveryTime (only include timestamp with expected next delivery time less or equal than current
  * time) by sort the ranging table set by each timestamp's last send time.
  */
-static Time_t generateRangingMessage(Ranging_Message_t *rangingMessage)
+Time_t generateRangingMessage(Ranging_Context_t *ctx, Ranging_Message_t *rangingMessage)
 {
   int8_t bodyUnitNumber = 0;
-  rangingSeqNumber++;
-  int curSeqNumber = rangingSeqNumber;
+  ctx->rangingSeqNumber++;
+  uint16_t curSeqNumber = ctx->rangingSeqNumber;
   rangingMessage->header.filter = 0;
   Time_t curTime = xTaskGetTickCount();
   /* Using the default RANGING_PERIOD when DYNAMIC_RANGING_PERIOD is not enabled. */
   Time_t taskDelay = M2T(RANGING_PERIOD);
 #ifdef ENABLE_BUS_BOARDING_SCHEME
-  rangingTableSetRearrange(&rangingTableSet, COMPARE_BY_NEXT_EXPECTED_DELIVERY_TIME);
+  rangingTableSetRearrange(&ctx->rangingTableSet, COMPARE_BY_NEXT_EXPECTED_DELIVERY_TIME);
 #else
-  rangingTableSetRearrange(&rangingTableSet, COMPARE_BY_LAST_SEND_TIME);
+  rangingTableSetRearrange(&ctx->rangingTableSet, COMPARE_BY_LAST_SEND_TIME);
 #endif
 
   /* Generate message body */
-  for (int index = 0; index < rangingTableSet.size; index++)
+  for (int index = 0; index < ctx->rangingTableSet.size; index++)
   {
     if (bodyUnitNumber >= RANGING_MAX_BODY_UNIT)
     {
       break;
     }
-    Ranging_Table_t *table = &rangingTableSet.tables[index];
-    if (table->latestReceived.timestamp.full)
+    Ranging_Table_t *table = &ctx->rangingTableSet.tables[index];
+    if (table->valid & RANGING_VALID_LATEST)
     {
       /* Only include timestamps with expected delivery time less or equal than current time. */
-      if (table->nextExpectedDeliveryTime > curTime)
+      if ((int32_t)(table->nextExpectedDeliveryTime - curTime) > 0)
+      {
+        continue;
+      }
+      /* When the body cannot hold every neighbor, leave lossy links out in favour of links likely to complete. */
+      if (ctx->rangingTableSet.size > (int)RANGING_MAX_BODY_UNIT &&
+          ctx->linkQuality[neighborSlotMapGet(&ctx->neighborSlotMap, table->neighborAddress)].reception < LINK_QUALITY_ADMIT_MIN)
       {
         continue;
       }
@@ -1778,7 +4046,7 @@ static Time_t generateRangingMessage(Ranging_Message_t *rangingMessage)
       //   rangingMessage->bodyUnits[bodyUnitNumber].timestamp = empty;
       // }
       rangingMessage->header.filter |= 1 << (table->neighborAddress % 16);
-      rangingTableOnEvent(table, RANGING_EVENT_TX_Tf);
+      rangingTableOnEvent(ctx, table, RANGING_EVENT_TX_Tf);
 
 #ifdef ENABLE_DYNAMIC_RANGING_PERIOD
       /* Change task delay dynamically, may increase packet loss rate since ranging period now is determined
@@ -1789,138 +4057,304 @@ static Time_t generateRangingMessage(Ranging_Message_t *rangingMessage)
       taskDelay = MAX(RANGING_PERIOD_MIN, taskDelay);
 #endif
 
-#ifdef ROUTING_OLSR_ENABLE
-      if (mprSetHas(getGlobalMPRSet(), table->neighborAddress))
-      {
-        rangingMessage->bodyUnits[bodyUnitNumber].flags.MPR = true;
-      }
-      else
-      {
-        rangingMessage->bodyUnits[bodyUnitNumber].flags.MPR = false;
-      }
+      rangingMessage->bodyUnits[bodyUnitNumber].flags.MPR = neighborSetHasMpr(&ctx->neighborSet, table->neighborAddress);
+#ifdef ENABLE_DISTANCE_SHARING
+      sharedDistanceFill(ctx, &rangingMessage->bodyUnits[bodyUnitNumber], curTime);
 #endif
 
       bodyUnitNumber++;
     }
   }
   /* Generate message header */
-  rangingMessage->header.srcAddress = MY_UWB_ADDRESS;
+  rangingMessage->header.srcAddress = ctx->myAddress;
   rangingMessage->header.msgLength = sizeof(Ranging_Message_Header_t) + sizeof(Body_Unit_t) * bodyUnitNumber;
   rangingMessage->header.msgSequence = curSeqNumber;
-  getLatestNTxTimestamps(rangingMessage->header.lastTxTimestamps, RANGING_MAX_Tr_UNIT);
-  float velocityX = logGetFloat(idVelocityX);
-  float velocityY = logGetFloat(idVelocityY);
-  float velocityZ = logGetFloat(idVelocityZ);
-  velocity = sqrt(pow(velocityX, 2) + pow(velocityY, 2) + pow(velocityZ, 2));
+#ifdef ENABLE_CHANNEL_HOPPING
+  channelHoppingUpdate(ctx, &ctx->channelHopping);
+  rangingMessage->header.channelGroup = ctx->channelHopping.group;
+  rangingMessage->header.channelBridge = ctx->channelHopping.isBridge;
+  rangingMessage->header.channelHead = ctx->channelHopping.head;
+#endif
+  int txTimestampCount = getLatestNTxTimestamps(ctx, rangingMessage->header.lastTxTimestamps, RANGING_MAX_Tr_UNIT);
+  for (int i = txTimestampCount; i < RANGING_MAX_Tr_UNIT; i++)
+  {
+    /* Not older than this frame, so receivers never take it for a Tf, see lastTxTimestampIsValid(). */
+    rangingMessage->header.lastTxTimestamps[i].timestamp.full = 0;
+    rangingMessage->header.lastTxTimestamps[i].seqNumber = curSeqNumber;
+  }
+  float velocityX = ctx->ownState.vx;
+  float velocityY = ctx->ownState.vy;
+  float velocityZ = ctx->ownState.vz;
+  ctx->velocity = sqrt(pow(velocityX, 2) + pow(velocityY, 2) + pow(velocityZ, 2));
 
-  float posiX = logGetFloat(idX);
-  float posiY = logGetFloat(idY);
-  float posiZ = logGetFloat(idZ);
+  float posiX = ctx->ownState.x;
+  float posiY = ctx->ownState.y;
+  float posiZ = ctx->ownState.z;
 
   rangingMessage->header.posiX = posiX;
   rangingMessage->header.posiY = posiY;
   rangingMessage->header.posiZ = posiZ;
   /* velocity in cm/s */
-  rangingMessage->header.velocity = (short)(velocity * 100);
+  rangingMessage->header.velocity = (short)(ctx->velocity * 100);
   //  DEBUG_PRINT("generateRangingMessage: ranging message size = %u with %u body units.\n",
   //              rangingMessage->header.msgLength,
   //              bodyUnitNumber
   //  );
-  estimatorKalmanGetSwarmInfo(&rangingMessage->header.velocityXInWorld,
-                              &rangingMessage->header.velocityYInWorld,
-                              &rangingMessage->header.gyroZ,
-                              &rangingMessage->header.positionZ);
-  rangingMessage->header.keep_flying = leaderStateInfo.keepFlying;
-  // 如果是leader则进行阶段控制
-  stage = ZERO_STAGE;
-  if (MY_UWB_ADDRESS == leaderStateInfo.address && leaderStateInfo.keepFlying)
-  {
-    // 分阶段控制
-    tickInterval = xTaskGetTickCount() - leaderStateInfo.keepFlyingTrueTick;
-    // 所有邻居起飞判断
-    uint32_t convergeTick = 2000; // 收敛时间10s
-    uint32_t followTick = 10000;  // 跟随时间10s
-    uint32_t converAndFollowTick = convergeTick + followTick;
-    uint32_t maintainTick = 5000;                                            // 每转一次需要的时间
-    uint32_t rotationNums_3Stage = 8;                                        // 第3阶段旋转次数
-    uint32_t rotationNums_4Stage = 5;                                        // 第4阶段旋转次数
-    uint32_t rotationTick_3Stage = maintainTick * (rotationNums_3Stage + 1); // 旋转总时间
-    uint32_t rotationTick_4Stage = maintainTick * (rotationNums_4Stage + 1);
+  rangingMessage->header.velocityXInWorld = ctx->ownState.velocityXInWorld;
+  rangingMessage->header.velocityYInWorld = ctx->ownState.velocityYInWorld;
+  rangingMessage->header.gyroZ = ctx->ownState.gyroZ;
+  rangingMessage->header.positionZ = ctx->ownState.positionZ;
+  xSemaphoreTake(ctx->leaderCommandMu, portMAX_DELAY);
+  rangingMessage->header.keep_flying = ctx->leaderCommand.keepFlying;
+  rangingMessage->header.commandEpoch = ctx->leaderCommand.epoch;
+  rangingMessage->header.commandAck = ctx->leaderCommand.ackBits;
+  rangingMessage->header.stage = ctx->leaderCommand.stage; // 这里传输stage，因为在设置setNeighborStateInfo()函数中只会用leader无人机的stage的值
+  xSemaphoreGive(ctx->leaderCommandMu);
+  /*--9添加--*/
 
-    int8_t stageStartPoint_4 = 64; // 第4阶段起始stage值，因为阶段的区分靠的是stage的值域,(-30,30)为第三阶段
-    if (tickInterval < convergeTick)
-    {
-      stage = FIRST_STAGE; // 0阶段，[0，收敛时间 )，做随机运动
-    }
-    else if (tickInterval >= convergeTick && tickInterval < converAndFollowTick)
+  /* Keeps ranging table in order to perform binary search */
+  rangingTableSetRearrange(&ctx->rangingTableSet, COMPARE_BY_ADDRESS);
+
+  return taskDelay;
+}
+
+#ifdef ENABLE_SWARM_LOCALIZATION
+/* Gather own links at the predicted distance and overheard pair distances into a new round, then solve outside of
+ * the ranging table lock. Heights of the neighbors come from their headers.
+ */
+static void swarmLocalizationUpdate(Ranging_Context_t *ctx, uint16_t positionZ)
+{
+  Time_t curTime = xTaskGetTickCount();
+  uint8_t node[RANGING_TABLE_SIZE_MAX];
+  xSemaphoreTake(ctx->rangingTableSet.mu, portMAX_DELAY);
+  swarmLocalizationBeginRound(&ctx->swarmLocalization);
+  swarmLocalizationNode(&ctx->swarmLocalization, ctx->myAddress, positionZ);
+  for (set_index_t slot = 0; slot < RANGING_TABLE_SIZE_MAX; slot++)
+  {
+    node[slot] = SWARM_LOCALIZATION_NODE_NONE;
+    UWB_Address_t neighborAddress = ctx->neighborSlotMap.addressOf[slot];
+    float uncertainty = 0;
+    if (neighborAddress == UWB_DEST_EMPTY)
     {
-      stage = SECOND_STAGE; // 1阶段，[收敛时间，收敛+跟随时间 )，做跟随运动
+      continue;
     }
-    else if (tickInterval >= converAndFollowTick && tickInterval < converAndFollowTick + rotationTick_3Stage)
+    node[slot] = swarmLocalizationNode(&ctx->swarmLocalization, neighborAddress, ctx->neighborStateInfo.positionZ[slot]);
+    int16_t distance = neighborMotionPredict(ctx, neighborAddress, curTime, &uncertainty);
+    if (distance > 0)
     {
-      stage = (tickInterval - converAndFollowTick) / maintainTick; // 计算旋转次数
-      stage = stage - 1;
+      swarmLocalizationAddLink(&ctx->swarmLocalization, 0, node[slot], distance,
+                               1 / (1 + uncertainty / SWARM_LOCALIZATION_UNCERTAINTY_SCALE));
     }
-    else
+  }
+  for (set_index_t slot1 = 0; slot1 < RANGING_TABLE_SIZE_MAX; slot1++)
+  {
+    for (set_index_t slot2 = slot1 + 1; slot2 < RANGING_TABLE_SIZE_MAX; slot2++)
     {
-      stage = LAND_STAGE;
+      if (node[slot1] == SWARM_LOCALIZATION_NODE_NONE || node[slot2] == SWARM_LOCALIZATION_NODE_NONE)
+      {
+        continue;
+      }
+      Time_t updateTime = 0;
+      int16_t distance = passiveDistanceGet(ctx, ctx->neighborSlotMap.addressOf[slot1],
+                                            ctx->neighborSlotMap.addressOf[slot2], &updateTime);
+      if (distance > 0 && curTime - updateTime < M2T(RANGING_TABLE_HOLD_TIME))
+      {
+        swarmLocalizationAddLink(&ctx->swarmLocalization, node[slot1], node[slot2], distance, SWARM_LOCALIZATION_PASSIVE_WEIGHT);
+      }
+#ifdef ENABLE_DISTANCE_SHARING
+      distance = sharedDistanceGet(ctx, ctx->neighborSlotMap.addressOf[slot1], ctx->neighborSlotMap.addressOf[slot2],
+                                   NULL);
+      if (distance > 0)
+      {
+        swarmLocalizationAddLink(&ctx->swarmLocalization, node[slot1], node[slot2], distance, 1);
+      }
+#endif
     }
-    // DEBUG_PRINT("%d\n",stage)
-    leaderStateInfo.stage = stage; // 这里设置leader的stage
+  }
+  xSemaphoreGive(ctx->rangingTableSet.mu);
+  ctx->swarmLocalizationResidual = swarmLocalizationSolve(&ctx->swarmLocalization, SWARM_LOCALIZATION_SWEEPS);
+  ctx->swarmLocalizationNodes = ctx->swarmLocalization.nodeCount;
+}
+
+bool relativePositionGet(Ranging_Context_t *ctx, uint16_t neighborAddress, float *x, float *y)
+{
+  return swarmLocalizationGetPosition(&ctx->swarmLocalization, neighborAddress, x, y);
+}
+
+bool getRelativePosition(uint16_t neighborAddress, float *x, float *y)
+{
+  return relativePositionGet(&rangingContext, neighborAddress, x, y);
+}
+#endif
+
+/* The core of one transmission, the FreeRTOS task around it only paces it and hands the frame to the radio. */
+Time_t rangingHandleTx(Ranging_Context_t *ctx, Ranging_Message_t *rangingMessage)
+{
+  xSemaphoreTake(ctx->rangingTableSet.mu, portMAX_DELAY);
+  xSemaphoreTake(ctx->neighborSet.mu, portMAX_DELAY);
+  rangingOwnStateSample(ctx);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecord(ctx, RANGING_RECORD_TX, &ctx->ownState, sizeof(ctx->ownState), NULL, 0);
+#endif
+#ifdef RANGING_BENCHMARK_ENABLE
+  uint64_t generateStart = usecTimestamp();
+  Time_t taskDelay = generateRangingMessage(ctx, rangingMessage);
+  ctx->benchmark.txGenerateUs += usecTimestamp() - generateStart;
+  ctx->benchmark.txFrames++;
+#else
+  Time_t taskDelay = generateRangingMessage(ctx, rangingMessage);
+#endif
+  xSemaphoreGive(ctx->neighborSet.mu);
+  xSemaphoreGive(ctx->rangingTableSet.mu);
+#ifdef ENABLE_SWARM_LOCALIZATION
+  swarmLocalizationUpdate(ctx, rangingMessage->header.positionZ);
+#endif
+  return taskDelay;
+}
 
-    // DEBUG_PRINT("--send--%d\n",rangingMessage->header.stage);
+/* Draws the injected loss of one frame, a plain xorshift32 kept in the context rather than rand(), whose hidden
+ * state is shared by every instance and thread of a host simulation.
+ */
+static bool rangingRxLossDraw(Ranging_Context_t *ctx)
+{
+  if (ctx->params->rxLossPercent == 0)
+  {
+    return false;
   }
-  rangingMessage->header.stage = leaderStateInfo.stage; // 这里传输stage，因为在设置setNeighborStateInfo()函数中只会用leader无人机的stage的值
-  /*--9添加--*/
+  uint32_t x = ctx->rxLossRandom;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ctx->rxLossRandom = x;
+  return x % 100 < ctx->params->rxLossPercent;
+}
 
-  /* Keeps ranging table in order to perform binary search */
-  rangingTableSetRearrange(&rangingTableSet, COMPARE_BY_ADDRESS);
+/* The core of one reception including the injected loss, the FreeRTOS task around it only dequeues. */
+void rangingHandleRx(Ranging_Context_t *ctx, Ranging_Message_With_Timestamp_t *rangingMessageWithTimestamp)
+{
+  xSemaphoreTake(ctx->rangingTableSet.mu, portMAX_DELAY);
+  xSemaphoreTake(ctx->neighborSet.mu, portMAX_DELAY);
+  rangingOwnStateSample(ctx);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  Ranging_Record_Rx_t rx = {.ownState = ctx->ownState,
+                            .rxTime = rangingMessageWithTimestamp->rxTime,
+                            .rxTick = rangingMessageWithTimestamp->rxTick};
+  rangingRecord(ctx, RANGING_RECORD_RX, &rx, sizeof(rx), &rangingMessageWithTimestamp->rangingMessage,
+                MIN(rangingMessageWithTimestamp->rangingMessage.header.msgLength, sizeof(Ranging_Message_t)));
+#endif
+  /* Injected loss, the frame is dropped as if it was never received. */
+  if (rangingRxLossDraw(ctx))
+  {
+#ifdef RANGING_BENCHMARK_ENABLE
+    ctx->benchmark.rxDropped++;
+#endif
+    xSemaphoreGive(ctx->neighborSet.mu);
+    xSemaphoreGive(ctx->rangingTableSet.mu);
+    return;
+  }
+#ifdef RANGING_BENCHMARK_ENABLE
+  uint64_t processStart = usecTimestamp();
+#endif
+  processRangingMessage(ctx, rangingMessageWithTimestamp);
+  topologySensing(ctx, &rangingMessageWithTimestamp->rangingMessage);
+  publishNeighborStateSnapshot(ctx);
+#ifdef RANGING_BENCHMARK_ENABLE
+  ctx->benchmark.rxProcessUs += usecTimestamp() - processStart;
+  ctx->benchmark.rxFrames++;
+#endif
+  xSemaphoreGive(ctx->neighborSet.mu);
+  xSemaphoreGive(ctx->rangingTableSet.mu);
+}
+
+/* Command fields of a frame this node does not range with, nothing but the leader command (and the clustering of
+ * channel hopping) is touched.
+ */
+void rangingHandleCommand(Ranging_Context_t *ctx, const Leader_Command_Update_t *update)
+{
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  rangingRecord(ctx, RANGING_RECORD_COMMAND, update, sizeof(Leader_Command_Update_t), NULL, 0);
+#endif
+  leaderCommandOnRx(ctx, update);
+#ifdef ENABLE_CHANNEL_HOPPING
+  channelHoppingOnRx(ctx, update->srcAddress, update->channelGroup, update->channelHead);
+#endif
+}
+
+/* The slot of a follower starts when a leader frame arrives (rangingRadioRx gives the semaphore), returns false if
+ * the leader stayed silent for timeout. A host driver polls it with timeout 0 to mirror the tx task.
+ */
+bool rangingTxSlotWait(Ranging_Context_t *ctx, TickType_t timeout)
+{
+  return xSemaphoreTake(ctx->rangingTxTaskBinary, timeout) == pdTRUE;
+}
+
+/* Delay of this node's slot after the leader frame. */
+TickType_t rangingTxSlotDelay(Ranging_Context_t *ctx)
+{
+  return ctx->txPeriodDelay;
+}
+
+/* How long a follower waits for the leader frame before it transmits on its own. */
+TickType_t rangingTxSlotTimeout(Ranging_Context_t *ctx)
+{
+#ifdef ENABLE_CHANNEL_HOPPING
+  /* The leader visits one group per period, in the periods it is away the slot of its last frame is kept. */
+  Channel_Hopping_t *hopping = &ctx->channelHopping;
+  Time_t now = xTaskGetTickCount();
+  if (hopping->leaderSeen && now - hopping->leaderRxTick < M2T(CHANNEL_SLOT_ANCHOR_PERIODS * RANGING_PERIOD))
+  {
+    Time_t slot = hopping->leaderRxTick + ctx->txPeriodDelay;
+    while ((int32_t)(slot - now) <= 0)
+    {
+      slot += M2T(RANGING_PERIOD);
+    }
+    return slot - now;
+  }
+#else
+  (void)ctx;
+#endif
+  return M2T(TX_PERIOD_IN_MS);
+}
 
+/* Build the next ranging frame of this instance into packet, ready for the radio. */
+Time_t rangingRadioTxBuild(Ranging_Context_t *ctx, UWB_Packet_t *packet)
+{
+  Ranging_Message_t *rangingMessage = (Ranging_Message_t *)&packet->payload;
+  packet->header.srcAddress = ctx->myAddress;
+  packet->header.destAddress = UWB_DEST_ANY;
+  packet->header.type = UWB_RANGING_MESSAGE;
+  Time_t taskDelay = rangingHandleTx(ctx, rangingMessage);
+  packet->header.length = sizeof(UWB_Packet_Header_t) + rangingMessage->header.msgLength;
   return taskDelay;
 }
 
 static void uwbRangingTxTask(void *parameters)
 {
+  Ranging_Context_t *ctx = (Ranging_Context_t *)parameters;
   systemWaitStart();
 
-  /* velocity log variable id */
-  idVelocityX = logGetVarId("stateEstimate", "vx");
-  idVelocityY = logGetVarId("stateEstimate", "vy");
-  idVelocityZ = logGetVarId("stateEstimate", "vz");
-
   UWB_Packet_t txPacketCache;
-  txPacketCache.header.srcAddress = uwbGetAddress();
-  txPacketCache.header.destAddress = UWB_DEST_ANY;
-  txPacketCache.header.type = UWB_RANGING_MESSAGE;
   txPacketCache.header.length = 0;
-  Ranging_Message_t *rangingMessage = (Ranging_Message_t *)&txPacketCache.payload;
   // Add by lcy
-  BaseType_t xReturn = pdPASS;
   while (true)
   {
-    if (MY_UWB_ADDRESS != 0)
+    if (ctx->myAddress != 0)
     {
       // DEBUG_PRINT("I am not 0\n");
-      TickType_t overTime_tick_count = (TX_PERIOD_IN_MS * configTICK_RATE_HZ) / 1000;
-      xReturn = xSemaphoreTake(rangingTxTaskBinary, overTime_tick_count);
-      if (pdTRUE == xReturn)
+      TickType_t overTime_tick_count = rangingTxSlotTimeout(ctx);
+      if (rangingTxSlotWait(ctx, overTime_tick_count))
       {
         // DEBUG_PRINT("Delay: %u\n", txPeriodDelay);
-        vTaskDelay(txPeriodDelay);
+        vTaskDelay(rangingTxSlotDelay(ctx));
       }
       else
       {
         // DEBUG_PRINT("Delay: Overtime!\n");
       }
     }
-    xSemaphoreTake(rangingTableSet.mu, portMAX_DELAY);
-    xSemaphoreTake(neighborSet.mu, portMAX_DELAY);
-
     // Time_t taskDelay = RANGING_PERIOD + rand() % RANGING_PERIOD;
-    Time_t taskDelay = RANGING_PERIOD - 6 + rand() % 13;
     // int randNum = rand() % 20;
-    generateRangingMessage(rangingMessage);
-    txPacketCache.header.length = sizeof(UWB_Packet_Header_t) + rangingMessage->header.msgLength;
+    rangingRadioTxBuild(ctx, &txPacketCache);
     // if (randNum < 17)
     // {
     //   uwbSendPacketBlock(&txPacketCache);
@@ -1934,13 +4368,8 @@ static void uwbRangingTxTask(void *parameters)
     uwbSendPacketBlock(&txPacketCache);
     //    printRangingTableSet(&rangingTableSet);
     //    printNeighborSet(&neighborSet);
-    latest_txTime = xTaskGetTickCount();
-    uint16_t notget_packet_interval = 0;
-
-    xSemaphoreGive(neighborSet.mu);
-    xSemaphoreGive(rangingTableSet.mu);
     // vTaskDelay(taskDelay);
-    if (MY_UWB_ADDRESS == 0)
+    if (ctx->myAddress == 0)
     {
       // DEBUG_PRINT("I am 0\n");
       vTaskDelay(RANGING_PERIOD);
@@ -1948,46 +4377,49 @@ static void uwbRangingTxTask(void *parameters)
   }
 }
 
+/* One pass of the rx task: handle at most one queued frame, waiting up to timeout for it, then every queued
+ * command. Returns whether a frame was handled.
+ */
+bool rangingRxTaskStep(Ranging_Context_t *ctx, TickType_t timeout)
+{
+  Ranging_Message_With_Timestamp_t rxPacketCache;
+  Leader_Command_Update_t commandUpdate;
+  bool handled = false;
+  if (xQueueReceive(ctx->rxQueue, &rxPacketCache, timeout))
+  {
+    rangingHandleRx(ctx, &rxPacketCache);
+    handled = true;
+  }
+  while (xQueueReceive(ctx->commandQueue, &commandUpdate, 0))
+  {
+    rangingHandleCommand(ctx, &commandUpdate);
+  }
+  return handled;
+}
+
 static void uwbRangingRxTask(void *parameters)
 {
+  Ranging_Context_t *ctx = (Ranging_Context_t *)parameters;
   systemWaitStart();
 
-  Ranging_Message_With_Timestamp_t rxPacketCache;
-
   while (true)
   {
-    if (xQueueReceive(rxQueue, &rxPacketCache, portMAX_DELAY))
-    {
-      int randNum = rand() % 20;
-      if (randNum < 50)
-      {
-        xSemaphoreTake(rangingTableSet.mu, portMAX_DELAY);
-        xSemaphoreTake(neighborSet.mu, portMAX_DELAY);
-
-        processRangingMessage(&rxPacketCache);
-        topologySensing(&rxPacketCache.rangingMessage);
-
-        xSemaphoreGive(neighborSet.mu);
-        xSemaphoreGive(rangingTableSet.mu);
-      }
-    }
+    rangingRxTaskStep(ctx, M2T(RANGING_COMMAND_POLL_PERIOD));
     vTaskDelay(M2T(1));
   }
 }
 
-void rangingRxCallback(void *parameters)
+/* Hand a received frame to the instance, from the radio isr on the deck or from a host medium. The caller reads
+ * rxTime and rxTick, so that instances sharing one simulated radio each get their own clock.
+ */
+void rangingRadioRx(Ranging_Context_t *ctx, const UWB_Packet_t *packet, dwTime_t rxTime, Time_t rxTick)
 {
-  DEBUG_PRINT("rangingRxCallback \n");
-
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
-  UWB_Packet_t *packet = (UWB_Packet_t *)parameters;
-
-  dwTime_t rxTime;
-  dwt_readrxtimestamp((uint8_t *)&rxTime.raw);
   Ranging_Message_With_Timestamp_t rxMessageWithTimestamp;
   rxMessageWithTimestamp.rxTime = rxTime;
-  Ranging_Message_t *rangingMessage = (Ranging_Message_t *)packet->payload;
+  rxMessageWithTimestamp.rxTick = rxTick;
+  const Ranging_Message_t *rangingMessage = (const Ranging_Message_t *)packet->payload;
   rxMessageWithTimestamp.rangingMessage = *rangingMessage;
 
   // Add by lcy
@@ -1995,125 +4427,447 @@ void rangingRxCallback(void *parameters)
   DEBUG_PRINT("fromneighbor:%d\n", neighborAddress);
   if (neighborAddress == 0)
   {
-    xSemaphoreGive(rangingTxTaskBinary);
+#ifdef ENABLE_CHANNEL_HOPPING
+    ctx->channelHopping.leaderRxTick = rxTick;
+    ctx->channelHopping.leaderSeen = true;
+#endif
+    xSemaphoreGive(ctx->rangingTxTaskBinary);
   }
 
-  if (MY_UWB_ADDRESS == 0 || neighborAddress == 0)
+  /* Followers only range with the leader. Frames of other followers still carry the leader command, only those
+   * fields go to the rx task through the command queue so that the command floods beyond the leader's range
+   * without building ranging state or taking room in the rx queue.
+   */
+  if (ctx->myAddress != 0 && neighborAddress != 0)
+  {
+    Leader_Command_Update_t commandUpdate;
+    leaderCommandUpdateFromMessage(rangingMessage, &commandUpdate);
+    xQueueSendFromISR(ctx->commandQueue, &commandUpdate, &xHigherPriorityTaskWoken);
+  }
+  else
   {
-    xQueueSendFromISR(rxQueue, &rxMessageWithTimestamp, &xHigherPriorityTaskWoken);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+    if (xQueueSendFromISR(ctx->rxQueue, &rxMessageWithTimestamp, &xHigherPriorityTaskWoken) != pdTRUE)
+    {
+      ctx->record.rxQueueDropped++;
+    }
+#else
+    xQueueSendFromISR(ctx->rxQueue, &rxMessageWithTimestamp, &xHigherPriorityTaskWoken);
+#endif
     DEBUG_PRINT("isReceivefrom0:%d", neighborAddress);
   }
 }
 
-void rangingTxCallback(void *parameters)
+/* Record the tx timestamp of a frame built by rangingRadioTxBuild once the radio has sent it. */
+void rangingRadioTxDone(Ranging_Context_t *ctx, const UWB_Packet_t *packet, dwTime_t txTime)
+{
+  const Ranging_Message_t *rangingMessage = (const Ranging_Message_t *)packet->payload;
+  Timestamp_Tuple_t timestamp = {.timestamp = txTime, .seqNumber = rangingMessage->header.msgSequence};
+  updateTfBuffer(ctx, timestamp);
+}
+
+void rangingRxCallback(void *parameters)
 {
-  UWB_Packet_t *packet = (UWB_Packet_t *)parameters;
-  Ranging_Message_t *rangingMessage = (Ranging_Message_t *)packet->payload;
+  DEBUG_PRINT("rangingRxCallback \n");
+  dwTime_t rxTime;
+  dwt_readrxtimestamp((uint8_t *)&rxTime.raw);
+  rangingRadioRx(&rangingContext, (UWB_Packet_t *)parameters, rxTime, xTaskGetTickCountFromISR());
+}
 
+void rangingTxCallback(void *parameters)
+{
   dwTime_t txTime;
   dwt_readtxtimestamp((uint8_t *)&txTime.raw);
+  rangingRadioTxDone(&rangingContext, (UWB_Packet_t *)parameters, txTime);
+}
 
-  Timestamp_Tuple_t timestamp = {.timestamp = txTime, .seqNumber = rangingMessage->header.msgSequence};
-  updateTfBuffer(timestamp);
+uint32_t rangingContextSize()
+{
+  return sizeof(Ranging_Context_t);
 }
 
-void rangingInit()
+void rangingContextSeed(Ranging_Context_t *ctx, uint32_t seed)
+{
+  /* Spread consecutive seeds apart, xorshift must not start from 0. */
+  ctx->rxLossRandom = seed * 2654435761u + 0x9E3779B9u;
+  if (ctx->rxLossRandom == 0)
+  {
+    ctx->rxLossRandom = 1;
+  }
+}
+
+/* Everything but the radio listener and the tasks, so that a host simulator can set up any number of instances in
+ * memory of rangingContextSize() bytes and drive them through the radio paths and task steps (rangingRadioRx,
+ * rangingRadioTxBuild, rangingRadioTxDone, rangingTxSlotWait, rangingRxTaskStep), see host/ranging_host_test.c.
+ */
+void rangingContextSetup(Ranging_Context_t *ctx, uint16_t address)
 {
-  MY_UWB_ADDRESS = uwbGetAddress();
-  rxQueue = xQueueCreate(RANGING_RX_QUEUE_SIZE, RANGING_RX_QUEUE_ITEM_SIZE);
-  neighborSetInit(&neighborSet);
+  rangingContextInit(ctx);
+  ctx->myAddress = address;
+  rangingContextSeed(ctx, address);
+  ctx->rxQueue = xQueueCreate(RANGING_RX_QUEUE_SIZE, RANGING_RX_QUEUE_ITEM_SIZE);
+  ctx->commandQueue = xQueueCreate(RANGING_COMMAND_QUEUE_SIZE, sizeof(Leader_Command_Update_t));
+  ctx->leaderCommandMu = xSemaphoreCreateMutex();
+  neighborSetInit(&ctx->neighborSet);
   // Add by lcy
-  txPeriodDelayset();
+  txPeriodDelayset(ctx);
   // Add by lcy
-  rangingTxTaskBinary = xSemaphoreCreateBinary(); // a binary semaphore
-  neighborSetEvictionTimer = xTimerCreate("neighborSetEvictionTimer",
-                                          M2T(NEIGHBOR_SET_HOLD_TIME / 2),
-                                          pdTRUE,
-                                          (void *)0,
-                                          neighborSetClearExpireTimerCallback);
-  xTimerStart(neighborSetEvictionTimer, M2T(0));
-  initNeighborStateInfoAndMedian_data();
-  initLeaderStateInfo();
-  rangingTableSetInit(&rangingTableSet);
-  rangingTableSetEvictionTimer = xTimerCreate("rangingTableSetEvictionTimer",
-                                              M2T(RANGING_TABLE_HOLD_TIME / 2),
-                                              pdTRUE,
-                                              (void *)0,
-                                              rangingTableSetClearExpireTimerCallback);
-  xTimerStart(rangingTableSetEvictionTimer, M2T(0));
-  TfBufferMutex = xSemaphoreCreateMutex();
+  ctx->rangingTxTaskBinary = xSemaphoreCreateBinary(); // a binary semaphore
+  ctx->neighborSetEvictionTimer = xTimerCreate("neighborSetEvictionTimer",
+                                               M2T(EXPIRATION_WHEEL_RESOLUTION),
+                                               pdTRUE,
+                                               (void *)ctx,
+                                               neighborSetClearExpireTimerCallback);
+  xTimerStart(ctx->neighborSetEvictionTimer, M2T(0));
+  initNeighborStateInfoAndMedian_data(ctx);
+  initLeaderStateInfo(ctx);
+  missionTimelineInit(ctx);
+  rangingTableSetInit(&ctx->rangingTableSet);
+  ctx->rangingTableSetEvictionTimer = xTimerCreate("rangingTableSetEvictionTimer",
+                                                   M2T(EXPIRATION_WHEEL_RESOLUTION),
+                                                   pdTRUE,
+                                                   (void *)ctx,
+                                                   rangingTableSetClearExpireTimerCallback);
+  xTimerStart(ctx->rangingTableSetEvictionTimer, M2T(0));
+  ctx->TfBufferMutex = xSemaphoreCreateMutex();
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  ctx->record.mu = xSemaphoreCreateMutex();
+#endif
+
+  ctx->idVelocityX = logGetVarId("stateEstimate", "vx");
+  ctx->idVelocityY = logGetVarId("stateEstimate", "vy");
+  ctx->idVelocityZ = logGetVarId("stateEstimate", "vz");
+  ctx->idX = logGetVarId("stateEstimate", "x");
+  ctx->idY = logGetVarId("stateEstimate", "y");
+  ctx->idZ = logGetVarId("stateEstimate", "z");
+
+  statisticInit(ctx);
+#ifdef ENABLE_CHANNEL_HOPPING
+  channelHoppingInit(ctx, &ctx->channelHopping);
+#endif
+#ifdef ENABLE_SWARM_LOCALIZATION
+  swarmLocalizationInit(&ctx->swarmLocalization, ctx->myAddress);
+#endif
+}
 
-  listener.type = UWB_RANGING_MESSAGE;
-  listener.rxQueue = NULL; // handle rxQueue in swarm_ranging.c instead of adhocdeck.c
-  listener.rxCb = rangingRxCallback;
-  listener.txCb = rangingTxCallback;
-  uwbRegisterListener(&listener);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+/* Payload length of every record type as rangingRecord() writes it, RX records carry at most a whole message. */
+static bool rangingRecordLengthValid(const Ranging_Record_Header_t *record)
+{
+  switch (record->type)
+  {
+  case RANGING_RECORD_CONFIG:
+    return record->length == sizeof(Ranging_Record_Config_t);
+  case RANGING_RECORD_RX:
+    return record->length >= sizeof(Ranging_Record_Rx_t) &&
+           record->length - sizeof(Ranging_Record_Rx_t) <= sizeof(Ranging_Message_t);
+  case RANGING_RECORD_TX:
+    return record->length == sizeof(Ranging_Own_State_t);
+  case RANGING_RECORD_TX_TIMESTAMP:
+    return record->length == sizeof(Timestamp_Tuple_t);
+  case RANGING_RECORD_TIMER:
+  case RANGING_RECORD_KEEP_FLYING:
+    return record->length == sizeof(uint8_t);
+  case RANGING_RECORD_RX_QUEUE_DROP:
+    return record->length == sizeof(uint16_t);
+  case RANGING_RECORD_COMMAND:
+    return record->length == sizeof(Leader_Command_Update_t);
+  default:
+    return false;
+  }
+}
 
-  idVelocityX = logGetVarId("stateEstimate", "vx");
-  idVelocityY = logGetVarId("stateEstimate", "vy");
-  idVelocityZ = logGetVarId("stateEstimate", "vz");
+bool rangingReplayRecord(Ranging_Context_t *ctx, const Ranging_Record_Header_t *record, const uint8_t *payload)
+{
+  if (!rangingRecordLengthValid(record))
+  {
+    DEBUG_PRINT("rangingReplayRecord: record of type %u with %u bytes rejected\n", record->type, record->length);
+    return false;
+  }
+  ctx->replaying = true;
+  switch (record->type)
+  {
+  case RANGING_RECORD_CONFIG:
+  {
+    Ranging_Record_Config_t config;
+    memcpy(&config, payload, sizeof(config));
+    ctx->params->distanceFilterType = config.distanceFilterType;
+    ctx->params->passiveRangingEnable = config.passiveRangingEnable;
+    ctx->params->rxLossPercent = config.rxLossPercent;
+    ctx->params->missionTimeline = config.missionTimeline;
+    break;
+  }
+  case RANGING_RECORD_RX:
+  {
+    Ranging_Record_Rx_t rx;
+    Ranging_Message_With_Timestamp_t rangingMessageWithTimestamp;
+    memcpy(&rx, payload, sizeof(rx));
+    memset(&rangingMessageWithTimestamp.rangingMessage, 0, sizeof(Ranging_Message_t));
+    memcpy(&rangingMessageWithTimestamp.rangingMessage, payload + sizeof(rx), record->length - sizeof(rx));
+    rangingMessageWithTimestamp.rxTime = rx.rxTime;
+    rangingMessageWithTimestamp.rxTick = rx.rxTick;
+    ctx->ownState = rx.ownState;
+    rangingHandleRx(ctx, &rangingMessageWithTimestamp);
+    break;
+  }
+  case RANGING_RECORD_TX:
+  {
+    Ranging_Message_t rangingMessage;
+    memcpy(&ctx->ownState, payload, sizeof(ctx->ownState));
+    rangingHandleTx(ctx, &rangingMessage);
+    break;
+  }
+  case RANGING_RECORD_TX_TIMESTAMP:
+  {
+    Timestamp_Tuple_t timestamp;
+    memcpy(&timestamp, payload, sizeof(timestamp));
+    updateTfBuffer(ctx, timestamp);
+    break;
+  }
+  case RANGING_RECORD_TIMER:
+    switch (payload[0])
+    {
+    case RANGING_RECORD_TIMER_RANGING_TABLE_SET:
+      rangingTableSetClearExpireTimerCallback(ctx->rangingTableSetEvictionTimer);
+      break;
+    case RANGING_RECORD_TIMER_NEIGHBOR_SET:
+      neighborSetClearExpireTimerCallback(ctx->neighborSetEvictionTimer);
+      break;
+    case RANGING_RECORD_TIMER_MISSION_TIMELINE:
+      missionTimelineTimerCallback(ctx->missionTimelineTimer);
+      break;
+    case RANGING_RECORD_TIMER_STATISTIC:
+      printStasticCallback(ctx->statisticTimer);
+      break;
+    case RANGING_RECORD_TIMER_NEIGHBOR_SET_EVENT:
+      neighborSetEventDispatch(ctx);
+      break;
+    }
+    break;
+  case RANGING_RECORD_KEEP_FLYING:
+    leaderKeepFlyingSet(ctx, payload[0]);
+    break;
+  case RANGING_RECORD_COMMAND:
+  {
+    Leader_Command_Update_t update;
+    memcpy(&update, payload, sizeof(update));
+    rangingHandleCommand(ctx, &update);
+    break;
+  }
+  default:
+    /* RX_QUEUE_DROP, the frames never reached the core. */
+    break;
+  }
+  ctx->replaying = false;
+  return true;
+}
+#endif
 
-  statisticInit();
+void rangingInit()
+{
+  Ranging_Context_t *ctx = &rangingContext;
+  rangingContextSetup(ctx, uwbGetAddress());
+  ctx->params = &rangingParams;
+  printRangingMemoryBudget();
+#ifdef ENABLE_CHANNEL_HOPPING
+  channelHoppingSetSwitchHook(ctx, channelHoppingRadioSwitch);
+#endif
 
-  xTaskCreate(uwbRangingTxTask, ADHOC_DECK_RANGING_TX_TASK_NAME, UWB_TASK_STACK_SIZE, NULL,
-              ADHOC_DECK_TASK_PRI, &uwbRangingTxTaskHandle);
-  xTaskCreate(uwbRangingRxTask, ADHOC_DECK_RANGING_RX_TASK_NAME, UWB_TASK_STACK_SIZE, NULL,
-              ADHOC_DECK_TASK_PRI, &uwbRangingRxTaskHandle);
+  ctx->listener.type = UWB_RANGING_MESSAGE;
+  ctx->listener.rxQueue = NULL; // handle rxQueue in swarm_ranging.c instead of adhocdeck.c
+  ctx->listener.rxCb = rangingRxCallback;
+  ctx->listener.txCb = rangingTxCallback;
+  uwbRegisterListener(&ctx->listener);
+
+  xTaskCreate(uwbRangingTxTask, ADHOC_DECK_RANGING_TX_TASK_NAME, UWB_TASK_STACK_SIZE, ctx,
+              ADHOC_DECK_TASK_PRI, &ctx->uwbRangingTxTaskHandle);
+  xTaskCreate(uwbRangingRxTask, ADHOC_DECK_RANGING_RX_TASK_NAME, UWB_TASK_STACK_SIZE, ctx,
+              ADHOC_DECK_TASK_PRI, &ctx->uwbRangingRxTaskHandle);
+  xTaskCreate(neighborSetEventTask, NEIGHBOR_SET_EVENT_TASK_NAME, UWB_TASK_STACK_SIZE, ctx,
+              ADHOC_DECK_TASK_PRI, &ctx->neighborSetEventTaskHandle);
+#ifdef RANGING_EVENT_RECORD_ENABLE
+  xTaskCreate(rangingRecordDrainTask, RANGING_RECORD_DRAIN_TASK_NAME, UWB_TASK_STACK_SIZE, ctx,
+              ADHOC_DECK_TASK_PRI, NULL);
+#endif
 }
 
-uint16_t getStatisticIndex = 3;
-static uint16_t getStasticRecvSeq()
+static uint16_t getStasticRecvSeq(Ranging_Context_t *ctx)
 {
-  return statistic[getStatisticIndex].recvSeq;
+  return ctx->statistic[ctx->getStatisticIndex].recvSeq;
 }
-static uint16_t getStasticRecvnum()
+static uint16_t getStasticRecvnum(Ranging_Context_t *ctx)
 {
-  return statistic[getStatisticIndex].recvnum;
+  return ctx->statistic[ctx->getStatisticIndex].recvnum;
 }
-static uint16_t getStasticCompute1num()
+static uint16_t getStasticCompute1num(Ranging_Context_t *ctx)
 {
-  return statistic[getStatisticIndex].compute1num;
+  return ctx->statistic[ctx->getStatisticIndex].compute1num;
 }
-static uint16_t getStasticCompute2num()
+static uint16_t getStasticCompute2num(Ranging_Context_t *ctx)
 {
-  return statistic[getStatisticIndex].compute2num;
+  return ctx->statistic[ctx->getStatisticIndex].compute2num;
 }
 
 LOG_GROUP_START(Ranging)
-LOG_ADD(LOG_INT16, distTo0, distanceTowards)
-LOG_ADD(LOG_FLOAT, truthDistTo0, distanceReal)
-LOG_ADD(LOG_INT16, distTo1, distanceTowards + 1)
-LOG_ADD(LOG_FLOAT, truthDistTo1, distanceReal+ 1)
-LOG_ADD(LOG_INT16, distTo2, distanceTowards + 2)
-LOG_ADD(LOG_FLOAT, truthDistTo2, distanceReal+ 2)
-LOG_ADD(LOG_INT16, distTo3, distanceTowards + 3)
-LOG_ADD(LOG_FLOAT, truthDistTo3, distanceReal+ 3)
-LOG_ADD(LOG_INT16, distTo4, distanceTowards + 4)
-LOG_ADD(LOG_FLOAT, truthDistTo4, distanceReal+ 4)
-LOG_ADD(LOG_INT16, distTo5, distanceTowards + 5)
-LOG_ADD(LOG_FLOAT, truthDistTo5, distanceReal+ 5)
-LOG_ADD(LOG_INT16, distTo6, distanceTowards + 6)
-LOG_ADD(LOG_FLOAT, truthDistTo6, distanceReal+ 6)
-LOG_ADD(LOG_INT16, distTo7, distanceTowards + 7)
-LOG_ADD(LOG_FLOAT, truthDistTo7, distanceReal+ 7)
-LOG_ADD(LOG_INT16, distTo8, distanceTowards + 8)
-LOG_ADD(LOG_FLOAT, truthDistTo8, distanceReal+ 8)
+LOG_ADD(LOG_INT16, distTo0, rangingContext.distanceTowards)
+LOG_ADD(LOG_FLOAT, truthDistTo0, rangingContext.distanceReal)
+LOG_ADD(LOG_INT16, rawDistTo0, rangingContext.distanceRaw)
+LOG_ADD(LOG_INT16, distTo1, rangingContext.distanceTowards + 1)
+LOG_ADD(LOG_FLOAT, truthDistTo1, rangingContext.distanceReal+ 1)
+LOG_ADD(LOG_INT16, rawDistTo1, rangingContext.distanceRaw + 1)
+LOG_ADD(LOG_INT16, distTo2, rangingContext.distanceTowards + 2)
+LOG_ADD(LOG_FLOAT, truthDistTo2, rangingContext.distanceReal+ 2)
+LOG_ADD(LOG_INT16, rawDistTo2, rangingContext.distanceRaw + 2)
+LOG_ADD(LOG_INT16, distTo3, rangingContext.distanceTowards + 3)
+LOG_ADD(LOG_FLOAT, truthDistTo3, rangingContext.distanceReal+ 3)
+LOG_ADD(LOG_INT16, rawDistTo3, rangingContext.distanceRaw + 3)
+LOG_ADD(LOG_INT16, distTo4, rangingContext.distanceTowards + 4)
+LOG_ADD(LOG_FLOAT, truthDistTo4, rangingContext.distanceReal+ 4)
+LOG_ADD(LOG_INT16, rawDistTo4, rangingContext.distanceRaw + 4)
+LOG_ADD(LOG_INT16, distTo5, rangingContext.distanceTowards + 5)
+LOG_ADD(LOG_FLOAT, truthDistTo5, rangingContext.distanceReal+ 5)
+LOG_ADD(LOG_INT16, rawDistTo5, rangingContext.distanceRaw + 5)
+LOG_ADD(LOG_INT16, distTo6, rangingContext.distanceTowards + 6)
+LOG_ADD(LOG_FLOAT, truthDistTo6, rangingContext.distanceReal+ 6)
+LOG_ADD(LOG_INT16, rawDistTo6, rangingContext.distanceRaw + 6)
+LOG_ADD(LOG_INT16, distTo7, rangingContext.distanceTowards + 7)
+LOG_ADD(LOG_FLOAT, truthDistTo7, rangingContext.distanceReal+ 7)
+LOG_ADD(LOG_INT16, rawDistTo7, rangingContext.distanceRaw + 7)
+LOG_ADD(LOG_INT16, distTo8, rangingContext.distanceTowards + 8)
+LOG_ADD(LOG_FLOAT, truthDistTo8, rangingContext.distanceReal+ 8)
+LOG_ADD(LOG_INT16, rawDistTo8, rangingContext.distanceRaw + 8)
+#ifdef RANGING_EVENT_RECORD_ENABLE
+LOG_ADD(LOG_UINT32, recordLost, &rangingContext.record.lost)
+LOG_ADD(LOG_UINT16, recordUsed, &rangingContext.record.used)
+#endif
 
 
 LOG_GROUP_STOP(Ranging)
 
+/* Statistic is indexed by neighbor slot, nbrN is the address of the neighbor holding slot N. */
 LOG_GROUP_START(Statistic)
-LOG_ADD(LOG_UINT16, recvSeq2, &statistic[2].recvSeq)
-LOG_ADD(LOG_UINT16, recvNum2, &statistic[2].recvnum)
-LOG_ADD(LOG_UINT16, compute1num2, &statistic[2].compute1num)
-LOG_ADD(LOG_UINT16, compute2num2, &statistic[2].compute2num)
-LOG_ADD(LOG_INT16, dist2, distanceTowards + 2)
-LOG_ADD(LOG_UINT8, distSrc2, distanceSource + 2)
-
-LOG_ADD(LOG_UINT16, recvSeq1, &statistic[1].recvSeq)
-LOG_ADD(LOG_UINT16, recvNum1, &statistic[1].recvnum)
-LOG_ADD(LOG_UINT16, compute1num1, &statistic[1].compute1num)
-LOG_ADD(LOG_UINT16, compute2num1, &statistic[1].compute2num)
-LOG_ADD(LOG_INT16, dist1, distanceTowards + 1)
-LOG_ADD(LOG_UINT8, distSrc1, distanceSource + 1)
-LOG_GROUP_STOP(Statistic)
\ No newline at end of file
+LOG_ADD(LOG_UINT16, nbr1, &rangingContext.neighborSlotMap.addressOf[1])
+LOG_ADD(LOG_UINT16, recvSeq1, &rangingContext.statistic[1].recvSeq)
+LOG_ADD(LOG_UINT16, recvNum1, &rangingContext.statistic[1].recvnum)
+LOG_ADD(LOG_UINT16, compute1num1, &rangingContext.statistic[1].compute1num)
+LOG_ADD(LOG_UINT16, compute2num1, &rangingContext.statistic[1].compute2num)
+LOG_ADD(LOG_UINT16, compute3num1, &rangingContext.statistic[1].compute3num)
+LOG_ADD(LOG_UINT16, passivenum1, &rangingContext.statistic[1].passivenum)
+LOG_ADD(LOG_UINT16, stallnum1, &rangingContext.statistic[1].stallnum)
+LOG_ADD(LOG_UINT16, lostnum1, &rangingContext.statistic[1].lostnum)
+LOG_ADD(LOG_UINT16, ageP50_1, &rangingContext.distanceLatency[1].p50)
+LOG_ADD(LOG_UINT16, ageP90_1, &rangingContext.distanceLatency[1].p90)
+
+LOG_ADD(LOG_UINT16, nbr0, &rangingContext.neighborSlotMap.addressOf[0])
+LOG_ADD(LOG_UINT16, recvSeq0, &rangingContext.statistic[0].recvSeq)
+LOG_ADD(LOG_UINT16, recvNum0, &rangingContext.statistic[0].recvnum)
+LOG_ADD(LOG_UINT16, compute1num0, &rangingContext.statistic[0].compute1num)
+LOG_ADD(LOG_UINT16, compute2num0, &rangingContext.statistic[0].compute2num)
+LOG_ADD(LOG_UINT16, compute3num0, &rangingContext.statistic[0].compute3num)
+LOG_ADD(LOG_UINT16, passivenum0, &rangingContext.statistic[0].passivenum)
+LOG_ADD(LOG_UINT16, stallnum0, &rangingContext.statistic[0].stallnum)
+LOG_ADD(LOG_UINT16, lostnum0, &rangingContext.statistic[0].lostnum)
+LOG_ADD(LOG_UINT16, ageP50_0, &rangingContext.distanceLatency[0].p50)
+LOG_ADD(LOG_UINT16, ageP90_0, &rangingContext.distanceLatency[0].p90)
+
+LOG_ADD(LOG_INT16, dist2, rangingContext.distanceTowards + 2)
+LOG_ADD(LOG_UINT8, distSrc2, rangingContext.distanceSource + 2)
+LOG_ADD(LOG_INT16, dist1, rangingContext.distanceTowards + 1)
+LOG_ADD(LOG_UINT8, distSrc1, rangingContext.distanceSource + 1)
+LOG_GROUP_STOP(Statistic)
+
+LOG_GROUP_START(Command)
+LOG_ADD(LOG_UINT16, epoch, &rangingContext.leaderCommand.epoch)
+LOG_ADD(LOG_UINT8, acks, &rangingContext.leaderCommand.ackCount)
+LOG_ADD(LOG_INT8, stage, &rangingContext.leaderCommand.stage)
+LOG_ADD(LOG_UINT16, republished, &rangingContext.commandRepublished)
+LOG_GROUP_STOP(Command)
+
+#ifdef ENABLE_SWARM_LOCALIZATION
+LOG_GROUP_START(Localization)
+LOG_ADD(LOG_UINT8, nodes, &rangingContext.swarmLocalizationNodes)
+LOG_ADD(LOG_FLOAT, residual, &rangingContext.swarmLocalizationResidual)
+LOG_GROUP_STOP(Localization)
+#endif
+
+/* Link quality in Q15 (32768 = 1) indexed by neighbor slot, nbrN is the address of the neighbor holding slot N. */
+_Static_assert(RANGING_TABLE_SIZE_MAX == 20, "LinkQuality log group lists one entry per slot");
+LOG_GROUP_START(LinkQuality)
+LOG_ADD(LOG_UINT16, nbr0, &rangingContext.neighborSlotMap.addressOf[0])
+LOG_ADD(LOG_UINT16, rx0, &rangingContext.linkQuality[0].reception)
+LOG_ADD(LOG_UINT16, ok0, &rangingContext.linkQuality[0].success)
+LOG_ADD(LOG_UINT16, nbr1, &rangingContext.neighborSlotMap.addressOf[1])
+LOG_ADD(LOG_UINT16, rx1, &rangingContext.linkQuality[1].reception)
+LOG_ADD(LOG_UINT16, ok1, &rangingContext.linkQuality[1].success)
+LOG_ADD(LOG_UINT16, nbr2, &rangingContext.neighborSlotMap.addressOf[2])
+LOG_ADD(LOG_UINT16, rx2, &rangingContext.linkQuality[2].reception)
+LOG_ADD(LOG_UINT16, ok2, &rangingContext.linkQuality[2].success)
+LOG_ADD(LOG_UINT16, nbr3, &rangingContext.neighborSlotMap.addressOf[3])
+LOG_ADD(LOG_UINT16, rx3, &rangingContext.linkQuality[3].reception)
+LOG_ADD(LOG_UINT16, ok3, &rangingContext.linkQuality[3].success)
+LOG_ADD(LOG_UINT16, nbr4, &rangingContext.neighborSlotMap.addressOf[4])
+LOG_ADD(LOG_UINT16, rx4, &rangingContext.linkQuality[4].reception)
+LOG_ADD(LOG_UINT16, ok4, &rangingContext.linkQuality[4].success)
+LOG_ADD(LOG_UINT16, nbr5, &rangingContext.neighborSlotMap.addressOf[5])
+LOG_ADD(LOG_UINT16, rx5, &rangingContext.linkQuality[5].reception)
+LOG_ADD(LOG_UINT16, ok5, &rangingContext.linkQuality[5].success)
+LOG_ADD(LOG_UINT16, nbr6, &rangingContext.neighborSlotMap.addressOf[6])
+LOG_ADD(LOG_UINT16, rx6, &rangingContext.linkQuality[6].reception)
+LOG_ADD(LOG_UINT16, ok6, &rangingContext.linkQuality[6].success)
+LOG_ADD(LOG_UINT16, nbr7, &rangingContext.neighborSlotMap.addressOf[7])
+LOG_ADD(LOG_UINT16, rx7, &rangingContext.linkQuality[7].reception)
+LOG_ADD(LOG_UINT16, ok7, &rangingContext.linkQuality[7].success)
+LOG_ADD(LOG_UINT16, nbr8, &rangingContext.neighborSlotMap.addressOf[8])
+LOG_ADD(LOG_UINT16, rx8, &rangingContext.linkQuality[8].reception)
+LOG_ADD(LOG_UINT16, ok8, &rangingContext.linkQuality[8].success)
+LOG_ADD(LOG_UINT16, nbr9, &rangingContext.neighborSlotMap.addressOf[9])
+LOG_ADD(LOG_UINT16, rx9, &rangingContext.linkQuality[9].reception)
+LOG_ADD(LOG_UINT16, ok9, &rangingContext.linkQuality[9].success)
+LOG_ADD(LOG_UINT16, nbr10, &rangingContext.neighborSlotMap.addressOf[10])
+LOG_ADD(LOG_UINT16, rx10, &rangingContext.linkQuality[10].reception)
+LOG_ADD(LOG_UINT16, ok10, &rangingContext.linkQuality[10].success)
+LOG_ADD(LOG_UINT16, nbr11, &rangingContext.neighborSlotMap.addressOf[11])
+LOG_ADD(LOG_UINT16, rx11, &rangingContext.linkQuality[11].reception)
+LOG_ADD(LOG_UINT16, ok11, &rangingContext.linkQuality[11].success)
+LOG_ADD(LOG_UINT16, nbr12, &rangingContext.neighborSlotMap.addressOf[12])
+LOG_ADD(LOG_UINT16, rx12, &rangingContext.linkQuality[12].reception)
+LOG_ADD(LOG_UINT16, ok12, &rangingContext.linkQuality[12].success)
+LOG_ADD(LOG_UINT16, nbr13, &rangingContext.neighborSlotMap.addressOf[13])
+LOG_ADD(LOG_UINT16, rx13, &rangingContext.linkQuality[13].reception)
+LOG_ADD(LOG_UINT16, ok13, &rangingContext.linkQuality[13].success)
+LOG_ADD(LOG_UINT16, nbr14, &rangingContext.neighborSlotMap.addressOf[14])
+LOG_ADD(LOG_UINT16, rx14, &rangingContext.linkQuality[14].reception)
+LOG_ADD(LOG_UINT16, ok14, &rangingContext.linkQuality[14].success)
+LOG_ADD(LOG_UINT16, nbr15, &rangingContext.neighborSlotMap.addressOf[15])
+LOG_ADD(LOG_UINT16, rx15, &rangingContext.linkQuality[15].reception)
+LOG_ADD(LOG_UINT16, ok15, &rangingContext.linkQuality[15].success)
+LOG_ADD(LOG_UINT16, nbr16, &rangingContext.neighborSlotMap.addressOf[16])
+LOG_ADD(LOG_UINT16, rx16, &rangingContext.linkQuality[16].reception)
+LOG_ADD(LOG_UINT16, ok16, &rangingContext.linkQuality[16].success)
+LOG_ADD(LOG_UINT16, nbr17, &rangingContext.neighborSlotMap.addressOf[17])
+LOG_ADD(LOG_UINT16, rx17, &rangingContext.linkQuality[17].reception)
+LOG_ADD(LOG_UINT16, ok17, &rangingContext.linkQuality[17].success)
+LOG_ADD(LOG_UINT16, nbr18, &rangingContext.neighborSlotMap.addressOf[18])
+LOG_ADD(LOG_UINT16, rx18, &rangingContext.linkQuality[18].reception)
+LOG_ADD(LOG_UINT16, ok18, &rangingContext.linkQuality[18].success)
+LOG_ADD(LOG_UINT16, nbr19, &rangingContext.neighborSlotMap.addressOf[19])
+LOG_ADD(LOG_UINT16, rx19, &rangingContext.linkQuality[19].reception)
+LOG_ADD(LOG_UINT16, ok19, &rangingContext.linkQuality[19].success)
+LOG_GROUP_STOP(LinkQuality)
+
+PARAM_GROUP_START(ranging)
+PARAM_ADD(PARAM_UINT8, distFilter, &rangingParams.distanceFilterType) // 0: none, 1: median, 2: Hampel, 3: Kalman
+PARAM_ADD(PARAM_UINT8, passiveTdoa, &rangingParams.passiveRangingEnable)
+PARAM_ADD(PARAM_UINT8, rxLossPct, &rangingParams.rxLossPercent) // injected rx loss in percent, 0 to disable
+#ifdef RANGING_EVENT_RECORD_ENABLE
+PARAM_ADD(PARAM_UINT8, record, &rangingParams.recordEnable) // 0 pauses the event record, e.g. to keep it for download
+#endif
+PARAM_GROUP_STOP(ranging)
+
+PARAM_GROUP_START(mission)
+PARAM_ADD(PARAM_UINT32, converge, &rangingParams.missionTimeline.convergeTime) // ms
+PARAM_ADD(PARAM_UINT32, follow, &rangingParams.missionTimeline.followTime)     // ms
+PARAM_ADD(PARAM_UINT32, maintain, &rangingParams.missionTimeline.maintainTime) // ms per rotation
+PARAM_ADD_WITH_CALLBACK(PARAM_UINT8, rotations, &rangingParams.missionTimeline.rotationCount,
+                        missionTimelineRotationCountChanged) // at most MISSION_TIMELINE_ROTATION_MAX
+PARAM_GROUP_STOP(mission)
\ No newline at end of file
@@ -5,23 +5,56 @@
 #include "adhocdeck.h"
 #include "semphr.h"
 
+/* All state of one ranging instance, defined in swarm_ranging.c. rangingInit() runs the default instance on the
+ * deck, the core entry points at the end of this file take any instance.
+ */
+typedef struct Ranging_Context Ranging_Context_t;
+
 // #define RANGING_DEBUG_ENABLE
 
 /* Function Switch */
 // #define ENABLE_BUS_BOARDING_SCHEME
 // #define ENABLE_DYNAMIC_RANGING_PERIOD
+// #define RANGING_TRANSITION_TRACE_ENABLE
+// #define RANGING_INVARIANT_CHECK_ENABLE
+// #define ENABLE_CHANNEL_HOPPING
+// #define RANGING_BENCHMARK_ENABLE // print per-link throughput, latency and loss as JSON lines on the console
+// #define ENABLE_SWARM_LOCALIZATION // solve relative positions of all neighbors from the pairwise distances
+// #define ENABLE_DISTANCE_SHARING // body units carry the sender's distance to that neighbor, all nodes must agree
+// #define RANGING_EVENT_RECORD_ENABLE // record the inputs of the ranging core so that a flight can be replayed
+#ifdef ENABLE_CHANNEL_HOPPING
+#define CHANNEL_GROUP_COUNT 2      // number of UWB channels the swarm is partitioned onto
+#define CHANNEL_GROUP_NONE 0xFF    // not in any group yet
+#define CHANNEL_GROUP_HOLD_COUNT 3 // transmissions a lost or contested cluster head must persist before acting on it
+#define CHANNEL_NEIGHBOR_TIMEOUT (4 * CHANNEL_GROUP_COUNT * RANGING_PERIOD) // ms, clustering forgets nodes not heard
+#define CHANNEL_SLOT_ANCHOR_PERIODS (2 * CHANNEL_GROUP_COUNT) // periods followers keep the slot of a leader frame
+#endif
 #ifdef ENABLE_DYNAMIC_RANGING_PERIOD
 #define DYNAMIC_RANGING_COEFFICIENT 1
 #endif
+#ifdef RANGING_EVENT_RECORD_ENABLE
+#define RANGING_RECORD_BUFFER_SIZE 4096 // bytes, records that do not fit are counted as lost until drained
+#define RANGING_RECORD_DRAIN_PERIOD 20   // ms between drains of the ring to the app channel, the ring lasts about 1 s
+#define RANGING_RECORD_DRAIN_TASK_NAME "rangingRecordTask"
+#endif
+#ifdef ENABLE_SWARM_LOCALIZATION
+#define SWARM_LOCALIZATION_PASSIVE_WEIGHT 0.5f // weight of overheard pair distances relative to own links
+#define SWARM_LOCALIZATION_UNCERTAINTY_SCALE 10.0f // cm, own link weight is 1 / (1 + uncertainty / scale)
+#endif
 
 /* Ranging Constants */
 #define RANGING_PERIOD 60      // default in 200ms
 #define RANGING_PERIOD_MIN 50  // default 50ms
 #define RANGING_PERIOD_MAX 500 // default 500ms
+#define UWB_TIME_UNITS_PER_MS 63897600ULL // DW1000 time unit is 1 / (499.2MHz * 128)
+#define TX_PERIOD_IN_MS 60 // followers transmit on their own once the leader has been silent this long
+#define RANGING_CONTEXT_SIZE_MAX (32 * 1024) // arena of all ranging state, half of the 64KB CCM
 
 /* Queue Constants */
 #define RANGING_RX_QUEUE_SIZE 5
 #define RANGING_RX_QUEUE_ITEM_SIZE sizeof(Ranging_Message_With_Timestamp_t)
+#define RANGING_COMMAND_QUEUE_SIZE 8       // command fields of frames a follower does not range with
+#define RANGING_COMMAND_POLL_PERIOD 10     // ms, the rx task drains the command queue at least this often
 
 /* Ranging Struct Constants */
 #define RANGING_MESSAGE_SIZE_MAX UWB_PAYLOAD_SIZE_MAX
@@ -29,24 +62,60 @@
 #define RANGING_MAX_Tr_UNIT 5
 #define RANGING_MAX_BODY_UNIT (RANGING_MESSAGE_PAYLOAD_SIZE_MAX / sizeof(Body_Unit_t))
 #define RANGING_TABLE_SIZE_MAX 20 // default up to 20 one-hop neighbors
-#define TX_RV_INTERVAL_HISTORY_SIZE 5
 #define RANGING_TABLE_SIZE 20
 #define RESET_INIT_STAGE 123
 #define ZERO_STAGE 124  // 飞行阶段，0阶段随机飞
 #define FIRST_STAGE 125 //
 #define SECOND_STAGE 126
 #define LAND_STAGE 127
+#define MISSION_TIMELINE_PERIOD 20 // ms, how often the leader re-evaluates its stage
+#define MISSION_TIMELINE_ROTATION_MAX (RESET_INIT_STAGE - 1) // rotation indices stay below RESET_INIT_STAGE
 #define RANGING_TABLE_HOLD_TIME (6 * RANGING_PERIOD_MAX)
+/* When the ranging table set is full, the least recently heard neighbor is replaced by a new one
+ * only if it has been silent for at least this long, so a crowded swarm does not thrash the table. */
+#define RANGING_TABLE_EVICTION_IDLE_TIME (3 * RANGING_PERIOD)
 #define Tr_Rr_BUFFER_POOL_SIZE 5
 // #define Tf_BUFFER_POOL_SIZE (2 * RANGING_PERIOD_MAX / RANGING_PERIOD_MIN)
 #define Tf_BUFFER_POOL_SIZE 5
 
+/* Clock Skew Estimation */
+#define CLOCK_SKEW_MIN_INTERVAL (200 * UWB_TIME_UNITS_PER_MS)  // baseline between two (Tr, Rr) pairs of a sample
+#define CLOCK_SKEW_MAX_INTERVAL (2000 * UWB_TIME_UNITS_PER_MS) // re-reference if the baseline grows longer
+#define CLOCK_SKEW_MIN_SAMPLES 8                               // samples before the estimate is trusted
+#define CLOCK_SKEW_GATE 5e-6f                                  // reject samples deviating more than 5 ppm
+#define SINGLE_SIDED_REPLY_MAX (200 * UWB_TIME_UNITS_PER_MS)   // bound the error of single-sided ranging
+
+/* Passive Ranging */
+#define PASSIVE_RX_HISTORY_SIZE 4 // recent (seqNumber, rxTime) of each neighbor, matched against overheard body units
+#define PASSIVE_DISTANCE_PAIR_COUNT (RANGING_TABLE_SIZE_MAX * (RANGING_TABLE_SIZE_MAX - 1) / 2)
+#define PASSIVE_DISTANCE_SMOOTHING 4 // moving average weight of passive estimates
+
+/* Distance Sharing */
+#ifdef ENABLE_DISTANCE_SHARING
+#define SHARED_DISTANCE_UNIT 4       // cm per quantization step, one byte covers up to 1020 cm
+#define SHARED_DISTANCE_AGE_UNIT 50  // ms per step of the reported distance age
+#define SHARED_DISTANCE_AGE_MAX 15   // 4 bit age, distances older than this are not shared
+#define SHARED_DISTANCE_ROW_SIZE 8   // distances kept per neighbor, the stalest is replaced
+#endif
+
 /* Topology Sensing */
-#define NEIGHBOR_ADDRESS_MAX 32
+#define NEIGHBOR_ADDRESS_MAX 63 // bounded by the 64-bit Neighbor_Bit_Set_t
 #define NEIGHBOR_SET_HOLD_TIME (6 * RANGING_PERIOD_MAX)
 
+/* Expiration Wheel */
+#define EXPIRATION_WHEEL_RESOLUTION RANGING_PERIOD // ms per bucket, also the eviction timer period
+#define EXPIRATION_WHEEL_BUCKET_COUNT 64           // power of 2, must span more than the longest hold time
+#define EXPIRATION_WHEEL_NIL 0xFF
+
+/* Neighbor Set Events */
+#define NEIGHBOR_SET_HOOKS_MAX 4 // max subscribers per event type
+#define NEIGHBOR_SET_EVENT_TASK_NAME "nbrSetEventTask"
+
 typedef short set_index_t;
 
+/* Neighbor Slot Map */
+#define NEIGHBOR_SLOT_NONE -1
+
 /* Timestamp Tuple */
 typedef struct
 {
@@ -60,18 +129,26 @@ typedef struct
   struct
   {
     uint8_t MPR : 1;
+#ifdef ENABLE_DISTANCE_SHARING
+    uint8_t distanceAge : 4; // age of distance in SHARED_DISTANCE_AGE_UNIT
+    uint8_t RESERVED : 3;
+#else
     uint8_t RESERVED : 7;
+#endif
   } flags;                             // 1 byte
   uint16_t address;                    // 2 byte
   Timestamp_Tuple_t timestamp;         // 10 byte
-} __attribute__((packed)) Body_Unit_t; // 13 byte
+#ifdef ENABLE_DISTANCE_SHARING
+  uint8_t distance;                    // 1 byte, sender's filtered distance in SHARED_DISTANCE_UNIT, 0 if unknown
+#endif
+} __attribute__((packed)) Body_Unit_t; // 13 byte, 14 byte with ENABLE_DISTANCE_SHARING
 
 /* Ranging Message Header*/
 typedef struct
 {
   uint16_t srcAddress;                                     // 2 byte
   uint16_t msgSequence;                                    // 2 byte
-  Timestamp_Tuple_t lastTxTimestamps[RANGING_MAX_Tr_UNIT]; // 10 byte * MAX_Tr_UNIT
+  Timestamp_Tuple_t lastTxTimestamps[RANGING_MAX_Tr_UNIT]; // 10 byte * MAX_Tr_UNIT, unused ones carry msgSequence
   short velocity;                                          // 2 byte cm/s
   short velocityXInWorld;                                  // 2 byte cm/s 在世界坐标系下的速度（不是基于机体坐标系的速度）
   short velocityYInWorld;                                  // 2 byte cm/s 在世界坐标系下的速度（不是基于机体坐标系的速度）
@@ -82,10 +159,17 @@ typedef struct
   int8_t stage;
   uint16_t msgLength; // 2 byte
   uint16_t filter;    // 16 bits bloom filter
+  uint16_t commandEpoch; // 2 byte, epoch of the leader command carried in keep_flying and stage
+  uint64_t commandAck;   // 8 byte, addresses known to hold commandEpoch
 
   float posiX;
   float posiY;
-  float posiZ;                                      // 4 byte rad/s
+  float posiZ; // 4 byte rad/s
+#ifdef ENABLE_CHANNEL_HOPPING
+  uint8_t channelGroup;                             // home channel group of the sender, the visited one for the leader
+  uint8_t channelBridge;                            // 1 if the sender hops between channel groups
+  uint16_t channelHead;                             // cluster head of the sender
+#endif
 } __attribute__((packed)) Ranging_Message_Header_t; // 10 byte + 10 byte * MAX_Tr_UNIT
 
 /* Ranging Message */
@@ -100,12 +184,30 @@ typedef struct
 {
   Ranging_Message_t rangingMessage;
   dwTime_t rxTime;
+  Time_t rxTick; // local tick when rxTime was captured
 } __attribute__((packed)) Ranging_Message_With_Timestamp_t;
 
+/* Own state the core reads from the estimator, sampled once at the start of each TX and RX */
+typedef struct
+{
+  float x, y, z;    // stateEstimate position, m
+  float vx, vy, vz; // stateEstimate velocity, m/s
+  short velocityXInWorld;
+  short velocityYInWorld;
+  float gyroZ;
+  uint16_t positionZ;
+} __attribute__((packed)) Ranging_Own_State_t;
+
+/* Validity of a (Tr, Rr) candidate, the Rr of the latest reception waits in the current slot for its Tr */
+#define RANGING_CANDIDATE_VALID_Tr (1 << 0)
+#define RANGING_CANDIDATE_VALID_Rr (1 << 1)
+#define RANGING_CANDIDATE_VALID (RANGING_CANDIDATE_VALID_Tr | RANGING_CANDIDATE_VALID_Rr)
+
 typedef struct
 {
   Timestamp_Tuple_t Tr;
   Timestamp_Tuple_t Rr;
+  uint8_t valid; // RANGING_CANDIDATE_VALID_* bits, timestamps and sequence numbers may legitimately be 0
 } __attribute__((packed)) Ranging_Table_Tr_Rr_Candidate_t;
 
 /* Tr and Rr candidate buffer for each Ranging Table */
@@ -135,6 +237,52 @@ typedef enum
   RANGING_TABLE_EVENT_COUNT
 } RANGING_TABLE_EVENT;
 
+/* Actions of a ranging state transition, applied in bit order. */
+#define RANGING_ACTION_NONE 0
+#define RANGING_ACTION_FIND_Tf (1 << 0)         // Tf <- TfBuffer[Rf.seqNumber]
+#define RANGING_ACTION_COMPUTE_DS_TWR (1 << 1)  // distance from (Tp, Rp, Tr, Rr, Tf, Rf)
+#define RANGING_ACTION_COMPUTE_HISTORY (1 << 2) // distance from (Tx, Rx, Tp, Rp, Tr, Rr)
+#define RANGING_ACTION_SHIFT_Rf (1 << 3)        // Rp <- Rf, Tp <- Tf
+#define RANGING_ACTION_SHIFT_Re (1 << 4)        // Rr <- Re
+
+/* Validity of the timestamps in a ranging table */
+#define RANGING_VALID_Rp (1 << 0)
+#define RANGING_VALID_Tp (1 << 1)
+#define RANGING_VALID_Rf (1 << 2)
+#define RANGING_VALID_Tf (1 << 3)
+#define RANGING_VALID_Re (1 << 4)
+#define RANGING_VALID_TxRx (1 << 5) // TxRxHistory
+#define RANGING_VALID_LATEST (1 << 6) // latestReceived
+
+/* A neighbor that is heard this many times in a row without producing a distance is reported as stalled. */
+#define RANGING_STALL_THRESHOLD 16
+
+typedef struct
+{
+  uint8_t actions; // RANGING_ACTION_* bitmask
+  uint8_t next;    // RANGING_STATE_RESERVED if the event is not expected in this state
+} Ranging_Transition_t;
+
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+#define RANGING_TRANSITION_TRACE_SIZE 8
+
+typedef struct
+{
+  Time_t tick;
+  uint16_t seqNumber; // Re of the transition, or the latest Tf for TX events
+  uint8_t prevState : 4;
+  uint8_t event : 4;
+  uint8_t curState;
+  int16_t distance; // distance computed by the transition, -1 if none
+} __attribute__((packed)) Ranging_Transition_Trace_Item_t;
+
+typedef struct
+{
+  Ranging_Transition_Trace_Item_t items[RANGING_TRANSITION_TRACE_SIZE];
+  uint8_t index; // next item to write
+} __attribute__((packed)) Ranging_Transition_Trace_t;
+#endif
+
 /* Ranging Table
   +------+------+------+------+------+
   |  Rp  |  Tr  |  Rf  |  P   |  tn  |
@@ -161,6 +309,10 @@ typedef struct
   Timestamp_Tuple_t Tf;
   Timestamp_Tuple_t Re;
   Timestamp_Tuple_t latestReceived;
+  Time_t latestReceivedTick; // local tick of latestReceived
+  Timestamp_Tuple_t rxHistory[PASSIVE_RX_HISTORY_SIZE]; // recent receptions of this neighbor
+  uint8_t rxHistoryIndex;
+  uint8_t rxHistoryValid; // bit i is set once rxHistory[i] holds a reception
 
   Time_t period;
   Time_t nextExpectedDeliveryTime;
@@ -168,19 +320,94 @@ typedef struct
   Time_t lastSendTime;
   int16_t distance;
 
+  /* Clock skew of this neighbor, neighbor interval = local interval * (1 + clockSkew) */
+  Ranging_Table_Tr_Rr_Candidate_t clockReference; /* (Tr, Rr) pair at the start of the current baseline */
+  float clockSkew;
+  uint8_t clockSkewSamples;
+
+#ifdef RANGING_TRANSITION_TRACE_ENABLE
+  Ranging_Transition_Trace_t trace;
+#endif
+  uint8_t rxWithoutDistance; // consecutive RX events without a distance
+  uint8_t valid;             // RANGING_VALID_* bits, timestamps and sequence numbers may legitimately be 0
+
   RANGING_TABLE_STATE state;
 } __attribute__((packed)) Ranging_Table_t;
 
+/* Passive Distance Matrix, distances between pairs of neighbors estimated from overheard frames, stored as the
+ * upper triangle of a slot by slot matrix.
+ */
+typedef struct
+{
+  int16_t distance[PASSIVE_DISTANCE_PAIR_COUNT]; // cm, -1 if unknown
+  Time_t updateTime[PASSIVE_DISTANCE_PAIR_COUNT];
+} Passive_Distance_Matrix_t;
+
+#ifdef ENABLE_DISTANCE_SHARING
+/* Shared Distance Row, distances a neighbor reported to its own neighbors, which may be two hops away from us. */
+typedef struct
+{
+  UWB_Address_t address[SHARED_DISTANCE_ROW_SIZE]; // UWB_DEST_EMPTY if unused
+  int16_t distance[SHARED_DISTANCE_ROW_SIZE];      // cm
+  Time_t measurementTime[SHARED_DISTANCE_ROW_SIZE]; // local tick, reception time minus the reported age
+} Shared_Distance_Row_t;
+#endif
+
+#ifdef ENABLE_CHANNEL_HOPPING
+/* Called with the channel group the radio should be tuned to, the UWB driver maps groups to channel and PRF. */
+typedef void (*channelSwitchHook)(uint8_t channelGroup);
+
+/* What the clustering keeps of a node heard recently, from its ranging frames or the command fields of them */
+typedef struct
+{
+  uint8_t group;      // channel group it advertised, CHANNEL_GROUP_NONE if never heard
+  uint16_t head;      // cluster head it advertised
+  Time_t lastHeard;   // local tick
+} Channel_Hopping_Neighbor_t;
+
+/* Channel hopping, the followers are clustered and each cluster ranges on its own channel group. The leader is not
+ * in any cluster, it visits the groups in use one ranging period each, and followers keep the slot of its last
+ * frame in the periods it is away. Followers out of the leader's reach are bridges, they alternate between their
+ * home group and the other groups on every transmission so that the leader command still crosses clusters.
+ */
+typedef struct
+{
+  uint8_t group;        // home channel group, the visited one for the leader
+  uint8_t current;      // channel group the radio is tuned to
+  bool isBridge;
+  uint16_t head;        // cluster head, this node's address if it heads its cluster
+  uint8_t pendingCount; // transmissions the head has been lost or contested
+  uint8_t hopIndex;     // round robin over the groups a bridge or the leader visits
+  Time_t leaderRxTick;  // local tick of the last leader frame
+  bool leaderSeen;
+  Channel_Hopping_Neighbor_t neighbors[NEIGHBOR_ADDRESS_MAX + 1];
+  channelSwitchHook switchHook;
+} Channel_Hopping_t;
+#endif
+
+/* Hashed timing wheel keyed by expiration tick, each address is linked into the bucket of its deadline so that
+ * refreshing an entry is O(1) and advancing the wheel only touches entries that actually expired.
+ */
+typedef struct
+{
+  Time_t deadline[NEIGHBOR_ADDRESS_MAX + 1];
+  uint8_t next[NEIGHBOR_ADDRESS_MAX + 1];
+  uint8_t prev[NEIGHBOR_ADDRESS_MAX + 1];
+  uint8_t bucketOf[NEIGHBOR_ADDRESS_MAX + 1]; /* EXPIRATION_WHEEL_NIL if not scheduled */
+  uint8_t heads[EXPIRATION_WHEEL_BUCKET_COUNT];
+  Time_t origin;   /* ticks count from here, so that they keep increasing across the wrap of Time_t */
+  Time_t lastTick; /* last bucket tick that is fully processed */
+} Expiration_Wheel_t;
+
 /* Ranging Table Set */
 typedef struct
 {
   int size;
   SemaphoreHandle_t mu;
   Ranging_Table_t tables[RANGING_TABLE_SIZE_MAX];
+  Expiration_Wheel_t expirationWheel;
 } Ranging_Table_Set_t;
 
-typedef void (*RangingTableEventHandler)(Ranging_Table_t *);
-
 typedef struct
 {
   uint64_t bits;
@@ -189,10 +416,14 @@ typedef struct
 
 typedef void (*neighborSetHook)(UWB_Address_t);
 
-typedef struct Neighbor_Set_Hook
+/* Static subscriber table of one event type. Events are posted by setting the neighbor's bit in pending, so all
+ * events of the same neighbor between two dispatches are coalesced into one notification.
+ */
+typedef struct
 {
-  neighborSetHook hook;
-  struct Neighbor_Set_Hook_Node *next;
+  neighborSetHook hooks[NEIGHBOR_SET_HOOKS_MAX];
+  uint8_t size;
+  Neighbor_Bit_Set_t pending;
 } Neighbor_Set_Hooks_t;
 
 typedef struct
@@ -203,18 +434,19 @@ typedef struct
   Neighbor_Bit_Set_t twoHop;
   /* one hop neighbors can be used to reach the corresponding two hop neighbor */
   Neighbor_Bit_Set_t twoHopReachSets[NEIGHBOR_ADDRESS_MAX + 1];
+  /* two hop neighbors can be reached through the corresponding one hop neighbor, transpose of twoHopReachSets */
+  Neighbor_Bit_Set_t twoHopCoverSets[NEIGHBOR_ADDRESS_MAX + 1];
+  /* MPR set maintained incrementally by neighborSetUpdateMpr() */
+  Neighbor_Bit_Set_t mprSet;
+  Neighbor_Bit_Set_t mprDirty;           /* two hop neighbors whose reach set changed since last update */
+  Neighbor_Bit_Set_t mprPruneCandidates; /* MPRs that may have become redundant since last update */
   Neighbor_Set_Hooks_t neighborNewHooks; /* hooks for newly added neighbor which neither one-hop nor two-hop */
   Neighbor_Set_Hooks_t neighborExpirationHooks;
   Neighbor_Set_Hooks_t neighborTopologyChangeHooks;
   Time_t expirationTime[NEIGHBOR_ADDRESS_MAX + 1];
+  Expiration_Wheel_t expirationWheel;
 } Neighbor_Set_t;
 
-typedef struct
-{
-  uint16_t interval[TX_RV_INTERVAL_HISTORY_SIZE]; // 近似两次数据包的发送间隔.存5次历史值
-  uint8_t latest_data_index;                      // 存储最新数据的index;
-} tx_rv_interval_history_t;
-
 typedef struct
 {
   uint16_t address;
@@ -224,20 +456,33 @@ typedef struct
   bool alreadyTakeoff;
 
 } leaderStateInfo_t;
+/* Compact address -> slot mapping, per-neighbor state is indexed by slot instead of by address so that
+ * its size only depends on RANGING_TABLE_SIZE_MAX, not on NEIGHBOR_ADDRESS_MAX. */
+typedef struct
+{
+  set_index_t slotOf[NEIGHBOR_ADDRESS_MAX + 1];     /* NEIGHBOR_SLOT_NONE if the address holds no slot */
+  UWB_Address_t addressOf[RANGING_TABLE_SIZE_MAX]; /* UWB_DEST_EMPTY if the slot is free */
+  uint8_t size;
+} Neighbor_Slot_Map_t;
+
 typedef struct
 {
-  uint16_t distanceTowards[RANGING_TABLE_SIZE + 1]; // cm
-  short velocityXInWorld[RANGING_TABLE_SIZE + 1];   // 2byte m/s 在世界坐标系下的速度（不是机体坐标系）
-  short velocityYInWorld[RANGING_TABLE_SIZE + 1];   // 2byte cm/s 在世界坐标系下的速度（不是机体坐标系）
-  float gyroZ[RANGING_TABLE_SIZE + 1];              // 4 byte rad/s
-  uint16_t positionZ[RANGING_TABLE_SIZE + 1];       // 2 byte cm/s
-  bool refresh[RANGING_TABLE_SIZE + 1];             // 当前信息从上次EKF获取，到现在是否更新
-  bool isNewAdd[RANGING_TABLE_SIZE + 1];            // 这个邻居是否是新加入的
-  bool isNewAddUsed[RANGING_TABLE_SIZE + 1];
-  bool isAlreadyTakeoff[RANGING_TABLE_SIZE_MAX + 1];
+  uint16_t distanceTowards[RANGING_TABLE_SIZE_MAX]; // cm
+  short velocityXInWorld[RANGING_TABLE_SIZE_MAX];   // 2byte m/s 在世界坐标系下的速度（不是机体坐标系）
+  short velocityYInWorld[RANGING_TABLE_SIZE_MAX];   // 2byte cm/s 在世界坐标系下的速度（不是机体坐标系）
+  float gyroZ[RANGING_TABLE_SIZE_MAX];              // 4 byte rad/s
+  uint16_t positionZ[RANGING_TABLE_SIZE_MAX];       // 2 byte cm/s
+  bool refresh[RANGING_TABLE_SIZE_MAX];             // 当前信息从上次EKF获取，到现在是否更新
+  bool isNewAdd[RANGING_TABLE_SIZE_MAX];            // 这个邻居是否是新加入的
+  bool isNewAddUsed[RANGING_TABLE_SIZE_MAX];
+  bool isAlreadyTakeoff[RANGING_TABLE_SIZE_MAX];
+  Time_t measurementTime[RANGING_TABLE_SIZE_MAX];  // 最新距离的测量时间(tick)
+  dwTime_t measurementUwbTime[RANGING_TABLE_SIZE_MAX]; // 最新距离的测量时间(本机UWB时间)
+  uint32_t addedVersion[RANGING_TABLE_SIZE_MAX];    // 邻居加入时的快照版本
+  uint32_t distanceVersion[RANGING_TABLE_SIZE_MAX]; // 最新距离所在的快照版本
   /* 用于辅助判断这个邻居是否是新加入的（注意：这里的'新加入'指的是，
   是相对于EKF来说的，主要用于在EKF中判断是否需要执行初始化工作）*/
-} neighborStateInfo_t; /*存储正在和本无人机进行通信的邻居的所有信息（用于EKF）*/
+} neighborStateInfo_t; /*存储正在和本无人机进行通信的邻居的所有信息（用于EKF），按slot索引*/
 
 typedef struct
 {
@@ -245,16 +490,227 @@ typedef struct
   int size;
 } currentNeighborAddressInfo_t; /*当前正在和本无人机进行通信的邻居地址信息*/
 
+/* Distance Latency, age of distances at consumption by the estimator */
+#define DISTANCE_LATENCY_BIN_COUNT 8
+
+typedef struct
+{
+  uint16_t histogram[DISTANCE_LATENCY_BIN_COUNT]; // bins bounded by DISTANCE_LATENCY_BIN_EDGES
+  uint16_t maxAge;                                // ms
+  uint16_t p50;                                   // ms, upper edge of the bin, refreshed periodically
+  uint16_t p90;                                   // ms, upper edge of the bin, refreshed periodically
+} Distance_Latency_t;
+
+/* Distance Latency kept by a snapshot consumer for the neighbors it has been fed */
+typedef struct
+{
+  UWB_Address_t address[RANGING_TABLE_SIZE_MAX]; // UWB_DEST_EMPTY if unused
+  Distance_Latency_t latency[RANGING_TABLE_SIZE_MAX];
+} Distance_Latency_Set_t;
+
+/* Leader Command, keep_flying and stage flooded through the swarm under a sequence numbered epoch. Every node
+ * carries its latest command in each header, so it spreads one hop per frame, and acknowledgement bitmaps are
+ * merged along the way so the leader learns the coverage.
+ */
+typedef struct
+{
+  uint16_t epoch;
+  bool keepFlying;
+  int8_t stage;
+  uint64_t ackBits; // addresses known to hold this epoch
+  uint8_t ackCount;
+} Leader_Command_t;
+
+/* Command fields of a frame, followers take them from frames they do not range with without touching the tables */
+typedef struct
+{
+  uint16_t srcAddress;
+  uint16_t epoch;
+  bool keepFlying;
+  int8_t stage;
+  uint64_t ackBits;
+#ifdef ENABLE_CHANNEL_HOPPING
+  uint8_t channelGroup; // clustering fields of the sender, see Channel_Hopping_t
+  uint16_t channelHead;
+#endif
+} __attribute__((packed)) Leader_Command_Update_t;
+
+/* Mission Timeline of the leader, durations in ms since keep_flying was set, loaded from params */
+typedef struct
+{
+  uint32_t convergeTime;  // FIRST_STAGE, random flight
+  uint32_t followTime;    // SECOND_STAGE, follow the leader
+  uint32_t maintainTime;  // each rotation of the third stage
+  uint8_t rotationCount;  // rotations of the third stage, then LAND_STAGE
+} Mission_Timeline_t;
+
+/* Params of one ranging instance */
+typedef struct
+{
+  uint8_t distanceFilterType;   // DISTANCE_FILTER_TYPE, param ranging.distFilter
+  uint8_t passiveRangingEnable; // 是否根据监听到的报文计算邻居之间的距离
+  uint8_t rxLossPercent;        // injected rx loss for experiments, param ranging.rxLossPct
+  uint8_t recordEnable;         // param ranging.record, only with RANGING_EVENT_RECORD_ENABLE
+  Mission_Timeline_t missionTimeline;
+} Ranging_Params_t;
+
+#ifdef RANGING_EVENT_RECORD_ENABLE
+/* Event Record, every input of the ranging core in the order it took effect. A record is a header followed by
+ * length bytes of payload, replaying the records from boot through rangingReplayRecord() gives the same state.
+ */
+typedef enum
+{
+  RANGING_RECORD_CONFIG,        // Ranging_Record_Config_t, whenever the params differ from the last record
+  RANGING_RECORD_RX,            // Ranging_Record_Rx_t, then msgLength bytes of the message
+  RANGING_RECORD_TX,            // Ranging_Own_State_t
+  RANGING_RECORD_TX_TIMESTAMP,  // Timestamp_Tuple_t reported by rangingTxCallback
+  RANGING_RECORD_TIMER,         // uint8_t RANGING_RECORD_TIMER_ID
+  RANGING_RECORD_KEEP_FLYING,   // uint8_t, keep_flying changed on the leader
+  RANGING_RECORD_RX_QUEUE_DROP, // uint16_t, frames the rx queue rejected since the previous record
+  RANGING_RECORD_COMMAND,       // Leader_Command_Update_t taken from the command queue
+} RANGING_RECORD_TYPE;
+
+typedef enum
+{
+  RANGING_RECORD_TIMER_RANGING_TABLE_SET,
+  RANGING_RECORD_TIMER_NEIGHBOR_SET,
+  RANGING_RECORD_TIMER_MISSION_TIMELINE,
+  RANGING_RECORD_TIMER_STATISTIC,
+  RANGING_RECORD_TIMER_NEIGHBOR_SET_EVENT, // the neighbor set event task, woken by the hooks rather than periodic
+} RANGING_RECORD_TIMER_ID;
+
+typedef struct
+{
+  uint8_t type;
+  uint16_t length; // payload bytes following this header
+  Time_t tick;     // xTaskGetTickCount() when the event took effect
+} __attribute__((packed)) Ranging_Record_Header_t;
+
+typedef struct
+{
+  uint8_t distanceFilterType;
+  uint8_t passiveRangingEnable;
+  uint8_t rxLossPercent;
+  Mission_Timeline_t missionTimeline;
+} __attribute__((packed)) Ranging_Record_Config_t;
+
+typedef struct
+{
+  Ranging_Own_State_t ownState;
+  dwTime_t rxTime;
+  Time_t rxTick;
+} __attribute__((packed)) Ranging_Record_Rx_t;
+
+/* Largest record, an RX record of a message of the maximum size. A read buffer of this size never stalls. */
+#define RANGING_RECORD_SIZE_MAX (sizeof(Ranging_Record_Header_t) + sizeof(Ranging_Record_Rx_t) + RANGING_MESSAGE_SIZE_MAX)
+#endif
+
+/* Neighbor Motion, alpha-beta tracker of distance and range rate between ranging rounds */
+#define NEIGHBOR_MOTION_ALPHA 0.5f
+#define NEIGHBOR_MOTION_BETA 0.1f
+#define NEIGHBOR_MOTION_MAX_HORIZON 500 // ms, no extrapolation beyond this since the last measurement
+#define NEIGHBOR_MOTION_PRIOR_WEIGHT 0.2f // pull of the range rate towards the one implied by the headers
+#define NEIGHBOR_MOTION_PRIOR_MIN_BASELINE 20.0f // cm, below this the line of sight from positions is meaningless
+
+typedef struct
+{
+  float distance;       // cm, tracked distance at lastUpdateTime
+  float rangeRate;      // cm/s, positive when separating
+  float residualVar;    // cm^2, smoothed squared innovation
+  float relativeSpeed;  // cm/s, bound of relative speed from both velocities
+  float rangeRatePrior; // cm/s, relative velocity of the headers projected onto the line of sight
+  Time_t lastUpdateTime;
+  bool hasRangeRatePrior;
+  bool initialized;
+} Neighbor_Motion_t;
+
+/* Link Quality, exponentially weighted over the last ~LINK_QUALITY_WINDOW frames, ratios in Q15 (32768 = 1) */
+#define LINK_QUALITY_ONE (1 << 15)
+#define LINK_QUALITY_WINDOW_SHIFT 4                   // window of 16 frames
+#define LINK_QUALITY_GAP_MAX 16                       // longer gaps saturate the window anyway
+#define LINK_QUALITY_ADMIT_MIN (LINK_QUALITY_ONE / 4) // body unit admission under contention
+
 typedef struct
 {
-  int16_t distance_history[3];
+  uint16_t reception; // ratio of frames received, from sequence number gaps
+  uint16_t success;   // ratio of received frames that produced a distance
+} Link_Quality_t;
+
+/* Neighbor State Snapshot, published by the RX path and consumed by the EKF in one call per tick */
+typedef struct
+{
+  UWB_Address_t address;
+  uint16_t distance;        // cm
+  short velocityXInWorld;   // cm/s
+  short velocityYInWorld;   // cm/s
+  float gyroZ;              // rad/s
+  uint16_t positionZ;       // cm
+  Time_t measurementTime;   // tick when the distance was measured
+  dwTime_t measurementUwbTime; // local UWB time when the distance was measured
+  uint32_t addedVersion;    // snapshot version in which this neighbor first appeared
+  uint32_t distanceVersion; // snapshot version in which the distance was last updated
+  Neighbor_Motion_t motion; // distance tracker, see getPredictedDistance()
+  bool isNewAdd;            // filled on read, addedVersion > lastVersion of the caller
+  bool refresh;             // filled on read, distanceVersion > lastVersion of the caller
+} Neighbor_State_t;
+
+typedef struct
+{
+  uint32_t sequence; // odd while being written, used to detect torn reads
+  uint32_t version;  // increases by one with every publish
+  bool keepFlying;
+  uint8_t size;
+  Neighbor_State_t neighbors[RANGING_TABLE_SIZE_MAX];
+} Neighbor_State_Snapshot_t;
+
+/* Distance Filter */
+#define DISTANCE_FILTER_WINDOW_SIZE 5          // sliding window of the median and Hampel filter
+#define DISTANCE_FILTER_HAMPEL_THRESHOLD 3.0f  // outlier if |x - median| > threshold * 1.4826 * MAD
+#define DISTANCE_FILTER_HAMPEL_MAD_MIN 5       // cm, floor of the MAD, about the DS-TWR noise
+#define DISTANCE_FILTER_KALMAN_MEASURE_NOISE 100.0f // cm^2, DS-TWR measurement variance
+#define DISTANCE_FILTER_KALMAN_PROCESS_NOISE 4.0f   // cm^2 per update, added on top of relative motion
+#define DISTANCE_FILTER_KALMAN_GATE 9.0f            // reject if innovation^2 > gate * innovation variance
+#define DISTANCE_FILTER_MAX_REJECTION 3             // re-initialize after this many consecutive rejections
+
+typedef enum
+{
+  DISTANCE_FILTER_NONE,
+  DISTANCE_FILTER_MEDIAN,
+  DISTANCE_FILTER_HAMPEL,
+  DISTANCE_FILTER_KALMAN,
+  DISTANCE_FILTER_TYPE_COUNT
+} DISTANCE_FILTER_TYPE;
+
+/* Per-neighbor filter state, every filter type runs in constant time on this fixed-size state. */
+typedef struct
+{
+  int16_t history[DISTANCE_FILTER_WINDOW_SIZE];
+  uint8_t type; /* DISTANCE_FILTER_TYPE the state belongs to */
   uint8_t index_inserting;
-} median_data_t;
+  uint8_t count;
+  uint8_t rejectionCount;
+  float estimate; // cm
+  float variance; // cm^2
+  Time_t lastUpdateTime;
+} Distance_Filter_t;
 
 /* Ranging Operations */
 void rangingInit();
 int16_t getDistance(UWB_Address_t neighborAddress);
-void setDistance(UWB_Address_t neighborAddress, int16_t distance, uint8_t source);
+void setDistance(Ranging_Context_t *ctx, UWB_Address_t neighborAddress, int16_t distance, uint8_t source);
+int16_t getRawDistance(UWB_Address_t neighborAddress);
+/* Distance between two neighbors estimated passively, -1 if unknown. */
+int16_t getPassiveDistance(UWB_Address_t address1, UWB_Address_t address2, Time_t *updateTime);
+#ifdef ENABLE_DISTANCE_SHARING
+/*获取邻居上报的两机之间的距离(cm)，其中一方须为本机的邻居，没有或已过期时返回-1*/
+int16_t getSharedDistance(UWB_Address_t address1, UWB_Address_t address2, Time_t *measurementTime);
+#endif
+
+/* Distance Filter Operations */
+void distanceFilterInit(Distance_Filter_t *filter);
+/* Returns the filtered distance, or -1 if the sample is rejected as an outlier. */
+int16_t distanceFilterUpdate(Distance_Filter_t *filter, DISTANCE_FILTER_TYPE type, int16_t distance,
+                             float relativeSpeed, Time_t curTime);
 
 /* Tr_Rr Buffer Operations */
 void rangingTableBufferInit(Ranging_Table_Tr_Rr_Buffer_t *rangingTableBuffer);
@@ -265,20 +721,35 @@ Ranging_Table_Tr_Rr_Candidate_t rangingTableBufferGetCandidate(Ranging_Table_Tr_
                                                                Timestamp_Tuple_t Tf, Timestamp_Tuple_t Tp);
 
 /* Tf Buffer Operations */
-void updateTfBuffer(Timestamp_Tuple_t timestamp);
-Timestamp_Tuple_t findTfBySeqNumber(uint16_t seqNumber);
-Timestamp_Tuple_t getLatestTxTimestamp();
-void getLatestNTxTimestamps(Timestamp_Tuple_t *timestamps, int n);
+void updateTfBuffer(Ranging_Context_t *ctx, Timestamp_Tuple_t timestamp);
+bool findTfBySeqNumber(Ranging_Context_t *ctx, uint16_t seqNumber, Timestamp_Tuple_t *Tf);
+Timestamp_Tuple_t getLatestTxTimestamp(Ranging_Context_t *ctx);
+/* Copy at most n of the latest Tf, newest first, and return how many there were. */
+int getLatestNTxTimestamps(Ranging_Context_t *ctx, Timestamp_Tuple_t *timestamps, int n);
+
+/* Expiration Wheel Operations */
+void expirationWheelInit(Expiration_Wheel_t *wheel, Time_t curTime);
+void expirationWheelSchedule(Expiration_Wheel_t *wheel, UWB_Address_t address, Time_t deadline);
+void expirationWheelCancel(Expiration_Wheel_t *wheel, UWB_Address_t address);
+/* Collect all addresses with deadline <= curTime into expired (room for NEIGHBOR_ADDRESS_MAX + 1), returns count. */
+int expirationWheelAdvance(Expiration_Wheel_t *wheel, Time_t curTime, UWB_Address_t *expired);
 
 /* Ranging Table Operations */
 Ranging_Table_Set_t *getGlobalRangingTableSet();
 void rangingTableInit(Ranging_Table_t *table, UWB_Address_t neighborAddress);
-void rangingTableOnEvent(Ranging_Table_t *table, RANGING_TABLE_EVENT event);
+void rangingTableOnEvent(Ranging_Context_t *ctx, Ranging_Table_t *table, RANGING_TABLE_EVENT event);
 void rangingTableSetInit(Ranging_Table_Set_t *set);
-bool rangingTableSetAddTable(Ranging_Table_Set_t *set, Ranging_Table_t table);
-void rangingTableSetUpdateTable(Ranging_Table_Set_t *set, Ranging_Table_t table);
-void rangingTableSetRemoveTable(Ranging_Table_Set_t *set, UWB_Address_t neighborAddress);
+bool rangingTableSetAddTable(Ranging_Context_t *ctx, Ranging_Table_Set_t *set, Ranging_Table_t table);
+void rangingTableSetUpdateTable(Ranging_Context_t *ctx, Ranging_Table_Set_t *set, Ranging_Table_t table);
+void rangingTableSetRemoveTable(Ranging_Context_t *ctx, Ranging_Table_Set_t *set, UWB_Address_t neighborAddress);
 Ranging_Table_t rangingTableSetFindTable(Ranging_Table_Set_t *set, UWB_Address_t neighborAddress);
+void rangingTableUpdateClockSkew(Ranging_Table_t *table, Timestamp_Tuple_t Tr, Timestamp_Tuple_t Rr);
+
+/* Neighbor Slot Map Operations */
+void neighborSlotMapInit(Neighbor_Slot_Map_t *map);
+set_index_t neighborSlotMapGet(Neighbor_Slot_Map_t *map, UWB_Address_t neighborAddress);
+set_index_t neighborSlotMapAcquire(Neighbor_Slot_Map_t *map, UWB_Address_t neighborAddress);
+void neighborSlotMapRelease(Neighbor_Slot_Map_t *map, UWB_Address_t neighborAddress);
 
 /* Neighbor Bit Set Operations */
 void neighborBitSetInit(Neighbor_Bit_Set_t *bitSet);
@@ -293,25 +764,37 @@ void neighborSetInit(Neighbor_Set_t *set);
 bool neighborSetHas(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
 bool neighborSetHasOneHop(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
 bool neighborSetHasTwoHop(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
-void neighborSetAddOneHopNeighbor(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
-void neighborSetAddTwoHopNeighbor(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
-void neighborSetRemoveNeighbor(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
+void neighborSetAddOneHopNeighbor(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t neighborAddress);
+void neighborSetAddTwoHopNeighbor(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t neighborAddress);
+void neighborSetRemoveNeighbor(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t neighborAddress);
 bool neighborSetHasRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to);
-void neighborSetAddRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to);
-void neighborSetRemoveRelation(Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to);
+void neighborSetAddRelation(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to);
+void neighborSetRemoveRelation(Ranging_Context_t *ctx, Neighbor_Set_t *set, UWB_Address_t from, UWB_Address_t to);
+bool neighborSetHasMpr(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
+void neighborSetUpdateMpr(Neighbor_Set_t *set);
 void neighborSetRegisterNewNeighborHook(Neighbor_Set_t *set, neighborSetHook hook);
 void neighborSetRegisterExpirationHook(Neighbor_Set_t *set, neighborSetHook hook);
 void neighborSetRegisterTopologyChangeHook(Neighbor_Set_t *set, neighborSetHook hook);
 void neighborSetHooksInvoke(Neighbor_Set_Hooks_t *hooks, UWB_Address_t neighborAddress);
+void neighborSetHooksPost(Ranging_Context_t *ctx, Neighbor_Set_Hooks_t *hooks, UWB_Address_t neighborAddress);
+int neighborSetHooksDispatch(Neighbor_Set_Hooks_t *hooks);
 void neighborSetUpdateExpirationTime(Neighbor_Set_t *set, UWB_Address_t neighborAddress);
-int neighborSetClearExpire(Neighbor_Set_t *set);
+int neighborSetClearExpire(Ranging_Context_t *ctx, Neighbor_Set_t *set);
+
+#ifdef ENABLE_CHANNEL_HOPPING
+/* Channel Hopping Operations */
+void channelHoppingRegisterSwitchHook(channelSwitchHook hook);
+uint8_t channelHoppingGetGroup();
+#endif
 
 /* Debug Operations */
 void printRangingTable(Ranging_Table_t *rangingTable);
+void printRangingTransitionTrace(Ranging_Table_t *rangingTable);
 void printRangingTableSet(Ranging_Table_Set_t *set);
 void printRangingMessage(Ranging_Message_t *rangingMessage);
 void printNeighborBitSet(Neighbor_Bit_Set_t *bitSet);
 void printNeighborSet(Neighbor_Set_t *set);
+void printRangingMemoryBudget();
 
 void setMyTakeoff(bool isAlreadyTakeoff);
 
@@ -319,17 +802,42 @@ void setMyTakeoff(bool isAlreadyTakeoff);
 int8_t getLeaderStage();
 
 /*初始化leader状态信息*/
-void initLeaderStateInfo();
+void initLeaderStateInfo(Ranging_Context_t *ctx);
+
+/*获取当前leader命令，包括epoch和已确认收到的节点*/
+void getLeaderCommand(Leader_Command_t *command);
 
 int16_t getDistance(UWB_Address_t neighborAddress);
 
 /*set邻居的状态信息*/
-void setNeighborStateInfo(uint16_t neighborAddress, Ranging_Message_Header_t *rangingMessageHeader);
+void setNeighborStateInfo(Ranging_Context_t *ctx, uint16_t neighborAddress, Ranging_Message_Header_t *rangingMessageHeader);
+
+void setNeighborDistance(Ranging_Context_t *ctx, uint16_t neighborAddress, int16_t distance);
+
+/*set邻居的距离以及该距离的测量时间(本机tick和本机UWB时间)*/
+void setNeighborDistanceWithEpoch(Ranging_Context_t *ctx, uint16_t neighborAddress, int16_t distance, Time_t measurementTick, dwTime_t measurementUwbTime);
+
+/*获取邻居距离在被getNeighborStateInfo()交给估计器时的时延分布(ms)，没有该邻居时返回false*/
+bool getDistanceLatency(uint16_t neighborAddress, Distance_Latency_t *latency);
+
+/*快照的使用者自己统计时延：每次取得快照后调用distanceLatencyAccount，curTime为使用快照的时刻*/
+void distanceLatencySetInit(Distance_Latency_Set_t *set);
+void distanceLatencyAccount(Distance_Latency_Set_t *set, const Neighbor_State_Snapshot_t *snapshot, Time_t curTime);
+bool distanceLatencySetGet(Distance_Latency_Set_t *set, UWB_Address_t neighborAddress, Distance_Latency_t *latency);
+
+/*预测邻居在queryTime时刻的距离(cm)及其不确定度(cm)，没有可用的测量时返回-1*/
+int16_t getPredictedDistance(uint16_t neighborAddress, Time_t queryTime, float *uncertainty);
+
+#ifdef ENABLE_SWARM_LOCALIZATION
+/*获取邻居相对本机的水平位置(cm)，本机在原点，坐标系的旋转和镜像由距离无法确定，邻居尚未定位时返回false*/
+bool getRelativePosition(uint16_t neighborAddress, float *x, float *y);
+#endif
 
-void setNeighborDistance(uint16_t neighborAddress, int16_t distance);
+/*获取邻居的链路质量，没有该邻居时返回false*/
+bool getLinkQuality(uint16_t neighborAddress, Link_Quality_t *quality);
 
 /*set邻居是否是新加入的*/
-void setNeighborStateInfo_isNewAdd(uint16_t neighborAddress, bool isNewAddNeighbor);
+void setNeighborStateInfo_isNewAdd(Ranging_Context_t *ctx, uint16_t neighborAddress, bool isNewAddNeighbor);
 
 /*get邻居的状态信息*/
 bool getNeighborStateInfo(uint16_t neighborAddress, uint16_t *distance, short *vx, short *vy, float *gyroZ, uint16_t *height, bool *isNewAddNeighbor);
@@ -337,7 +845,75 @@ bool getNeighborStateInfo(uint16_t neighborAddress, uint16_t *distance, short *v
 /*getOrSetKeepflying*/
 bool getOrSetKeepflying(uint16_t RobIDfromControl, bool keep_flying);
 
+/*发布邻居状态快照，在RX路径上调用*/
+void publishNeighborStateSnapshot(Ranging_Context_t *ctx);
+
+/*获取最新的邻居状态快照，lastVersion为调用者上一次获取的版本，没有更新的快照时返回false*/
+bool getNeighborStateSnapshot(Neighbor_State_Snapshot_t *snapshot, uint32_t lastVersion);
+
 /*get正在和本无人机进行通信的邻居地址信息，供外部调用*/
 void getCurrentNeighborAddressInfo_t(currentNeighborAddressInfo_t *currentNeighborAddressInfo);
 
+/* Ranging core, reentrant around an explicit context */
+uint32_t rangingContextSize();
+void rangingContextSetup(Ranging_Context_t *ctx, uint16_t address);
+/* Reseed the per-instance random state (injected loss), rangingContextSetup seeds it from the address. */
+void rangingContextSeed(Ranging_Context_t *ctx, uint32_t seed);
+void rangingHandleRx(Ranging_Context_t *ctx, Ranging_Message_With_Timestamp_t *rangingMessageWithTimestamp);
+Time_t rangingHandleTx(Ranging_Context_t *ctx, Ranging_Message_t *rangingMessage);
+void rangingHandleCommand(Ranging_Context_t *ctx, const Leader_Command_Update_t *update);
+void processRangingMessage(Ranging_Context_t *ctx, Ranging_Message_With_Timestamp_t *rangingMessageWithTimestamp);
+Time_t generateRangingMessage(Ranging_Context_t *ctx, Ranging_Message_t *rangingMessage);
+
+/* Radio paths of an instance, the deck callbacks and tasks of the default instance go through the same functions,
+ * so that a host driver can share one simulated radio between any number of instances.
+ */
+void rangingRadioRx(Ranging_Context_t *ctx, const UWB_Packet_t *packet, dwTime_t rxTime, Time_t rxTick);
+void rangingRadioTxDone(Ranging_Context_t *ctx, const UWB_Packet_t *packet, dwTime_t txTime);
+Time_t rangingRadioTxBuild(Ranging_Context_t *ctx, UWB_Packet_t *packet);
+bool rangingTxSlotWait(Ranging_Context_t *ctx, TickType_t timeout);
+TickType_t rangingTxSlotDelay(Ranging_Context_t *ctx);
+TickType_t rangingTxSlotTimeout(Ranging_Context_t *ctx);
+bool rangingRxTaskStep(Ranging_Context_t *ctx, TickType_t timeout);
+
+/* Accessors of an instance, the functions above without a context (getDistance, ...) read the default instance. */
+int16_t distanceGet(Ranging_Context_t *ctx, UWB_Address_t neighborAddress);
+int16_t rawDistanceGet(Ranging_Context_t *ctx, UWB_Address_t neighborAddress);
+int16_t passiveDistanceGet(Ranging_Context_t *ctx, UWB_Address_t address1, UWB_Address_t address2, Time_t *updateTime);
+#ifdef ENABLE_DISTANCE_SHARING
+int16_t sharedDistanceGet(Ranging_Context_t *ctx, UWB_Address_t address1, UWB_Address_t address2, Time_t *measurementTime);
+#endif
+int16_t predictedDistanceGet(Ranging_Context_t *ctx, uint16_t neighborAddress, Time_t queryTime, float *uncertainty);
+bool distanceLatencyGet(Ranging_Context_t *ctx, uint16_t neighborAddress, Distance_Latency_t *latency);
+bool linkQualityGet(Ranging_Context_t *ctx, uint16_t neighborAddress, Link_Quality_t *quality);
+Ranging_Table_Set_t *rangingTableSetGet(Ranging_Context_t *ctx);
+Neighbor_Set_t *neighborSetGet(Ranging_Context_t *ctx);
+void leaderCommandGet(Ranging_Context_t *ctx, Leader_Command_t *command);
+int8_t leaderStageGet(Ranging_Context_t *ctx);
+void myTakeoffSet(Ranging_Context_t *ctx, bool isAlreadyTakeoff);
+bool neighborStateSnapshotGet(Ranging_Context_t *ctx, Neighbor_State_Snapshot_t *snapshot, uint32_t lastVersion);
+bool keepFlyingGetOrSet(Ranging_Context_t *ctx, uint16_t uwbAddress, bool keep_flying);
+bool neighborStateInfoGet(Ranging_Context_t *ctx, uint16_t neighborAddress, uint16_t *distance, short *vx, short *vy,
+                          float *gyroZ, uint16_t *height, bool *isNewAddNeighbor);
+void currentNeighborAddressInfoGet(Ranging_Context_t *ctx, currentNeighborAddressInfo_t *currentNeighborAddressInfo);
+#ifdef ENABLE_CHANNEL_HOPPING
+void channelHoppingSetSwitchHook(Ranging_Context_t *ctx, channelSwitchHook hook);
+uint8_t channelHoppingGroupGet(Ranging_Context_t *ctx);
+#endif
+#ifdef ENABLE_SWARM_LOCALIZATION
+bool relativePositionGet(Ranging_Context_t *ctx, uint16_t neighborAddress, float *x, float *y);
+#endif
+#ifdef RANGING_EVENT_RECORD_ENABLE
+/* Move whole records, oldest first, out of the instance into buffer and return the bytes moved. If the oldest record
+ * alone does not fit into size, nothing is moved and minus its size is returned, see RANGING_RECORD_SIZE_MAX.
+ */
+int32_t rangingRecordDrain(Ranging_Context_t *ctx, uint8_t *buffer, uint16_t size);
+int32_t rangingRecordRead(uint8_t *buffer, uint16_t size);
+/* Drive one record through the code it was captured in, xTaskGetTickCount() must return record->tick meanwhile.
+ * payload holds record->length bytes. Returns false and leaves the instance untouched if the length does not fit the
+ * type of the record.
+ */
+bool rangingReplayRecord(Ranging_Context_t *ctx, const Ranging_Record_Header_t *record, const uint8_t *payload);
+#endif
+
 #endif
\ No newline at end of file